@@ -17,7 +17,7 @@ TARGET = QtXlsx
 TEMPLATE = lib
 CONFIG += staticlib
 
-QT += core gui gui-private
+QT += core gui
 !build_xlsx_lib:DEFINES += XLSX_NO_LIB
 
 CONFIG += build_xlsx_lib
@@ -25,6 +25,14 @@ CONFIG += build_xlsx_lib
 INCLUDEPATH += $$PWD
 DEPENDPATH += $$PWD
 
+# zlib is needed by the zip package writer/reader
+contains(QT_CONFIG, system-zlib) {
+    if(unix|mingw):LIBS += -lz
+    else:LIBS += zdll.lib
+} else {
+    INCLUDEPATH += $$[QT_INSTALL_HEADERS]/QtZlib
+}
+
 HEADERS += \
     ./xlsxdocpropscore_p.h \
     ./xlsxdocpropsapp_p.h \
@@ -44,6 +52,7 @@ HEADERS += \
     ./xlsxglobal.h \
     ./xlsxdrawing_p.h \
     ./xlsxzipreader_p.h \
+    ./xlsxzipentry_p.h \
     ./xlsxdocument.h \
     ./xlsxdocument_p.h \
     ./xlsxcell.h \
@@ -56,7 +65,17 @@ HEADERS += \
     ./xlsxconditionalformatting.h \
     ./xlsxconditionalformatting_p.h \
     ./xlsxcolor_p.h \
-    ./xlsxnumformatparser_p.h
+    ./xlsxnumformatparser_p.h \
+    ./xlsxloadoptions.h \
+    ./xlsxloadoptions_p.h \
+    ./xlsxsimd_p.h \
+    ./xlsxsheetdatascanner_p.h \
+    ./xlsxcellrangeindex_p.h \
+    ./xlsxpixelsizeindex_p.h \
+    ./xlsxmediafile_p.h \
+    ./xlsxformulaengine_p.h \
+    ./xlsxcalculationstatistics.h \
+    ./xlsxrowsorter_p.h
 
 SOURCES += \
     ./xlsxdocpropscore.cpp \
@@ -80,7 +99,15 @@ SOURCES += \
     ./xlsxrichstring.cpp \
     ./xlsxconditionalformatting.cpp \
     ./xlsxcolor.cpp \
-    ./xlsxnumformatparser.cpp
+    ./xlsxnumformatparser.cpp \
+    ./xlsxloadoptions.cpp \
+    ./xlsxsheetdatascanner.cpp \
+    ./xlsxcellrangeindex.cpp \
+    ./xlsxpixelsizeindex.cpp \
+    ./xlsxmediafile.cpp \
+    ./xlsxformulaengine.cpp \
+    ./xlsxcalculationstatistics.cpp \
+    ./xlsxrowsorter.cpp
 
 OTHER_FILES += \
     ./version.txt
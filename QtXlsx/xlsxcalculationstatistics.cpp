@@ -0,0 +1,93 @@
+/****************************************************************************
+** Copyright (c) 2013-2014 Debao Zhang <hello@debao.me>
+** All right reserved.
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+** NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+** LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+** OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+** WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+****************************************************************************/
+#include "xlsxcalculationstatistics.h"
+
+namespace QXlsx {
+
+/*!
+    \class CalculationStatistics
+    \brief Reports what a formula calculation did and how long it took
+    \inmodule QtXlsx
+
+    Returned by Worksheet::calculate().
+*/
+
+/*!
+    Constructs the statistics of a calculation which did nothing.
+*/
+CalculationStatistics::CalculationStatistics()
+    : formulas(0), levels(0), threads(1), graphMsecs(0), evaluationMsecs(0), canceled(false)
+{
+}
+
+/*!
+    \fn int CalculationStatistics::formulaCount() const
+
+    Returns the number of formula cells which were evaluated.
+*/
+
+/*!
+    \fn int CalculationStatistics::levelCount() const
+
+    Returns the number of dependency levels the formulas were grouped in.
+    The formulas of one level don't depend on each other, and are
+    evaluated in parallel when more than one thread is used.
+*/
+
+/*!
+    \fn int CalculationStatistics::threadCount() const
+
+    Returns the number of threads used for the evaluation.
+*/
+
+/*!
+    \fn qint64 CalculationStatistics::graphTime() const
+
+    Returns the time, in milliseconds, spent finding the formulas to
+    evaluate and ordering them.
+*/
+
+/*!
+    \fn qint64 CalculationStatistics::evaluationTime() const
+
+    Returns the time, in milliseconds, spent evaluating the formulas.
+*/
+
+/*!
+    \fn qint64 CalculationStatistics::elapsed() const
+
+    Returns the total time of the calculation, in milliseconds.
+*/
+
+/*!
+    \fn bool CalculationStatistics::isCanceled() const
+
+    Returns true if the calculation was canceled before all the formulas
+    were evaluated.
+
+    \sa Worksheet::cancelCalculation()
+*/
+
+} // namespace QXlsx
@@ -0,0 +1,60 @@
+/****************************************************************************
+** Copyright (c) 2013-2014 Debao Zhang <hello@debao.me>
+** All right reserved.
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+** NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+** LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+** OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+** WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+****************************************************************************/
+#ifndef QXLSX_XLSXCALCULATIONSTATISTICS_H
+#define QXLSX_XLSXCALCULATIONSTATISTICS_H
+#include "xlsxglobal.h"
+
+namespace QXlsx {
+
+class FormulaEngine;
+
+class CalculationStatistics
+{
+public:
+    CalculationStatistics();
+
+    inline int formulaCount() const { return formulas; }
+    inline int levelCount() const { return levels; }
+    inline int threadCount() const { return threads; }
+    inline qint64 graphTime() const { return graphMsecs; }
+    inline qint64 evaluationTime() const { return evaluationMsecs; }
+    inline qint64 elapsed() const { return graphMsecs + evaluationMsecs; }
+    inline bool isCanceled() const { return canceled; }
+
+private:
+    friend class FormulaEngine;
+    int formulas;
+    int levels;
+    int threads;
+    qint64 graphMsecs;
+    qint64 evaluationMsecs;
+    bool canceled;
+};
+
+} // namespace QXlsx
+
+Q_DECLARE_TYPEINFO(QXlsx::CalculationStatistics, Q_MOVABLE_TYPE);
+
+#endif // QXLSX_XLSXCALCULATIONSTATISTICS_H
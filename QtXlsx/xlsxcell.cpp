@@ -34,15 +34,15 @@
 namespace QXlsx {
 
 CellPrivate::CellPrivate(Cell *p) :
-    q_ptr(p)
+    sharedIndex(-1), q_ptr(p)
 {
 
 }
 
 CellPrivate::CellPrivate(const CellPrivate * const cp)
     : value(cp->value), formula(cp->formula), dataType(cp->dataType)
-    , format(cp->format), range(cp->range), richString(cp->richString)
-    , parent(cp->parent)
+    , format(cp->format), range(cp->range), sharedIndex(cp->sharedIndex)
+    , richString(cp->richString), parent(cp->parent)
 {
 
 }
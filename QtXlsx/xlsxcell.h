@@ -65,6 +65,7 @@ public:
 private:
     friend class Worksheet;
     friend class WorksheetPrivate;
+    friend class FormulaEngine;
 
     Cell(const QVariant &data=QVariant(), DataType type=Blank, const Format &format=Format(), Worksheet *parent=0);
     Cell(const Cell * const cell);
@@ -56,7 +56,8 @@ public:
     QString formula;
     Cell::DataType dataType;
     Format format;
-    CellRange range; //used for arrayFormula
+    CellRange range; //used for arrayFormula and the master of a shared formula
+    int sharedIndex; //si of the shared formula, or -1
 
     RichString richString;
 
@@ -0,0 +1,338 @@
+/****************************************************************************
+** Copyright (c) 2013-2014 Debao Zhang <hello@debao.me>
+** All right reserved.
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+** NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+** LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+** OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+** WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+****************************************************************************/
+#include "xlsxcellrangeindex_p.h"
+#include <QtAlgorithms>
+
+namespace QXlsx {
+
+/*
+   Rows are bucketed by blocks of 1 << RowBlockShift, the columns of tall
+   ranges by blocks of 1 << ColumnBlockShift. A range covering more than
+   MaxBlocksPerRange row blocks is stored by columns.
+*/
+static const int RowBlockShift = 8;
+static const int ColumnBlockShift = 4;
+static const int MaxBlocksPerRange = 4;
+
+CellRangeIndex::CellRangeIndex()
+    : m_count(0)
+{
+}
+
+void CellRangeIndex::clear()
+{
+    m_entries.clear();
+    m_blocks.clear();
+    m_columnBlocks.clear();
+    m_largeEntries.clear();
+    m_count = 0;
+}
+
+bool CellRangeIndex::isEmpty() const
+{
+    return m_count == 0;
+}
+
+int CellRangeIndex::count() const
+{
+    return m_count;
+}
+
+/*
+   Returns all the ranges, in insertion order.
+*/
+QList<CellRange> CellRangeIndex::ranges() const
+{
+    QList<CellRange> result;
+    result.reserve(m_count);
+    for (int i=0; i<m_entries.size(); ++i) {
+        if (m_entries[i].range.isValid())
+            result.append(m_entries[i].range);
+    }
+    return result;
+}
+
+CellRangeIndex::Placement CellRangeIndex::placement(const CellRange &range)
+{
+    if ((range.lastRow() >> RowBlockShift) - (range.firstRow() >> RowBlockShift) < MaxBlocksPerRange)
+        return RowBlocks;
+    if ((range.lastColumn() >> ColumnBlockShift) - (range.firstColumn() >> ColumnBlockShift) < MaxBlocksPerRange)
+        return ColumnBlocks;
+    return LargeRanges;
+}
+
+void CellRangeIndex::addToBlocks(QHash<int, QVector<int> > &blocks, int first, int last, int index)
+{
+    for (int block = first; block <= last; ++block)
+        blocks[block].append(index);
+}
+
+void CellRangeIndex::removeFromBlocks(QHash<int, QVector<int> > &blocks, int first, int last, int index)
+{
+    for (int block = first; block <= last; ++block) {
+        QHash<int, QVector<int> >::iterator it = blocks.find(block);
+        if (it == blocks.end())
+            continue;
+        it.value().remove(it.value().indexOf(index));
+        if (it.value().isEmpty())
+            blocks.erase(it);
+    }
+}
+
+/*
+   Adds \a range to the index, reported as \a value by the lookups.
+*/
+void CellRangeIndex::insert(const CellRange &range, int value)
+{
+    if (!range.isValid())
+        return;
+
+    Entry entry;
+    entry.range = range;
+    entry.value = value;
+    const int index = m_entries.size();
+    m_entries.append(entry);
+    ++m_count;
+
+    switch (placement(range)) {
+    case RowBlocks:
+        addToBlocks(m_blocks, range.firstRow() >> RowBlockShift, range.lastRow() >> RowBlockShift, index);
+        break;
+    case ColumnBlocks:
+        addToBlocks(m_columnBlocks, range.firstColumn() >> ColumnBlockShift,
+                    range.lastColumn() >> ColumnBlockShift, index);
+        break;
+    default:
+        m_largeEntries.append(index);
+        break;
+    }
+}
+
+/*
+   Removes \a range stored with \a value.
+*/
+void CellRangeIndex::remove(const CellRange &range, int value)
+{
+    if (!range.isValid())
+        return;
+
+    const Placement where = placement(range);
+    QVector<int> indexes;
+    if (where == LargeRanges) {
+        indexes = m_largeEntries;
+    } else {
+        const QHash<int, QVector<int> > &blocks = where == RowBlocks ? m_blocks : m_columnBlocks;
+        const int key = where == RowBlocks ? range.firstRow() >> RowBlockShift
+                                           : range.firstColumn() >> ColumnBlockShift;
+        indexes = blocks.value(key);
+    }
+
+    int index = -1;
+    for (int i=0; i<indexes.size(); ++i) {
+        const Entry &entry = m_entries[indexes[i]];
+        if (entry.value == value && entry.range == range) {
+            index = indexes[i];
+            break;
+        }
+    }
+    if (index == -1)
+        return;
+
+    switch (where) {
+    case RowBlocks:
+        removeFromBlocks(m_blocks, range.firstRow() >> RowBlockShift, range.lastRow() >> RowBlockShift, index);
+        break;
+    case ColumnBlocks:
+        removeFromBlocks(m_columnBlocks, range.firstColumn() >> ColumnBlockShift,
+                         range.lastColumn() >> ColumnBlockShift, index);
+        break;
+    default:
+        m_largeEntries.remove(m_largeEntries.indexOf(index));
+        break;
+    }
+    m_entries[index].range = CellRange();
+    --m_count;
+
+    if (m_count == 0)
+        clear();
+}
+
+/*
+   Returns the sorted indexes in m_entries of the ranges which may contain
+   the cell (\a row, \a column).
+*/
+QVector<int> CellRangeIndex::entriesAt(int row, int column) const
+{
+    const QVector<int> rowEntries = m_blocks.value(row >> RowBlockShift);
+    const QVector<int> columnEntries = m_columnBlocks.value(column >> ColumnBlockShift);
+    if (columnEntries.isEmpty() && m_largeEntries.isEmpty())
+        return rowEntries;
+
+    QVector<int> indexes = rowEntries;
+    indexes += columnEntries;
+    indexes += m_largeEntries;
+    qSort(indexes);
+    return indexes;
+}
+
+/*
+   Returns the index in m_entries of the most recently inserted range
+   containing the cell (\a row, \a column), or -1.
+*/
+int CellRangeIndex::lastEntryAt(int row, int column) const
+{
+    const QVector<int> indexes = entriesAt(row, column);
+    for (int i=indexes.size()-1; i>=0; --i) {
+        if (contains(m_entries[indexes[i]].range, row, column))
+            return indexes[i];
+    }
+    return -1;
+}
+
+/*
+   Returns the value of the most recently inserted range containing the
+   cell (\a row, \a column), or -1.
+*/
+int CellRangeIndex::lastValueAt(int row, int column) const
+{
+    int index = lastEntryAt(row, column);
+    return index == -1 ? -1 : m_entries[index].value;
+}
+
+/*
+   Returns the most recently inserted range containing the cell
+   (\a row, \a column), or an invalid range.
+*/
+CellRange CellRangeIndex::lastRangeAt(int row, int column) const
+{
+    int index = lastEntryAt(row, column);
+    return index == -1 ? CellRange() : m_entries[index].range;
+}
+
+/*
+   Returns the values of all the ranges containing the cell (\a row, \a column).
+*/
+QList<int> CellRangeIndex::valuesAt(int row, int column) const
+{
+    QList<int> values;
+    if (isEmpty())
+        return values;
+
+    const QVector<int> indexes = entriesAt(row, column);
+    for (int i=0; i<indexes.size(); ++i) {
+        const Entry &entry = m_entries[indexes[i]];
+        if (contains(entry.range, row, column))
+            values.append(entry.value);
+    }
+    return values;
+}
+
+/*
+   Appends to \a indexes the contents of the blocks \a first to \a last.
+*/
+static void appendBlocks(const QHash<int, QVector<int> > &blocks, int first, int last, QVector<int> &indexes)
+{
+    if (last - first >= blocks.size()) {
+        //Cheaper to walk the blocks which exist.
+        QHash<int, QVector<int> >::const_iterator it = blocks.constBegin();
+        for (; it != blocks.constEnd(); ++it) {
+            if (it.key() >= first && it.key() <= last)
+                indexes += it.value();
+        }
+    } else {
+        for (int block = first; block <= last; ++block) {
+            QHash<int, QVector<int> >::const_iterator it = blocks.constFind(block);
+            if (it != blocks.constEnd())
+                indexes += it.value();
+        }
+    }
+}
+
+/*
+   Returns the sorted indexes of the entries which may intersect \a range,
+   some of them more than once.
+*/
+QVector<int> CellRangeIndex::candidateEntries(const CellRange &range) const
+{
+    QVector<int> indexes;
+    appendBlocks(m_blocks, range.firstRow() >> RowBlockShift, range.lastRow() >> RowBlockShift, indexes);
+    appendBlocks(m_columnBlocks, range.firstColumn() >> ColumnBlockShift,
+                 range.lastColumn() >> ColumnBlockShift, indexes);
+    indexes += m_largeEntries;
+    qSort(indexes);
+    return indexes;
+}
+
+/*
+   Returns the values of all the ranges sharing at least one cell with \a range.
+*/
+QList<int> CellRangeIndex::valuesIntersecting(const CellRange &range) const
+{
+    QList<int> values;
+    if (!range.isValid() || isEmpty())
+        return values;
+
+    QVector<int> indexes = candidateEntries(range);
+    int previous = -1;
+    for (int i=0; i<indexes.size(); ++i) {
+        if (indexes[i] == previous)
+            continue;
+        previous = indexes[i];
+        const Entry &entry = m_entries[indexes[i]];
+        if (intersects(entry.range, range))
+            values.append(entry.value);
+    }
+    return values;
+}
+
+/*
+   Returns true if any range shares at least one cell with \a range.
+*/
+bool CellRangeIndex::intersects(const CellRange &range) const
+{
+    if (!range.isValid() || isEmpty())
+        return false;
+
+    QVector<int> indexes = candidateEntries(range);
+    for (int i=0; i<indexes.size(); ++i) {
+        if (intersects(m_entries[indexes[i]].range, range))
+            return true;
+    }
+    return false;
+}
+
+bool CellRangeIndex::contains(const CellRange &range, int row, int column)
+{
+    return row >= range.firstRow() && row <= range.lastRow()
+            && column >= range.firstColumn() && column <= range.lastColumn();
+}
+
+bool CellRangeIndex::intersects(const CellRange &a, const CellRange &b)
+{
+    return a.firstRow() <= b.lastRow() && b.firstRow() <= a.lastRow()
+            && a.firstColumn() <= b.lastColumn() && b.firstColumn() <= a.lastColumn();
+}
+
+} // namespace QXlsx
@@ -0,0 +1,110 @@
+/****************************************************************************
+** Copyright (c) 2013-2014 Debao Zhang <hello@debao.me>
+** All right reserved.
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+** NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+** LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+** OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+** WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+****************************************************************************/
+#ifndef XLSXCELLRANGEINDEX_P_H
+#define XLSXCELLRANGEINDEX_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt Xlsx API.  It exists for the convenience
+// of the Qt Xlsx.  This header file may change from
+// version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include "xlsxglobal.h"
+#include "xlsxcellrange.h"
+#include <QVector>
+#include <QHash>
+#include <QList>
+
+namespace QXlsx {
+
+/*
+   Finds the ranges of a sheet which contain a cell, or which intersect
+   another range, without testing every range.
+
+   Each range is stored with an int value chosen by the owner, usually
+   the index of the object it belongs to. Short ranges are bucketed by
+   blocks of rows. Tall ranges, such as whole columns or running totals
+   anchored to the first row, are bucketed by blocks of columns instead,
+   and ranges both tall and wide are kept in a list of their own, so a
+   range is never stored in more than a few buckets. Results are returned
+   in insertion order.
+*/
+class CellRangeIndex
+{
+public:
+    CellRangeIndex();
+
+    void clear();
+    bool isEmpty() const;
+    int count() const;
+    QList<CellRange> ranges() const;
+
+    void insert(const CellRange &range, int value);
+    void remove(const CellRange &range, int value);
+
+    int lastValueAt(int row, int column) const;
+    CellRange lastRangeAt(int row, int column) const;
+    QList<int> valuesAt(int row, int column) const;
+    QList<int> valuesIntersecting(const CellRange &range) const;
+    bool intersects(const CellRange &range) const;
+
+private:
+    struct Entry
+    {
+        CellRange range;
+        int value;
+    };
+
+    enum Placement
+    {
+        RowBlocks,
+        ColumnBlocks,
+        LargeRanges
+    };
+
+    static Placement placement(const CellRange &range);
+    static bool contains(const CellRange &range, int row, int column);
+    static bool intersects(const CellRange &a, const CellRange &b);
+    void addToBlocks(QHash<int, QVector<int> > &blocks, int first, int last, int index);
+    void removeFromBlocks(QHash<int, QVector<int> > &blocks, int first, int last, int index);
+    QVector<int> entriesAt(int row, int column) const;
+    int lastEntryAt(int row, int column) const;
+    QVector<int> candidateEntries(const CellRange &range) const;
+
+    QVector<Entry> m_entries;
+    QHash<int, QVector<int> > m_blocks; //row block to indexes in m_entries
+    QHash<int, QVector<int> > m_columnBlocks; //column block to indexes of tall ranges
+    QVector<int> m_largeEntries; //indexes of ranges both tall and wide
+    int m_count;
+};
+
+} // namespace QXlsx
+
+#endif // XLSXCELLRANGEINDEX_P_H
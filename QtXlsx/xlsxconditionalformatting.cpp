@@ -28,6 +28,7 @@
 #include "xlsxworksheet.h"
 #include "xlsxcellrange.h"
 #include "xlsxstyles_p.h"
+#include "xlsxutility_p.h"
 
 #include <QXmlStreamReader>
 #include <QXmlStreamWriter>
@@ -51,6 +52,144 @@ ConditionalFormattingPrivate::~ConditionalFormattingPrivate()
 
 }
 
+static bool isSameColor(const XlsxColor &a, const XlsxColor &b)
+{
+    if (a.isRgbColor())
+        return b.isRgbColor() && a.rgbColor() == b.rgbColor();
+    if (a.isIndexedColor())
+        return b.isIndexedColor() && a.indexedColor() == b.indexedColor();
+    if (a.isThemeColor())
+        return b.isThemeColor() && a.themeColor() == b.themeColor();
+    return b.isInvalid();
+}
+
+static bool isSameAttribute(const QVariant &a, const QVariant &b)
+{
+    if (a.userType() != b.userType())
+        return false;
+    if (a.userType() == qMetaTypeId<XlsxCfVoData>()) {
+        XlsxCfVoData va = a.value<XlsxCfVoData>();
+        XlsxCfVoData vb = b.value<XlsxCfVoData>();
+        return va.type == vb.type && va.value == vb.value && va.gte == vb.gte;
+    }
+    if (a.userType() == qMetaTypeId<XlsxColor>())
+        return isSameColor(a.value<XlsxColor>(), b.value<XlsxColor>());
+    return a == b;
+}
+
+/*
+   Returns true if \a other has the same rules, so that both could be
+   saved as one conditionalFormatting element.
+*/
+bool ConditionalFormattingPrivate::hasSameRules(const ConditionalFormattingPrivate &other) const
+{
+    if (cfRules.size() != other.cfRules.size())
+        return false;
+
+    for (int i=0; i<cfRules.size(); ++i) {
+        const XlsxCfRuleData *a = cfRules[i].data();
+        const XlsxCfRuleData *b = other.cfRules[i].data();
+        if (a == b)
+            continue;
+        if (a->priority != b->priority || a->dxfFormat != b->dxfFormat
+                || a->attrs.size() != b->attrs.size())
+            return false;
+        QMap<int, QVariant>::const_iterator ita = a->attrs.constBegin();
+        QMap<int, QVariant>::const_iterator itb = b->attrs.constBegin();
+        for (; ita != a->attrs.constEnd(); ++ita, ++itb) {
+            if (ita.key() != itb.key() || !isSameAttribute(ita.value(), itb.value()))
+                return false;
+        }
+    }
+    return true;
+}
+
+/*
+   Returns true if the formulas of the rules refer to cells relative to
+   the top left cell of the first range.
+*/
+bool ConditionalFormattingPrivate::hasRelativeReferences() const
+{
+    for (int i=0; i<cfRules.size(); ++i) {
+        const QMap<int, QVariant> &attrs = cfRules[i]->attrs;
+        //The text rules are written with the top left cell at save time
+        if (attrs.contains(XlsxCfRuleData::A_formula1_temp))
+            return true;
+        if (xl_has_relative_references(attrs.value(XlsxCfRuleData::A_formula1).toString())
+                || xl_has_relative_references(attrs.value(XlsxCfRuleData::A_formula2).toString())
+                || xl_has_relative_references(attrs.value(XlsxCfRuleData::A_formula3).toString()))
+            return true;
+        for (int a=XlsxCfRuleData::A_cfvo1; a<=XlsxCfRuleData::A_cfvo3; ++a) {
+            if (!attrs.contains(a))
+                continue;
+            XlsxCfVoData cfvo = attrs.value(a).value<XlsxCfVoData>();
+            if (cfvo.type == ConditionalFormatting::VOT_Formula && xl_has_relative_references(cfvo.value))
+                return true;
+        }
+    }
+    return false;
+}
+
+/*
+   Updates the references of the rule formulas for rows or columns
+   inserted in or removed from the sheet \a sheetName, as
+   xl_move_formula() does. Rules are shared by the copies of the
+   formatting, so changed rules are replaced rather than edited.
+*/
+void ConditionalFormattingPrivate::moveFormulas(const QString &sheetName, bool inSheet, bool rows, int first, int count)
+{
+    for (int i=0; i<cfRules.size(); ++i) {
+        QMap<int, QVariant> attrs = cfRules[i]->attrs;
+        bool changed = false;
+        for (int a=XlsxCfRuleData::A_formula1; a<=XlsxCfRuleData::A_formula3; ++a) {
+            if (!attrs.contains(a))
+                continue;
+            const QString formula = attrs[a].toString();
+            const QString moved = xl_move_formula(formula, sheetName, inSheet, rows, first, count);
+            if (moved != formula) {
+                attrs[a] = moved;
+                changed = true;
+            }
+        }
+        for (int a=XlsxCfRuleData::A_cfvo1; a<=XlsxCfRuleData::A_cfvo3; ++a) {
+            if (!attrs.contains(a))
+                continue;
+            XlsxCfVoData cfvo = attrs[a].value<XlsxCfVoData>();
+            if (cfvo.type != ConditionalFormatting::VOT_Formula)
+                continue;
+            const QString moved = xl_move_formula(cfvo.value, sheetName, inSheet, rows, first, count);
+            if (moved != cfvo.value) {
+                cfvo.value = moved;
+                attrs[a] = QVariant::fromValue(cfvo);
+                changed = true;
+            }
+        }
+        if (changed) {
+            QSharedPointer<XlsxCfRuleData> rule(new XlsxCfRuleData(*cfRules[i]));
+            rule->attrs = attrs;
+            cfRules[i] = rule;
+        }
+    }
+}
+
+/*
+   Returns true if a rule compares each cell with the other cells of the
+   ranges, such as top10 or colorScale, so that it means something else
+   over other ranges.
+*/
+bool ConditionalFormattingPrivate::hasRangeRules() const
+{
+    for (int i=0; i<cfRules.size(); ++i) {
+        QString type = cfRules[i]->attrs.value(XlsxCfRuleData::A_type).toString();
+        if (type == QLatin1String("top10") || type == QLatin1String("aboveAverage")
+                || type == QLatin1String("duplicateValues") || type == QLatin1String("uniqueValues")
+                || type == QLatin1String("dataBar") || type == QLatin1String("colorScale")
+                || type == QLatin1String("iconSet"))
+            return true;
+    }
+    return false;
+}
+
 void ConditionalFormattingPrivate::writeCfVo(QXmlStreamWriter &writer, const XlsxCfVoData &cfvo) const
 {
     writer.writeEmptyElement(QStringLiteral("cfvo"));
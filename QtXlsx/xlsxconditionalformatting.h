@@ -124,6 +124,7 @@ public:
 
 private:
     friend class Worksheet;
+    friend class WorksheetPrivate;
     friend class ::ConditionalFormattingTest;
     bool saveToXml(QXmlStreamWriter &writer) const;
     bool loadFromXml(QXmlStreamReader &reader, Styles *styles=0);
@@ -115,6 +115,11 @@ public:
     ConditionalFormattingPrivate(const ConditionalFormattingPrivate &other);
     ~ConditionalFormattingPrivate();
 
+    bool hasSameRules(const ConditionalFormattingPrivate &other) const;
+    bool hasRelativeReferences() const;
+    bool hasRangeRules() const;
+    void moveFormulas(const QString &sheetName, bool inSheet, bool rows, int first, int count);
+
     void writeCfVo(QXmlStreamWriter &writer, const XlsxCfVoData& cfvo) const;
     bool readCfVo(QXmlStreamReader &reader, XlsxCfVoData& cfvo);
     bool readCfRule(QXmlStreamReader &reader, XlsxCfRuleData *cfRule, Styles *styles);
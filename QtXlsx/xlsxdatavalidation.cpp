@@ -27,6 +27,7 @@
 #include "xlsxdatavalidation_p.h"
 #include "xlsxworksheet.h"
 #include "xlsxcellrange.h"
+#include "xlsxutility_p.h"
 
 #include <QXmlStreamReader>
 #include <QXmlStreamWriter>
@@ -63,6 +64,40 @@ DataValidationPrivate::~DataValidationPrivate()
 
 }
 
+/*
+   Returns a key which is the same for two validations if and only if
+   they differ by their ranges at most.
+*/
+QString DataValidationPrivate::ruleKey() const
+{
+    QString key = QStringLiteral("%1 %2 %3 %4%5%6 ").arg(validationType).arg(validationOperator)
+            .arg(errorStyle).arg(allowBlank).arg(isPromptMessageVisible).arg(isErrorMessageVisible);
+    //Prefix each text with its length to keep the key unambiguous.
+    const QString texts[] = {formula1, formula2, errorMessage, errorMessageTitle, promptMessage, promptMessageTitle};
+    for (int i=0; i<6; ++i)
+        key += QString::number(texts[i].size()) + QLatin1Char(':') + texts[i];
+    return key;
+}
+
+/*
+   Returns true if the formulas refer to cells relative to the top left
+   cell of the first range.
+*/
+bool DataValidationPrivate::hasRelativeReferences() const
+{
+    return xl_has_relative_references(formula1) || xl_has_relative_references(formula2);
+}
+
+/*
+   Updates the references of the formulas for rows or columns inserted
+   in or removed from the sheet \a sheetName, as xl_move_formula() does.
+*/
+void DataValidationPrivate::moveFormulas(const QString &sheetName, bool inSheet, bool rows, int first, int count)
+{
+    formula1 = xl_move_formula(formula1, sheetName, inSheet, rows, first, count);
+    formula2 = xl_move_formula(formula2, sheetName, inSheet, rows, first, count);
+}
+
 /*!
  * \class DataValidation
  * \brief Data validation for single cell or a range
@@ -115,6 +115,7 @@ public:
     bool saveToXml(QXmlStreamWriter &writer) const;
     static DataValidation loadFromXml(QXmlStreamReader &reader);
 private:
+    friend class WorksheetPrivate;
     QSharedDataPointer<DataValidationPrivate> d;
 };
 
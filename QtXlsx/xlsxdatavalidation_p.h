@@ -50,6 +50,10 @@ public:
     DataValidationPrivate(const DataValidationPrivate &other);
     ~DataValidationPrivate();
 
+    QString ruleKey() const;
+    bool hasRelativeReferences() const;
+    void moveFormulas(const QString &sheetName, bool inSheet, bool rows, int first, int count);
+
     DataValidation::ValidationType validationType;
     DataValidation::ValidationOperator validationOperator;
     DataValidation::ErrorStyle errorStyle;
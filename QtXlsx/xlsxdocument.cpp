@@ -37,12 +37,13 @@
 #include "xlsxutility_p.h"
 #include "xlsxworkbook_p.h"
 #include "xlsxdrawing_p.h"
+#include "xlsxmediafile_p.h"
 #include "xlsxzipreader_p.h"
 #include "xlsxzipwriter_p.h"
 
 #include <QFile>
 #include <QPointF>
-#include <QBuffer>
+#include <QScopedPointer>
 
 namespace QXlsx {
 
@@ -83,10 +84,28 @@ namespace QXlsx {
 
 DocumentPrivate::DocumentPrivate(Document *p) :
     q_ptr(p), defaultPackageName(QStringLiteral("Book1.xlsx"))
+  , compressionLevel(Document::DefaultCompression)
 {
     workbook = QSharedPointer<Workbook>(new Workbook);
 }
 
+/*
+ * Map the compression level to the deflate level used by zlib.
+ */
+static int zipCompressionLevel(Document::CompressionLevel level)
+{
+    switch (level) {
+    case Document::StoreOnly:
+        return 0;
+    case Document::FastCompression:
+        return 1;
+    case Document::BestCompression:
+        return 9;
+    default:
+        return -1;
+    }
+}
+
 void DocumentPrivate::init()
 {
     if (workbook->worksheetCount() == 0)
@@ -97,9 +116,7 @@ bool DocumentPrivate::loadPackage(QIODevice *device)
 {
     Q_Q(Document);
     ZipReader zipReader(device);
-    QStringList filePaths = zipReader.filePaths();
-
-    if (!filePaths.contains(QLatin1String("_rels/.rels")))
+    if (!zipReader.contains(QStringLiteral("_rels/.rels")))
         return false;
 
     Relationships rootRels;
@@ -148,6 +165,7 @@ bool DocumentPrivate::loadPackage(QIODevice *device)
         QString name = rels_styles[0].target;
         QString path = xlworkbook_Dir + QLatin1String("/") + name;
         QSharedPointer<Styles> styles (new Styles(true));
+        styles->setNumberFormatsOnly(loadOptions.profile() == LoadOptions::ValuesOnly);
         styles->loadFromXmlData(zipReader.fileData(path));
         workbook->d_ptr->styles = styles;
     }
@@ -158,12 +176,14 @@ bool DocumentPrivate::loadPackage(QIODevice *device)
         //In normal case this should be sharedStrings.xml which in xl
         QString name = rels_sharedStrings[0].target;
         QString path = xlworkbook_Dir + QLatin1String("/") + name;
-        workbook->d_ptr->sharedStrings->loadFromXmlData(zipReader.fileData(path));
+        QScopedPointer<QIODevice> sharedStringsDevice(zipReader.fileDevice(path));
+        if (sharedStringsDevice)
+            workbook->d_ptr->sharedStrings->loadFromXmlFile(sharedStringsDevice.data());
     }
 
     //load theme
     QList<XlsxRelationship> rels_theme = workbook->relationships().documentRelationships(QStringLiteral("/theme"));
-    if (!rels_theme.isEmpty()) {
+    if (!rels_theme.isEmpty() && loadOptions.profile() != LoadOptions::ValuesOnly) {
         //In normal case this should be theme/theme1.xml which in xl
         QString name = rels_theme[0].target;
         QString path = xlworkbook_Dir + QLatin1String("/") + name;
@@ -175,16 +195,25 @@ bool DocumentPrivate::loadPackage(QIODevice *device)
     if (rels_worksheets.isEmpty())
         return false;
 
+    //Positions in the file; adding the sheets moves the active one.
+    const int activeTab = workbook->d_func()->activesheetIndex;
+    const int firstSheet = workbook->d_func()->firstsheet;
     for (int i=0; i<sheetNameIdPairList.size(); ++i) {
         XlsxSheetItemInfo info = sheetNameIdPairList[i];
         QString worksheet_path = xlworkbook_Dir + QLatin1String("/") + workbook->relationships().getRelationshipById(info.rId).target;
         QString rel_path = getRelFilePath(worksheet_path);
+        if (!loadOptions.isSheetSelected(info.name))
+            continue;
         Worksheet *sheet = workbook->addWorksheet(info.name, info.sheetId);
         //If the .rel file exists, load it.
-        if (zipReader.filePaths().contains(rel_path))
+        if (zipReader.contains(rel_path))
             sheet->relationships().loadFromXmlData(zipReader.fileData(rel_path));
-        sheet->loadFromXmlData(zipReader.fileData(worksheet_path));
+        //Parse the sheet while it is inflated, without an inflated copy in memory.
+        QScopedPointer<QIODevice> sheetDevice(zipReader.fileDevice(worksheet_path));
+        if (sheetDevice)
+            sheet->loadFromXmlFile(sheetDevice.data(), loadOptions);
     }
+    workbook->d_func()->restoreSheetReferences(activeTab, firstSheet);
 
     return true;
 }
@@ -192,10 +221,30 @@ bool DocumentPrivate::loadPackage(QIODevice *device)
 bool DocumentPrivate::savePackage(QIODevice *device) const
 {
     Q_Q(const Document);
+
+    //The styles, formats and rules skipped by the load would be lost.
+    if (loadOptions.profile() == LoadOptions::ValuesOnly)
+        return false;
+
+    //Results of the formulas are saved with them. A canceled calculation
+    //would leave stale results, so nothing is written.
+    for (int i=0; i<workbook->worksheetCount(); ++i) {
+        Worksheet *sheet = workbook->worksheet(i);
+        if (sheet->isCalculationEnabled() && sheet->calculate().isCanceled())
+            return false;
+    }
+
     ZipWriter zipWriter(device);
     if (zipWriter.error())
         return false;
 
+    zipWriter.setCompressionLevel(zipCompressionLevel(compressionLevel));
+    QMapIterator<QString, Document::CompressionLevel> it(partCompressionLevels);
+    while (it.hasNext()) {
+        it.next();
+        zipWriter.setCompressionLevel(it.key(), zipCompressionLevel(it.value()));
+    }
+
     ContentTypes contentTypes;
     DocPropsApp docPropsApp;
     DocPropsCore docPropsCore;
@@ -209,7 +258,11 @@ bool DocumentPrivate::savePackage(QIODevice *device) const
         contentTypes.addWorksheetName(QStringLiteral("sheet%1").arg(i+1));
         docPropsApp.addPartTitle(sheet->sheetName());
 
-        zipWriter.addFile(QStringLiteral("xl/worksheets/sheet%1.xml").arg(i+1), sheet->saveToXmlData());
+        //Stream the sheet into the package, large sheets are never held in memory as a whole.
+        QIODevice *sheetDevice = zipWriter.beginFile(QStringLiteral("xl/worksheets/sheet%1.xml").arg(i+1));
+        if (sheetDevice)
+            sheet->saveToXmlFile(sheetDevice);
+        zipWriter.endFile();
         Relationships &rel = sheet->relationships();
         if (!rel.isEmpty())
             zipWriter.addFile(QStringLiteral("xl/worksheets/_rels/sheet%1.xml.rels").arg(i+1), rel.saveToXmlData());
@@ -263,18 +316,16 @@ bool DocumentPrivate::savePackage(QIODevice *device) const
     zipWriter.addFile(QStringLiteral("xl/theme/theme1.xml"), workbook->theme()->saveToXmlData());
 
     // save image files
-    if (!workbook->images().isEmpty())
-        contentTypes.addImageTypes(QStringList()<<QStringLiteral("png"));
-
-    for (int i=0; i<workbook->images().size(); ++i) {
-        QImage image = workbook->images()[i];
-
-        QByteArray data;
-        QBuffer buffer(&data);
-        buffer.open(QIODevice::WriteOnly);
-        image.save(&buffer, "png");
-        zipWriter.addFile(QStringLiteral("xl/media/image%1.png").arg(i+1), data);
+    QStringList imageTypes;
+    QList<QSharedPointer<MediaFile> > mediaFiles = workbook->mediaFiles();
+    for (int i=0; i<mediaFiles.size(); ++i) {
+        QSharedPointer<MediaFile> media = mediaFiles[i];
+        if (!imageTypes.contains(media->suffix()))
+            imageTypes.append(media->suffix());
+        zipWriter.addFile(QStringLiteral("xl/media/image%1.%2").arg(i+1).arg(media->suffix()), media->contents());
     }
+    if (!imageTypes.isEmpty())
+        contentTypes.addImageTypes(imageTypes);
 
     // save root .rels xml file
     Relationships rootrels;
@@ -287,7 +338,7 @@ bool DocumentPrivate::savePackage(QIODevice *device) const
     zipWriter.addFile(QStringLiteral("[Content_Types].xml"), contentTypes.saveToXmlData());
 
     zipWriter.close();
-    return true;
+    return !zipWriter.error();
 }
 
 
@@ -338,6 +389,40 @@ Document::Document(QIODevice *device, QObject *parent) :
     d_ptr->init();
 }
 
+/*!
+ * \overload
+ * Try to open an existing xlsx document named \a name, loading only
+ * the sheets and cells selected by \a options.
+ * The \a parent argument is passed to QObject's constructor.
+ */
+Document::Document(const QString &name, const LoadOptions &options, QObject *parent) :
+    QObject(parent), d_ptr(new DocumentPrivate(this))
+{
+    d_ptr->packageName = name;
+    d_ptr->loadOptions = options;
+    if (QFile::exists(name)) {
+        QFile xlsx(name);
+        if (xlsx.open(QFile::ReadOnly))
+            d_ptr->loadPackage(&xlsx);
+    }
+    d_ptr->init();
+}
+
+/*!
+ * \overload
+ * Try to open an existing xlsx document from \a device, loading only
+ * the sheets and cells selected by \a options.
+ * The \a parent argument is passed to QObject's constructor.
+ */
+Document::Document(QIODevice *device, const LoadOptions &options, QObject *parent) :
+    QObject(parent), d_ptr(new DocumentPrivate(this))
+{
+    d_ptr->loadOptions = options;
+    if (device && device->isReadable())
+        d_ptr->loadPackage(device);
+    d_ptr->init();
+}
+
 /*!
     \overload
 
@@ -382,6 +467,17 @@ int Document::insertImage(int row, int column, const QImage &image, double xOffs
     return currentWorksheet()->insertImage(row, column, image, QPointF(xOffset, yOffset), xScale, yScale);
 }
 
+/*!
+ * \overload
+ * Insert an image to current active worksheet from the png or jpeg file contents \a data,
+ * which are stored in the package as they are, without being decoded or encoded again.
+ * Returns -1 if the format of \a data is not supported.
+ */
+int Document::insertImage(int row, int column, const QByteArray &data, double xOffset, double yOffset, double xScale, double yScale)
+{
+    return currentWorksheet()->insertImage(row, column, data, QPointF(xOffset, yOffset), xScale, yScale);
+}
+
 /*!
     Merge a \a range of cells. The first cell should contain the data and the others should
     be blank. All cells will be applied the same style if a valid \a format is given.
@@ -722,6 +818,52 @@ QStringList Document::worksheetNames() const
     return d->workbook->worksheetNames();
 }
 
+/*!
+    \enum Document::CompressionLevel
+
+    \value StoreOnly The parts are stored without compression, which gives
+           the fastest save. When the document is saved to a sequential
+           device, the worksheets are still written as deflate data, in
+           blocks which are not compressed, so that streaming unzippers can
+           read them.
+    \value FastCompression The fastest deflate level.
+    \value DefaultCompression The default deflate level of zlib.
+    \value BestCompression The best but slowest deflate level.
+*/
+
+/*!
+ * Returns the compression level used when the document is saved.
+ * The default is DefaultCompression.
+ */
+Document::CompressionLevel Document::compressionLevel() const
+{
+    Q_D(const Document);
+    return d->compressionLevel;
+}
+
+/*!
+ * Sets the compression \a level used for all the parts of the package
+ * when the document is saved.
+ */
+void Document::setCompressionLevel(CompressionLevel level)
+{
+    Q_D(Document);
+    d->compressionLevel = level;
+}
+
+/*!
+ * \overload
+ * Overrides the compression \a level for the parts whose path in the package
+ * starts with \a partPrefix. For example, "xl/media/" can be set to StoreOnly
+ * to keep the already compressed images stored. When several prefixes match,
+ * the longest one is used.
+ */
+void Document::setCompressionLevel(const QString &partPrefix, CompressionLevel level)
+{
+    Q_D(Document);
+    d->partCompressionLevels[partPrefix] = level;
+}
+
 /*!
  * Save current document to the filesystem. If no name specified when
  * the document constructed, a default name "book1.xlsx" will be used.
@@ -741,6 +883,11 @@ bool Document::save() const
  */
 bool Document::saveAs(const QString &name) const
 {
+    Q_D(const Document);
+    //Checked before the file is truncated
+    if (d->loadOptions.profile() == LoadOptions::ValuesOnly)
+        return false;
+
     QFile file(name);
     if (file.open(QIODevice::WriteOnly))
         return saveAs(&file);
@@ -750,6 +897,17 @@ bool Document::saveAs(const QString &name) const
 /*!
  * \overload
  * This function writes a document to the given \a device.
+ *
+ * The \a device doesn't need to be seekable, so the document can be
+ * streamed to a socket or a pipe while the worksheets are serialized.
+ *
+ * The sheets with calculation enabled are calculated first. If one of
+ * these calculations is canceled, nothing is written and false is
+ * returned.
+ *
+ * A document loaded with the LoadOptions::ValuesOnly profile lacks its
+ * fonts, fills, borders and rules, so it is never saved: nothing is
+ * written and false is returned.
  */
 bool Document::saveAs(QIODevice *device) const
 {
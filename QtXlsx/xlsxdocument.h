@@ -41,6 +41,7 @@ class Cell;
 class CellRange;
 class DataValidation;
 class ConditionalFormatting;
+class LoadOptions;
 
 class DocumentPrivate;
 class Document : public QObject
@@ -49,9 +50,18 @@ class Document : public QObject
     Q_DECLARE_PRIVATE(Document)
 
 public:
+    enum CompressionLevel {
+        StoreOnly,
+        FastCompression,
+        DefaultCompression,
+        BestCompression
+    };
+
     explicit Document(QObject *parent = 0);
     Document(const QString &xlsxName, QObject *parent=0);
     Document(QIODevice *device, QObject *parent=0);
+    Document(const QString &xlsxName, const LoadOptions &options, QObject *parent=0);
+    Document(QIODevice *device, const LoadOptions &options, QObject *parent=0);
     ~Document();
 
     int write(const QString &cell, const QVariant &value, const Format &format=Format());
@@ -59,6 +69,7 @@ public:
     QVariant read(const QString &cell) const;
     QVariant read(int row, int col) const;
     int insertImage(int row, int column, const QImage &image, double xOffset=0, double yOffset=0, double xScale=1, double yScale=1);
+    int insertImage(int row, int column, const QByteArray &data, double xOffset=0, double yOffset=0, double xScale=1, double yScale=1);
     int mergeCells(const CellRange &range, const Format &format=Format());
     int mergeCells(const QString &range, const Format &format=Format());
     int unmergeCells(const CellRange &range);
@@ -98,6 +109,10 @@ public:
     Q_DECL_DEPRECATED void setCurrentWorksheet(int index);
     Q_DECL_DEPRECATED void setCurrentWorksheet(const QString &name);
 
+    CompressionLevel compressionLevel() const;
+    void setCompressionLevel(CompressionLevel level);
+    void setCompressionLevel(const QString &partPrefix, CompressionLevel level);
+
     bool save() const;
     bool saveAs(const QString &xlsXname) const;
     bool saveAs(QIODevice *device) const;
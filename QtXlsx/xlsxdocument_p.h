@@ -39,6 +39,7 @@
 
 #include "xlsxdocument.h"
 #include "xlsxworkbook.h"
+#include "xlsxloadoptions.h"
 
 #include <QMap>
 
@@ -59,6 +60,9 @@ public:
     QString packageName; //name of the .xlsx file
 
     QMap<QString, QString> documentProperties; //core, app and custom properties
+    Document::CompressionLevel compressionLevel;
+    QMap<QString, Document::CompressionLevel> partCompressionLevels; //path prefix based override
+    LoadOptions loadOptions;
     QSharedPointer<Workbook> workbook;
 };
 
@@ -0,0 +1,1968 @@
+/****************************************************************************
+** Copyright (c) 2013-2014 Debao Zhang <hello@debao.me>
+** All right reserved.
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+** NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+** LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+** OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+** WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+****************************************************************************/
+#include "xlsxformulaengine_p.h"
+#include "xlsxworksheet.h"
+#include "xlsxworksheet_p.h"
+#include "xlsxworkbook.h"
+#include "xlsxcell.h"
+#include "xlsxcell_p.h"
+#include "xlsxutility_p.h"
+#include "xlsxsimd_p.h"
+
+#include <QHashIterator>
+#include <QThreadPool>
+#include <QThread>
+#include <QRunnable>
+#include <QElapsedTimer>
+#include <qnumeric.h>
+#include <math.h>
+
+namespace QXlsx {
+
+static const int MaxRow = 1048576;
+static const int MaxColumn = 16384;
+static const int FormulaBatchSize = 64; //Cells evaluated between two checks for cancellation
+static const int FormulaParallelLevelSize = 512; //Smaller levels aren't worth the threads
+
+/*
+   Binary operators. Comparisons come last.
+*/
+enum FormulaOperator {
+    OpAdd,
+    OpSubtract,
+    OpMultiply,
+    OpDivide,
+    OpPower,
+    OpConcatenate,
+    OpEqual,
+    OpNotEqual,
+    OpLess,
+    OpLessOrEqual,
+    OpGreater,
+    OpGreaterOrEqual
+};
+
+enum FormulaFunction {
+    FnUnknown = -1,
+    FnSum,
+    FnAverage,
+    FnMin,
+    FnMax,
+    FnCount,
+    FnCountA,
+    FnProduct,
+    FnSumIf,
+    FnCountIf,
+    FnAbs,
+    FnRound,
+    FnInt,
+    FnMod,
+    FnSqrt,
+    FnPower,
+    FnIf,
+    FnIfError,
+    FnAnd,
+    FnOr,
+    FnNot,
+    FnIsBlank,
+    FnIsNumber,
+    FnIsText,
+    FnIsError,
+    FnLen,
+    FnLeft,
+    FnRight,
+    FnMid,
+    FnUpper,
+    FnLower,
+    FnTrim,
+    FnConcatenate,
+    FnExact,
+    FnValue,
+    FnVLookup,
+    FnHLookup,
+    FnIndex,
+    FnMatch
+};
+
+struct FormulaFunctionInfo
+{
+    const char *name;
+    int minArgs;
+    int maxArgs;
+};
+
+//Indexed by FormulaFunction
+static const FormulaFunctionInfo formulaFunctions[] = {
+    {"SUM", 1, 255},
+    {"AVERAGE", 1, 255},
+    {"MIN", 1, 255},
+    {"MAX", 1, 255},
+    {"COUNT", 1, 255},
+    {"COUNTA", 1, 255},
+    {"PRODUCT", 1, 255},
+    {"SUMIF", 2, 3},
+    {"COUNTIF", 2, 2},
+    {"ABS", 1, 1},
+    {"ROUND", 2, 2},
+    {"INT", 1, 1},
+    {"MOD", 2, 2},
+    {"SQRT", 1, 1},
+    {"POWER", 2, 2},
+    {"IF", 1, 3},
+    {"IFERROR", 2, 2},
+    {"AND", 1, 255},
+    {"OR", 1, 255},
+    {"NOT", 1, 1},
+    {"ISBLANK", 1, 1},
+    {"ISNUMBER", 1, 1},
+    {"ISTEXT", 1, 1},
+    {"ISERROR", 1, 1},
+    {"LEN", 1, 1},
+    {"LEFT", 1, 2},
+    {"RIGHT", 1, 2},
+    {"MID", 3, 3},
+    {"UPPER", 1, 1},
+    {"LOWER", 1, 1},
+    {"TRIM", 1, 1},
+    {"CONCATENATE", 1, 255},
+    {"EXACT", 2, 2},
+    {"VALUE", 1, 1},
+    {"VLOOKUP", 3, 4},
+    {"HLOOKUP", 3, 4},
+    {"INDEX", 2, 3},
+    {"MATCH", 2, 3}
+};
+
+static int functionId(const QString &name)
+{
+    const int count = sizeof(formulaFunctions) / sizeof(formulaFunctions[0]);
+    for (int i=0; i<count; ++i) {
+        if (name.compare(QLatin1String(formulaFunctions[i].name), Qt::CaseInsensitive) == 0)
+            return i;
+    }
+    return FnUnknown;
+}
+
+FormulaValue FormulaValue::fromBool(bool value)
+{
+    FormulaValue result;
+    result.type = Boolean;
+    result.number = value ? 1 : 0;
+    return result;
+}
+
+FormulaValue FormulaValue::error(const char *text)
+{
+    return FormulaValue(Error, QString::fromLatin1(text));
+}
+
+bool FormulaValue::isErrorText(const QString &text)
+{
+    static const char * const errors[] = {
+        "#NULL!", "#DIV/0!", "#VALUE!", "#REF!", "#NAME?", "#NUM!", "#N/A"
+    };
+    if (!text.startsWith(QLatin1Char('#')))
+        return false;
+    for (uint i=0; i<sizeof(errors)/sizeof(errors[0]); ++i) {
+        if (text == QLatin1String(errors[i]))
+            return true;
+    }
+    return false;
+}
+
+/*
+   Returns the value of \a cell as read by formulas. The cached value is
+   used for formula cells.
+*/
+FormulaValue FormulaValue::fromCell(const Cell *cell)
+{
+    if (!cell)
+        return FormulaValue();
+
+    switch (cell->dataType()) {
+    case Cell::Numeric:
+        return FormulaValue(cell->value().toDouble());
+    case Cell::String:
+    case Cell::InlineString:
+        return FormulaValue(String, cell->value().toString());
+    case Cell::Boolean:
+        return fromBool(cell->value().toBool());
+    case Cell::Error:
+        return FormulaValue(Error, cell->value().toString());
+    case Cell::Formula:
+    case Cell::ArrayFormula: {
+        QVariant value = cell->value();
+        if (!value.isValid())
+            return FormulaValue();
+        if (value.userType() == QMetaType::Bool)
+            return fromBool(value.toBool());
+        if (value.userType() == QMetaType::QString) {
+            QString text = value.toString();
+            return FormulaValue(isErrorText(text) ? Error : String, text);
+        }
+        return FormulaValue(value.toDouble());
+    }
+    default:
+        return FormulaValue();
+    }
+}
+
+QVariant FormulaValue::toVariant() const
+{
+    switch (type) {
+    case Number:
+        return number;
+    case String:
+    case Error:
+        return text;
+    case Boolean:
+        return number != 0;
+    default:
+        return 0.0;
+    }
+}
+
+/*
+   Parses the "A1", "$A$1", "A" or "1" parts of a reference. The part is
+   a cell if both \a row and \a column are set, a whole column or a whole
+   row otherwise.
+*/
+static bool parseReferencePart(const QString &token, int *row, int *column)
+{
+    *row = 0;
+    *column = 0;
+    int letters = 0;
+    int digits = 0;
+    int i = 0;
+    const int size = token.size();
+    if (i < size && token[i] == QLatin1Char('$'))
+        ++i;
+    for (; i < size && letters <= 3; ++i, ++letters) {
+        ushort ch = token[i].unicode();
+        if (ch >= 'a' && ch <= 'z')
+            ch -= 'a' - 'A';
+        if (ch < 'A' || ch > 'Z')
+            break;
+        *column = *column * 26 + (ch - 'A' + 1);
+    }
+    if (i < size && token[i] == QLatin1Char('$'))
+        ++i;
+    for (; i < size && digits <= 7; ++i, ++digits) {
+        ushort digit = token[i].unicode() - '0';
+        if (digit > 9)
+            break;
+        *row = *row * 10 + digit;
+    }
+    if (i != size || letters > 3 || (letters == 0 && digits == 0))
+        return false;
+    if (*column > MaxColumn || *row > MaxRow || (digits && *row == 0))
+        return false;
+    return true;
+}
+
+static inline bool isNameChar(QChar ch)
+{
+    ushort c = ch.unicode();
+    return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')
+            || c == '_' || c == '.' || c == '$' || c == '\\' || c > 0x7f;
+}
+
+/*
+   Recursive descent parser of the A1 formula syntax, with the operator
+   precedence of Excel.
+*/
+class FormulaParser
+{
+public:
+    FormulaParser(const QString &text, const QString &sheetName, FormulaAst *ast)
+        : m_text(text), m_sheetName(sheetName), m_pos(0), m_ast(ast), m_failed(false)
+    {
+    }
+
+    int parse();
+
+private:
+    int comparison();
+    int concatenation();
+    int additive();
+    int multiplicative();
+    int power();
+    int prefix();
+    int postfix();
+    int primary();
+    int function(const QString &name);
+    int reference(const QString &sheet);
+    int number();
+    int binary(int op, int left, int right);
+    int add(const FormulaNode &node);
+    int fail() { m_failed = true; return -1; }
+
+    void skipSpaces();
+    bool accept(char ch);
+    bool acceptPair(char first, char second);
+    QString nameToken();
+
+    const QString &m_text;
+    QString m_sheetName;
+    int m_pos;
+    FormulaAst *m_ast;
+    bool m_failed;
+};
+
+int FormulaParser::parse()
+{
+    accept('=');
+    int root = comparison();
+    skipSpaces();
+    if (m_failed || m_pos != m_text.size())
+        return -1;
+    return root;
+}
+
+int FormulaParser::add(const FormulaNode &node)
+{
+    m_ast->nodes.append(node);
+    return m_ast->nodes.size() - 1;
+}
+
+int FormulaParser::binary(int op, int left, int right)
+{
+    if (left < 0 || right < 0)
+        return fail();
+    FormulaNode node(FormulaNode::Binary);
+    node.op = op;
+    node.args << left << right;
+    return add(node);
+}
+
+void FormulaParser::skipSpaces()
+{
+    while (m_pos < m_text.size() && m_text[m_pos].isSpace())
+        ++m_pos;
+}
+
+bool FormulaParser::accept(char ch)
+{
+    skipSpaces();
+    if (m_pos < m_text.size() && m_text[m_pos] == QLatin1Char(ch)) {
+        ++m_pos;
+        return true;
+    }
+    return false;
+}
+
+bool FormulaParser::acceptPair(char first, char second)
+{
+    skipSpaces();
+    if (m_pos + 1 < m_text.size() && m_text[m_pos] == QLatin1Char(first) && m_text[m_pos+1] == QLatin1Char(second)) {
+        m_pos += 2;
+        return true;
+    }
+    return false;
+}
+
+QString FormulaParser::nameToken()
+{
+    int start = m_pos;
+    while (m_pos < m_text.size() && isNameChar(m_text[m_pos]))
+        ++m_pos;
+    return m_text.mid(start, m_pos - start);
+}
+
+int FormulaParser::comparison()
+{
+    int left = concatenation();
+    while (!m_failed) {
+        int op;
+        if (acceptPair('<', '>'))
+            op = OpNotEqual;
+        else if (acceptPair('<', '='))
+            op = OpLessOrEqual;
+        else if (acceptPair('>', '='))
+            op = OpGreaterOrEqual;
+        else if (accept('<'))
+            op = OpLess;
+        else if (accept('>'))
+            op = OpGreater;
+        else if (accept('='))
+            op = OpEqual;
+        else
+            break;
+        left = binary(op, left, concatenation());
+    }
+    return left;
+}
+
+int FormulaParser::concatenation()
+{
+    int left = additive();
+    while (!m_failed && accept('&'))
+        left = binary(OpConcatenate, left, additive());
+    return left;
+}
+
+int FormulaParser::additive()
+{
+    int left = multiplicative();
+    while (!m_failed) {
+        if (accept('+'))
+            left = binary(OpAdd, left, multiplicative());
+        else if (accept('-'))
+            left = binary(OpSubtract, left, multiplicative());
+        else
+            break;
+    }
+    return left;
+}
+
+int FormulaParser::multiplicative()
+{
+    int left = power();
+    while (!m_failed) {
+        if (accept('*'))
+            left = binary(OpMultiply, left, power());
+        else if (accept('/'))
+            left = binary(OpDivide, left, power());
+        else
+            break;
+    }
+    return left;
+}
+
+int FormulaParser::power()
+{
+    int left = prefix();
+    while (!m_failed && accept('^'))
+        left = binary(OpPower, left, prefix());
+    return left;
+}
+
+//Negation binds tighter than '^' in Excel: -2^2 is 4
+int FormulaParser::prefix()
+{
+    if (accept('-')) {
+        int operand = prefix();
+        if (operand < 0)
+            return fail();
+        FormulaNode node(FormulaNode::Unary);
+        node.args << operand;
+        return add(node);
+    }
+    if (accept('+'))
+        return prefix();
+    return postfix();
+}
+
+int FormulaParser::postfix()
+{
+    int operand = primary();
+    while (!m_failed && accept('%')) {
+        FormulaNode node(FormulaNode::Percent);
+        node.args << operand;
+        operand = add(node);
+    }
+    return operand;
+}
+
+int FormulaParser::primary()
+{
+    skipSpaces();
+    if (m_pos >= m_text.size())
+        return fail();
+
+    const QChar ch = m_text[m_pos];
+    if (ch == QLatin1Char('(')) {
+        ++m_pos;
+        int node = comparison();
+        if (!accept(')'))
+            return fail();
+        return node;
+    } else if (ch == QLatin1Char('"')) {
+        QString text;
+        for (++m_pos; m_pos < m_text.size(); ++m_pos) {
+            if (m_text[m_pos] == QLatin1Char('"')) {
+                if (m_pos + 1 < m_text.size() && m_text[m_pos+1] == QLatin1Char('"'))
+                    ++m_pos;
+                else
+                    break;
+            }
+            text.append(m_text[m_pos]);
+        }
+        if (m_pos >= m_text.size())
+            return fail();
+        ++m_pos;
+        FormulaNode node(FormulaNode::Constant);
+        node.value = FormulaValue(FormulaValue::String, text);
+        return add(node);
+    } else if (ch == QLatin1Char('#')) {
+        int start = m_pos++;
+        while (m_pos < m_text.size() && (m_text[m_pos].isLetterOrNumber() || m_text[m_pos] == QLatin1Char('/')))
+            ++m_pos;
+        if (m_pos < m_text.size() && (m_text[m_pos] == QLatin1Char('!') || m_text[m_pos] == QLatin1Char('?')))
+            ++m_pos;
+        QString text = m_text.mid(start, m_pos - start).toUpper();
+        if (!FormulaValue::isErrorText(text))
+            return fail();
+        FormulaNode node(FormulaNode::Constant);
+        node.value = FormulaValue(FormulaValue::Error, text);
+        return add(node);
+    } else if (ch.isDigit() || ch == QLatin1Char('.')) {
+        return number();
+    } else if (ch == QLatin1Char('\'')) {
+        QString sheet;
+        for (++m_pos; m_pos < m_text.size(); ++m_pos) {
+            if (m_text[m_pos] == QLatin1Char('\'')) {
+                if (m_pos + 1 < m_text.size() && m_text[m_pos+1] == QLatin1Char('\''))
+                    ++m_pos;
+                else
+                    break;
+            }
+            sheet.append(m_text[m_pos]);
+        }
+        if (m_pos + 1 >= m_text.size() || m_text[m_pos+1] != QLatin1Char('!'))
+            return fail();
+        m_pos += 2;
+        return reference(sheet);
+    } else if (isNameChar(ch)) {
+        int start = m_pos;
+        QString name = nameToken();
+        if (m_pos < m_text.size() && m_text[m_pos] == QLatin1Char('(')) {
+            ++m_pos;
+            return function(name);
+        }
+        if (m_pos < m_text.size() && m_text[m_pos] == QLatin1Char('!')) {
+            ++m_pos;
+            return reference(name);
+        }
+        if (name.compare(QLatin1String("TRUE"), Qt::CaseInsensitive) == 0
+                || name.compare(QLatin1String("FALSE"), Qt::CaseInsensitive) == 0) {
+            FormulaNode node(FormulaNode::Constant);
+            node.value = FormulaValue::fromBool(name.size() == 4);
+            return add(node);
+        }
+        m_pos = start;
+        return reference(QString());
+    }
+    return fail();
+}
+
+int FormulaParser::number()
+{
+    int start = m_pos;
+    while (m_pos < m_text.size() && m_text[m_pos].isDigit())
+        ++m_pos;
+    //Whole rows, such as 1:3
+    if (m_pos > start && m_pos < m_text.size() && m_text[m_pos] == QLatin1Char(':')) {
+        m_pos = start;
+        return reference(QString());
+    }
+    if (m_pos < m_text.size() && m_text[m_pos] == QLatin1Char('.')) {
+        ++m_pos;
+        while (m_pos < m_text.size() && m_text[m_pos].isDigit())
+            ++m_pos;
+    }
+    if (m_pos < m_text.size() && (m_text[m_pos] == QLatin1Char('E') || m_text[m_pos] == QLatin1Char('e'))) {
+        int mark = m_pos++;
+        if (m_pos < m_text.size() && (m_text[m_pos] == QLatin1Char('+') || m_text[m_pos] == QLatin1Char('-')))
+            ++m_pos;
+        if (m_pos < m_text.size() && m_text[m_pos].isDigit()) {
+            while (m_pos < m_text.size() && m_text[m_pos].isDigit())
+                ++m_pos;
+        } else {
+            m_pos = mark;
+        }
+    }
+    bool ok = false;
+    double value = xl_string_to_double(m_text.mid(start, m_pos - start), &ok);
+    if (!ok)
+        return fail();
+    FormulaNode node(FormulaNode::Constant);
+    node.value = FormulaValue(value);
+    return add(node);
+}
+
+int FormulaParser::function(const QString &name)
+{
+    FormulaNode node(FormulaNode::Function);
+    node.name = name.toUpper();
+    node.op = functionId(node.name);
+    if (!accept(')')) {
+        while (true) {
+            skipSpaces();
+            int arg;
+            if (m_pos < m_text.size() && (m_text[m_pos] == QLatin1Char(',') || m_text[m_pos] == QLatin1Char(')')))
+                arg = add(FormulaNode(FormulaNode::Missing));
+            else
+                arg = comparison();
+            if (arg < 0)
+                return fail();
+            node.args.append(arg);
+            if (accept(')'))
+                break;
+            if (!accept(','))
+                return fail();
+        }
+    }
+    return add(node);
+}
+
+/*
+   Parses a cell, a range, a whole column range such as A:C or a whole
+   row range such as 1:3. Other names are not supported and evaluate to
+   #NAME?.
+*/
+int FormulaParser::reference(const QString &sheet)
+{
+    QString first = nameToken();
+    int row1, col1;
+    if (!parseReferencePart(first, &row1, &col1)) {
+        if (first.isEmpty())
+            return fail();
+        FormulaNode node(FormulaNode::Constant);
+        node.value = FormulaValue::error("#NAME?");
+        return add(node);
+    }
+
+    int row2 = row1;
+    int col2 = col1;
+    if (m_pos < m_text.size() && m_text[m_pos] == QLatin1Char(':')) {
+        ++m_pos;
+        QString second = nameToken();
+        if (!parseReferencePart(second, &row2, &col2))
+            return fail();
+        if ((row1 == 0) != (row2 == 0) || (col1 == 0) != (col2 == 0))
+            return fail();
+    } else if (row1 == 0 || col1 == 0) {
+        //A name made of letters only, or of digits only
+        FormulaNode node(FormulaNode::Constant);
+        node.value = FormulaValue::error("#NAME?");
+        return add(node);
+    }
+
+    if (row1 == 0) {
+        row1 = 1;
+        row2 = MaxRow;
+    }
+    if (col1 == 0) {
+        col1 = 1;
+        col2 = MaxColumn;
+    }
+
+    FormulaNode node(FormulaNode::Reference);
+    node.range = CellRange(qMin(row1, row2), qMin(col1, col2), qMax(row1, row2), qMax(col1, col2));
+    if (!sheet.isEmpty() && sheet.compare(m_sheetName, Qt::CaseInsensitive) != 0)
+        node.name = sheet;
+
+    if (node.name.isEmpty())
+        m_ast->precedents.append(node.range);
+    else
+        m_ast->hasExternalReferences = true;
+    return add(node);
+}
+
+/*
+   Parses \a formula of a cell of the sheet \a sheetName. The root of the
+   returned tree is -1 if the formula is not supported.
+*/
+QSharedPointer<const FormulaAst> FormulaAst::parse(const QString &formula, const QString &sheetName)
+{
+    QSharedPointer<FormulaAst> ast(new FormulaAst);
+    FormulaParser parser(formula, sheetName, ast.data());
+    ast->root = parser.parse();
+    if (ast->root < 0) {
+        ast->nodes.clear();
+        ast->precedents.clear();
+        ast->hasExternalReferences = false;
+    }
+    return ast;
+}
+
+static bool toNumber(const FormulaValue &value, double *number)
+{
+    switch (value.type) {
+    case FormulaValue::Empty:
+        *number = 0;
+        return true;
+    case FormulaValue::Number:
+    case FormulaValue::Boolean:
+        *number = value.number;
+        return true;
+    case FormulaValue::String: {
+        bool ok = false;
+        *number = xl_string_to_double(value.text.trimmed(), &ok);
+        return ok && !value.text.trimmed().isEmpty();
+    }
+    default:
+        return false;
+    }
+}
+
+static QString toText(const FormulaValue &value)
+{
+    switch (value.type) {
+    case FormulaValue::Number:
+        return QString::number(value.number, 'g', 15);
+    case FormulaValue::Boolean:
+        return value.number ? QStringLiteral("TRUE") : QStringLiteral("FALSE");
+    case FormulaValue::String:
+    case FormulaValue::Error:
+        return value.text;
+    default:
+        return QString();
+    }
+}
+
+static bool toBool(const FormulaValue &value, bool *result)
+{
+    switch (value.type) {
+    case FormulaValue::Empty:
+        *result = false;
+        return true;
+    case FormulaValue::Number:
+    case FormulaValue::Boolean:
+        *result = value.number != 0;
+        return true;
+    case FormulaValue::String:
+        if (value.text.compare(QLatin1String("TRUE"), Qt::CaseInsensitive) == 0) {
+            *result = true;
+            return true;
+        }
+        if (value.text.compare(QLatin1String("FALSE"), Qt::CaseInsensitive) == 0) {
+            *result = false;
+            return true;
+        }
+        return false;
+    default:
+        return false;
+    }
+}
+
+//Numbers sort before text, and text before booleans
+static int typeRank(FormulaValue::Type type)
+{
+    if (type == FormulaValue::String)
+        return 1;
+    if (type == FormulaValue::Boolean)
+        return 2;
+    return 0;
+}
+
+static int compareValues(FormulaValue a, FormulaValue b)
+{
+    if (a.type == FormulaValue::Empty)
+        a = b.type == FormulaValue::String ? FormulaValue(FormulaValue::String, QString()) : FormulaValue(0.0);
+    if (b.type == FormulaValue::Empty)
+        b = a.type == FormulaValue::String ? FormulaValue(FormulaValue::String, QString()) : FormulaValue(0.0);
+
+    int rankA = typeRank(a.type);
+    int rankB = typeRank(b.type);
+    if (rankA != rankB)
+        return rankA - rankB;
+    if (a.type == FormulaValue::String)
+        return a.text.compare(b.text, Qt::CaseInsensitive);
+    if (a.number < b.number)
+        return -1;
+    return a.number > b.number ? 1 : 0;
+}
+
+/*
+   Evaluates the tree of one formula cell. Values of the cells are read
+   through the public worksheet API, so other sheets work the same way.
+*/
+class FormulaEvaluator
+{
+public:
+    FormulaEvaluator(Worksheet *sheet, const FormulaAst *ast)
+        : m_sheet(sheet), m_ast(ast)
+    {
+    }
+
+    FormulaValue evaluate();
+
+private:
+    FormulaValue value(int index);
+    FormulaValue binary(const FormulaNode &node);
+    FormulaValue function(const FormulaNode &node);
+    FormulaValue lookup(const FormulaNode &node, bool vertical);
+    FormulaValue index(const FormulaNode &node);
+    FormulaValue match(const FormulaNode &node);
+    FormulaValue conditional(const FormulaNode &node, bool sum);
+
+    bool numberArg(const FormulaNode &node, int arg, double *number, FormulaValue *error);
+    bool textArg(const FormulaNode &node, int arg, QString *text, FormulaValue *error);
+    bool collectNumbers(const FormulaNode &node, QVector<double> &numbers, FormulaValue *error);
+    Worksheet *sheetOf(const FormulaNode &node) const;
+    CellRange usedRange(Worksheet *sheet, const CellRange &range) const;
+    FormulaValue cellValue(Worksheet *sheet, int row, int column) const;
+    int matchOffset(Worksheet *sheet, const CellRange &line, const FormulaValue &key, int matchType) const;
+
+    Worksheet *m_sheet;
+    const FormulaAst *m_ast;
+};
+
+FormulaValue FormulaEvaluator::evaluate()
+{
+    if (m_ast->root < 0)
+        return FormulaValue::error("#NAME?");
+    return value(m_ast->root);
+}
+
+Worksheet *FormulaEvaluator::sheetOf(const FormulaNode &node) const
+{
+    if (node.name.isEmpty())
+        return m_sheet;
+    Workbook *book = m_sheet->workbook();
+    for (int i=0; i<book->worksheetCount(); ++i) {
+        Worksheet *sheet = book->worksheet(i);
+        if (sheet->sheetName().compare(node.name, Qt::CaseInsensitive) == 0)
+            return sheet;
+    }
+    return 0;
+}
+
+/*
+   Returns the part of \a range inside the dimension of \a sheet, the
+   other cells are empty.
+*/
+CellRange FormulaEvaluator::usedRange(Worksheet *sheet, const CellRange &range) const
+{
+    CellRange dimension = sheet->dimension();
+    if (!dimension.isValid())
+        return CellRange();
+    return CellRange(qMax(range.firstRow(), dimension.firstRow()), qMax(range.firstColumn(), dimension.firstColumn()),
+                     qMin(range.lastRow(), dimension.lastRow()), qMin(range.lastColumn(), dimension.lastColumn()));
+}
+
+FormulaValue FormulaEvaluator::cellValue(Worksheet *sheet, int row, int column) const
+{
+    return FormulaValue::fromCell(sheet->cellAt(row, column));
+}
+
+FormulaValue FormulaEvaluator::value(int index)
+{
+    const FormulaNode &node = m_ast->nodes[index];
+    switch (node.type) {
+    case FormulaNode::Constant:
+        return node.value;
+    case FormulaNode::Missing:
+        return FormulaValue();
+    case FormulaNode::Reference: {
+        Worksheet *sheet = sheetOf(node);
+        if (!sheet)
+            return FormulaValue::error("#REF!");
+        //No implicit intersection, a range can't be used as one value
+        if (node.range.rowCount() != 1 || node.range.columnCount() != 1)
+            return FormulaValue::error("#VALUE!");
+        return cellValue(sheet, node.range.firstRow(), node.range.firstColumn());
+    }
+    case FormulaNode::Unary:
+    case FormulaNode::Percent: {
+        FormulaValue operand = value(node.args[0]);
+        if (operand.type == FormulaValue::Error)
+            return operand;
+        double number;
+        if (!toNumber(operand, &number))
+            return FormulaValue::error("#VALUE!");
+        return FormulaValue(node.type == FormulaNode::Unary ? -number : number / 100);
+    }
+    case FormulaNode::Binary:
+        return binary(node);
+    case FormulaNode::Function:
+        return function(node);
+    }
+    return FormulaValue();
+}
+
+FormulaValue FormulaEvaluator::binary(const FormulaNode &node)
+{
+    FormulaValue left = value(node.args[0]);
+    if (left.type == FormulaValue::Error)
+        return left;
+    FormulaValue right = value(node.args[1]);
+    if (right.type == FormulaValue::Error)
+        return right;
+
+    if (node.op == OpConcatenate)
+        return FormulaValue(FormulaValue::String, toText(left) + toText(right));
+
+    if (node.op >= OpEqual) {
+        int c = compareValues(left, right);
+        switch (node.op) {
+        case OpEqual: return FormulaValue::fromBool(c == 0);
+        case OpNotEqual: return FormulaValue::fromBool(c != 0);
+        case OpLess: return FormulaValue::fromBool(c < 0);
+        case OpLessOrEqual: return FormulaValue::fromBool(c <= 0);
+        case OpGreater: return FormulaValue::fromBool(c > 0);
+        default: return FormulaValue::fromBool(c >= 0);
+        }
+    }
+
+    double a, b;
+    if (!toNumber(left, &a) || !toNumber(right, &b))
+        return FormulaValue::error("#VALUE!");
+    double result;
+    switch (node.op) {
+    case OpAdd:
+        result = a + b;
+        break;
+    case OpSubtract:
+        result = a - b;
+        break;
+    case OpMultiply:
+        result = a * b;
+        break;
+    case OpDivide:
+        if (b == 0)
+            return FormulaValue::error("#DIV/0!");
+        result = a / b;
+        break;
+    default:
+        result = pow(a, b);
+        break;
+    }
+    if (qIsNaN(result) || qIsInf(result))
+        return FormulaValue::error("#NUM!");
+    return FormulaValue(result);
+}
+
+bool FormulaEvaluator::numberArg(const FormulaNode &node, int arg, double *number, FormulaValue *error)
+{
+    FormulaValue v = value(node.args[arg]);
+    if (v.type == FormulaValue::Error) {
+        *error = v;
+        return false;
+    }
+    if (!toNumber(v, number)) {
+        *error = FormulaValue::error("#VALUE!");
+        return false;
+    }
+    return true;
+}
+
+bool FormulaEvaluator::textArg(const FormulaNode &node, int arg, QString *text, FormulaValue *error)
+{
+    FormulaValue v = value(node.args[arg]);
+    if (v.type == FormulaValue::Error) {
+        *error = v;
+        return false;
+    }
+    *text = toText(v);
+    return true;
+}
+
+/*
+   Collects the numbers of the arguments as SUM does: the numbers found
+   in ranges, and the other arguments converted to numbers.
+*/
+bool FormulaEvaluator::collectNumbers(const FormulaNode &node, QVector<double> &numbers, FormulaValue *error)
+{
+    for (int i=0; i<node.args.size(); ++i) {
+        const FormulaNode &argNode = m_ast->nodes[node.args[i]];
+        if (argNode.type == FormulaNode::Missing)
+            continue;
+        if (argNode.type != FormulaNode::Reference) {
+            double number;
+            if (!numberArg(node, i, &number, error))
+                return false;
+            numbers.append(number);
+            continue;
+        }
+
+        Worksheet *sheet = sheetOf(argNode);
+        if (!sheet) {
+            *error = FormulaValue::error("#REF!");
+            return false;
+        }
+        CellRange range = usedRange(sheet, argNode.range);
+        for (int row=range.firstRow(); row<=range.lastRow(); ++row) {
+            for (int col=range.firstColumn(); col<=range.lastColumn(); ++col) {
+                FormulaValue v = cellValue(sheet, row, col);
+                if (v.type == FormulaValue::Number) {
+                    numbers.append(v.number);
+                } else if (v.type == FormulaValue::Error) {
+                    *error = v;
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+/*
+   Returns the offset in the row or column \a line of the value matching
+   \a key, or -1. \a matchType is 0 for an exact match, 1 for the largest
+   value not greater than \a key in ascending data and -1 for the smallest
+   value not less than \a key in descending data.
+*/
+int FormulaEvaluator::matchOffset(Worksheet *sheet, const CellRange &line, const FormulaValue &key, int matchType) const
+{
+    const bool vertical = line.columnCount() == 1;
+    const int count = vertical ? line.rowCount() : line.columnCount();
+    CellRange used = usedRange(sheet, line);
+    const int usedCount = !used.isValid() ? 0
+            : (vertical ? used.lastRow() - line.firstRow() + 1 : used.lastColumn() - line.firstColumn() + 1);
+
+    int found = -1;
+    for (int i=0; i<qMin(count, usedCount); ++i) {
+        FormulaValue v = vertical ? cellValue(sheet, line.firstRow() + i, line.firstColumn())
+                                  : cellValue(sheet, line.firstRow(), line.firstColumn() + i);
+        if (v.type == FormulaValue::Empty || typeRank(v.type) != typeRank(key.type))
+            continue;
+        int c = compareValues(v, key);
+        if (matchType == 0) {
+            if (c == 0)
+                return i;
+        } else if (c * matchType <= 0) {
+            found = i;
+        } else {
+            break;
+        }
+    }
+    return found;
+}
+
+FormulaValue FormulaEvaluator::lookup(const FormulaNode &node, bool vertical)
+{
+    FormulaValue key = value(node.args[0]);
+    if (key.type == FormulaValue::Error)
+        return key;
+    const FormulaNode &table = m_ast->nodes[node.args[1]];
+    if (table.type != FormulaNode::Reference)
+        return FormulaValue::error("#VALUE!");
+    Worksheet *sheet = sheetOf(table);
+    if (!sheet)
+        return FormulaValue::error("#REF!");
+
+    FormulaValue error;
+    double number;
+    if (!numberArg(node, 2, &number, &error))
+        return error;
+    int index = static_cast<int>(number);
+    if (index < 1)
+        return FormulaValue::error("#VALUE!");
+    if (index > (vertical ? table.range.columnCount() : table.range.rowCount()))
+        return FormulaValue::error("#REF!");
+
+    bool approximate = true;
+    if (node.args.size() > 3 && m_ast->nodes[node.args[3]].type != FormulaNode::Missing) {
+        FormulaValue v = value(node.args[3]);
+        if (v.type == FormulaValue::Error)
+            return v;
+        if (!toBool(v, &approximate))
+            return FormulaValue::error("#VALUE!");
+    }
+
+    const CellRange &r = table.range;
+    CellRange line = vertical ? CellRange(r.firstRow(), r.firstColumn(), r.lastRow(), r.firstColumn())
+                              : CellRange(r.firstRow(), r.firstColumn(), r.firstRow(), r.lastColumn());
+    int offset = matchOffset(sheet, line, key, approximate ? 1 : 0);
+    if (offset < 0)
+        return FormulaValue::error("#N/A");
+
+    FormulaValue result = vertical ? cellValue(sheet, r.firstRow() + offset, r.firstColumn() + index - 1)
+                                   : cellValue(sheet, r.firstRow() + index - 1, r.firstColumn() + offset);
+    if (result.type == FormulaValue::Empty)
+        return FormulaValue(0.0);
+    return result;
+}
+
+FormulaValue FormulaEvaluator::index(const FormulaNode &node)
+{
+    const FormulaNode &table = m_ast->nodes[node.args[0]];
+    if (table.type != FormulaNode::Reference)
+        return FormulaValue::error("#VALUE!");
+    Worksheet *sheet = sheetOf(table);
+    if (!sheet)
+        return FormulaValue::error("#REF!");
+
+    FormulaValue error;
+    double rowNumber;
+    double columnNumber = 1;
+    if (!numberArg(node, 1, &rowNumber, &error))
+        return error;
+    if (node.args.size() > 2 && !numberArg(node, 2, &columnNumber, &error))
+        return error;
+    //INDEX(A1:E1, n) picks a column
+    if (node.args.size() == 2 && table.range.rowCount() == 1) {
+        columnNumber = rowNumber;
+        rowNumber = 1;
+    }
+
+    int row = static_cast<int>(rowNumber);
+    int column = static_cast<int>(columnNumber);
+    if (row < 1 || column < 1)
+        return FormulaValue::error("#VALUE!");
+    if (row > table.range.rowCount() || column > table.range.columnCount())
+        return FormulaValue::error("#REF!");
+
+    FormulaValue result = cellValue(sheet, table.range.firstRow() + row - 1, table.range.firstColumn() + column - 1);
+    if (result.type == FormulaValue::Empty)
+        return FormulaValue(0.0);
+    return result;
+}
+
+FormulaValue FormulaEvaluator::match(const FormulaNode &node)
+{
+    FormulaValue key = value(node.args[0]);
+    if (key.type == FormulaValue::Error)
+        return key;
+    const FormulaNode &line = m_ast->nodes[node.args[1]];
+    if (line.type != FormulaNode::Reference || (line.range.rowCount() != 1 && line.range.columnCount() != 1))
+        return FormulaValue::error("#N/A");
+    Worksheet *sheet = sheetOf(line);
+    if (!sheet)
+        return FormulaValue::error("#REF!");
+
+    double matchType = 1;
+    FormulaValue error;
+    if (node.args.size() > 2 && m_ast->nodes[node.args[2]].type != FormulaNode::Missing
+            && !numberArg(node, 2, &matchType, &error)) {
+        return error;
+    }
+    int type = matchType > 0 ? 1 : (matchType < 0 ? -1 : 0);
+    int offset = matchOffset(sheet, line.range, key, type);
+    if (offset < 0)
+        return FormulaValue::error("#N/A");
+    return FormulaValue(offset + 1);
+}
+
+/*
+   SUMIF and COUNTIF. The criteria is a value, optionally preceded by a
+   comparison operator such as ">=". Wildcards are not supported.
+*/
+FormulaValue FormulaEvaluator::conditional(const FormulaNode &node, bool sum)
+{
+    const FormulaNode &rangeNode = m_ast->nodes[node.args[0]];
+    if (rangeNode.type != FormulaNode::Reference)
+        return FormulaValue::error("#VALUE!");
+    Worksheet *sheet = sheetOf(rangeNode);
+    if (!sheet)
+        return FormulaValue::error("#REF!");
+    FormulaValue criteria = value(node.args[1]);
+    if (criteria.type == FormulaValue::Error)
+        return criteria;
+
+    int op = OpEqual;
+    if (criteria.type == FormulaValue::String) {
+        static const struct { const char *text; int op; } prefixes[] = {
+            {"<>", OpNotEqual}, {"<=", OpLessOrEqual}, {">=", OpGreaterOrEqual},
+            {"<", OpLess}, {">", OpGreater}, {"=", OpEqual}
+        };
+        for (uint i=0; i<sizeof(prefixes)/sizeof(prefixes[0]); ++i) {
+            if (criteria.text.startsWith(QLatin1String(prefixes[i].text))) {
+                op = prefixes[i].op;
+                criteria.text.remove(0, qstrlen(prefixes[i].text));
+                break;
+            }
+        }
+        double number;
+        if (toNumber(criteria, &number))
+            criteria = FormulaValue(number);
+    }
+
+    const CellRange &range = rangeNode.range;
+    CellRange sumRange = range;
+    Worksheet *sumSheet = sheet;
+    if (sum && node.args.size() > 2) {
+        const FormulaNode &sumNode = m_ast->nodes[node.args[2]];
+        if (sumNode.type != FormulaNode::Reference)
+            return FormulaValue::error("#VALUE!");
+        sumSheet = sheetOf(sumNode);
+        if (!sumSheet)
+            return FormulaValue::error("#REF!");
+        sumRange = sumNode.range;
+    }
+
+    double total = 0;
+    CellRange used = usedRange(sheet, range);
+    for (int row=used.firstRow(); row<=used.lastRow(); ++row) {
+        for (int col=used.firstColumn(); col<=used.lastColumn(); ++col) {
+            FormulaValue v = cellValue(sheet, row, col);
+            if (v.type == FormulaValue::Empty || typeRank(v.type) != typeRank(criteria.type)) {
+                if (op != OpNotEqual)
+                    continue;
+            } else {
+                int c = compareValues(v, criteria);
+                bool matched;
+                switch (op) {
+                case OpNotEqual: matched = c != 0; break;
+                case OpLess: matched = c < 0; break;
+                case OpLessOrEqual: matched = c <= 0; break;
+                case OpGreater: matched = c > 0; break;
+                case OpGreaterOrEqual: matched = c >= 0; break;
+                default: matched = c == 0; break;
+                }
+                if (!matched)
+                    continue;
+            }
+            if (!sum) {
+                total += 1;
+                continue;
+            }
+            FormulaValue s = cellValue(sumSheet, sumRange.firstRow() + row - range.firstRow(),
+                                       sumRange.firstColumn() + col - range.firstColumn());
+            if (s.type == FormulaValue::Number)
+                total += s.number;
+        }
+    }
+    return FormulaValue(total);
+}
+
+FormulaValue FormulaEvaluator::function(const FormulaNode &node)
+{
+    if (node.op == FnUnknown)
+        return FormulaValue::error("#NAME?");
+    const FormulaFunctionInfo &info = formulaFunctions[node.op];
+    if (node.args.size() < info.minArgs || node.args.size() > info.maxArgs)
+        return FormulaValue::error("#VALUE!");
+
+    FormulaValue error;
+    switch (node.op) {
+    case FnSum:
+    case FnAverage:
+    case FnMin:
+    case FnMax:
+    case FnProduct: {
+        QVector<double> numbers;
+        if (!collectNumbers(node, numbers, &error))
+            return error;
+        if (numbers.isEmpty())
+            return node.op == FnAverage ? FormulaValue::error("#DIV/0!") : FormulaValue(0.0);
+        if (node.op == FnMin || node.op == FnMax) {
+            double min, max;
+            xlsxMinMax(numbers.constData(), numbers.size(), &min, &max);
+            return FormulaValue(node.op == FnMin ? min : max);
+        }
+        if (node.op == FnProduct) {
+            double result = 1;
+            foreach (double number, numbers)
+                result *= number;
+            return FormulaValue(result);
+        }
+        double result = xlsxSum(numbers.constData(), numbers.size());
+        if (node.op == FnAverage)
+            result /= numbers.size();
+        return FormulaValue(result);
+    }
+    case FnCount:
+    case FnCountA: {
+        double count = 0;
+        foreach (int arg, node.args) {
+            const FormulaNode &argNode = m_ast->nodes[arg];
+            if (argNode.type == FormulaNode::Reference) {
+                Worksheet *sheet = sheetOf(argNode);
+                if (!sheet)
+                    continue;
+                CellRange range = usedRange(sheet, argNode.range);
+                for (int row=range.firstRow(); row<=range.lastRow(); ++row) {
+                    for (int col=range.firstColumn(); col<=range.lastColumn(); ++col) {
+                        FormulaValue v = cellValue(sheet, row, col);
+                        if (node.op == FnCount ? v.type == FormulaValue::Number : v.type != FormulaValue::Empty)
+                            count += 1;
+                    }
+                }
+            } else if (argNode.type != FormulaNode::Missing) {
+                FormulaValue v = value(arg);
+                double number;
+                if (node.op == FnCountA || (v.type != FormulaValue::Error && toNumber(v, &number)))
+                    count += 1;
+            }
+        }
+        return FormulaValue(count);
+    }
+    case FnSumIf:
+        return conditional(node, true);
+    case FnCountIf:
+        return conditional(node, false);
+    case FnAbs:
+    case FnInt:
+    case FnSqrt: {
+        double x;
+        if (!numberArg(node, 0, &x, &error))
+            return error;
+        if (node.op == FnAbs)
+            return FormulaValue(fabs(x));
+        if (node.op == FnInt)
+            return FormulaValue(floor(x));
+        if (x < 0)
+            return FormulaValue::error("#NUM!");
+        return FormulaValue(sqrt(x));
+    }
+    case FnRound: {
+        double x, digits;
+        if (!numberArg(node, 0, &x, &error) || !numberArg(node, 1, &digits, &error))
+            return error;
+        double factor = pow(10.0, static_cast<int>(digits));
+        //Round the scaled value to 15 digits first, so 2.675 gives 2.68
+        double scaled = QString::number(fabs(x) * factor, 'g', 15).toDouble();
+        double result = floor(scaled + 0.5) / factor;
+        return FormulaValue(x < 0 ? -result : result);
+    }
+    case FnMod:
+    case FnPower: {
+        double a, b;
+        if (!numberArg(node, 0, &a, &error) || !numberArg(node, 1, &b, &error))
+            return error;
+        if (node.op == FnMod) {
+            if (b == 0)
+                return FormulaValue::error("#DIV/0!");
+            return FormulaValue(a - b * floor(a / b));
+        }
+        double result = pow(a, b);
+        if (qIsNaN(result) || qIsInf(result))
+            return FormulaValue::error("#NUM!");
+        return FormulaValue(result);
+    }
+    case FnIf: {
+        FormulaValue condition = value(node.args[0]);
+        if (condition.type == FormulaValue::Error)
+            return condition;
+        bool test;
+        if (!toBool(condition, &test))
+            return FormulaValue::error("#VALUE!");
+        int branch = test ? 1 : 2;
+        if (branch >= node.args.size())
+            return FormulaValue::fromBool(test);
+        FormulaValue result = value(node.args[branch]);
+        if (result.type == FormulaValue::Empty)
+            return FormulaValue(0.0);
+        return result;
+    }
+    case FnIfError: {
+        FormulaValue result = value(node.args[0]);
+        if (result.type == FormulaValue::Error)
+            return value(node.args[1]);
+        return result;
+    }
+    case FnAnd:
+    case FnOr: {
+        bool any = false;
+        bool result = node.op == FnAnd;
+        foreach (int arg, node.args) {
+            const FormulaNode &argNode = m_ast->nodes[arg];
+            QVector<FormulaValue> values;
+            if (argNode.type == FormulaNode::Reference) {
+                Worksheet *sheet = sheetOf(argNode);
+                if (!sheet)
+                    return FormulaValue::error("#REF!");
+                CellRange range = usedRange(sheet, argNode.range);
+                for (int row=range.firstRow(); row<=range.lastRow(); ++row) {
+                    for (int col=range.firstColumn(); col<=range.lastColumn(); ++col) {
+                        FormulaValue v = cellValue(sheet, row, col);
+                        //Text and blank cells of ranges are ignored
+                        if (v.type != FormulaValue::String && v.type != FormulaValue::Empty)
+                            values.append(v);
+                    }
+                }
+            } else {
+                values.append(value(arg));
+            }
+            foreach (const FormulaValue &v, values) {
+                if (v.type == FormulaValue::Error)
+                    return v;
+                bool b;
+                if (!toBool(v, &b))
+                    return FormulaValue::error("#VALUE!");
+                any = true;
+                result = node.op == FnAnd ? (result && b) : (result || b);
+            }
+        }
+        if (!any)
+            return FormulaValue::error("#VALUE!");
+        return FormulaValue::fromBool(result);
+    }
+    case FnNot: {
+        FormulaValue v = value(node.args[0]);
+        if (v.type == FormulaValue::Error)
+            return v;
+        bool b;
+        if (!toBool(v, &b))
+            return FormulaValue::error("#VALUE!");
+        return FormulaValue::fromBool(!b);
+    }
+    case FnIsBlank:
+    case FnIsNumber:
+    case FnIsText:
+    case FnIsError: {
+        FormulaValue v = value(node.args[0]);
+        static const FormulaValue::Type types[] = {
+            FormulaValue::Empty, FormulaValue::Number, FormulaValue::String, FormulaValue::Error
+        };
+        return FormulaValue::fromBool(v.type == types[node.op - FnIsBlank]);
+    }
+    case FnLen:
+    case FnUpper:
+    case FnLower:
+    case FnTrim:
+    case FnValue: {
+        QString text;
+        if (!textArg(node, 0, &text, &error))
+            return error;
+        if (node.op == FnLen)
+            return FormulaValue(text.size());
+        if (node.op == FnUpper)
+            return FormulaValue(FormulaValue::String, text.toUpper());
+        if (node.op == FnLower)
+            return FormulaValue(FormulaValue::String, text.toLower());
+        if (node.op == FnValue) {
+            double number;
+            if (!toNumber(FormulaValue(FormulaValue::String, text), &number))
+                return FormulaValue::error("#VALUE!");
+            return FormulaValue(number);
+        }
+        //Only spaces are trimmed, and runs of inner spaces become one
+        QString result;
+        result.reserve(text.size());
+        foreach (QChar ch, text) {
+            if (ch == QLatin1Char(' ') && (result.isEmpty() || result.endsWith(QLatin1Char(' '))))
+                continue;
+            result.append(ch);
+        }
+        if (result.endsWith(QLatin1Char(' ')))
+            result.chop(1);
+        return FormulaValue(FormulaValue::String, result);
+    }
+    case FnLeft:
+    case FnRight:
+    case FnMid: {
+        QString text;
+        if (!textArg(node, 0, &text, &error))
+            return error;
+        double start = 1;
+        double count = 1;
+        if (node.op == FnMid) {
+            if (!numberArg(node, 1, &start, &error) || !numberArg(node, 2, &count, &error))
+                return error;
+            if (start < 1)
+                return FormulaValue::error("#VALUE!");
+        } else if (node.args.size() > 1 && !numberArg(node, 1, &count, &error)) {
+            return error;
+        }
+        if (count < 0)
+            return FormulaValue::error("#VALUE!");
+        int n = static_cast<int>(qMin(count, double(text.size())));
+        if (node.op == FnLeft)
+            return FormulaValue(FormulaValue::String, text.left(n));
+        if (node.op == FnRight)
+            return FormulaValue(FormulaValue::String, text.right(n));
+        if (start > text.size())
+            return FormulaValue(FormulaValue::String, QString());
+        return FormulaValue(FormulaValue::String, text.mid(static_cast<int>(start) - 1, n));
+    }
+    case FnConcatenate: {
+        QString result;
+        for (int i=0; i<node.args.size(); ++i) {
+            QString text;
+            if (!textArg(node, i, &text, &error))
+                return error;
+            result.append(text);
+        }
+        return FormulaValue(FormulaValue::String, result);
+    }
+    case FnExact: {
+        QString a, b;
+        if (!textArg(node, 0, &a, &error) || !textArg(node, 1, &b, &error))
+            return error;
+        return FormulaValue::fromBool(a == b);
+    }
+    case FnVLookup:
+        return lookup(node, true);
+    case FnHLookup:
+        return lookup(node, false);
+    case FnIndex:
+        return index(node);
+    case FnMatch:
+        return match(node);
+    }
+    return FormulaValue::error("#NAME?");
+}
+
+static inline quint64 cellKey(int row, int column)
+{
+    return (quint64(row) << 16) | quint64(column);
+}
+
+static bool isFormulaCell(const QSharedPointer<Cell> &cell)
+{
+    return cell && (cell->dataType() == Cell::Formula || cell->dataType() == Cell::ArrayFormula)
+            && !cell->formula().isEmpty();
+}
+
+FormulaEngine::FormulaEngine(WorksheetPrivate *sheet)
+    : m_sheet(sheet), m_built(false), m_calculating(false), m_run(0)
+{
+}
+
+/*
+   Drops the dependency graph. It is built again, and all the formulas
+   are evaluated, by the next calculation.
+*/
+void FormulaEngine::invalidate()
+{
+    m_built = false;
+    m_cells.clear();
+    m_freeIds.clear();
+    m_cellIds.clear();
+    m_dependents.clear();
+    m_dirtyIds.clear();
+    m_externalIds.clear();
+    m_changedCells.clear();
+    m_astCache.clear();
+}
+
+QSharedPointer<Cell> FormulaEngine::cellAt(int row, int column) const
+{
+    XlsxCellTable::const_iterator it = m_sheet->cellTable.constFind(row);
+    if (it == m_sheet->cellTable.constEnd())
+        return QSharedPointer<Cell>();
+    return it.value().value(column);
+}
+
+QSharedPointer<const FormulaAst> FormulaEngine::compile(const QString &formula)
+{
+    QHash<QString, QSharedPointer<const FormulaAst> >::const_iterator it = m_astCache.constFind(formula);
+    if (it != m_astCache.constEnd())
+        return it.value();
+    QSharedPointer<const FormulaAst> ast = FormulaAst::parse(formula, m_sheet->name);
+    m_astCache.insert(formula, ast);
+    return ast;
+}
+
+void FormulaEngine::build()
+{
+    invalidate();
+    QHashIterator<int, XlsxCellRow> it(m_sheet->cellTable);
+    while (it.hasNext()) {
+        it.next();
+        QHashIterator<int, QSharedPointer<Cell> > it2(it.value());
+        while (it2.hasNext()) {
+            it2.next();
+            if (isFormulaCell(it2.value()))
+                addFormulaCell(it.key(), it2.key(), it2.value());
+        }
+    }
+    m_built = true;
+}
+
+void FormulaEngine::addFormulaCell(int row, int column, const QSharedPointer<Cell> &cell)
+{
+    int id;
+    if (!m_freeIds.isEmpty()) {
+        id = m_freeIds.last();
+        m_freeIds.removeLast();
+    } else {
+        id = m_cells.size();
+        m_cells.append(FormulaCell());
+    }
+    m_cells[id].row = row;
+    m_cells[id].column = column;
+    m_cells[id].dirty = false;
+    m_cellIds.insert(cellKey(row, column), id);
+    setFormulaCell(id, cell);
+}
+
+void FormulaEngine::setFormulaCell(int id, const QSharedPointer<Cell> &cell)
+{
+    FormulaCell &formulaCell = m_cells[id];
+    formulaCell.cell = cell;
+    formulaCell.ast = compile(cell->formula());
+    foreach (const CellRange &range, formulaCell.ast->precedents)
+        m_dependents.insert(range, id);
+    if (formulaCell.ast->hasExternalReferences)
+        m_externalIds.append(id);
+    markDirty(id);
+}
+
+/*
+   Detaches the formula cell \a id from the graph, its id can be reused.
+*/
+void FormulaEngine::removeFormulaCell(int id)
+{
+    FormulaCell &formulaCell = m_cells[id];
+    foreach (const CellRange &range, formulaCell.ast->precedents)
+        m_dependents.remove(range, id);
+    if (formulaCell.ast->hasExternalReferences)
+        m_externalIds.remove(m_externalIds.indexOf(id));
+    formulaCell.cell.clear();
+    formulaCell.ast.clear();
+}
+
+void FormulaEngine::markDirty(int id)
+{
+    if (!m_cells[id].dirty) {
+        m_cells[id].dirty = true;
+        m_dirtyIds.append(id);
+    }
+}
+
+/*
+   Called once the cell (\a row, \a column) has been written.
+*/
+void FormulaEngine::cellChanged(int row, int column)
+{
+    if (!m_built)
+        return;
+
+    QSharedPointer<Cell> cell = cellAt(row, column);
+    QHash<quint64, int>::iterator it = m_cellIds.find(cellKey(row, column));
+    if (it != m_cellIds.end()) {
+        int id = it.value();
+        removeFormulaCell(id);
+        if (isFormulaCell(cell)) {
+            setFormulaCell(id, cell);
+        } else {
+            m_cellIds.erase(it);
+            m_freeIds.append(id);
+        }
+    } else if (isFormulaCell(cell)) {
+        addFormulaCell(row, column, cell);
+    }
+    m_changedCells.append(QPoint(row, column));
+}
+
+void FormulaEngine::rangeChanged(const CellRange &range)
+{
+    if (!m_built)
+        return;
+    for (int row=range.firstRow(); row<=range.lastRow(); ++row) {
+        for (int col=range.firstColumn(); col<=range.lastColumn(); ++col)
+            cellChanged(row, col);
+    }
+}
+
+/*
+   Appends to \a levels the \a ids of the nodes reached from \a current,
+   level by level (Kahn's algorithm), ignoring the nodes marked in
+   \a skip. Returns the number of nodes added.
+*/
+static int appendLevels(const QVector<int> &ids, const QVector<QVector<int> > &successors,
+                        const QVector<bool> &skip, QVector<int> current, QVector<int> &inDegree,
+                        QVector<QVector<int> > &levels)
+{
+    int leveled = 0;
+    while (!current.isEmpty()) {
+        QVector<int> level;
+        QVector<int> next;
+        foreach (int i, current) {
+            level.append(ids[i]);
+            foreach (int j, successors[i]) {
+                if (!skip[j] && --inDegree[j] == 0)
+                    next.append(j);
+            }
+        }
+        leveled += level.size();
+        levels.append(level);
+        current = next;
+    }
+    return leveled;
+}
+
+/*
+   Returns which nodes of the graph \a successors are part of a cycle,
+   looking at the strongly connected components reached from \a roots
+   (Tarjan's algorithm, without recursion).
+*/
+static QVector<bool> cycleMembers(const QVector<QVector<int> > &successors, const QVector<int> &roots)
+{
+    const int size = successors.size();
+    QVector<bool> inCycle(size, false);
+    QVector<int> index(size, -1);
+    QVector<int> lowLink(size, 0);
+    QVector<bool> onStack(size, false);
+    QVector<int> stack;
+    QVector<QPair<int, int> > path; //node, next successor to visit
+    int counter = 0;
+
+    foreach (int root, roots) {
+        if (index[root] >= 0)
+            continue;
+        index[root] = lowLink[root] = counter++;
+        stack.append(root);
+        onStack[root] = true;
+        path.append(qMakePair(root, 0));
+
+        while (!path.isEmpty()) {
+            const int v = path.last().first;
+            if (path.last().second < successors[v].size()) {
+                const int w = successors[v][path.last().second++];
+                if (index[w] < 0) {
+                    index[w] = lowLink[w] = counter++;
+                    stack.append(w);
+                    onStack[w] = true;
+                    path.append(qMakePair(w, 0));
+                } else if (onStack[w]) {
+                    lowLink[v] = qMin(lowLink[v], index[w]);
+                }
+                continue;
+            }
+
+            path.removeLast();
+            if (!path.isEmpty())
+                lowLink[path.last().first] = qMin(lowLink[path.last().first], lowLink[v]);
+            if (lowLink[v] != index[v])
+                continue;
+
+            //v is the root of a component: a cycle if it has more than one
+            //node, or a node reading itself.
+            const bool cycle = stack.last() != v || successors[v].contains(v);
+            int w;
+            do {
+                w = stack.last();
+                stack.removeLast();
+                onStack[w] = false;
+                inCycle[w] = cycle;
+            } while (w != v);
+        }
+    }
+    return inCycle;
+}
+
+/*
+   Returns the formula cells to evaluate, grouped by level: the cells of
+   a level only read cells of the previous levels. Cells which are part
+   of a circular reference get 0, as in Excel.
+*/
+QVector<QVector<int> > FormulaEngine::dirtyLevels()
+{
+    QVector<int> ids;
+    QVector<int> local(m_cells.size(), -1);
+    QVector<QVector<int> > successors;
+
+    //Seeds: written formulas, formulas reading written cells, and
+    //formulas reading other sheets.
+    QVector<int> seeds = m_dirtyIds + m_externalIds;
+    foreach (const QPoint &pos, m_changedCells)
+        seeds += m_dependents.valuesAt(pos.x(), pos.y()).toVector();
+    foreach (int id, seeds) {
+        if (m_cells[id].cell && local[id] < 0) {
+            local[id] = ids.size();
+            ids.append(id);
+        }
+    }
+
+    //Everything depending on them, transitively
+    for (int i=0; i<ids.size(); ++i) {
+        const FormulaCell &formulaCell = m_cells[ids[i]];
+        QVector<int> next;
+        foreach (int id, m_dependents.valuesAt(formulaCell.row, formulaCell.column)) {
+            if (local[id] < 0) {
+                local[id] = ids.size();
+                ids.append(id);
+            }
+            next.append(local[id]);
+        }
+        successors.append(next);
+    }
+
+    QVector<int> inDegree(ids.size(), 0);
+    for (int i=0; i<successors.size(); ++i) {
+        foreach (int j, successors[i])
+            ++inDegree[j];
+    }
+
+    QVector<QVector<int> > levels;
+    QVector<int> current;
+    for (int i=0; i<ids.size(); ++i) {
+        if (inDegree[i] == 0)
+            current.append(i);
+    }
+    QVector<bool> inCycle(ids.size(), false);
+    int leveled = appendLevels(ids, successors, inCycle, current, inDegree, levels);
+
+    if (leveled < ids.size()) {
+        //Left are the cells of cycles and the cells reading them. Only
+        //the former get 0; the others are evaluated after them.
+        QVector<int> remaining;
+        for (int i=0; i<ids.size(); ++i) {
+            if (inDegree[i] > 0)
+                remaining.append(i);
+        }
+        inCycle = cycleMembers(successors, remaining);
+
+        current.clear();
+        foreach (int i, remaining) {
+            inDegree[i] = 0;
+            if (inCycle[i])
+                m_cells[ids[i]].cell->d_ptr->value = 0.0;
+        }
+        foreach (int i, remaining) {
+            if (inCycle[i])
+                continue;
+            foreach (int j, successors[i]) {
+                if (!inCycle[j])
+                    ++inDegree[j];
+            }
+        }
+        foreach (int i, remaining) {
+            if (!inCycle[i] && inDegree[i] == 0)
+                current.append(i);
+        }
+        appendLevels(ids, successors, inCycle, current, inDegree, levels);
+    }
+
+    foreach (int id, ids)
+        m_cells[id].dirty = false;
+    m_dirtyIds.clear();
+    m_changedCells.clear();
+    return levels;
+}
+
+void FormulaEngine::evaluateCell(int id) const
+{
+    const FormulaCell &formulaCell = m_cells.at(id);
+    FormulaEvaluator evaluator(m_sheet->q_ptr, formulaCell.ast.data());
+    formulaCell.cell->d_ptr->value = evaluator.evaluate().toVariant();
+}
+
+/*
+   Evaluates the cells [\a from, \a to) of \a level, stopping early if
+   the calculation is canceled.
+*/
+void FormulaEngine::evaluateLevel(const QVector<int> &level, int from, int to) const
+{
+    for (int i=from; i<to; i+=FormulaBatchSize) {
+        if (isCanceled())
+            return;
+        const int end = qMin(i + FormulaBatchSize, to);
+        for (int j=i; j<end; ++j)
+            evaluateCell(level.at(j));
+    }
+}
+
+bool FormulaEngine::isCanceled() const
+{
+    return m_sheet->calculationCanceled.load() == m_run;
+}
+
+/*
+   One worker of a parallel level. The workers take batches of the level
+   from a shared counter until none is left, so a worker which got cheap
+   formulas takes more batches.
+*/
+class FormulaLevelRunner : public QRunnable
+{
+public:
+    FormulaLevelRunner(const FormulaEngine *engine, const QVector<int> &level, QAtomicInt *next)
+        : m_engine(engine), m_level(level), m_next(next)
+    {
+    }
+
+    void run()
+    {
+        while (!m_engine->isCanceled()) {
+            int from = m_next->fetchAndAddRelaxed(FormulaBatchSize);
+            if (from >= m_level.size())
+                return;
+            m_engine->evaluateLevel(m_level, from, qMin(from + FormulaBatchSize, m_level.size()));
+        }
+    }
+
+private:
+    const FormulaEngine *m_engine;
+    const QVector<int> &m_level;
+    QAtomicInt *m_next;
+};
+
+/*
+   Evaluates the formulas affected by the changes since the previous
+   calculation, all of them the first time.
+
+   Levels with enough formulas are evaluated by the threads of a pool,
+   whose size is the calculation thread count of the sheet. Worksheet::
+   cancelCalculation() stops the evaluation between two batches; the
+   formulas which were not evaluated stay dirty for the next calculation.
+
+   Each calculation gets a number, and a cancel only applies to the
+   calculation which was running when it was issued, so a late cancel
+   never stops the next one.
+*/
+CalculationStatistics FormulaEngine::calculate()
+{
+    CalculationStatistics statistics;
+    if (m_calculating)
+        return statistics;
+    m_calculating = true;
+    m_run = m_sheet->calculationRun.fetchAndAddOrdered(1) + 1;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    if (!m_built)
+        build();
+
+    //Formulas reading other sheets get their current results
+    if (!m_externalIds.isEmpty()) {
+        Workbook *book = m_sheet->workbook;
+        for (int i=0; i<book->worksheetCount(); ++i) {
+            Worksheet *sheet = book->worksheet(i);
+            if (sheet != m_sheet->q_ptr && sheet->isCalculationEnabled())
+                sheet->calculate();
+        }
+    }
+
+    QVector<QVector<int> > levels = dirtyLevels();
+    statistics.levels = levels.size();
+    statistics.graphMsecs = timer.restart();
+
+    int threadCount = m_sheet->calculationThreadCount;
+    if (threadCount <= 0)
+        threadCount = QThread::idealThreadCount();
+    statistics.threads = qMax(threadCount, 1);
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(statistics.threads);
+    for (int i=0; i<levels.size(); ++i) {
+        const QVector<int> &level = levels[i];
+        if (isCanceled()) {
+            //Canceled before this level started
+        } else if (statistics.threads > 1 && level.size() >= FormulaParallelLevelSize) {
+            QAtomicInt next(0);
+            for (int j=0; j<statistics.threads; ++j)
+                pool.start(new FormulaLevelRunner(this, level, &next));
+            pool.waitForDone();
+        } else {
+            evaluateLevel(level, 0, level.size());
+        }
+
+        if (isCanceled()) {
+            //Some formulas of this level may be done, they are simply
+            //evaluated again.
+            for (int j=i; j<levels.size(); ++j) {
+                foreach (int id, levels[j])
+                    markDirty(id);
+            }
+            statistics.canceled = true;
+            break;
+        }
+        statistics.formulas += level.size();
+    }
+    statistics.evaluationMsecs = timer.elapsed();
+
+    m_calculating = false;
+    return statistics;
+}
+
+} // namespace QXlsx
@@ -0,0 +1,185 @@
+/****************************************************************************
+** Copyright (c) 2013-2014 Debao Zhang <hello@debao.me>
+** All right reserved.
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+** NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+** LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+** OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+** WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+****************************************************************************/
+#ifndef XLSXFORMULAENGINE_P_H
+#define XLSXFORMULAENGINE_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt Xlsx API.  It exists for the convenience
+// of the Qt Xlsx.  This header file may change from
+// version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include "xlsxglobal.h"
+#include "xlsxcellrange.h"
+#include "xlsxcellrangeindex_p.h"
+#include "xlsxcalculationstatistics.h"
+#include <QString>
+#include <QVariant>
+#include <QVector>
+#include <QHash>
+#include <QPoint>
+#include <QSharedPointer>
+
+namespace QXlsx {
+
+class Cell;
+class Worksheet;
+class WorksheetPrivate;
+class FormulaLevelRunner;
+
+struct FormulaValue
+{
+    enum Type {
+        Empty,
+        Number,
+        String,
+        Boolean,
+        Error
+    };
+
+    FormulaValue() : type(Empty), number(0) {}
+    FormulaValue(double number) : type(Number), number(number) {}
+    FormulaValue(Type type, const QString &text) : type(type), number(0), text(text) {}
+
+    static FormulaValue fromBool(bool value);
+    static FormulaValue fromCell(const Cell *cell);
+    static FormulaValue error(const char *text);
+    static bool isErrorText(const QString &text);
+    QVariant toVariant() const;
+
+    Type type;
+    double number; //Also used for Boolean
+    QString text; //String or Error
+};
+
+struct FormulaNode
+{
+    enum Type {
+        Constant,
+        Reference,
+        Unary,
+        Binary,
+        Percent,
+        Function,
+        Missing
+    };
+
+    FormulaNode(Type type=Missing) : type(type), op(0) {}
+
+    Type type;
+    int op; //Operator, or function id
+    FormulaValue value; //Constant
+    QString name; //Function name, or sheet name of a Reference
+    CellRange range; //Reference
+    QVector<int> args;
+};
+
+/*
+   A formula parsed once, shared by all the cells with the same text.
+   Nodes are stored in a vector, children before their parents.
+*/
+struct FormulaAst
+{
+    FormulaAst() : root(-1), hasExternalReferences(false) {}
+
+    static QSharedPointer<const FormulaAst> parse(const QString &formula, const QString &sheetName);
+
+    QVector<FormulaNode> nodes;
+    int root; //-1 if the formula can't be parsed
+    QList<CellRange> precedents; //Ranges of the own sheet read by the formula
+    bool hasExternalReferences; //Reads other sheets
+};
+
+/*
+   Evaluates the formulas of a worksheet and stores their results as the
+   cached values of the cells.
+
+   Formula cells are nodes of a dependency graph: the ranges each formula
+   reads are kept in a CellRangeIndex, so the formulas depending on a
+   changed cell are found without scanning the sheet. Only the formulas
+   affected by the changes reported since the previous calculation are
+   evaluated again, level by level of the graph. Formulas reading other
+   sheets are evaluated every time.
+
+   The formulas of a level don't read each other, so large levels are
+   split in batches evaluated by a thread pool.
+*/
+class FormulaEngine
+{
+public:
+    explicit FormulaEngine(WorksheetPrivate *sheet);
+
+    void invalidate();
+    void cellChanged(int row, int column);
+    void rangeChanged(const CellRange &range);
+    CalculationStatistics calculate();
+    bool isCalculating() const { return m_calculating; }
+
+private:
+    struct FormulaCell
+    {
+        int row;
+        int column;
+        QSharedPointer<Cell> cell; //Null once removed
+        QSharedPointer<const FormulaAst> ast;
+        bool dirty;
+    };
+
+    void build();
+    QSharedPointer<Cell> cellAt(int row, int column) const;
+    QSharedPointer<const FormulaAst> compile(const QString &formula);
+    void addFormulaCell(int row, int column, const QSharedPointer<Cell> &cell);
+    void setFormulaCell(int id, const QSharedPointer<Cell> &cell);
+    void removeFormulaCell(int id);
+    void markDirty(int id);
+    friend class FormulaLevelRunner;
+
+    QVector<QVector<int> > dirtyLevels();
+    void evaluateCell(int id) const;
+    void evaluateLevel(const QVector<int> &level, int from, int to) const;
+    bool isCanceled() const;
+
+    WorksheetPrivate *m_sheet;
+    bool m_built;
+    bool m_calculating;
+    int m_run; //Number of the running calculation
+    QVector<FormulaCell> m_cells;
+    QVector<int> m_freeIds;
+    QHash<quint64, int> m_cellIds; //Position to index in m_cells
+    CellRangeIndex m_dependents; //Precedent ranges to index in m_cells
+    QVector<int> m_dirtyIds;
+    QVector<int> m_externalIds;
+    QVector<QPoint> m_changedCells;
+    QHash<QString, QSharedPointer<const FormulaAst> > m_astCache;
+};
+
+} // namespace QXlsx
+
+#endif // XLSXFORMULAENGINE_P_H
@@ -0,0 +1,256 @@
+/****************************************************************************
+** Copyright (c) 2013-2014 Debao Zhang <hello@debao.me>
+** All right reserved.
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+** NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+** LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+** OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+** WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+****************************************************************************/
+#include "xlsxloadoptions.h"
+#include "xlsxloadoptions_p.h"
+
+namespace QXlsx {
+
+LoadOptionsPrivate::LoadOptionsPrivate()
+    :profile(LoadOptions::FullLoad)
+{
+
+}
+
+LoadOptionsPrivate::LoadOptionsPrivate(const LoadOptionsPrivate &other)
+    :QSharedData(other)
+    , profile(other.profile), sheetNames(other.sheetNames), range(other.range), columns(other.columns)
+    , columnMask(other.columnMask)
+{
+
+}
+
+LoadOptionsPrivate::~LoadOptionsPrivate()
+{
+
+}
+
+/*!
+ * \class LoadOptions
+ * \brief Restricts which parts of a workbook are loaded
+ * \inmodule QtXlsx
+ *
+ * By default everything in the workbook is loaded. Jobs which only
+ * need a few sheets, a range or a set of columns can use the load
+ * options to keep the rest of the workbook out of memory:
+ *
+ * \code
+ * LoadOptions options;
+ * options.setSheetNames(QStringList() << "Data");
+ * options.setColumns(1, 6); // A to F
+ * Document xlsx("big.xlsx", options);
+ * \endcode
+ *
+ * Cells outside the selection are skipped while the sheet is parsed,
+ * they are never materialized.
+ */
+
+/*!
+ * \enum LoadOptions::LoadProfile
+ *
+ * The enum type defines how much of the workbook is loaded.
+ *
+ * \value FullLoad everything is loaded, which is the default.
+ * \value ValuesOnly only the cell values are loaded. Of the styles only
+ *        the number formats are kept, which is enough to recognize dates.
+ *        Fonts, fills, borders, the theme, conditional formatting, data
+ *        validation, hyperlinks, column info and row info are skipped.
+ *        A document loaded this way is read only: saving it would
+ *        write a workbook without what was skipped, so Document::save()
+ *        and Document::saveAs() refuse to and return false.
+ */
+
+/*!
+    Construct load options which select the whole workbook.
+*/
+LoadOptions::LoadOptions()
+    :d(new LoadOptionsPrivate())
+{
+
+}
+
+/*!
+    Constructs a copy of \a other.
+*/
+LoadOptions::LoadOptions(const LoadOptions &other)
+    :d(other.d)
+{
+
+}
+
+/*!
+    Assigns \a other to this options and returns a reference to this options.
+ */
+LoadOptions &LoadOptions::operator=(const LoadOptions &other)
+{
+    this->d = other.d;
+    return *this;
+}
+
+/*!
+ * Destroy the object.
+ */
+LoadOptions::~LoadOptions()
+{
+}
+
+/*!
+    Returns the names of the sheets to be loaded, empty means all sheets.
+*/
+QStringList LoadOptions::sheetNames() const
+{
+    return d->sheetNames;
+}
+
+/*!
+    Only the sheets named \a sheetNames will be loaded.
+    An empty list loads all the sheets.
+*/
+void LoadOptions::setSheetNames(const QStringList &sheetNames)
+{
+    d->sheetNames = sheetNames;
+}
+
+/*!
+    Returns the cell range to be loaded, an invalid range means
+    no restriction.
+*/
+CellRange LoadOptions::range() const
+{
+    return d->range;
+}
+
+/*!
+    Only the cells inside \a range will be loaded.
+*/
+void LoadOptions::setRange(const CellRange &range)
+{
+    d->range = range;
+}
+
+/*!
+    \overload
+    Only the cells inside \a range, such as "A1:F1000", will be loaded.
+*/
+void LoadOptions::setRange(const QString &range)
+{
+    d->range = CellRange(range);
+}
+
+/*!
+    Returns the columns to be loaded, empty means all columns.
+*/
+QList<int> LoadOptions::columns() const
+{
+    return d->columns;
+}
+
+/*!
+    Only the cells in the given \a columns will be loaded.
+    An empty list loads all the columns.
+*/
+void LoadOptions::setColumns(const QList<int> &columns)
+{
+    d->columns = columns;
+    int maxColumn = 0;
+    foreach (int col, columns)
+        maxColumn = qMax(maxColumn, col);
+    d->columnMask = QBitArray(columns.isEmpty() ? 0 : maxColumn + 1);
+    foreach (int col, columns) {
+        if (col > 0)
+            d->columnMask.setBit(col);
+    }
+}
+
+/*!
+    \overload
+    Only the cells from \a firstColumn to \a lastColumn will be loaded.
+*/
+void LoadOptions::setColumns(int firstColumn, int lastColumn)
+{
+    QList<int> columns;
+    for (int col=firstColumn; col<=lastColumn; ++col)
+        columns.append(col);
+    setColumns(columns);
+}
+
+/*!
+    Returns the load profile, the default is FullLoad.
+*/
+LoadOptions::LoadProfile LoadOptions::profile() const
+{
+    return d->profile;
+}
+
+/*!
+    Sets the load \a profile.
+*/
+void LoadOptions::setProfile(LoadProfile profile)
+{
+    d->profile = profile;
+}
+
+/*!
+    Returns whether the sheet named \a sheetName will be loaded.
+*/
+bool LoadOptions::isSheetSelected(const QString &sheetName) const
+{
+    return d->sheetNames.isEmpty() || d->sheetNames.contains(sheetName);
+}
+
+/*!
+    Returns whether any cell of the \a row will be loaded.
+*/
+bool LoadOptions::isRowSelected(int row) const
+{
+    if (!d->range.isValid())
+        return true;
+    return row >= d->range.firstRow() && row <= d->range.lastRow();
+}
+
+/*!
+    Returns whether the cell at (\a row, \a column) will be loaded.
+*/
+bool LoadOptions::isCellSelected(int row, int column) const
+{
+    if (d->range.isValid()) {
+        if (row < d->range.firstRow() || row > d->range.lastRow()
+                || column < d->range.firstColumn() || column > d->range.lastColumn())
+            return false;
+    }
+    if (!d->columns.isEmpty())
+        return column >= 0 && column < d->columnMask.size() && d->columnMask.testBit(column);
+    return true;
+}
+
+/*!
+    Returns true if only part of the cells will be loaded, because of
+    a range or a column selection.
+*/
+bool LoadOptions::hasCellSelection() const
+{
+    return d->range.isValid() || !d->columns.isEmpty();
+}
+
+} // namespace QXlsx
@@ -0,0 +1,76 @@
+/****************************************************************************
+** Copyright (c) 2013-2014 Debao Zhang <hello@debao.me>
+** All right reserved.
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+** NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+** LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+** OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+** WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+****************************************************************************/
+
+#ifndef QXLSX_XLSXLOADOPTIONS_H
+#define QXLSX_XLSXLOADOPTIONS_H
+
+#include "xlsxglobal.h"
+#include <QSharedDataPointer>
+#include <QStringList>
+#include <QList>
+
+namespace QXlsx {
+
+class CellRange;
+
+class LoadOptionsPrivate;
+class LoadOptions
+{
+public:
+    enum LoadProfile {
+        FullLoad,
+        ValuesOnly
+    };
+
+    LoadOptions();
+    LoadOptions(const LoadOptions &other);
+    ~LoadOptions();
+
+    QStringList sheetNames() const;
+    void setSheetNames(const QStringList &sheetNames);
+    CellRange range() const;
+    void setRange(const CellRange &range);
+    void setRange(const QString &range);
+    QList<int> columns() const;
+    void setColumns(const QList<int> &columns);
+    void setColumns(int firstColumn, int lastColumn);
+
+    LoadProfile profile() const;
+    void setProfile(LoadProfile profile);
+
+    bool isSheetSelected(const QString &sheetName) const;
+    bool isRowSelected(int row) const;
+    bool isCellSelected(int row, int column) const;
+    bool hasCellSelection() const;
+
+    LoadOptions &operator=(const LoadOptions &other);
+
+private:
+    QSharedDataPointer<LoadOptionsPrivate> d;
+};
+
+} // namespace QXlsx
+
+#endif // QXLSX_XLSXLOADOPTIONS_H
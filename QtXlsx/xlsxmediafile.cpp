@@ -0,0 +1,166 @@
+/****************************************************************************
+** Copyright (c) 2013-2014 Debao Zhang <hello@debao.me>
+** All right reserved.
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+** NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+** LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+** OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+** WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+****************************************************************************/
+#include "xlsxmediafile_p.h"
+#include <QBuffer>
+#include <QImageReader>
+#include <QCryptographicHash>
+#include <QThreadPool>
+#include <QRunnable>
+
+namespace QXlsx {
+
+MediaFile::MediaFile()
+    : m_imageCacheKey(0)
+{
+}
+
+MediaFile::MediaFile(const QImage &image)
+    : m_image(image), m_suffix(QStringLiteral("png")), m_size(image.size())
+    , m_imageCacheKey(image.cacheKey())
+{
+}
+
+/*
+   Creates a media file from png or jpeg \a data, which is stored as is.
+   Only the header of the image is read, to get its size.
+
+   Returns a null pointer if the format is not supported.
+*/
+QSharedPointer<MediaFile> MediaFile::fromEncodedData(const QByteArray &data)
+{
+    QByteArray bytes(data);
+    QBuffer buffer(&bytes);
+    buffer.open(QIODevice::ReadOnly);
+    QImageReader reader(&buffer);
+
+    QString suffix;
+    QByteArray format = reader.format();
+    if (format == "png")
+        suffix = QStringLiteral("png");
+    else if (format == "jpeg" || format == "jpg")
+        suffix = QStringLiteral("jpeg");
+    else
+        return QSharedPointer<MediaFile>();
+
+    QSize size = reader.size();
+    if (!size.isValid())
+        return QSharedPointer<MediaFile>();
+
+    QSharedPointer<MediaFile> file(new MediaFile);
+    file->m_contents = data;
+    file->m_hashKey = QCryptographicHash::hash(data, QCryptographicHash::Sha1);
+    file->m_suffix = suffix;
+    file->m_size = size;
+    return file;
+}
+
+bool MediaFile::isEncoded() const
+{
+    return !m_hashKey.isEmpty();
+}
+
+/*
+   Returns the cache key of the image the file was made from, or 0.
+*/
+qint64 MediaFile::imageCacheKey() const
+{
+    return m_imageCacheKey;
+}
+
+QByteArray MediaFile::contents() const
+{
+    return m_contents;
+}
+
+QByteArray MediaFile::hashKey() const
+{
+    return m_hashKey;
+}
+
+QString MediaFile::suffix() const
+{
+    return m_suffix;
+}
+
+QSize MediaFile::size() const
+{
+    return m_size;
+}
+
+void MediaFile::encode()
+{
+    if (isEncoded())
+        return;
+
+    QBuffer buffer(&m_contents);
+    buffer.open(QIODevice::WriteOnly);
+    m_image.save(&buffer, "png");
+    m_hashKey = QCryptographicHash::hash(m_contents, QCryptographicHash::Sha1);
+    m_image = QImage();
+}
+
+class MediaFileEncoder : public QRunnable
+{
+public:
+    MediaFileEncoder(MediaFile *file)
+        : m_file(file)
+    {
+    }
+
+    void run()
+    {
+        m_file->encode();
+    }
+
+private:
+    MediaFile *m_file;
+};
+
+/*
+   Encodes the \a files which are not encoded yet, in parallel.
+   The files must be distinct.
+*/
+void MediaFile::encode(const QList<QSharedPointer<MediaFile> > &files)
+{
+    QList<MediaFile *> pending;
+    foreach (QSharedPointer<MediaFile> file, files) {
+        if (!file->isEncoded())
+            pending.append(file.data());
+    }
+
+    if (pending.isEmpty())
+        return;
+    if (pending.size() == 1) {
+        pending.first()->encode();
+        return;
+    }
+
+    QThreadPool pool;
+    foreach (MediaFile *file, pending)
+        pool.start(new MediaFileEncoder(file));
+    pool.waitForDone();
+}
+
+} // namespace QXlsx
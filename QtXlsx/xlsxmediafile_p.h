@@ -0,0 +1,88 @@
+/****************************************************************************
+** Copyright (c) 2013-2014 Debao Zhang <hello@debao.me>
+** All right reserved.
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+** NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+** LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+** OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+** WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+****************************************************************************/
+#ifndef XLSXMEDIAFILE_P_H
+#define XLSXMEDIAFILE_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt Xlsx API.  It exists for the convenience
+// of the Qt Xlsx.  This header file may change from
+// version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include "xlsxglobal.h"
+#include <QImage>
+#include <QByteArray>
+#include <QString>
+#include <QSize>
+#include <QList>
+#include <QSharedPointer>
+
+namespace QXlsx {
+
+/*
+   An image file of the xl/media folder.
+
+   It is made either from a QImage, encoded to png when the package is
+   saved, or from bytes which are already encoded. Encoded bytes and
+   their hash are kept, so the image is encoded once however many times
+   the document is saved, and files with the same contents can be
+   written once.
+*/
+class MediaFile
+{
+public:
+    MediaFile(const QImage &image);
+    static QSharedPointer<MediaFile> fromEncodedData(const QByteArray &data);
+
+    bool isEncoded() const;
+    qint64 imageCacheKey() const;
+    QByteArray contents() const;
+    QByteArray hashKey() const;
+    QString suffix() const;
+    QSize size() const;
+
+    static void encode(const QList<QSharedPointer<MediaFile> > &files);
+
+private:
+    friend class MediaFileEncoder;
+    MediaFile();
+    void encode();
+
+    QImage m_image; //Released once encoded
+    QByteArray m_contents;
+    QByteArray m_hashKey;
+    QString m_suffix;
+    QSize m_size;
+    qint64 m_imageCacheKey;
+};
+
+} // namespace QXlsx
+
+#endif // XLSXMEDIAFILE_P_H
@@ -0,0 +1,121 @@
+/****************************************************************************
+** Copyright (c) 2013-2014 Debao Zhang <hello@debao.me>
+** All right reserved.
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+** NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+** LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+** OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+** WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+****************************************************************************/
+#include "xlsxpixelsizeindex_p.h"
+#include <QtAlgorithms>
+
+namespace QXlsx {
+
+PixelSizeIndex::PixelSizeIndex(int defaultSize, int lastIndex)
+    : m_defaultSize(defaultSize), m_lastIndex(lastIndex), m_dirty(false)
+{
+    m_deltaSums.append(0);
+}
+
+/*
+   Removes all the sizes and uses \a defaultSize for every index.
+*/
+void PixelSizeIndex::clear(int defaultSize)
+{
+    m_sizes.clear();
+    m_defaultSize = defaultSize;
+    m_dirty = true;
+}
+
+void PixelSizeIndex::setSize(int index, int size)
+{
+    if (size == m_defaultSize)
+        m_sizes.remove(index);
+    else
+        m_sizes[index] = size;
+    m_dirty = true;
+}
+
+int PixelSizeIndex::size(int index) const
+{
+    return m_sizes.value(index, m_defaultSize);
+}
+
+/*
+   Returns the sum of the sizes of the indexes before \a index.
+*/
+qint64 PixelSizeIndex::position(int index) const
+{
+    update();
+    int before = qLowerBound(m_indexes.constBegin(), m_indexes.constEnd(), index) - m_indexes.constBegin();
+    return qint64(index - 1) * m_defaultSize + m_deltaSums[before];
+}
+
+/*
+   Returns the first index, not before \a from, which is reached at the
+   distance \a offset from the start of \a from, and makes \a offset
+   relative to the start of that index.
+
+   Same as stepping over the indexes while the offset is greater than
+   their size.
+*/
+int PixelSizeIndex::indexAt(int from, double *offset) const
+{
+    qint64 start = position(from);
+
+    //Gallop to a range which contains the result, then bisect it.
+    int first = from;
+    int last = from;
+    int step = 1;
+    while (last < m_lastIndex && position(last + 1) - start < *offset) {
+        first = last + 1;
+        last = qMin(last + step, m_lastIndex);
+        step *= 2;
+    }
+    while (first < last) {
+        int middle = first + (last - first) / 2;
+        if (position(middle + 1) - start < *offset)
+            first = middle + 1;
+        else
+            last = middle;
+    }
+
+    *offset -= position(first) - start;
+    return first;
+}
+
+void PixelSizeIndex::update() const
+{
+    if (!m_dirty)
+        return;
+
+    m_indexes.clear();
+    m_indexes.reserve(m_sizes.size());
+    m_deltaSums.clear();
+    m_deltaSums.reserve(m_sizes.size() + 1);
+    m_deltaSums.append(0);
+    QMap<int, int>::const_iterator it = m_sizes.constBegin();
+    for (; it != m_sizes.constEnd(); ++it) {
+        m_indexes.append(it.key());
+        m_deltaSums.append(m_deltaSums.last() + it.value() - m_defaultSize);
+    }
+    m_dirty = false;
+}
+
+} // namespace QXlsx
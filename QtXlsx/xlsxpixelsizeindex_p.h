@@ -0,0 +1,78 @@
+/****************************************************************************
+** Copyright (c) 2013-2014 Debao Zhang <hello@debao.me>
+** All right reserved.
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+** NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+** LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+** OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+** WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+****************************************************************************/
+#ifndef XLSXPIXELSIZEINDEX_P_H
+#define XLSXPIXELSIZEINDEX_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt Xlsx API.  It exists for the convenience
+// of the Qt Xlsx.  This header file may change from
+// version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include "xlsxglobal.h"
+#include <QMap>
+#include <QVector>
+
+namespace QXlsx {
+
+/*
+   Pixel sizes of the rows or columns of a sheet, indexed from 1.
+
+   Most rows and columns have the default size, so only the others are
+   stored, together with the running sum of their differences from the
+   default. The position of an index, and the index found at a distance
+   from another one, are then binary searches instead of walks over every
+   row or column before them.
+*/
+class PixelSizeIndex
+{
+public:
+    PixelSizeIndex(int defaultSize, int lastIndex);
+
+    void clear(int defaultSize);
+    void setSize(int index, int size);
+    int size(int index) const;
+    qint64 position(int index) const;
+    int indexAt(int from, double *offset) const;
+
+private:
+    void update() const;
+
+    QMap<int, int> m_sizes;
+    int m_defaultSize;
+    int m_lastIndex;
+    mutable QVector<int> m_indexes; //keys of m_sizes
+    mutable QVector<qint64> m_deltaSums; //differences before m_indexes[i]
+    mutable bool m_dirty;
+};
+
+} // namespace QXlsx
+
+#endif // XLSXPIXELSIZEINDEX_P_H
@@ -0,0 +1,212 @@
+/****************************************************************************
+** Copyright (c) 2013-2014 Debao Zhang <hello@debao.me>
+** All right reserved.
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+** NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+** LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+** OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+** WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+****************************************************************************/
+#include "xlsxrowsorter_p.h"
+
+#include <QHash>
+#include <QStringList>
+#include <QThreadPool>
+#include <QRunnable>
+#include <algorithm>
+
+namespace QXlsx {
+
+static const int ParallelSortSize = 65536; //Smaller ranges are sorted by one thread
+
+struct RowLessThan
+{
+    explicit RowLessThan(const RowSorter *sorter) : sorter(sorter) {}
+    bool operator()(int a, int b) const { return sorter->lessThan(a, b); }
+    const RowSorter *sorter;
+};
+
+static bool localeAwareLessThan(const QString &a, const QString &b)
+{
+    return QString::localeAwareCompare(a, b) < 0;
+}
+
+/*
+   Sorts a part of the rows, or merges two sorted neighbouring parts.
+*/
+class RowSortRunner : public QRunnable
+{
+public:
+    RowSortRunner(const RowSorter *sorter, int *begin, int *middle, int *end)
+        : m_sorter(sorter), m_begin(begin), m_middle(middle), m_end(end)
+    {
+    }
+
+    void run()
+    {
+        if (m_middle)
+            m_sorter->mergeRows(m_begin, m_middle, m_end);
+        else
+            m_sorter->sortRows(m_begin, m_end);
+    }
+
+private:
+    const RowSorter *m_sorter;
+    int *m_begin;
+    int *m_middle;
+    int *m_end;
+};
+
+/*
+   Constructs a sorter of \a rowCount rows whose keys are all empty. There
+   is one key per entry of \a descending.
+*/
+RowSorter::RowSorter(int rowCount, const QVector<bool> &descending)
+    : m_rowCount(rowCount), m_descending(descending)
+    , m_keys(rowCount * descending.size())
+{
+}
+
+void RowSorter::setNumber(int row, int key, double value)
+{
+    m_keys[row * m_descending.size() + key] = RowSortKey(RowSortKey::Number, value);
+}
+
+/*
+   The rank of \a text among the strings is only known once all the keys
+   are set, see resolveStrings().
+*/
+void RowSorter::setString(int row, int key, const QString &text)
+{
+    PendingString pending;
+    pending.slot = row * m_descending.size() + key;
+    pending.text = text;
+    m_strings.append(pending);
+    m_keys[pending.slot] = RowSortKey(RowSortKey::String, 0);
+}
+
+void RowSorter::setBoolean(int row, int key, bool value)
+{
+    m_keys[row * m_descending.size() + key] = RowSortKey(RowSortKey::Boolean, value ? 1 : 0);
+}
+
+void RowSorter::setError(int row, int key)
+{
+    m_keys[row * m_descending.size() + key] = RowSortKey(RowSortKey::Error, 0);
+}
+
+/*
+   Replaces the strings by their ordinals. The distinct strings are
+   collated once, case insensitively, and strings which collate equal
+   share their ordinal; comparing rows then only compares numbers.
+*/
+void RowSorter::resolveStrings()
+{
+    QHash<QString, int> ordinals;
+    QStringList texts;
+    for (int i=0; i<m_strings.size(); ++i) {
+        m_strings[i].text = m_strings[i].text.toCaseFolded();
+        if (!ordinals.contains(m_strings[i].text)) {
+            ordinals.insert(m_strings[i].text, 0);
+            texts.append(m_strings[i].text);
+        }
+    }
+
+    std::sort(texts.begin(), texts.end(), localeAwareLessThan);
+    int ordinal = 0;
+    for (int i=0; i<texts.size(); ++i) {
+        if (i > 0 && QString::localeAwareCompare(texts[i-1], texts[i]) != 0)
+            ++ordinal;
+        ordinals[texts[i]] = ordinal;
+    }
+
+    foreach (const PendingString &pending, m_strings)
+        m_keys[pending.slot].value = ordinals.value(pending.text);
+    m_strings.clear();
+}
+
+bool RowSorter::lessThan(int a, int b) const
+{
+    const int keyCount = m_descending.size();
+    const RowSortKey *keyA = m_keys.constData() + a * keyCount;
+    const RowSortKey *keyB = m_keys.constData() + b * keyCount;
+    for (int i=0; i<keyCount; ++i) {
+        const RowSortKey &x = keyA[i];
+        const RowSortKey &y = keyB[i];
+        if (x.type == RowSortKey::Empty || y.type == RowSortKey::Empty) {
+            if (x.type == y.type)
+                continue;
+            return y.type == RowSortKey::Empty;
+        }
+        if (x.type != y.type)
+            return (x.type < y.type) != m_descending[i];
+        if (x.value != y.value)
+            return (x.value < y.value) != m_descending[i];
+    }
+    return false;
+}
+
+void RowSorter::sortRows(int *begin, int *end) const
+{
+    std::stable_sort(begin, end, RowLessThan(this));
+}
+
+void RowSorter::mergeRows(int *begin, int *middle, int *end) const
+{
+    std::inplace_merge(begin, middle, end, RowLessThan(this));
+}
+
+/*
+   Returns the rows in sorted order: the row which goes to the position i
+   is at the index i of the result.
+
+   Large ranges are cut in \a threadCount parts sorted in parallel, then
+   merged pairwise, the merges of a round running in parallel too.
+*/
+QVector<int> RowSorter::sort(int threadCount)
+{
+    resolveStrings();
+
+    QVector<int> order(m_rowCount);
+    for (int i=0; i<m_rowCount; ++i)
+        order[i] = i;
+    int *data = order.data();
+
+    if (threadCount <= 1 || m_rowCount < ParallelSortSize) {
+        sortRows(data, data + m_rowCount);
+        return order;
+    }
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(threadCount);
+    const int partSize = (m_rowCount + threadCount - 1) / threadCount;
+    for (int start=0; start<m_rowCount; start+=partSize)
+        pool.start(new RowSortRunner(this, data + start, 0, data + qMin(start + partSize, m_rowCount)));
+    pool.waitForDone();
+
+    for (int width=partSize; width<m_rowCount; width*=2) {
+        for (int start=0; start+width<m_rowCount; start+=2*width) {
+            pool.start(new RowSortRunner(this, data + start, data + start + width,
+                                         data + qMin(start + 2 * width, m_rowCount)));
+        }
+        pool.waitForDone();
+    }
+    return order;
+}
+
+} // namespace QXlsx
@@ -0,0 +1,109 @@
+/****************************************************************************
+** Copyright (c) 2013-2014 Debao Zhang <hello@debao.me>
+** All right reserved.
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+** NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+** LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+** OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+** WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+****************************************************************************/
+#ifndef XLSXROWSORTER_P_H
+#define XLSXROWSORTER_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt Xlsx API.  It exists for the convenience
+// of the Qt Xlsx.  This header file may change from
+// version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include "xlsxglobal.h"
+#include <QVector>
+#include <QString>
+
+namespace QXlsx {
+
+class Cell;
+class RowSortRunner;
+
+/*
+   Sort key of one cell, compared without looking at the cell again.
+   Strings are replaced by their rank in the collated list of the
+   distinct strings of the key columns.
+*/
+struct RowSortKey
+{
+    enum Type {
+        Number,
+        String,
+        Boolean,
+        Error,
+        Empty
+    };
+
+    RowSortKey() : type(Empty), value(0) {}
+    RowSortKey(Type type, double value) : type(type), value(value) {}
+
+    Type type;
+    double value;
+};
+
+/*
+   Orders the rows of a range by their keys, the way Excel does: numbers,
+   then text, booleans and errors, reversed for descending keys. Empty
+   keys always go last. The sort is stable.
+*/
+class RowSorter
+{
+public:
+    RowSorter(int rowCount, const QVector<bool> &descending);
+
+    void setNumber(int row, int key, double value);
+    void setString(int row, int key, const QString &text);
+    void setBoolean(int row, int key, bool value);
+    void setError(int row, int key);
+
+    QVector<int> sort(int threadCount);
+    bool lessThan(int a, int b) const;
+
+private:
+    friend class RowSortRunner;
+
+    void resolveStrings();
+    void sortRows(int *begin, int *end) const;
+    void mergeRows(int *begin, int *middle, int *end) const;
+
+    struct PendingString
+    {
+        int slot;
+        QString text;
+    };
+
+    int m_rowCount;
+    QVector<bool> m_descending;
+    QVector<RowSortKey> m_keys; //m_rowCount rows of m_descending.size() keys
+    QVector<PendingString> m_strings;
+};
+
+} // namespace QXlsx
+
+#endif // XLSXROWSORTER_P_H
@@ -31,7 +31,6 @@
 #include <QXmlStreamReader>
 #include <QDir>
 #include <QFile>
-#include <QRegularExpression>
 #include <QDebug>
 #include <QBuffer>
 
@@ -47,6 +46,15 @@ int SharedStrings::count() const
     return m_stringCount;
 }
 
+/*
+   Reserves room for \a count unique strings.
+*/
+void SharedStrings::reserve(int count)
+{
+    m_stringTable.reserve(count);
+    m_stringList.reserve(count);
+}
+
 bool SharedStrings::isEmpty() const
 {
     return m_stringList.isEmpty();
@@ -107,6 +115,31 @@ void SharedStrings::removeSharedString(const RichString &string)
     }
 }
 
+/*
+   Moves \a count references from \a before to \a after. When they are
+   all the references of \a before and \a after is a new string, the
+   string is changed in place and keeps its index.
+*/
+void SharedStrings::replaceSharedString(const RichString &before, const RichString &after, int count)
+{
+    if (before == after)
+        return;
+
+    QHash<RichString, XlsxSharedStringInfo>::iterator it = m_stringTable.find(before);
+    if (it != m_stringTable.end() && it.value().count <= count && !m_stringTable.contains(after)) {
+        XlsxSharedStringInfo item = it.value();
+        m_stringTable.erase(it);
+        m_stringTable.insert(after, item);
+        m_stringList[item.index] = after;
+        return;
+    }
+
+    for (int i=0; i<count; ++i) {
+        removeSharedString(before);
+        addSharedString(after);
+    }
+}
+
 int SharedStrings::getSharedStringIndex(const QString &string) const
 {
     return getSharedStringIndex(RichString(string));
@@ -216,11 +249,9 @@ void SharedStrings::saveToXmlFile(QIODevice *device) const
                     writer.writeEndElement();// rPr
                 }
                 writer.writeStartElement(QStringLiteral("t"));
-                if (string.fragmentText(i).contains(QRegularExpression(QStringLiteral("^\\s")))
-                        || string.fragmentText(i).contains(QRegularExpression(QStringLiteral("\\s$")))) {
+                if (xl_needs_space_preserve(string.fragmentText(i)))
                     writer.writeAttribute(QStringLiteral("xml:space"), QStringLiteral("preserve"));
-                }
-                writer.writeCharacters(string.fragmentText(i));
+                xl_write_characters(writer, string.fragmentText(i));
                 writer.writeEndElement();// t
 
                 writer.writeEndElement(); //r
@@ -228,11 +259,9 @@ void SharedStrings::saveToXmlFile(QIODevice *device) const
         } else {
             writer.writeStartElement(QStringLiteral("t"));
             QString pString = string.toPlainString();
-            if (pString.contains(QRegularExpression(QStringLiteral("^\\s")))
-                    || pString.contains(QRegularExpression(QStringLiteral("\\s$")))) {
+            if (xl_needs_space_preserve(pString))
                 writer.writeAttribute(QStringLiteral("xml:space"), QStringLiteral("preserve"));
-            }
-            writer.writeCharacters(pString);
+            xl_write_characters(writer, pString);
             writer.writeEndElement();//t
         }
         writer.writeEndElement();//si
@@ -285,7 +314,7 @@ void SharedStrings::readRichStringPart(QXmlStreamReader &reader, RichString &ric
             if (reader.name() == QLatin1String("rPr")) {
                 format = readRichStringPart_rPr(reader);
             } else if (reader.name() == QLatin1String("t")) {
-                text = reader.readElementText();
+                text = xl_unescape_characters(reader.readElementText());
             }
         }
     }
@@ -298,7 +327,7 @@ void SharedStrings::readPlainStringPart(QXmlStreamReader &reader, RichString &ri
 
     //QXmlStreamAttributes attributes = reader.attributes();
 
-    QString text = reader.readElementText();
+    QString text = xl_unescape_characters(reader.readElementText());
     richString.addFragment(text, Format());
 }
 
@@ -370,6 +399,9 @@ bool SharedStrings::loadFromXmlFile(QIODevice *device)
              if (reader.name() == QLatin1String("sst")) {
                  QXmlStreamAttributes attributes = reader.attributes();
                  count = attributes.value(QLatin1String("uniqueCount")).toString().toInt();
+                 //Don't trust uniqueCount beyond what the part can hold, <si/> being 5 bytes.
+                 if (count > 0 && device->size() > 0)
+                     reserve(static_cast<int>(qMin(qint64(count), device->size() / 5)));
              } else if (reader.name() == QLatin1String("si")) {
                  readString(reader);
              }
@@ -65,6 +65,7 @@ class  SharedStrings
 public:
     SharedStrings();
     int count() const;
+    void reserve(int count);
     bool isEmpty() const;
     
     int addSharedString(const QString &string);
@@ -72,6 +73,7 @@ public:
     void removeSharedString(const QString &string);
     void removeSharedString(const RichString &string);
     void incRefByStringIndex(int idx);
+    void replaceSharedString(const RichString &before, const RichString &after, int count);
 
     int getSharedStringIndex(const QString &string) const;
     int getSharedStringIndex(const RichString &string) const;
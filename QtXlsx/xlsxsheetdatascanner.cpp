@@ -0,0 +1,385 @@
+/****************************************************************************
+** Copyright (c) 2013-2014 Debao Zhang <hello@debao.me>
+** All right reserved.
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+** NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+** LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+** OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+** WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+****************************************************************************/
+#include "xlsxsheetdatascanner_p.h"
+#include "xlsxsimd_p.h"
+#include "xlsxutility_p.h"
+#include <string.h>
+
+namespace QXlsx {
+
+static inline bool isXmlSpace(char ch)
+{
+    return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r';
+}
+
+static inline bool nameEquals(const char *name, int length, const char *expected)
+{
+    for (int i=0; i<length; ++i) {
+        if (name[i] != expected[i])
+            return false;
+    }
+    return expected[length] == '\0';
+}
+
+static void appendUtf8(QByteArray &out, uint codePoint)
+{
+    if (codePoint < 0x80) {
+        out.append(static_cast<char>(codePoint));
+    } else if (codePoint < 0x800) {
+        out.append(static_cast<char>(0xc0 | (codePoint >> 6)));
+        out.append(static_cast<char>(0x80 | (codePoint & 0x3f)));
+    } else if (codePoint < 0x10000) {
+        out.append(static_cast<char>(0xe0 | (codePoint >> 12)));
+        out.append(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3f)));
+        out.append(static_cast<char>(0x80 | (codePoint & 0x3f)));
+    } else {
+        out.append(static_cast<char>(0xf0 | (codePoint >> 18)));
+        out.append(static_cast<char>(0x80 | ((codePoint >> 12) & 0x3f)));
+        out.append(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3f)));
+        out.append(static_cast<char>(0x80 | (codePoint & 0x3f)));
+    }
+}
+
+/*
+   Appends the character referenced by the entity [\a begin, \a end),
+   the part between '&' and ';'. Returns false for unknown entities.
+*/
+static bool appendEntity(QByteArray &out, const char *begin, const char *end)
+{
+    int length = end - begin;
+    if (nameEquals(begin, length, "lt")) {
+        out.append('<');
+    } else if (nameEquals(begin, length, "gt")) {
+        out.append('>');
+    } else if (nameEquals(begin, length, "amp")) {
+        out.append('&');
+    } else if (nameEquals(begin, length, "quot")) {
+        out.append('"');
+    } else if (nameEquals(begin, length, "apos")) {
+        out.append('\'');
+    } else if (length > 1 && begin[0] == '#') {
+        bool hex = begin[1] == 'x';
+        const char *p = begin + (hex ? 2 : 1);
+        if (p == end)
+            return false;
+        uint codePoint = 0;
+        for (; p < end; ++p) {
+            uint digit;
+            if (*p >= '0' && *p <= '9')
+                digit = *p - '0';
+            else if (hex && *p >= 'a' && *p <= 'f')
+                digit = *p - 'a' + 10;
+            else if (hex && *p >= 'A' && *p <= 'F')
+                digit = *p - 'A' + 10;
+            else
+                return false;
+            codePoint = codePoint * (hex ? 16 : 10) + digit;
+            if (codePoint > 0x10ffff)
+                return false;
+        }
+        if (codePoint == 0 || (codePoint >= 0xd800 && codePoint <= 0xdfff))
+            return false;
+        appendUtf8(out, codePoint);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+SheetDataScanner::SheetDataScanner(const char *begin, const char *end) :
+    m_pos(begin), m_end(end), m_tokenType(NoToken), m_pendingEnd(NoToken)
+  , m_text(0), m_textLength(0)
+{
+}
+
+/*
+   Reads the next token. The attributes of RowStart and CellStart tokens
+   are only valid until the next call.
+*/
+SheetDataScanner::TokenType SheetDataScanner::readNext()
+{
+    if (m_tokenType == Invalid || m_tokenType == EndOfData)
+        return m_tokenType;
+
+    m_attributes.clear();
+    if (m_pendingEnd != NoToken) {
+        //End of a self-closing <row/> or <c/>
+        m_tokenType = m_pendingEnd;
+        m_pendingEnd = NoToken;
+        return m_tokenType;
+    }
+
+    while (true) {
+        const char *lt = xlsxFindByte(m_pos, m_end, '<');
+        for (const char *p = m_pos; p < lt; ++p) {
+            if (!isXmlSpace(*p))
+                return m_tokenType = Invalid; //Mixed content
+        }
+        m_pos = lt;
+        if (m_pos == m_end)
+            return m_tokenType = EndOfData;
+        if (m_end - m_pos < 2)
+            return m_tokenType = Invalid;
+
+        if (m_pos[1] == '/') {
+            const char *gt = xlsxFindByte(m_pos, m_end, '>');
+            if (gt == m_end)
+                return m_tokenType = Invalid;
+            const char *name = m_pos + 2;
+            int nameLength = gt - name;
+            while (nameLength > 0 && isXmlSpace(name[nameLength-1]))
+                --nameLength;
+            m_pos = gt + 1;
+            if (nameEquals(name, nameLength, "row"))
+                return m_tokenType = RowEnd;
+            if (nameEquals(name, nameLength, "c"))
+                return m_tokenType = CellEnd;
+            if (nameEquals(name, nameLength, "is"))
+                continue;
+            return m_tokenType = Invalid;
+        }
+
+        const char *name;
+        int nameLength;
+        bool selfClosing;
+        if (!readStartTag(&name, &nameLength, &selfClosing))
+            return m_tokenType = Invalid;
+
+        if (nameEquals(name, nameLength, "row")) {
+            if (selfClosing)
+                m_pendingEnd = RowEnd;
+            return m_tokenType = RowStart;
+        } else if (nameEquals(name, nameLength, "c")) {
+            if (selfClosing)
+                m_pendingEnd = CellEnd;
+            return m_tokenType = CellStart;
+        } else if (nameEquals(name, nameLength, "v")) {
+            return readElementText(ValueText, selfClosing, name, nameLength);
+        } else if (nameEquals(name, nameLength, "f")) {
+            //Its attributes, such as t="shared", are left to the caller.
+            return readElementText(FormulaText, selfClosing, name, nameLength);
+        } else if (nameEquals(name, nameLength, "t")) {
+            return readElementText(InlineStringText, selfClosing, name, nameLength);
+        } else if (nameEquals(name, nameLength, "is") && !selfClosing) {
+            continue;
+        }
+        return m_tokenType = Invalid;
+    }
+}
+
+/*
+   Reads the start tag at the current position and its attributes.
+*/
+bool SheetDataScanner::readStartTag(const char **name, int *nameLength, bool *selfClosing)
+{
+    const char *p = m_pos + 1;
+    if (*p == '!' || *p == '?')
+        return false; //Comments, CDATA and processing instructions
+    *name = p;
+    while (p < m_end && !isXmlSpace(*p) && *p != '>' && *p != '/')
+        ++p;
+    *nameLength = p - *name;
+    if (*nameLength == 0)
+        return false;
+
+    while (true) {
+        while (p < m_end && isXmlSpace(*p))
+            ++p;
+        if (p >= m_end)
+            return false;
+        if (*p == '>') {
+            *selfClosing = false;
+            m_pos = p + 1;
+            return true;
+        }
+        if (*p == '/') {
+            if (p + 1 >= m_end || p[1] != '>')
+                return false;
+            *selfClosing = true;
+            m_pos = p + 2;
+            return true;
+        }
+
+        Attribute attr;
+        attr.name = p;
+        while (p < m_end && *p != '=' && !isXmlSpace(*p) && *p != '>' && *p != '/')
+            ++p;
+        attr.nameLength = p - attr.name;
+        while (p < m_end && isXmlSpace(*p))
+            ++p;
+        if (attr.nameLength == 0 || p >= m_end || *p != '=')
+            return false;
+        ++p;
+        while (p < m_end && isXmlSpace(*p))
+            ++p;
+        if (p >= m_end || (*p != '"' && *p != '\''))
+            return false;
+        const char quote = *p++;
+        const char *valueEnd = xlsxFindByte(p, m_end, quote);
+        if (valueEnd == m_end)
+            return false;
+        attr.value = p;
+        attr.valueLength = valueEnd - p;
+        m_attributes.append(attr);
+        p = valueEnd + 1;
+    }
+}
+
+/*
+   Reads the end tag of the element \a name at the current position.
+*/
+bool SheetDataScanner::readEndTag(const char *name, int nameLength)
+{
+    const char *p = m_pos;
+    if (m_end - p < nameLength + 3 || p[1] != '/' || memcmp(p + 2, name, nameLength) != 0)
+        return false;
+    p += 2 + nameLength;
+    while (p < m_end && isXmlSpace(*p))
+        ++p;
+    if (p >= m_end || *p != '>')
+        return false;
+    m_pos = p + 1;
+    return true;
+}
+
+SheetDataScanner::TokenType SheetDataScanner::readElementText(TokenType type, bool selfClosing, const char *name, int nameLength)
+{
+    m_text = m_pos;
+    m_textLength = 0;
+    if (!selfClosing) {
+        const char *lt = xlsxFindByte(m_pos, m_end, '<');
+        if (lt == m_end)
+            return m_tokenType = Invalid;
+        m_textLength = lt - m_pos;
+        m_pos = lt;
+        //Nested elements and CDATA sections end up here too.
+        if (!readEndTag(name, nameLength))
+            return m_tokenType = Invalid;
+    }
+    return m_tokenType = type;
+}
+
+const SheetDataScanner::Attribute *SheetDataScanner::findAttribute(const char *name) const
+{
+    for (int i=0; i<m_attributes.size(); ++i) {
+        if (nameEquals(m_attributes[i].name, m_attributes[i].nameLength, name))
+            return &m_attributes[i];
+    }
+    return 0;
+}
+
+bool SheetDataScanner::hasAttribute(const char *name) const
+{
+    return findAttribute(name) != 0;
+}
+
+/*
+   Returns the raw value of the attribute \a name. The returned array
+   refers to the scanned data.
+*/
+QByteArray SheetDataScanner::attribute(const char *name) const
+{
+    const Attribute *attr = findAttribute(name);
+    if (!attr)
+        return QByteArray();
+    return QByteArray::fromRawData(attr->value, attr->valueLength);
+}
+
+bool SheetDataScanner::attributeEquals(const char *name, const char *value) const
+{
+    const Attribute *attr = findAttribute(name);
+    return attr && nameEquals(attr->value, attr->valueLength, value);
+}
+
+int SheetDataScanner::intAttribute(const char *name, int defaultValue) const
+{
+    const Attribute *attr = findAttribute(name);
+    if (!attr || attr->valueLength == 0)
+        return defaultValue;
+
+    const char *p = attr->value;
+    const char *end = p + attr->valueLength;
+    bool negative = *p == '-';
+    if (negative)
+        ++p;
+    qint64 value = 0;
+    for (; p < end; ++p) {
+        uint digit = static_cast<uchar>(*p) - '0';
+        if (digit > 9 || value > 0x7fffffff)
+            return defaultValue;
+        value = value * 10 + digit;
+    }
+    if (value > 0x7fffffff)
+        return defaultValue;
+    return static_cast<int>(negative ? -value : value);
+}
+
+/*
+   Returns the text of the current ValueText, FormulaText or
+   InlineStringText token, with entities and line ends resolved.
+   \a ok is set to false if the text contains an unknown entity.
+*/
+QString SheetDataScanner::text(bool *ok) const
+{
+    if (ok)
+        *ok = true;
+    const char *p = m_text;
+    const char *end = m_text + m_textLength;
+    if (xlsxFindByte(p, end, '&') == end && xlsxFindByte(p, end, '\r') == end)
+        return QString::fromUtf8(p, m_textLength);
+
+    QByteArray decoded;
+    decoded.reserve(m_textLength);
+    while (p < end) {
+        if (*p == '\r') {
+            decoded.append('\n');
+            ++p;
+            if (p < end && *p == '\n')
+                ++p;
+        } else if (*p == '&') {
+            const char *semicolon = xlsxFindByte(p, end, ';');
+            if (semicolon == end || !appendEntity(decoded, p + 1, semicolon)) {
+                if (ok)
+                    *ok = false;
+                return QString();
+            }
+            p = semicolon + 1;
+        } else {
+            decoded.append(*p++);
+        }
+    }
+    return QString::fromUtf8(decoded);
+}
+
+/*
+   Returns the text of the current token parsed as a number, without
+   building a QString first. Cell values never contain entities.
+*/
+double SheetDataScanner::number(bool *ok) const
+{
+    return xl_string_to_double(m_text, m_textLength, ok);
+}
+
+} // namespace QXlsx
@@ -0,0 +1,108 @@
+/****************************************************************************
+** Copyright (c) 2013-2014 Debao Zhang <hello@debao.me>
+** All right reserved.
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+** NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+** LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+** OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+** WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+****************************************************************************/
+
+#ifndef XLSXSHEETDATASCANNER_P_H
+#define XLSXSHEETDATASCANNER_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt Xlsx API.  It exists for the convenience
+// of the Qt Xlsx.  This header file may change from
+// version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include "xlsxglobal.h"
+#include <QByteArray>
+#include <QString>
+#include <QVarLengthArray>
+
+namespace QXlsx {
+
+/*
+   Scanner for the UTF-8 content of a <sheetData> element. It only knows
+   the handful of elements found there: <row>, <c>, <v>, <f>, <is> and
+   <t>. Anything else, such as comments or rich inline strings, makes it
+   report Invalid, in which case the caller is expected to parse the
+   sheet with QXmlStreamReader instead.
+*/
+class SheetDataScanner
+{
+public:
+    enum TokenType {
+        NoToken,
+        RowStart,
+        RowEnd,
+        CellStart,
+        CellEnd,
+        ValueText,
+        FormulaText,
+        InlineStringText,
+        EndOfData,
+        Invalid
+    };
+
+    SheetDataScanner(const char *begin, const char *end);
+
+    TokenType readNext();
+    TokenType tokenType() const { return m_tokenType; }
+
+    bool hasAttribute(const char *name) const;
+    QByteArray attribute(const char *name) const;
+    bool attributeEquals(const char *name, const char *value) const;
+    int intAttribute(const char *name, int defaultValue=0) const;
+    QString text(bool *ok=0) const;
+    double number(bool *ok=0) const;
+    bool isTextEmpty() const { return m_textLength == 0; }
+
+private:
+    struct Attribute
+    {
+        const char *name;
+        int nameLength;
+        const char *value;
+        int valueLength;
+    };
+
+    const Attribute *findAttribute(const char *name) const;
+    bool readStartTag(const char **name, int *nameLength, bool *selfClosing);
+    bool readEndTag(const char *name, int nameLength);
+    TokenType readElementText(TokenType type, bool selfClosing, const char *name, int nameLength);
+
+    const char *m_pos;
+    const char *m_end;
+    TokenType m_tokenType;
+    TokenType m_pendingEnd;
+    QVarLengthArray<Attribute, 16> m_attributes;
+    const char *m_text;
+    int m_textLength;
+};
+
+} // namespace QXlsx
+
+#endif // XLSXSHEETDATASCANNER_P_H
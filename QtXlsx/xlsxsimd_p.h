@@ -0,0 +1,207 @@
+/****************************************************************************
+** Copyright (c) 2013-2014 Debao Zhang <hello@debao.me>
+** All right reserved.
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+** NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+** LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+** OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+** WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+****************************************************************************/
+
+#ifndef XLSXSIMD_P_H
+#define XLSXSIMD_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt Xlsx API.  It exists for the convenience
+// of the Qt Xlsx.  This header file may change from
+// version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include "xlsxglobal.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define QXLSX_HAVE_SSE2
+#  include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#  include <intrin.h>
+#endif
+
+namespace QXlsx {
+
+/*
+   Index of the lowest set bit of \a mask, which must not be 0.
+*/
+static inline int xlsxLowestBit(uint mask)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return static_cast<int>(index);
+#elif defined(__GNUC__)
+    return __builtin_ctz(mask);
+#else
+    int index = 0;
+    while (!(mask & 1)) {
+        mask >>= 1;
+        ++index;
+    }
+    return index;
+#endif
+}
+
+/*
+   Returns the first occurrence of \a ch in [\a begin, \a end), or \a end.
+   Sixteen bytes are compared at once when SSE2 is available.
+*/
+static inline const char *xlsxFindByte(const char *begin, const char *end, char ch)
+{
+    const char *p = begin;
+#ifdef QXLSX_HAVE_SSE2
+    const __m128i needle = _mm_set1_epi8(ch);
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        uint mask = static_cast<uint>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle)));
+        if (mask)
+            return p + xlsxLowestBit(mask);
+        p += 16;
+    }
+#endif
+    while (p < end && *p != ch)
+        ++p;
+    return p;
+}
+
+/*
+   Returns the sum of the \a count values at \a data. Two values are
+   added at once when SSE2 is available.
+*/
+static inline double xlsxSum(const double *data, int count)
+{
+    int i = 0;
+    double sum = 0;
+#ifdef QXLSX_HAVE_SSE2
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    for (; i + 4 <= count; i += 4) {
+        acc0 = _mm_add_pd(acc0, _mm_loadu_pd(data + i));
+        acc1 = _mm_add_pd(acc1, _mm_loadu_pd(data + i + 2));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+    sum = lanes[0] + lanes[1];
+#endif
+    for (; i < count; ++i)
+        sum += data[i];
+    return sum;
+}
+
+/*
+   Returns the sum of the squared differences between the \a count values
+   at \a data and \a mean.
+*/
+static inline double xlsxSumOfSquares(const double *data, int count, double mean)
+{
+    int i = 0;
+    double sum = 0;
+#ifdef QXLSX_HAVE_SSE2
+    const __m128d m = _mm_set1_pd(mean);
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    for (; i + 4 <= count; i += 4) {
+        __m128d d0 = _mm_sub_pd(_mm_loadu_pd(data + i), m);
+        __m128d d1 = _mm_sub_pd(_mm_loadu_pd(data + i + 2), m);
+        acc0 = _mm_add_pd(acc0, _mm_mul_pd(d0, d0));
+        acc1 = _mm_add_pd(acc1, _mm_mul_pd(d1, d1));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+    sum = lanes[0] + lanes[1];
+#endif
+    for (; i < count; ++i)
+        sum += (data[i] - mean) * (data[i] - mean);
+    return sum;
+}
+
+/*
+   Sets \a min and \a max to the smallest and the largest of the \a count
+   values at \a data, which must not be 0. The values must not be NaN.
+*/
+static inline void xlsxMinMax(const double *data, int count, double *min, double *max)
+{
+    int i = 0;
+    double lo = data[0];
+    double hi = data[0];
+#ifdef QXLSX_HAVE_SSE2
+    if (count >= 2) {
+        __m128d vlo = _mm_loadu_pd(data);
+        __m128d vhi = vlo;
+        for (i = 2; i + 2 <= count; i += 2) {
+            __m128d v = _mm_loadu_pd(data + i);
+            vlo = _mm_min_pd(vlo, v);
+            vhi = _mm_max_pd(vhi, v);
+        }
+        double lanes[2];
+        _mm_storeu_pd(lanes, vlo);
+        lo = qMin(lanes[0], lanes[1]);
+        _mm_storeu_pd(lanes, vhi);
+        hi = qMax(lanes[0], lanes[1]);
+    }
+#endif
+    for (; i < count; ++i) {
+        lo = qMin(lo, data[i]);
+        hi = qMax(hi, data[i]);
+    }
+    *min = lo;
+    *max = hi;
+}
+
+/*
+   Returns how many of the \a count values at \a data are between \a lower
+   and \a upper, inclusive.
+*/
+static inline int xlsxCountBetween(const double *data, int count, double lower, double upper)
+{
+    int i = 0;
+    int result = 0;
+#ifdef QXLSX_HAVE_SSE2
+    const __m128d lo = _mm_set1_pd(lower);
+    const __m128d hi = _mm_set1_pd(upper);
+    for (; i + 2 <= count; i += 2) {
+        __m128d v = _mm_loadu_pd(data + i);
+        __m128d inside = _mm_and_pd(_mm_cmpge_pd(v, lo), _mm_cmple_pd(v, hi));
+        int mask = _mm_movemask_pd(inside);
+        result += (mask & 1) + (mask >> 1);
+    }
+#endif
+    for (; i < count; ++i) {
+        if (data[i] >= lower && data[i] <= upper)
+            ++result;
+    }
+    return result;
+}
+
+} // namespace QXlsx
+
+#endif // XLSXSIMD_P_H
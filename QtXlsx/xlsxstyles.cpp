@@ -42,7 +42,7 @@ namespace QXlsx {
 
 */
 Styles::Styles(bool createEmpty)
-    : m_nextCustomNumFmtId(176), m_emptyFormatAdded(false)
+    : m_nextCustomNumFmtId(176), m_emptyFormatAdded(false), m_numberFormatsOnly(false)
 {
     //!Fix me. Should the custom num fmt Id starts with 164 or 176 or others??
 
@@ -63,6 +63,16 @@ Styles::~Styles()
 {
 }
 
+/*
+   When enabled, only the number formats of styles.xml are loaded. The
+   xf formats then carry nothing but their number format, which is
+   still enough to tell dates apart from plain numbers.
+*/
+void Styles::setNumberFormatsOnly(bool enable)
+{
+    m_numberFormatsOnly = enable;
+}
+
 Format Styles::xfFormat(int idx) const
 {
     if (idx <0 || idx >= m_xf_formatsList.size())
@@ -1042,6 +1052,11 @@ bool Styles::readCellXfs(QXmlStreamReader &reader)
                         format.setNumberFormat(numFmtIndex, m_customNumFmtIdMap[numFmtIndex]->formatString);
                 }
 
+                if (m_numberFormatsOnly) {
+                    addXfFormat(format, true);
+                    continue;
+                }
+
                 if (xfAttrs.hasAttribute(QLatin1String("applyFont"))) {
                     int fontIndex = xfAttrs.value(QLatin1String("fontId")).toString().toInt();
                     if (fontIndex >= m_fontsList.size()) {
@@ -1231,7 +1246,11 @@ bool Styles::loadFromXmlFile(QIODevice *device)
     while (!reader.atEnd()) {
         QXmlStreamReader::TokenType token = reader.readNext();
         if (token == QXmlStreamReader::StartElement) {
-            if (reader.name() == QLatin1String("numFmts")) {
+            if (m_numberFormatsOnly && reader.name() != QLatin1String("styleSheet")
+                    && reader.name() != QLatin1String("numFmts")
+                    && reader.name() != QLatin1String("cellXfs")) {
+                reader.skipCurrentElement();
+            } else if (reader.name() == QLatin1String("numFmts")) {
                 readNumFmts(reader);
             } else if (reader.name() == QLatin1String("fonts")) {
                 readFonts(reader);
@@ -80,6 +80,8 @@ public:
 
     QColor getColorByIndex(int idx);
 
+    void setNumberFormatsOnly(bool enable);
+
 private:
     friend class Format;
     friend class ::StylesTest;
@@ -132,6 +134,7 @@ private:
     QHash<QByteArray, Format> m_dxf_formatsHash;
 
     bool m_emptyFormatAdded;
+    bool m_numberFormatsOnly;
 };
 
 }
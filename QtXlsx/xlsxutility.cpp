@@ -23,15 +23,25 @@
 **
 ****************************************************************************/
 #include "xlsxutility_p.h"
+#include "xlsxsimd_p.h"
+#include "xlsxcellrange.h"
 
 #include <QString>
 #include <QPoint>
-#include <QRegularExpression>
 #include <QMap>
 #include <QStringList>
 #include <QColor>
 #include <QDateTime>
 #include <QDebug>
+#include <QIODevice>
+#include <QTextCodec>
+#include <QXmlStreamWriter>
+#include <QVector>
+#include <QPair>
+#include <QtAlgorithms>
+#include <limits.h>
+#include <algorithm>
+#include <string.h>
 
 namespace QXlsx {
 
@@ -98,25 +108,243 @@ QDateTime datetimeFromNumber(double num, bool is1904)
 
 QPoint xl_cell_to_rowcol(const QString &cell_str)
 {
-    if (cell_str.isEmpty())
+    return xl_cell_to_rowcol(QStringRef(&cell_str));
+}
+
+/*
+   Parses "A1" notation, 1 to 3 column letters followed by the row number,
+   without any allocation. This is called for every cell when loading.
+*/
+template <typename T>
+static QPoint cellToRowCol(const T *data, int size)
+{
+    int i = 0;
+    int col = 0;
+    for (; i < size && i < 3; ++i) {
+        ushort ch = static_cast<ushort>(data[i]);
+        if (ch < 'A' || ch > 'Z')
+            break;
+        col = col * 26 + (ch - 'A' + 1);
+    }
+    if (i == 0 || i == size)
         return QPoint(-1, -1);
-    QRegularExpression re(QStringLiteral("^([A-Z]{1,3})(\\d+)$"));
-    QRegularExpressionMatch match = re.match(cell_str);
-    if (match.hasMatch()) {
-        QString col_str = match.captured(1);
-        QString row_str = match.captured(2);
-        int col = 0;
-        int expn = 0;
-        for (int i=col_str.size()-1; i>-1; --i) {
-            col += (col_str[i].unicode() - 'A' + 1) * intPow(26, expn);
-            expn++;
+
+    int row = 0;
+    for (; i < size; ++i) {
+        ushort digit = static_cast<ushort>(data[i]) - '0';
+        if (digit > 9 || row > 100000000)
+            return QPoint(-1, -1);
+        row = row * 10 + digit;
+    }
+    return QPoint(row, col);
+}
+
+QPoint xl_cell_to_rowcol(const QStringRef &cell_str)
+{
+    return cellToRowCol(reinterpret_cast<const ushort *>(cell_str.unicode()), cell_str.size());
+}
+
+QPoint xl_cell_to_rowcol(const char *cell_str, int size)
+{
+    return cellToRowCol(reinterpret_cast<const uchar *>(cell_str), size);
+}
+
+/*
+   Parses a decimal integer, with an optional sign, without any allocation.
+   Returns 0 and sets \a ok to false if \a str is not a valid integer.
+*/
+int xl_string_to_int(const QStringRef &str, bool *ok)
+{
+    const QChar *data = str.constData();
+    const int size = str.size();
+
+    int i = 0;
+    bool negative = false;
+    if (size > 0 && (data[0] == QLatin1Char('-') || data[0] == QLatin1Char('+'))) {
+        negative = data[0] == QLatin1Char('-');
+        ++i;
+    }
+
+    qint64 value = 0;
+    bool valid = i < size;
+    for (; valid && i < size; ++i) {
+        ushort digit = data[i].unicode() - '0';
+        value = value * 10 + digit;
+        valid = digit <= 9 && value <= Q_INT64_C(2147483648);
+    }
+    if (negative)
+        value = -value;
+    valid = valid && value >= INT_MIN && value <= INT_MAX;
+
+    if (ok)
+        *ok = valid;
+    return valid ? static_cast<int>(value) : 0;
+}
+
+/*
+   Powers of ten which are exactly representable as double.
+*/
+static const double exactPowersOfTen[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline bool isXmlSpace(ushort ch)
+{
+    return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r';
+}
+
+/*
+   Parses the decimal number in [\a begin, \a end), as written by Excel:
+   an optional sign, digits with an optional fraction and an optional
+   exponent such as "1.5E-3" or "2E+20".
+
+   Numbers with no more than 19 significant digits are collected into an
+   integer. When that integer and the power of ten are both exact doubles
+   the result is a single correctly rounded multiplication or division
+   (Clinger's fast path), and integers need no floating point operation
+   at all. Anything else sets \a needFallback.
+*/
+template <typename T>
+static bool parseDouble(const T *begin, const T *end, double *result, bool *needFallback)
+{
+    *needFallback = false;
+    while (begin < end && isXmlSpace(static_cast<ushort>(*begin)))
+        ++begin;
+    while (end > begin && isXmlSpace(static_cast<ushort>(end[-1])))
+        --end;
+
+    const T *p = begin;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        ++p;
+    }
+
+    quint64 mantissa = 0;
+    int digitCount = 0;
+    int exponent = 0;
+    bool hasDigits = false;
+    bool truncated = false;
+
+    for (; p < end; ++p) {
+        ushort digit = static_cast<ushort>(*p) - '0';
+        if (digit > 9)
+            break;
+        hasDigits = true;
+        if (mantissa == 0 && digit == 0)
+            continue; //leading zero
+        if (digitCount < 19) {
+            mantissa = mantissa * 10 + digit;
+            ++digitCount;
+        } else {
+            ++exponent;
+            truncated = truncated || digit;
         }
+    }
+    if (p < end && *p == '.') {
+        for (++p; p < end; ++p) {
+            ushort digit = static_cast<ushort>(*p) - '0';
+            if (digit > 9)
+                break;
+            hasDigits = true;
+            if (digitCount < 19) {
+                if (mantissa != 0 || digit != 0) {
+                    mantissa = mantissa * 10 + digit;
+                    ++digitCount;
+                }
+                --exponent;
+            } else {
+                truncated = truncated || digit;
+            }
+        }
+    }
+    if (!hasDigits)
+        return false;
 
-        int row = row_str.toInt();
-        return QPoint(row, col);
-    } else {
-        return QPoint(-1, -1); //...
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        ++p;
+        bool negativeExponent = false;
+        if (p < end && (*p == '-' || *p == '+')) {
+            negativeExponent = *p == '-';
+            ++p;
+        }
+        if (p == end)
+            return false;
+        int value = 0;
+        for (; p < end; ++p) {
+            ushort digit = static_cast<ushort>(*p) - '0';
+            if (digit > 9)
+                return false;
+            if (value < 100000)
+                value = value * 10 + digit;
+        }
+        exponent += negativeExponent ? -value : value;
+    }
+    if (p != end)
+        return false;
+
+    if (!truncated && mantissa <= (Q_UINT64_C(1) << 53)) {
+        double value = static_cast<double>(mantissa);
+        if (mantissa == 0 || exponent == 0) {
+            *result = negative ? -value : value;
+            return true;
+        } else if (exponent > 0 && exponent <= 22) {
+            value *= exactPowersOfTen[exponent];
+            *result = negative ? -value : value;
+            return true;
+        } else if (exponent < 0 && exponent >= -22) {
+            value /= exactPowersOfTen[-exponent];
+            *result = negative ? -value : value;
+            return true;
+        }
+    }
+
+    *needFallback = true;
+    return true;
+}
+
+/*
+   Locale independent replacement of QString::toDouble() for the numbers
+   stored in cell values. Returns 0 and sets \a ok to false if \a str is
+   not a number.
+*/
+double xl_string_to_double(const QString &str, bool *ok)
+{
+    const ushort *data = str.utf16();
+    double value = 0;
+    bool needFallback;
+    bool valid = parseDouble(data, data + str.size(), &value, &needFallback);
+    if (valid && needFallback) {
+        //Already known to be plain ASCII here.
+        char buffer[64];
+        if (str.size() < int(sizeof(buffer))) {
+            for (int i=0; i<str.size(); ++i)
+                buffer[i] = static_cast<char>(data[i]);
+            value = QByteArray::fromRawData(buffer, str.size()).trimmed().toDouble(&valid);
+        } else {
+            value = str.toLatin1().trimmed().toDouble(&valid);
+        }
     }
+    if (ok)
+        *ok = valid;
+    return valid ? value : 0;
+}
+
+/*
+   \overload
+   Parses \a size bytes of \a str in place.
+*/
+double xl_string_to_double(const char *str, int size, bool *ok)
+{
+    double value = 0;
+    bool needFallback;
+    bool valid = parseDouble(str, str + size, &value, &needFallback);
+    if (valid && needFallback)
+        value = QByteArray::fromRawData(str, size).trimmed().toDouble(&valid);
+    if (ok)
+        *ok = valid;
+    return valid ? value : 0;
 }
 
 QString xl_col_to_name(int col_num)
@@ -137,19 +365,17 @@ QString xl_col_to_name(int col_num)
 
 int xl_col_name_to_value(const QString &col_str)
 {
-    QRegularExpression re(QStringLiteral("^([A-Z]{1,3})$"));
-    QRegularExpressionMatch match = re.match(col_str);
-    if (match.hasMatch()) {
-        int col = 0;
-        int expn = 0;
-        for (int i=col_str.size()-1; i>-1; --i) {
-            col += (col_str[i].unicode() - 'A' + 1) * intPow(26, expn);
-            expn++;
-        }
+    if (col_str.isEmpty() || col_str.size() > 3)
+        return -1;
 
-        return col;
+    int col = 0;
+    for (int i=0; i<col_str.size(); ++i) {
+        ushort ch = col_str[i].unicode();
+        if (ch < 'A' || ch > 'Z')
+            return -1;
+        col = col * 26 + (ch - 'A' + 1);
     }
-    return -1;
+    return col;
 }
 
 QString xl_rowcol_to_cell(int row, int col, bool row_abs, bool col_abs)
@@ -177,4 +403,722 @@ QString xl_rowcol_to_cell_fast(int row, int col)
     return col_str + QString::number(row);
 }
 
+static inline bool isFormulaNameChar(ushort ch)
+{
+    return (ch >= 'A' && ch <= 'Z') || (ch >= 'a' && ch <= 'z') || (ch >= '0' && ch <= '9')
+            || ch == '_' || ch == '.' || ch == '$' || ch == '\\' || ch > 0x7f;
+}
+
+/*
+   Parses the A1 reference \a token, such as "B2", "$B$2", "B" or "$2".
+   \a row is 0 for a whole column and \a col is 0 for a whole row.
+   Returns false if \a token is not a reference.
+*/
+static bool parseReferenceToken(const QChar *token, int size, int *row, int *col, bool *rowAbs, bool *colAbs)
+{
+    int i = 0;
+    *colAbs = i < size && token[i] == QLatin1Char('$');
+    if (*colAbs)
+        ++i;
+    *col = 0;
+    int letters = 0;
+    for (; i < size && letters <= 3; ++i, ++letters) {
+        ushort ch = token[i].unicode();
+        if (ch >= 'a' && ch <= 'z')
+            ch -= 'a' - 'A';
+        if (ch < 'A' || ch > 'Z')
+            break;
+        *col = *col * 26 + (ch - 'A' + 1);
+    }
+    *rowAbs = i < size && token[i] == QLatin1Char('$');
+    if (*rowAbs)
+        ++i;
+    *row = 0;
+    int digits = 0;
+    for (; i < size && digits <= 7; ++i, ++digits) {
+        ushort digit = token[i].unicode() - '0';
+        if (digit > 9)
+            break;
+        *row = *row * 10 + digit;
+    }
+    //1048576 rows and 16384 columns, otherwise it is a name
+    if ((letters == 0 && digits == 0) || letters > 3 || i != size
+            || (digits && *row < 1) || *row > 1048576 || *col > 16384) {
+        return false;
+    }
+    if (digits == 0 && *rowAbs)
+        return false;
+    if (letters == 0) {
+        //The '$' of "$2" belongs to the row
+        if (*colAbs && *rowAbs)
+            return false;
+        *rowAbs = *colAbs;
+        *colAbs = false;
+    }
+    return true;
+}
+
+static QString referenceToken(int row, int col, bool rowAbs, bool colAbs)
+{
+    if (row == 0)
+        return (colAbs ? QStringLiteral("$") : QString()) + xl_col_to_name(col);
+    if (col == 0)
+        return (rowAbs ? QStringLiteral("$") : QString()) + QString::number(row);
+    return xl_rowcol_to_cell(row, col, rowAbs, colAbs);
+}
+
+/*
+   Moves the relative parts of the reference (\a row, \a col) by
+   \a rowOffset rows and \a columnOffset columns. A row or a column of 0,
+   as in a whole column or a whole row, stays 0. Returns false if the
+   reference leaves the sheet.
+*/
+static bool shiftReference(int *row, int *col, bool rowAbs, bool colAbs, int rowOffset, int columnOffset)
+{
+    if (*row != 0) {
+        if (!rowAbs)
+            *row += rowOffset;
+        if (*row < 1 || *row > 1048576)
+            return false;
+    }
+    if (*col != 0) {
+        if (!colAbs)
+            *col += columnOffset;
+        if (*col < 1 || *col > 16384)
+            return false;
+    }
+    return true;
+}
+
+/*
+   Returns \a formula as it reads when copied \a rowOffset rows and
+   \a columnOffset columns away: the relative parts of its A1 references
+   are moved, and references moved out of the sheet become #REF!.
+
+   Whole column and whole row ranges such as "A:A" or "$1:3" are moved
+   too. Function names, sheet names, string literals and bracketed
+   references are left alone.
+*/
+QString xl_shift_formula(const QString &formula, int rowOffset, int columnOffset)
+{
+    if (rowOffset == 0 && columnOffset == 0)
+        return formula;
+
+    QString result;
+    result.reserve(formula.size() + 8);
+    const QChar *data = formula.constData();
+    const int size = formula.size();
+    int i = 0;
+    while (i < size) {
+        const int start = i;
+        const ushort ch = data[i].unicode();
+        if (ch == '"' || ch == '\'') {
+            //String literal or quoted sheet name, with doubled quotes inside
+            for (++i; i < size; ++i) {
+                if (data[i].unicode() == ch) {
+                    if (i + 1 < size && data[i+1].unicode() == ch)
+                        ++i;
+                    else
+                        break;
+                }
+            }
+            i = qMin(i + 1, size);
+            result.append(data + start, i - start);
+        } else if (ch == '[') {
+            //External workbook or structured reference
+            int depth = 0;
+            for (; i < size; ++i) {
+                if (data[i] == QLatin1Char('['))
+                    ++depth;
+                else if (data[i] == QLatin1Char(']') && --depth == 0)
+                    break;
+            }
+            i = qMin(i + 1, size);
+            result.append(data + start, i - start);
+        } else if (isFormulaNameChar(ch)) {
+            while (i < size && isFormulaNameChar(data[i].unicode()))
+                ++i;
+            //Followed by '(' or '!', it names a function or a sheet
+            const bool isName = i < size && (data[i] == QLatin1Char('(') || data[i] == QLatin1Char('!'));
+            int row1, col1, row2, col2;
+            bool rowAbs1, colAbs1, rowAbs2, colAbs2;
+            if (isName || !parseReferenceToken(data + start, i - start, &row1, &col1, &rowAbs1, &colAbs1)) {
+                result.append(data + start, i - start);
+                continue;
+            }
+            bool isRange = false;
+            int end = i;
+            if (i + 1 < size && data[i] == QLatin1Char(':')) {
+                int j = i + 1;
+                while (j < size && isFormulaNameChar(data[j].unicode()))
+                    ++j;
+                if (j > i + 1 && parseReferenceToken(data + i + 1, j - i - 1, &row2, &col2, &rowAbs2, &colAbs2)
+                        && (row1 == 0) == (row2 == 0) && (col1 == 0) == (col2 == 0)) {
+                    isRange = true;
+                    end = j;
+                }
+            }
+            //"A" or "1" alone is a name or a number
+            if (!isRange && (row1 == 0 || col1 == 0)) {
+                result.append(data + start, i - start);
+                continue;
+            }
+            i = end;
+
+            bool valid = shiftReference(&row1, &col1, rowAbs1, colAbs1, rowOffset, columnOffset);
+            if (isRange)
+                valid = shiftReference(&row2, &col2, rowAbs2, colAbs2, rowOffset, columnOffset) && valid;
+            if (!valid) {
+                result.append(QLatin1String("#REF!"));
+            } else {
+                result.append(referenceToken(row1, col1, rowAbs1, colAbs1));
+                if (isRange) {
+                    result.append(QLatin1Char(':'));
+                    result.append(referenceToken(row2, col2, rowAbs2, colAbs2));
+                }
+            }
+        } else {
+            result.append(data[i]);
+            ++i;
+        }
+    }
+    return result;
+}
+
+/*
+   Returns true if \a formula has relative references, whose meaning
+   depends on the cell the formula belongs to.
+*/
+bool xl_has_relative_references(const QString &formula)
+{
+    return xl_shift_formula(formula, 1, 1) != formula;
+}
+
+/*
+   Returns where the row or column \a index goes when \a count rows or
+   columns are inserted before \a first, or when -\a count rows or columns
+   are removed from \a first. Returns 0 if \a index is removed.
+*/
+int xl_move_index(int index, int first, int count)
+{
+    if (index < first)
+        return index;
+    if (count < 0 && index < first - count)
+        return 0;
+    return index + count;
+}
+
+/*
+   Moves the span [\a firstIndex, \a lastIndex] of rows or columns as
+   xl_move_index() does. The span grows when rows are inserted inside it
+   and shrinks when some of its rows are removed. Returns false if the
+   whole span is removed or pushed past \a maxIndex.
+*/
+bool xl_move_span(int *firstIndex, int *lastIndex, int first, int count, int maxIndex)
+{
+    if (*lastIndex < first)
+        return true;
+    if (count > 0) {
+        if (*firstIndex >= first)
+            *firstIndex += count;
+        *lastIndex = qMin(*lastIndex + count, maxIndex);
+        return *firstIndex <= maxIndex;
+    }
+
+    const int last = first - count - 1;
+    if (*firstIndex > last) {
+        *firstIndex += count;
+        *lastIndex += count;
+        return true;
+    }
+    if (*firstIndex >= first && *lastIndex <= last)
+        return false;
+    if (*firstIndex >= first)
+        *firstIndex = first;
+    *lastIndex = *lastIndex > last ? *lastIndex + count : first - 1;
+    return true;
+}
+
+/*
+   Returns \a range after the insertion or removal of rows, if \a rows
+   is true, or of columns. An invalid range is returned if all of its
+   cells are removed.
+*/
+CellRange xl_move_range(const CellRange &range, bool rows, int first, int count)
+{
+    int firstRow = range.firstRow();
+    int lastRow = range.lastRow();
+    int firstColumn = range.firstColumn();
+    int lastColumn = range.lastColumn();
+    bool ok = rows ? xl_move_span(&firstRow, &lastRow, first, count, 1048576)
+                   : xl_move_span(&firstColumn, &lastColumn, first, count, 16384);
+    if (!ok)
+        return CellRange();
+    return CellRange(firstRow, firstColumn, lastRow, lastColumn);
+}
+
+/*
+   Returns \a formula with its references to the sheet \a sheetName
+   updated for the insertion or removal of rows, if \a rows is true, or
+   of columns, as xl_move_index() describes. \a inSheet tells whether the
+   formula belongs to that sheet, so that references without a sheet
+   name point to it.
+
+   Both absolute and relative references are moved. A reference whose
+   cells are all removed becomes #REF!, a range losing some of its cells
+   shrinks.
+*/
+QString xl_move_formula(const QString &formula, const QString &sheetName, bool inSheet, bool rows, int first, int count)
+{
+    if (count == 0)
+        return formula;
+
+    const int maxIndex = rows ? 1048576 : 16384;
+    QString result;
+    result.reserve(formula.size() + 8);
+    const QChar *data = formula.constData();
+    const int size = formula.size();
+    //Sheet given to the next reference: 0 none, 1 the moved sheet, -1 another one
+    int prefix = 0;
+    int i = 0;
+    while (i < size) {
+        const int start = i;
+        const ushort ch = data[i].unicode();
+        if (ch == '"' || ch == '\'') {
+            //String literal or quoted sheet name, with doubled quotes inside
+            QString text;
+            for (++i; i < size; ++i) {
+                if (data[i].unicode() == ch) {
+                    if (i + 1 < size && data[i+1].unicode() == ch)
+                        ++i;
+                    else
+                        break;
+                }
+                text.append(data[i]);
+            }
+            i = qMin(i + 1, size);
+            result.append(data + start, i - start);
+            prefix = 0;
+            if (ch == '\'' && i < size && data[i] == QLatin1Char('!')) {
+                result.append(data[i++]);
+                prefix = text.compare(sheetName, Qt::CaseInsensitive) == 0 ? 1 : -1;
+            }
+        } else if (ch == '[') {
+            //External workbook or structured reference
+            int depth = 0;
+            for (; i < size; ++i) {
+                if (data[i] == QLatin1Char('['))
+                    ++depth;
+                else if (data[i] == QLatin1Char(']') && --depth == 0)
+                    break;
+            }
+            i = qMin(i + 1, size);
+            result.append(data + start, i - start);
+            prefix = -1;
+        } else if (isFormulaNameChar(ch)) {
+            while (i < size && isFormulaNameChar(data[i].unicode()))
+                ++i;
+            if (i < size && data[i] == QLatin1Char('(')) {
+                result.append(data + start, i - start);
+                prefix = 0;
+                continue;
+            }
+            if (i < size && data[i] == QLatin1Char('!')) {
+                ++i;
+                result.append(data + start, i - start);
+                const QString name(data + start, i - start - 1);
+                prefix = name.compare(sheetName, Qt::CaseInsensitive) == 0 ? 1 : -1;
+                continue;
+            }
+            const bool moved = prefix == 0 ? inSheet : prefix == 1;
+            prefix = 0;
+
+            int row1, col1, row2, col2;
+            bool rowAbs1, colAbs1, rowAbs2, colAbs2;
+            if (!parseReferenceToken(data + start, i - start, &row1, &col1, &rowAbs1, &colAbs1)) {
+                result.append(data + start, i - start);
+                continue;
+            }
+            bool isRange = false;
+            int end = i;
+            if (i + 1 < size && data[i] == QLatin1Char(':')) {
+                int j = i + 1;
+                while (j < size && isFormulaNameChar(data[j].unicode()))
+                    ++j;
+                if (j > i + 1 && parseReferenceToken(data + i + 1, j - i - 1, &row2, &col2, &rowAbs2, &colAbs2)
+                        && (row1 == 0) == (row2 == 0) && (col1 == 0) == (col2 == 0)) {
+                    isRange = true;
+                    end = j;
+                }
+            }
+            //"A" or "1" alone is a name
+            if (!isRange && (row1 == 0 || col1 == 0)) {
+                result.append(data + start, i - start);
+                continue;
+            }
+            i = end;
+
+            int *index1 = rows ? &row1 : &col1;
+            int *index2 = rows ? &row2 : &col2;
+            if (!moved || *index1 == 0) {
+                //Another sheet, or whole columns when moving rows
+                result.append(data + start, end - start);
+            } else if (!isRange) {
+                int index = xl_move_index(*index1, first, count);
+                if (index == 0 || index > maxIndex) {
+                    result.append(QLatin1String("#REF!"));
+                } else {
+                    *index1 = index;
+                    result.append(referenceToken(row1, col1, rowAbs1, colAbs1));
+                }
+            } else {
+                const bool reversed = *index1 > *index2;
+                int low = reversed ? *index2 : *index1;
+                int high = reversed ? *index1 : *index2;
+                if (!xl_move_span(&low, &high, first, count, maxIndex)) {
+                    result.append(QLatin1String("#REF!"));
+                } else {
+                    *index1 = reversed ? high : low;
+                    *index2 = reversed ? low : high;
+                    result.append(referenceToken(row1, col1, rowAbs1, colAbs1));
+                    result.append(QLatin1Char(':'));
+                    result.append(referenceToken(row2, col2, rowAbs2, colAbs2));
+                }
+            }
+        } else {
+            result.append(data[i]);
+            ++i;
+            prefix = 0;
+        }
+    }
+    return result;
+}
+
+/*
+   The text buffer is flushed once less than XmlTextBufferReserve bytes
+   are left, enough for one iteration of the loop: up to 15 clean bytes
+   of an SSE2 block followed by the longest escaped character.
+*/
+static const int XmlTextBufferSize = 8192;
+static const int XmlTextBufferReserve = 32;
+
+static inline char *writeLiteral(char *out, const char *str, int size)
+{
+    memcpy(out, str, size);
+    return out + size;
+}
+
+static inline bool isHexDigit(ushort u)
+{
+    return (u >= '0' && u <= '9') || (u >= 'A' && u <= 'F') || (u >= 'a' && u <= 'f');
+}
+
+static inline int hexDigitValue(ushort u)
+{
+    return u <= '9' ? u - '0' : (u | 0x20) - 'a' + 10;
+}
+
+/*
+   Returns true if [\a p, \a end) starts with an escape sequence _xHHHH_.
+*/
+static inline bool isEscapeSequence(const ushort *p, const ushort *end)
+{
+    return end - p >= 7 && p[0] == '_' && p[1] == 'x' && isHexDigit(p[2]) && isHexDigit(p[3])
+            && isHexDigit(p[4]) && isHexDigit(p[5]) && p[6] == '_';
+}
+
+/*
+   Writes \a u as the escape sequence _xHHHH_, 7 bytes.
+*/
+static inline char *writeEscapeSequence(char *out, ushort u)
+{
+    static const char hexDigits[] = "0123456789ABCDEF";
+    *out++ = '_';
+    *out++ = 'x';
+    *out++ = hexDigits[u >> 12];
+    *out++ = hexDigits[(u >> 8) & 0xf];
+    *out++ = hexDigits[(u >> 4) & 0xf];
+    *out++ = hexDigits[u & 0xf];
+    *out++ = '_';
+    return out;
+}
+
+/*
+   Returns true if \a u at \a p has to be written as an escape sequence:
+   a control character XML 1.0 can't carry, or the '_' starting text which
+   reads as an escape sequence.
+*/
+static inline bool needsEscapeSequence(ushort u, const ushort *p, const ushort *end)
+{
+    if (u < 0x20)
+        return u != '\t' && u != '\n' && u != '\r';
+    return u == '_' && isEscapeSequence(p, end);
+}
+
+/*
+   Escapes \a text the way xl_write_characters() does, for the writers
+   which it leaves to QXmlStreamWriter.
+*/
+static QString escapeCharacters(const QString &text)
+{
+    QString result;
+    const ushort *start = text.utf16();
+    const ushort * const end = start + text.size();
+    for (const ushort *p = start; p < end; ++p) {
+        if (!needsEscapeSequence(*p, p, end))
+            continue;
+        char sequence[7];
+        writeEscapeSequence(sequence, *p);
+        result.append(reinterpret_cast<const QChar *>(start), p - start);
+        result.append(QLatin1String(sequence, 7));
+        start = p + 1;
+    }
+    if (result.isNull())
+        return text;
+    result.append(reinterpret_cast<const QChar *>(start), end - start);
+    return result;
+}
+
+/*
+   Writes \a text as element content, escaped and transcoded to UTF-8
+   directly into the device of \a writer.
+
+   Runs of printable ASCII characters are checked sixteen at a time when
+   SSE2 is available and copied to the output in one go. Control characters
+   that XML 1.0 can't carry are written as _xHHHH_, the way Excel does,
+   and a '_' which would read as such a sequence is written as _x005F_.
+   Writers without a device or with a codec other than UTF-8 fall back to
+   QXmlStreamWriter::writeCharacters().
+*/
+void xl_write_characters(QXmlStreamWriter &writer, const QString &text)
+{
+    QIODevice *device = writer.device();
+    if (!device || !writer.codec() || writer.codec()->mibEnum() != 106) { //106: UTF-8
+        writer.writeCharacters(escapeCharacters(text));
+        return;
+    }
+
+    //Let the writer finish the pending start tag, then bypass it.
+    writer.writeCharacters(QString());
+    if (text.isEmpty())
+        return;
+
+    char buffer[XmlTextBufferSize];
+    char *out = buffer;
+    char * const limit = buffer + XmlTextBufferSize - XmlTextBufferReserve;
+    const ushort *p = text.utf16();
+    const ushort * const end = p + text.size();
+
+    while (p < end) {
+        if (out > limit) {
+            device->write(buffer, out - buffer);
+            out = buffer;
+        }
+#ifdef QXLSX_HAVE_SSE2
+        if (end - p >= 16) {
+            //Units from 0x100 saturate to 0xff and units from 0x8000 to 0,
+            //so all of non ASCII and control characters are negative or
+            //below 0x20 as signed bytes.
+            __m128i bytes = _mm_packus_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)),
+                                             _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 8)));
+            __m128i special = _mm_cmplt_epi8(bytes, _mm_set1_epi8(0x20));
+            special = _mm_or_si128(special, _mm_cmpeq_epi8(bytes, _mm_set1_epi8('<')));
+            special = _mm_or_si128(special, _mm_cmpeq_epi8(bytes, _mm_set1_epi8('>')));
+            special = _mm_or_si128(special, _mm_cmpeq_epi8(bytes, _mm_set1_epi8('&')));
+            special = _mm_or_si128(special, _mm_cmpeq_epi8(bytes, _mm_set1_epi8('"')));
+            special = _mm_or_si128(special, _mm_cmpeq_epi8(bytes, _mm_set1_epi8('_')));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out), bytes);
+
+            uint mask = static_cast<uint>(_mm_movemask_epi8(special));
+            if (!mask) {
+                out += 16;
+                p += 16;
+                continue;
+            }
+            int clean = xlsxLowestBit(mask);
+            out += clean;
+            p += clean;
+        }
+#endif
+        ushort u = *p++;
+        if (u < 0x80) {
+            if (u == '<') {
+                out = writeLiteral(out, "&lt;", 4);
+            } else if (u == '>') {
+                out = writeLiteral(out, "&gt;", 4);
+            } else if (u == '&') {
+                out = writeLiteral(out, "&amp;", 5);
+            } else if (u == '"') {
+                out = writeLiteral(out, "&quot;", 6);
+            } else if (needsEscapeSequence(u, p - 1, end)) {
+                out = writeEscapeSequence(out, u);
+            } else {
+                *out++ = static_cast<char>(u);
+            }
+        } else if (u < 0x800) {
+            *out++ = static_cast<char>(0xc0 | (u >> 6));
+            *out++ = static_cast<char>(0x80 | (u & 0x3f));
+        } else if (QChar::isHighSurrogate(u) && p < end && QChar::isLowSurrogate(*p)) {
+            uint ucs4 = QChar::surrogateToUcs4(u, *p++);
+            *out++ = static_cast<char>(0xf0 | (ucs4 >> 18));
+            *out++ = static_cast<char>(0x80 | ((ucs4 >> 12) & 0x3f));
+            *out++ = static_cast<char>(0x80 | ((ucs4 >> 6) & 0x3f));
+            *out++ = static_cast<char>(0x80 | (ucs4 & 0x3f));
+        } else {
+            if (QChar::isSurrogate(u)) //unpaired
+                u = QChar::ReplacementCharacter;
+            *out++ = static_cast<char>(0xe0 | (u >> 12));
+            *out++ = static_cast<char>(0x80 | ((u >> 6) & 0x3f));
+            *out++ = static_cast<char>(0x80 | (u & 0x3f));
+        }
+    }
+
+    if (out != buffer)
+        device->write(buffer, out - buffer);
+}
+
+/*
+   Returns \a text with the escape sequences _xHHHH_ written by
+   xl_write_characters() and by Excel replaced by their characters.
+*/
+QString xl_unescape_characters(const QString &text)
+{
+    int from = text.indexOf(QLatin1String("_x"));
+    if (from == -1)
+        return text;
+
+    QString result;
+    result.reserve(text.size());
+    const ushort *start = text.utf16();
+    const ushort * const end = start + text.size();
+    const ushort *p = start + from;
+    while (p < end) {
+        if (!isEscapeSequence(p, end)) {
+            ++p;
+            continue;
+        }
+        result.append(reinterpret_cast<const QChar *>(start), p - start);
+        result.append(QChar((hexDigitValue(p[2]) << 12) | (hexDigitValue(p[3]) << 8)
+                            | (hexDigitValue(p[4]) << 4) | hexDigitValue(p[5])));
+        p += 7;
+        start = p;
+    }
+    result.append(reinterpret_cast<const QChar *>(start), end - start);
+    return result;
+}
+
+/*
+   Same as QXmlStreamWriter::writeTextElement(), with the text written
+   by xl_write_characters().
+*/
+void xl_write_text_element(QXmlStreamWriter &writer, const QString &name, const QString &text)
+{
+    writer.writeStartElement(name);
+    xl_write_characters(writer, text);
+    writer.writeEndElement();
+}
+
+/*
+   Returns true if \a text starts or ends with white space, which needs
+   xml:space="preserve" to survive.
+*/
+bool xl_needs_space_preserve(const QString &text)
+{
+    return !text.isEmpty() && (text.at(0).isSpace() || text.at(text.size() - 1).isSpace());
+}
+
+static bool rangeStartsBefore(const CellRange &a, const CellRange &b)
+{
+    if (a.firstRow() != b.firstRow())
+        return a.firstRow() < b.firstRow();
+    return a.firstColumn() < b.firstColumn();
+}
+
+/*
+   Returns ranges covering the same cells as \a ranges, with overlapping
+   and adjacent ranges merged.
+
+   Rows are swept from top to bottom in bands where the set of ranges
+   doesn't change. The ranges of a band are reduced to disjoint column
+   intervals, and an interval which continues the same interval of the
+   band right above grows the rectangle started there. This gives the
+   minimal cover for runs and blocks of cells, not for any shape.
+*/
+QList<CellRange> xl_coalesce_ranges(const QList<CellRange> &ranges)
+{
+    if (ranges.size() < 2)
+        return ranges;
+
+    QVector<CellRange> sorted;
+    QVector<int> bounds;
+    sorted.reserve(ranges.size());
+    bounds.reserve(ranges.size() * 2);
+    foreach (CellRange range, ranges) {
+        if (!range.isValid())
+            continue;
+        sorted.append(range);
+        bounds.append(range.firstRow());
+        bounds.append(range.lastRow() + 1);
+    }
+    qSort(sorted.begin(), sorted.end(), rangeStartsBefore);
+    qSort(bounds.begin(), bounds.end());
+    bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+
+    QList<CellRange> result;
+    QVector<CellRange> active;  //Ranges covering the current band
+    QVector<CellRange> open;    //Rectangles reaching the band above, by column
+    QVector<QPair<int, int> > intervals;
+    int next = 0;
+    for (int b=0; b+1<bounds.size(); ++b) {
+        const int top = bounds[b];
+        const int bottom = bounds[b+1] - 1;
+
+        for (int i=active.size()-1; i>=0; --i) {
+            if (active[i].lastRow() < top)
+                active.remove(i);
+        }
+        while (next < sorted.size() && sorted[next].firstRow() == top)
+            active.append(sorted[next++]);
+
+        intervals.clear();
+        for (int i=0; i<active.size(); ++i)
+            intervals.append(qMakePair(active[i].firstColumn(), active[i].lastColumn()));
+        qSort(intervals);
+        int count = 0;
+        for (int i=0; i<intervals.size(); ++i) {
+            if (count && intervals[i].first <= intervals[count-1].second + 1)
+                intervals[count-1].second = qMax(intervals[count-1].second, intervals[i].second);
+            else
+                intervals[count++] = intervals[i];
+        }
+        intervals.resize(count);
+
+        QVector<CellRange> continued;
+        int j = 0;
+        for (int i=0; i<intervals.size(); ++i) {
+            while (j < open.size() && open[j].firstColumn() < intervals[i].first)
+                result.append(open[j++]);
+            if (j < open.size() && open[j].lastRow() == top - 1
+                    && open[j].firstColumn() == intervals[i].first
+                    && open[j].lastColumn() == intervals[i].second) {
+                CellRange range = open[j++];
+                range.setLastRow(bottom);
+                continued.append(range);
+            } else {
+                continued.append(CellRange(top, intervals[i].first, bottom, intervals[i].second));
+            }
+        }
+        while (j < open.size())
+            result.append(open[j++]);
+        open = continued;
+    }
+    for (int i=0; i<open.size(); ++i)
+        result.append(open[i]);
+
+    if (result.size() >= ranges.size())
+        return ranges;
+    qSort(result.begin(), result.end(), rangeStartsBefore);
+    return result;
+}
+
 } //namespace QXlsx
@@ -39,13 +39,18 @@
 #include "xlsxglobal.h"
 class QPoint;
 class QString;
+class QStringRef;
 class QStringList;
 class QColor;
 class QDateTime;
 class QTime;
+class QXmlStreamWriter;
+template <typename T> class QList;
 
 namespace QXlsx {
 
+class CellRange;
+
  int intPow(int x, int p);
  QStringList splitPath(const QString &path);
  QString getRelFilePath(const QString &filePath);
@@ -55,10 +60,28 @@ namespace QXlsx {
  double timeToNumber(const QTime &t);
 
  QPoint xl_cell_to_rowcol(const QString &cell_str);
+ QPoint xl_cell_to_rowcol(const QStringRef &cell_str);
+ QPoint xl_cell_to_rowcol(const char *cell_str, int size);
+ int xl_string_to_int(const QStringRef &str, bool *ok=0);
+ double xl_string_to_double(const QString &str, bool *ok=0);
+ double xl_string_to_double(const char *str, int size, bool *ok=0);
  QString xl_col_to_name(int col_num);
  int xl_col_name_to_value(const QString &col_str);
  QString xl_rowcol_to_cell(int row, int col, bool row_abs=false, bool col_abs=false);
  QString xl_rowcol_to_cell_fast(int row, int col);
+ QString xl_shift_formula(const QString &formula, int rowOffset, int columnOffset);
+ bool xl_has_relative_references(const QString &formula);
+ int xl_move_index(int index, int first, int count);
+ bool xl_move_span(int *firstIndex, int *lastIndex, int first, int count, int maxIndex);
+ CellRange xl_move_range(const CellRange &range, bool rows, int first, int count);
+ QString xl_move_formula(const QString &formula, const QString &sheetName, bool inSheet, bool rows, int first, int count);
+
+ void xl_write_characters(QXmlStreamWriter &writer, const QString &text);
+QString xl_unescape_characters(const QString &text);
+ void xl_write_text_element(QXmlStreamWriter &writer, const QString &name, const QString &text);
+ bool xl_needs_space_preserve(const QString &text);
+
+ QList<CellRange> xl_coalesce_ranges(const QList<CellRange> &ranges);
 
 } //QXlsx
 #endif // XLSXUTILITY_H
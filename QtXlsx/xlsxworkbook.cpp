@@ -61,6 +61,77 @@ WorkbookPrivate::WorkbookPrivate(Workbook *q) :
     last_sheet_id = 0;
 }
 
+/*
+   Returns true if \a formula refers to the sheet \a sheetName, as
+   "Name!" or "'Name'!".
+*/
+static bool refersToSheet(const QString &formula, const QString &sheetName)
+{
+    QString quoted = sheetName;
+    quoted.replace(QLatin1Char('\''), QStringLiteral("''"));
+    quoted = QLatin1Char('\'') + quoted + QStringLiteral("'!");
+    if (formula.contains(quoted, Qt::CaseInsensitive))
+        return true;
+
+    const QString plain = sheetName + QLatin1Char('!');
+    int pos = -1;
+    while ((pos = formula.indexOf(plain, pos + 1, Qt::CaseInsensitive)) != -1) {
+        //Not the end of a longer name
+        if (pos == 0)
+            return true;
+        const QChar before = formula.at(pos - 1);
+        if (!before.isLetterOrNumber() && before != QLatin1Char('_') && before != QLatin1Char('.'))
+            return true;
+    }
+    return false;
+}
+
+/*
+   The views and the defined names read from the workbook part refer to
+   sheets by their position in the file, \a activeTab and \a firstSheet
+   for the views. Points them to the sheets loaded. When some sheets were
+   skipped by the load options, the views on a skipped sheet go back to
+   the first sheet, and the names scoped to or referring to a skipped
+   sheet are dropped.
+*/
+void WorkbookPrivate::restoreSheetReferences(int activeTab, int firstSheet)
+{
+    QHash<int, int> loadedIndexes; //sheetId to index in worksheets
+    for (int i=0; i<worksheets.size(); ++i)
+        loadedIndexes.insert(worksheets[i]->sheetId(), i);
+
+    QStringList skippedNames;
+    foreach (const XlsxSheetItemInfo &info, sheetItemInfoList) {
+        if (!loadedIndexes.contains(info.sheetId))
+            skippedNames.append(info.name);
+    }
+
+    activesheetIndex = 0;
+    if (activeTab >= 0 && activeTab < sheetItemInfoList.size())
+        activesheetIndex = loadedIndexes.value(sheetItemInfoList[activeTab].sheetId, 0);
+    firstsheet = 0;
+    if (firstSheet >= 0 && firstSheet < sheetItemInfoList.size())
+        firstsheet = loadedIndexes.value(sheetItemInfoList[firstSheet].sheetId, 0);
+
+    if (skippedNames.isEmpty())
+        return;
+    QList<XlsxDefineNameData> names;
+    foreach (const XlsxDefineNameData &data, definedNamesList) {
+        if (data.sheetId != -1 && !loadedIndexes.contains(data.sheetId))
+            continue;
+        bool refersToSkipped = false;
+        foreach (const QString &name, skippedNames) {
+            if (refersToSheet(data.formula, name)) {
+                refersToSkipped = true;
+                break;
+            }
+        }
+        if (!refersToSkipped)
+            names.append(data);
+    }
+    definedNamesList = names;
+}
+
 Workbook::Workbook() :
     d_ptr(new WorkbookPrivate(this))
 {
@@ -313,6 +384,39 @@ bool Workbook::copyWorksheet(int index, const QString &newName)
     return false;
 }
 
+/*!
+ * Returns the string cells of all the worksheets whose text matches
+ * \a text, sheet by sheet, with the sheet of each.
+ *
+ * \sa Worksheet::find()
+ */
+QList<QPair<Worksheet *, CellRange> > Workbook::find(const QString &text, Qt::MatchFlags flags) const
+{
+    Q_D(const Workbook);
+    QList<QPair<Worksheet *, CellRange> > cells;
+    for (int i=0; i<d->worksheets.size(); ++i) {
+        Worksheet *sheet = d->worksheets[i].data();
+        foreach (const CellRange &range, sheet->find(text, flags))
+            cells.append(qMakePair(sheet, range));
+    }
+    return cells;
+}
+
+/*!
+ * Replaces \a before by \a after in the string cells of all the
+ * worksheets, and returns the number of cells changed.
+ *
+ * \sa Worksheet::replace()
+ */
+int Workbook::replace(const QString &before, const QString &after, Qt::MatchFlags flags)
+{
+    Q_D(Workbook);
+    int count = 0;
+    for (int i=0; i<d->worksheets.size(); ++i)
+        count += d->worksheets[i]->replace(before, after, flags);
+    return count;
+}
+
 QList<QSharedPointer<Worksheet> > Workbook::worksheets() const
 {
     Q_D(const Workbook);
@@ -357,10 +461,10 @@ Theme *Workbook::theme()
     return d->theme.data();
 }
 
-QList<QImage> Workbook::images()
+QList<QSharedPointer<MediaFile> > Workbook::mediaFiles()
 {
     Q_D(Workbook);
-    return d->images;
+    return d->mediaFiles;
 }
 
 QList<Drawing *> Workbook::drawings()
@@ -372,10 +476,29 @@ QList<Drawing *> Workbook::drawings()
 void Workbook::prepareDrawings()
 {
     Q_D(Workbook);
-    int image_ref_id = 0;
-    d->images.clear();
+    d->mediaFiles.clear();
     d->drawings.clear();
 
+    //Copies of the same QImage share one media file, which is encoded once
+    QList<QSharedPointer<MediaFile> > pending;
+    QHash<qint64, QSharedPointer<MediaFile> > pendingImages;
+    foreach (QSharedPointer<Worksheet> sheet, d->worksheets) {
+        foreach (XlsxImageData *imageData, sheet->images()) {
+            if (imageData->media->isEncoded())
+                continue;
+            qint64 key = imageData->media->imageCacheKey();
+            if (pendingImages.contains(key)) {
+                imageData->media = pendingImages[key];
+            } else {
+                pendingImages.insert(key, imageData->media);
+                pending.append(imageData->media);
+            }
+        }
+    }
+    MediaFile::encode(pending);
+
+    //Files with the same contents are written once
+    QHash<QByteArray, int> mediaIds;
     for (int i=0; i<d->worksheets.size(); ++i) {
         QSharedPointer<Worksheet> sheet = d->worksheets[i];
         if (sheet->images().isEmpty()) //No drawing (such as Image, ...)
@@ -385,9 +508,14 @@ void Workbook::prepareDrawings()
 
         //At present, only picture type supported
         for (int idx = 0; idx < sheet->images().size(); ++idx) {
-            image_ref_id += 1;
-            sheet->prepareImage(idx, image_ref_id);
-            d->images.append(sheet->images()[idx]->image);
+            QSharedPointer<MediaFile> media = sheet->images()[idx]->media;
+            int media_id = mediaIds.value(media->hashKey());
+            if (!media_id) {
+                d->mediaFiles.append(media);
+                media_id = d->mediaFiles.size();
+                mediaIds.insert(media->hashKey(), media_id);
+            }
+            sheet->prepareImage(idx, media_id);
         }
 
         d->drawings.append(sheet->drawing());
@@ -434,7 +562,7 @@ void Workbook::saveToXmlFile(QIODevice *device) const
     //Store the firstSheet when it isn't the default
     //For example, when "the first sheet 0 is hidden", the first sheet will be 1
     if (d->firstsheet > 0)
-        writer.writeAttribute(QStringLiteral("firstSheet"), QString::number(d->firstsheet + 1));
+        writer.writeAttribute(QStringLiteral("firstSheet"), QString::number(d->firstsheet));
     //Store the activeTab when it isn't the first sheet
     if (d->activesheetIndex > 0)
         writer.writeAttribute(QStringLiteral("activeTab"), QString::number(d->activesheetIndex));
@@ -513,8 +641,8 @@ bool Workbook::loadFromXmlFile(QIODevice *device)
                 QXmlStreamAttributes attrs = reader.attributes();
                 if (attrs.hasAttribute(QLatin1String("date1904")))
                     d->date1904 = true;
-             } else if (reader.name() == QLatin1String("bookviews")) {
-                while (!(reader.name() == QLatin1String("bookviews") && reader.tokenType() == QXmlStreamReader::EndElement)) {
+             } else if (reader.name() == QLatin1String("bookViews")) {
+                while (!(reader.name() == QLatin1String("bookViews") && reader.tokenType() == QXmlStreamReader::EndElement)) {
                     reader.readNextStartElement();
                     if (reader.tokenType() == QXmlStreamReader::StartElement) {
                         if (reader.name() == QLatin1String("workbookView")) {
@@ -543,8 +671,8 @@ bool Workbook::loadFromXmlFile(QIODevice *device)
                      data.comment = attrs.value(QLatin1String("comment")).toString();
                  if (attrs.hasAttribute(QLatin1String("localSheetId"))) {
                      int localId = attrs.value(QLatin1String("localSheetId")).toString().toInt();
-                     int sheetId = d->sheetItemInfoList[localId].sheetId;
-                     data.sheetId = sheetId;
+                     if (localId >= 0 && localId < d->sheetItemInfoList.size())
+                         data.sheetId = d->sheetItemInfoList[localId].sheetId;
                  }
                  data.formula = reader.readElementText();
                  d->definedNamesList.append(data);
@@ -26,7 +26,9 @@
 #define XLSXWORKBOOK_H
 
 #include "xlsxglobal.h"
+#include "xlsxcellrange.h"
 #include <QList>
+#include <QPair>
 #include <QImage>
 #include <QSharedPointer>
 
@@ -42,6 +44,7 @@ class Document;
 class Theme;
 class Relationships;
 class DocumentPrivate;
+class MediaFile;
 
 class WorkbookPrivate;
 class Workbook
@@ -60,6 +63,8 @@ public:
     bool deleteWorksheet(int index);
     bool copyWorksheet(int index, const QString &newName=QString());
     bool moveWorksheet(int srcIndex, int distIndex);
+    QList<QPair<Worksheet *, CellRange> > find(const QString &text, Qt::MatchFlags flags=Qt::MatchContains) const;
+    int replace(const QString &before, const QString &after, Qt::MatchFlags flags=Qt::MatchContains);
 
     Worksheet *activeWorksheet() const;
     bool setActiveWorksheet(int index);
@@ -90,7 +95,7 @@ private:
     SharedStrings *sharedStrings() const;
     Styles *styles();
     Theme *theme();
-    QList<QImage> images();
+    QList<QSharedPointer<MediaFile> > mediaFiles();
     QList<Drawing *> drawings();
     void prepareDrawings();
     QStringList worksheetNames() const;
@@ -79,6 +79,8 @@ class WorkbookPrivate
 public:
     WorkbookPrivate(Workbook *q);
 
+    void restoreSheetReferences(int activeTab, int firstSheet);
+
     Workbook *q_ptr;
     mutable Relationships relationships;
 
@@ -87,7 +89,7 @@ public:
     QStringList worksheetNames;
     QSharedPointer<Styles> styles;
     QSharedPointer<Theme> theme;
-    QList<QImage> images;
+    QList<QSharedPointer<MediaFile> > mediaFiles;
     QList<Drawing *> drawings;
     QList<XlsxDefineNameData> definedNamesList;
 
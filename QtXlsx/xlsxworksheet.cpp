@@ -26,6 +26,7 @@
 #include "xlsxworksheet.h"
 #include "xlsxworksheet_p.h"
 #include "xlsxworkbook.h"
+#include "xlsxworkbook_p.h"
 #include "xlsxformat.h"
 #include "xlsxformat_p.h"
 #include "xlsxutility_p.h"
@@ -36,6 +37,10 @@
 #include "xlsxcell_p.h"
 #include "xlsxcellrange.h"
 #include "xlsxconditionalformatting_p.h"
+#include "xlsxdatavalidation_p.h"
+#include "xlsxsheetdatascanner_p.h"
+#include "xlsxsimd_p.h"
+#include "xlsxrowsorter_p.h"
 
 #include <QVariant>
 #include <QDateTime>
@@ -45,15 +50,19 @@
 #include <QRegularExpression>
 #include <QDebug>
 #include <QBuffer>
+#include <QThread>
 #include <QXmlStreamWriter>
 #include <QXmlStreamReader>
 
+#include <qnumeric.h>
 #include <math.h>
+#include <string.h>
 
 namespace QXlsx {
 
 WorksheetPrivate::WorksheetPrivate(Worksheet *p) :
     q_ptr(p)
+  , row_sizes(20, XLSX_ROW_MAX), col_sizes(64, XLSX_COLUMN_MAX)
   , windowProtection(false), showFormulas(false), showGridLines(true), showRowColHeaders(true)
   , showZeros(true), rightToLeft(false), tabSelected(false), showRuler(false)
   , showOutlineSymbols(true), showWhiteSpace(true)
@@ -69,12 +78,19 @@ WorksheetPrivate::WorksheetPrivate(Worksheet *p) :
     default_row_zeroed = false;
 
     hidden = false;
+    reservedColumns = 0;
+    nextSharedIndex = 0;
+    formulaEngine = 0;
+    calculationThreadCount = 1;
+    valueIndexEnabled = false;
+    valueIndexValid = false;
 }
 
 WorksheetPrivate::~WorksheetPrivate()
 {
     if (drawing)
         delete drawing;
+    delete formulaEngine;
 }
 
 /*
@@ -90,9 +106,10 @@ void WorksheetPrivate::calculateSpans() const
     int span_max = -1;
 
     for (int row_num = dimension.firstRow(); row_num <= dimension.lastRow(); row_num++) {
-        if (cellTable.contains(row_num)) {
+        XlsxCellTable::const_iterator rowIt = cellTable.constFind(row_num);
+        if (rowIt != cellTable.constEnd()) {
             for (int col_num = dimension.firstColumn(); col_num <= dimension.lastColumn(); col_num++) {
-                if (cellTable[row_num].contains(col_num)) {
+                if (rowIt.value().contains(col_num)) {
                     if (span_max == -1) {
                         span_min = col_num;
                         span_max = col_num;
@@ -105,6 +122,14 @@ void WorksheetPrivate::calculateSpans() const
                 }
             }
         }
+        if (!rangeFormats.isEmpty()) {
+            QList<int> formats = rangeFormatsInRow(row_num);
+            for (int i=0; i<formats.size(); ++i) {
+                const CellRange &range = rangeFormats[formats[i]].range;
+                span_min = qMin(span_min, qMax(range.firstColumn(), dimension.firstColumn()));
+                span_max = qMax(span_max, qMin(range.lastColumn(), dimension.lastColumn()));
+            }
+        }
         if (comments.contains(row_num)) {
             for (int col_num = dimension.firstColumn(); col_num <= dimension.lastColumn(); col_num++) {
                 if (comments[row_num].contains(col_num)) {
@@ -198,11 +223,13 @@ QSharedPointer<Worksheet> Worksheet::copy(const QString &distName, int distId) c
 
     sheet_d->dimension = d->dimension;
 
-    QMapIterator<int, QMap<int, QSharedPointer<Cell> > > it(d->cellTable);
+    sheet_d->cellTable.reserve(d->cellTable.size());
+    QHashIterator<int, XlsxCellRow> it(d->cellTable);
     while (it.hasNext()) {
         it.next();
         int row = it.key();
-        QMapIterator<int, QSharedPointer<Cell> > it2(it.value());
+        sheet_d->cellTable[row].reserve(it.value().size());
+        QHashIterator<int, QSharedPointer<Cell> > it2(it.value());
         while (it2.hasNext()) {
             it2.next();
             int col = it2.key();
@@ -213,11 +240,19 @@ QSharedPointer<Worksheet> Worksheet::copy(const QString &distName, int distId) c
             if (cell->dataType() == Cell::String)
                 d->workbook->sharedStrings()->addSharedString(cell->d_ptr->richString);
 
-            sheet_d->cellTable[row][col] = cell;
+            sheet_d->cellRow(row)[col] = cell;
         }
     }
 
     sheet_d->merges = d->merges;
+    sheet_d->sharedFormulas = d->sharedFormulas;
+    sheet_d->nextSharedIndex = d->nextSharedIndex;
+    if (d->formulaEngine)
+        sheet_d->formulaEngine = new FormulaEngine(sheet_d);
+    sheet_d->calculationThreadCount = d->calculationThreadCount;
+    sheet_d->valueIndexEnabled = d->valueIndexEnabled;
+    sheet_d->rangeFormats = d->rangeFormats;
+    sheet_d->rangeFormatIndex = d->rangeFormatIndex;
 //    sheet_d->rowsInfo = d->rowsInfo;
 //    sheet_d->colsInfo = d->colsInfo;
 //    sheet_d->colsInfoHelper = d->colsInfoHelper;
@@ -259,6 +294,9 @@ void Worksheet::setSheetName(const QString &sheetName)
 {
     Q_D(Worksheet);
     d->name = sheetName;
+    //References qualified with the own sheet name are parsed again
+    if (d->formulaEngine)
+        d->formulaEngine->invalidate();
 }
 
 /*!
@@ -603,6 +641,312 @@ QVariant Worksheet::read(int row, int column) const
     return cell->value();
 }
 
+/*
+   Returns true if \a value, the value of a cell, is a number. Cells
+   written as integers, such as the formula cells not calculated yet,
+   hold numbers too.
+*/
+static inline bool isNumberValue(const QVariant &value)
+{
+    switch (value.userType()) {
+    case QMetaType::Double:
+    case QMetaType::Float:
+    case QMetaType::Int:
+    case QMetaType::UInt:
+    case QMetaType::LongLong:
+    case QMetaType::ULongLong:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*!
+    Returns the numeric value of the cell (\a row, \a column), without
+    going through a QVariant or the date and formula handling of read().
+    Date cells return their serial number and formula cells their cached
+    result.
+
+    If \a ok is not 0, *ok is set to false when the cell doesn't exist
+    or doesn't hold a number, and 0 is returned.
+ */
+double Worksheet::readDouble(int row, int column, bool *ok) const
+{
+    const Cell *cell = cellAt(row, column);
+    bool isNumber = cell && isNumberValue(cell->d_ptr->value);
+    if (ok)
+        *ok = isNumber;
+    return isNumber ? cell->d_ptr->value.toDouble() : 0.0;
+}
+
+/*!
+    Returns the text of the cell (\a row, \a column). Rich strings are
+    returned as plain text.
+
+    If \a ok is not 0, *ok is set to false when the cell doesn't exist
+    or doesn't hold a string, and an empty string is returned.
+ */
+QString Worksheet::readString(int row, int column, bool *ok) const
+{
+    const Cell *cell = cellAt(row, column);
+    bool isString = cell && cell->d_ptr->dataType != Cell::Error
+            && cell->d_ptr->value.type() == QVariant::String;
+    if (ok)
+        *ok = isString;
+    return isString ? cell->d_ptr->value.toString() : QString();
+}
+
+/*!
+    Returns the boolean value of the cell (\a row, \a column).
+
+    If \a ok is not 0, *ok is set to false when the cell doesn't exist
+    or doesn't hold a boolean, and false is returned.
+ */
+bool Worksheet::readBool(int row, int column, bool *ok) const
+{
+    const Cell *cell = cellAt(row, column);
+    bool isBool = cell && cell->d_ptr->value.type() == QVariant::Bool;
+    if (ok)
+        *ok = isBool;
+    return isBool ? cell->d_ptr->value.toBool() : false;
+}
+
+template <typename Iterator>
+static bool itemKeyLessThan(const Iterator &a, const Iterator &b)
+{
+    return a.key() < b.key();
+}
+
+/*
+   Collects the items of \a hash whose keys are within [\a first, \a last],
+   in no particular order. Keys are looked up one by one when the interval
+   is smaller than the hash, otherwise the whole hash is walked once.
+*/
+template <typename T>
+static void hashItemsInRange(const QHash<int, T> &hash, int first, int last,
+                             QVector<typename QHash<int, T>::const_iterator> &items)
+{
+    items.clear();
+    if (last - first < hash.size()) {
+        for (int key = first; key <= last; ++key) {
+            typename QHash<int, T>::const_iterator it = hash.constFind(key);
+            if (it != hash.constEnd())
+                items.append(it);
+        }
+    } else {
+        typename QHash<int, T>::const_iterator it = hash.constBegin();
+        for (; it != hash.constEnd(); ++it) {
+            if (it.key() >= first && it.key() <= last)
+                items.append(it);
+        }
+    }
+}
+
+template <typename T>
+static QList<int> keysInRange(const QHash<int, T> &hash, int first, int last)
+{
+    QVector<typename QHash<int, T>::const_iterator> items;
+    hashItemsInRange(hash, first, last, items);
+    QList<int> keys;
+    for (int i=0; i<items.size(); ++i)
+        keys.append(items[i].key());
+    return keys;
+}
+
+template <typename T>
+static QList<int> keysInRange(const QMap<int, T> &map, int first, int last)
+{
+    QList<int> keys;
+    typename QMap<int, T>::const_iterator it = map.lowerBound(first);
+    for (; it != map.constEnd() && it.key() <= last; ++it)
+        keys.append(it.key());
+    return keys;
+}
+
+/*!
+    Returns the numeric values of the cells in \a range, row by row.
+    Positions which are empty or don't hold a number are NaN.
+
+    Only the cells present in the sheet are visited, so pulling a long
+    column costs one lookup per row rather than one per cell.
+ */
+QVector<double> Worksheet::readDoubles(const CellRange &range) const
+{
+    Q_D(const Worksheet);
+    if (!range.isValid())
+        return QVector<double>();
+
+    const int columnCount = range.columnCount();
+    QVector<double> values(range.rowCount() * columnCount, qQNaN());
+    double *data = values.data();
+
+    QVector<XlsxCellTable::const_iterator> rows;
+    QVector<XlsxCellRow::const_iterator> cells;
+    hashItemsInRange(d->cellTable, range.firstRow(), range.lastRow(), rows);
+    for (int i=0; i<rows.size(); ++i) {
+        double *rowData = data + (rows[i].key() - range.firstRow()) * columnCount;
+        hashItemsInRange(rows[i].value(), range.firstColumn(), range.lastColumn(), cells);
+        for (int j=0; j<cells.size(); ++j) {
+            const QVariant &value = cells[j].value()->d_ptr->value;
+            if (isNumberValue(value))
+                rowData[cells[j].key() - range.firstColumn()] = value.toDouble();
+        }
+    }
+    return values;
+}
+
+/*!
+    Returns the texts of the cells in \a range, row by row. Positions
+    which are empty or don't hold a string are empty strings.
+ */
+QVector<QString> Worksheet::readStrings(const CellRange &range) const
+{
+    Q_D(const Worksheet);
+    if (!range.isValid())
+        return QVector<QString>();
+
+    const int columnCount = range.columnCount();
+    QVector<QString> values(range.rowCount() * columnCount);
+    QString *data = values.data();
+
+    QVector<XlsxCellTable::const_iterator> rows;
+    QVector<XlsxCellRow::const_iterator> cells;
+    hashItemsInRange(d->cellTable, range.firstRow(), range.lastRow(), rows);
+    for (int i=0; i<rows.size(); ++i) {
+        QString *rowData = data + (rows[i].key() - range.firstRow()) * columnCount;
+        hashItemsInRange(rows[i].value(), range.firstColumn(), range.lastColumn(), cells);
+        for (int j=0; j<cells.size(); ++j) {
+            const CellPrivate *cell = cells[j].value()->d_ptr;
+            if (cell->dataType != Cell::Error && cell->value.type() == QVariant::String)
+                rowData[cells[j].key() - range.firstColumn()] = cell->value.toString();
+        }
+    }
+    return values;
+}
+
+/*
+   Appends the numeric values of the cells in \a range to \a numbers, so
+   the aggregates run over contiguous doubles whatever else the range
+   holds. Cells are taken row by row, so that sums are rounded the same
+   way from one run to the next whatever the hash order.
+*/
+void WorksheetPrivate::collectNumbers(const CellRange &range, QVector<double> &numbers) const
+{
+    if (!range.isValid())
+        return;
+
+    QVector<XlsxCellTable::const_iterator> rows;
+    QVector<XlsxCellRow::const_iterator> cells;
+    hashItemsInRange(cellTable, range.firstRow(), range.lastRow(), rows);
+    qSort(rows.begin(), rows.end(), itemKeyLessThan<XlsxCellTable::const_iterator>);
+    for (int i=0; i<rows.size(); ++i) {
+        hashItemsInRange(rows[i].value(), range.firstColumn(), range.lastColumn(), cells);
+        qSort(cells.begin(), cells.end(), itemKeyLessThan<XlsxCellRow::const_iterator>);
+        for (int j=0; j<cells.size(); ++j) {
+            const QVariant &value = cells[j].value()->d_ptr->value;
+            if (isNumberValue(value))
+                numbers.append(value.toDouble());
+        }
+    }
+}
+
+/*!
+    Returns the sum of the numeric values of the cells in \a range.
+    Text, booleans and empty cells are ignored, as in Excel's SUM().
+ */
+double Worksheet::sum(const CellRange &range) const
+{
+    Q_D(const Worksheet);
+    QVector<double> numbers;
+    d->collectNumbers(range, numbers);
+    return xlsxSum(numbers.constData(), numbers.size());
+}
+
+/*!
+    Returns the mean of the numeric values of the cells in \a range, or
+    NaN if there are none.
+ */
+double Worksheet::mean(const CellRange &range) const
+{
+    Q_D(const Worksheet);
+    QVector<double> numbers;
+    d->collectNumbers(range, numbers);
+    if (numbers.isEmpty())
+        return qQNaN();
+    return xlsxSum(numbers.constData(), numbers.size()) / numbers.size();
+}
+
+/*!
+    Returns the smallest numeric value of the cells in \a range, or NaN
+    if there are none.
+ */
+double Worksheet::minimum(const CellRange &range) const
+{
+    Q_D(const Worksheet);
+    QVector<double> numbers;
+    d->collectNumbers(range, numbers);
+    if (numbers.isEmpty())
+        return qQNaN();
+    double min, max;
+    xlsxMinMax(numbers.constData(), numbers.size(), &min, &max);
+    return min;
+}
+
+/*!
+    Returns the largest numeric value of the cells in \a range, or NaN
+    if there are none.
+ */
+double Worksheet::maximum(const CellRange &range) const
+{
+    Q_D(const Worksheet);
+    QVector<double> numbers;
+    d->collectNumbers(range, numbers);
+    if (numbers.isEmpty())
+        return qQNaN();
+    double min, max;
+    xlsxMinMax(numbers.constData(), numbers.size(), &min, &max);
+    return max;
+}
+
+/*!
+    Returns the sample standard deviation of the numeric values of the
+    cells in \a range, as Excel's STDEV() does, or NaN if there are less
+    than two.
+ */
+double Worksheet::standardDeviation(const CellRange &range) const
+{
+    Q_D(const Worksheet);
+    QVector<double> numbers;
+    d->collectNumbers(range, numbers);
+    if (numbers.size() < 2)
+        return qQNaN();
+    double mean = xlsxSum(numbers.constData(), numbers.size()) / numbers.size();
+    return sqrt(xlsxSumOfSquares(numbers.constData(), numbers.size(), mean) / (numbers.size() - 1));
+}
+
+/*!
+    Returns the number of cells in \a range holding a numeric value.
+ */
+int Worksheet::count(const CellRange &range) const
+{
+    Q_D(const Worksheet);
+    QVector<double> numbers;
+    d->collectNumbers(range, numbers);
+    return numbers.size();
+}
+
+/*!
+    Returns the number of cells in \a range holding a numeric value
+    between \a lower and \a upper, inclusive.
+ */
+int Worksheet::countBetween(const CellRange &range, double lower, double upper) const
+{
+    Q_D(const Worksheet);
+    QVector<double> numbers;
+    d->collectNumbers(range, numbers);
+    return xlsxCountBetween(numbers.constData(), numbers.size(), lower, upper);
+}
+
 /*!
  * \overload
  * Returns the cell at the position \a row_column.
@@ -624,21 +968,25 @@ Cell *Worksheet::cellAt(const QString &row_column) const
 Cell *Worksheet::cellAt(int row, int column) const
 {
     Q_D(const Worksheet);
-    if (!d->cellTable.contains(row))
+    XlsxCellTable::const_iterator rowIt = d->cellTable.constFind(row);
+    if (rowIt == d->cellTable.constEnd())
         return 0;
-    if (!d->cellTable[row].contains(column))
+    XlsxCellRow::const_iterator it = rowIt.value().constFind(column);
+    if (it == rowIt.value().constEnd())
         return 0;
 
-    return d->cellTable[row][column].data();
+    return it.value().data();
 }
 
 Format WorksheetPrivate::cellFormat(int row, int col) const
 {
-    if (!cellTable.contains(row))
+    XlsxCellTable::const_iterator rowIt = cellTable.constFind(row);
+    if (rowIt == cellTable.constEnd())
         return Format();
-    if (!cellTable[row].contains(col))
+    XlsxCellRow::const_iterator it = rowIt.value().constFind(col);
+    if (it == rowIt.value().constEnd())
         return Format();
-    return cellTable[row][col]->format();
+    return it.value()->format();
 }
 
 /*!
@@ -676,7 +1024,8 @@ int Worksheet::writeString(int row, int column, const RichString &value, const F
     d->workbook->styles()->addXfFormat(fmt);
     QSharedPointer<Cell> cell = QSharedPointer<Cell>(new Cell(QString(), Cell::String, fmt, this));
     cell->d_ptr->richString = value;
-    d->cellTable[row][column] = cell;
+    d->cellRow(row)[column] = cell;
+    d->cellChanged(row, column);
     return error;
 }
 
@@ -713,7 +1062,8 @@ int Worksheet::writeString(int row, int column, const QString &value, const Form
     d->sharedStrings()->addSharedString(content);
     Format fmt = format.isValid() ? format : d->cellFormat(row, column);
     d->workbook->styles()->addXfFormat(fmt);
-    d->cellTable[row][column] = QSharedPointer<Cell>(new Cell(content, Cell::String, fmt, this));
+    d->cellRow(row)[column] = QSharedPointer<Cell>(new Cell(content, Cell::String, fmt, this));
+    d->cellChanged(row, column);
     return error;
 }
 
@@ -749,7 +1099,8 @@ int Worksheet::writeInlineString(int row, int column, const QString &value, cons
 
     Format fmt = format.isValid() ? format : d->cellFormat(row, column);
     d->workbook->styles()->addXfFormat(fmt);
-    d->cellTable[row][column] = QSharedPointer<Cell>(new Cell(value, Cell::InlineString, fmt, this));
+    d->cellRow(row)[column] = QSharedPointer<Cell>(new Cell(value, Cell::InlineString, fmt, this));
+    d->cellChanged(row, column);
     return error;
 }
 
@@ -778,7 +1129,8 @@ int Worksheet::writeNumeric(int row, int column, double value, const Format &for
 
     Format fmt = format.isValid() ? format : d->cellFormat(row, column);
     d->workbook->styles()->addXfFormat(fmt);
-    d->cellTable[row][column] = QSharedPointer<Cell>(new Cell(value, Cell::Numeric, fmt, this));
+    d->cellRow(row)[column] = QSharedPointer<Cell>(new Cell(value, Cell::Numeric, fmt, this));
+    d->cellChanged(row, column);
     return 0;
 }
 
@@ -815,7 +1167,8 @@ int Worksheet::writeFormula(int row, int column, const QString &formula, const F
     d->workbook->styles()->addXfFormat(fmt);
     Cell *data = new Cell(result, Cell::Formula, fmt, this);
     data->d_ptr->formula = _formula;
-    d->cellTable[row][column] = QSharedPointer<Cell>(data);
+    d->cellRow(row)[column] = QSharedPointer<Cell>(data);
+    d->cellChanged(row, column);
 
     return error;
 }
@@ -847,12 +1200,13 @@ int Worksheet::writeArrayFormula(const CellRange &range, const QString &formula,
                 QSharedPointer<Cell> data(new Cell(0, Cell::ArrayFormula, _format, this));
                 data->d_ptr->formula = _formula;
                 data->d_ptr->range = range;
-                d->cellTable[row][column] = data;
+                d->cellRow(row)[column] = data;
             } else {
-                d->cellTable[row][column] = QSharedPointer<Cell>(new Cell(0, Cell::Numeric, _format, this));
+                d->cellRow(row)[column] = QSharedPointer<Cell>(new Cell(0, Cell::Numeric, _format, this));
             }
         }
     }
+    d->rangeChanged(range);
 
     return error;
 }
@@ -866,6 +1220,63 @@ int Worksheet::writeArrayFormula(const QString &range, const QString &formula, c
     return writeArrayFormula(CellRange(range), formula, format);
 }
 
+/*!
+    Fill the \a range with the \a formula of its top-left cell, with the \a format.
+    The relative references of \a formula are moved for the other cells, as
+    Excel's fill down and fill right do.
+
+    The cells are saved as one shared formula, so the formula text is only
+    written once for the whole range.
+*/
+int Worksheet::writeSharedFormula(const CellRange &range, const QString &formula, const Format &format)
+{
+    Q_D(Worksheet);
+    int error = 0;
+
+    if (d->checkDimensions(range.firstRow(), range.firstColumn()))
+        return -1;
+    if (d->checkDimensions(range.lastRow(), range.lastColumn()))
+        return -1;
+    if (range.rowCount() == 1 && range.columnCount() == 1)
+        return writeFormula(range.firstRow(), range.firstColumn(), formula, format);
+
+    QString _formula = formula;
+    //Remove the formula '=' sign if exists
+    if (_formula.startsWith(QLatin1String("=")))
+        _formula.remove(0,1);
+
+    int si = d->nextSharedIndex++;
+    for (int row=range.firstRow(); row<=range.lastRow(); ++row) {
+        XlsxCellRow &cells = d->cellRow(row);
+        for (int column=range.firstColumn(); column<=range.lastColumn(); ++column) {
+            Format _format = format.isValid() ? format : d->cellFormat(row, column);
+            d->workbook->styles()->addXfFormat(_format);
+            QSharedPointer<Cell> data(new Cell(0, Cell::Formula, _format, this));
+            data->d_ptr->sharedIndex = si;
+            if (row == range.firstRow() && column == range.firstColumn()) {
+                data->d_ptr->formula = _formula;
+                data->d_ptr->range = range;
+            } else {
+                data->d_ptr->formula = xl_shift_formula(_formula, row - range.firstRow(), column - range.firstColumn());
+            }
+            cells[column] = data;
+        }
+    }
+    d->sharedFormulas[si] = QPoint(range.firstRow(), range.firstColumn());
+    d->rangeChanged(range);
+
+    return error;
+}
+
+/*!
+    \overload
+    Fill the \a range with the \a formula of its top-left cell, with the \a format.
+ */
+int Worksheet::writeSharedFormula(const QString &range, const QString &formula, const Format &format)
+{
+    return writeSharedFormula(CellRange(range), formula, format);
+}
+
 /*!
     \overload
     Write a empty cell \a row_column with the \a format
@@ -892,7 +1303,8 @@ int Worksheet::writeBlank(int row, int column, const Format &format)
     Format fmt = format.isValid() ? format : d->cellFormat(row, column);
     d->workbook->styles()->addXfFormat(fmt);
 
-    d->cellTable[row][column] = QSharedPointer<Cell>(new Cell(QVariant(), Cell::Blank, fmt, this));
+    d->cellRow(row)[column] = QSharedPointer<Cell>(new Cell(QVariant(), Cell::Blank, fmt, this));
+    d->cellChanged(row, column);
 
     return 0;
 }
@@ -921,7 +1333,8 @@ int Worksheet::writeBool(int row, int column, bool value, const Format &format)
 
     Format fmt = format.isValid() ? format : d->cellFormat(row, column);
     d->workbook->styles()->addXfFormat(fmt);
-    d->cellTable[row][column] = QSharedPointer<Cell>(new Cell(value, Cell::Boolean, fmt, this));
+    d->cellRow(row)[column] = QSharedPointer<Cell>(new Cell(value, Cell::Boolean, fmt, this));
+    d->cellChanged(row, column);
 
     return 0;
 }
@@ -955,7 +1368,8 @@ int Worksheet::writeDateTime(int row, int column, const QDateTime &dt, const For
 
     double value = datetimeToNumber(dt, d->workbook->isDate1904());
 
-    d->cellTable[row][column] = QSharedPointer<Cell>(new Cell(value, Cell::Numeric, fmt, this));
+    d->cellRow(row)[column] = QSharedPointer<Cell>(new Cell(value, Cell::Numeric, fmt, this));
+    d->cellChanged(row, column);
 
     return 0;
 }
@@ -988,7 +1402,8 @@ int Worksheet::writeTime(int row, int column, const QTime &t, const Format &form
         fmt.setNumberFormat(QStringLiteral("hh:mm:ss"));
     d->workbook->styles()->addXfFormat(fmt);
 
-    d->cellTable[row][column] = QSharedPointer<Cell>(new Cell(timeToNumber(t), Cell::Numeric, fmt, this));
+    d->cellRow(row)[column] = QSharedPointer<Cell>(new Cell(timeToNumber(t), Cell::Numeric, fmt, this));
+    d->cellChanged(row, column);
 
     return 0;
 }
@@ -1053,7 +1468,8 @@ int Worksheet::writeHyperlink(int row, int column, const QUrl &url, const Format
 
     //Write the hyperlink string as normal string.
     d->sharedStrings()->addSharedString(displayString);
-    d->cellTable[row][column] = QSharedPointer<Cell>(new Cell(displayString, Cell::String, fmt, this));
+    d->cellRow(row)[column] = QSharedPointer<Cell>(new Cell(displayString, Cell::String, fmt, this));
+    d->cellChanged(row, column);
 
     //Store the hyperlink data in a separate table
     d->urlTable[row][column] = QSharedPointer<XlsxHyperlinkData>(new XlsxHyperlinkData(XlsxHyperlinkData::External, urlString, locationString, QString(), tip));
@@ -1071,7 +1487,7 @@ bool Worksheet::addDataValidation(const DataValidation &validation)
     if (validation.ranges().isEmpty() || validation.validationType()==DataValidation::None)
         return false;
 
-    d->dataValidationsList.append(validation);
+    d->appendDataValidation(validation);
     return true;
 }
 
@@ -1091,7 +1507,7 @@ bool Worksheet::addConditionalFormatting(const ConditionalFormatting &cf)
             d->workbook->styles()->addDxfFormat(rule->dxfFormat);
         rule->priority = 1;
     }
-    d->conditionalFormattingList.append(cf);
+    d->appendConditionalFormatting(cf);
     return true;
 }
 
@@ -1102,7 +1518,25 @@ int Worksheet::insertImage(int row, int column, const QImage &image, const QPoin
 {
     Q_D(Worksheet);
 
-    d->imageList.append(new XlsxImageData(row, column, image, offset, xScale, yScale));
+    QSharedPointer<MediaFile> media(new MediaFile(image));
+    d->imageList.append(new XlsxImageData(row, column, media, offset, xScale, yScale));
+    return 0;
+}
+
+/*!
+ * \internal
+ * \overload
+ * Inserts an image from the png or jpeg file contents \a data, which are
+ * written to the package as is. Returns -1 if the format is not supported.
+ */
+int Worksheet::insertImage(int row, int column, const QByteArray &data, const QPointF &offset, double xScale, double yScale)
+{
+    Q_D(Worksheet);
+
+    QSharedPointer<MediaFile> media = MediaFile::fromEncodedData(data);
+    if (!media)
+        return -1;
+    d->imageList.append(new XlsxImageData(row, column, media, offset, xScale, yScale));
     return 0;
 }
 
@@ -1110,7 +1544,10 @@ int Worksheet::insertImage(int row, int column, const QImage &image, const QPoin
     Merge a \a range of cells. The first cell should contain the data and the others should
     be blank. All cells will be applied the same style if a valid \a format is given.
 
-    \note All cells except the top-left one will be cleared.
+    \note All cells except the top-left one will be removed, with their
+    values and their own formats.
+
+    Returns -1 if \a range overlaps cells which are already merged.
  */
 int Worksheet::mergeCells(const CellRange &range, const Format &format)
 {
@@ -1118,29 +1555,33 @@ int Worksheet::mergeCells(const CellRange &range, const Format &format)
     if (range.rowCount() < 2 && range.columnCount() < 2)
         return -1;
 
+    if (d->merges.intersects(range))
+        return -1;
+
     if (d->checkDimensions(range.firstRow(), range.firstColumn()))
         return -1;
 
+    //The cells of the merged area don't need to exist, the format is kept
+    //for the range and saved with blank cells.
     if (format.isValid())
-        d->workbook->styles()->addXfFormat(format);
-
-    for (int row = range.firstRow(); row <= range.lastRow(); ++row) {
-        for (int col = range.firstColumn(); col <= range.lastColumn(); ++col) {
-            if (row == range.firstRow() && col == range.firstColumn()) {
-                Cell *cell = cellAt(row, col);
-                if (cell) {
-                    if (format.isValid())
-                        cell->d_ptr->format = format;
-                } else {
-                    writeBlank(row, col, format);
-                }
-            } else {
-                writeBlank(row, col, format);
-            }
+        d->setRangeFormat(range, format);
+    else
+        d->checkDimensions(range.lastRow(), range.lastColumn());
+
+    //Remove the cells other than the top-left one, the merged area is
+    //saved with blank cells of the range format.
+    foreach (int row, keysInRange(d->cellTable, range.firstRow(), range.lastRow())) {
+        XlsxCellTable::iterator it = d->cellTable.find(row);
+        foreach (int col, keysInRange(it.value(), range.firstColumn(), range.lastColumn())) {
+            if (row != range.firstRow() || col != range.firstColumn())
+                it.value().remove(col);
         }
+        if (it.value().isEmpty())
+            d->cellTable.erase(it);
     }
+    d->rangeChanged(range);
 
-    d->merges.append(range);
+    d->merges.insert(range, 0);
     return 0;
 }
 
@@ -1149,7 +1590,8 @@ int Worksheet::mergeCells(const CellRange &range, const Format &format)
     Merge a \a range of cells. The first cell should contain the data and the others should
     be blank. All cells will be applied the same style if a valid \a format is given.
 
-    \note All cells except the top-left one will be cleared.
+    \note All cells except the top-left one will be removed, with their
+    values and their own formats.
  */
 int Worksheet::mergeCells(const QString &range, const Format &format)
 {
@@ -1171,10 +1613,10 @@ int Worksheet::mergeCells(const QString &range, const Format &format)
 int Worksheet::unmergeCells(const CellRange &range)
 {
     Q_D(Worksheet);
-    if (!d->merges.contains(range))
+    if (d->merges.lastRangeAt(range.firstRow(), range.firstColumn()) != range)
         return -1;
 
-    d->merges.removeOne(range);
+    d->merges.remove(range, 0);
     return 0;
 }
 
@@ -1203,7 +1645,48 @@ int Worksheet::unmergeCells(const QString &range)
 QList<CellRange> Worksheet::mergedCells() const
 {
     Q_D(const Worksheet);
-    return d->merges;
+    return d->merges.ranges();
+}
+
+/*!
+    Returns the merged range which contains the cell (\a row, \a column),
+    or an invalid range if the cell isn't merged.
+*/
+CellRange Worksheet::mergedRangeAt(int row, int column) const
+{
+    Q_D(const Worksheet);
+    return d->merges.lastRangeAt(row, column);
+}
+
+/*!
+    Returns the data validations which apply to the cell (\a row, \a column).
+*/
+QList<DataValidation> Worksheet::validationsAt(int row, int column) const
+{
+    Q_D(const Worksheet);
+    QList<DataValidation> validations;
+    QList<int> indexes = d->dataValidationIndex.valuesAt(row, column);
+    for (int i=0; i<indexes.size(); ++i) {
+        //A validation with overlapping ranges is met more than once.
+        if (i == 0 || indexes[i] != indexes[i-1])
+            validations.append(d->dataValidationsList[indexes[i]]);
+    }
+    return validations;
+}
+
+/*!
+    Returns the conditional formattings which apply to the cell (\a row, \a column).
+*/
+QList<ConditionalFormatting> Worksheet::conditionalFormattingsAt(int row, int column) const
+{
+    Q_D(const Worksheet);
+    QList<ConditionalFormatting> formattings;
+    QList<int> indexes = d->conditionalFormattingIndex.valuesAt(row, column);
+    for (int i=0; i<indexes.size(); ++i) {
+        if (i == 0 || indexes[i] != indexes[i-1])
+            formattings.append(d->conditionalFormattingList[indexes[i]]);
+    }
+    return formattings;
 }
 
 void Worksheet::saveToXmlFile(QIODevice *device) const
@@ -1299,8 +1782,7 @@ void Worksheet::saveToXmlFile(QIODevice *device) const
     writer.writeEndElement();//sheetData
 
     d->saveXmlMergeCells(writer);
-    foreach (const ConditionalFormatting cf, d->conditionalFormattingList)
-        cf.saveToXml(writer);
+    d->saveXmlConditionalFormattings(writer);
     d->saveXmlDataValidations(writer);
     d->saveXmlHyperlinks(writer);
     d->saveXmlDrawings(writer);
@@ -1313,7 +1795,12 @@ void WorksheetPrivate::saveXmlSheetData(QXmlStreamWriter &writer) const
 {
     calculateSpans();
     for (int row_num = dimension.firstRow(); row_num <= dimension.lastRow(); row_num++) {
-        if (!(cellTable.contains(row_num) || comments.contains(row_num) || rowsInfo.contains(row_num))) {
+        QList<int> formats;
+        if (!rangeFormats.isEmpty())
+            formats = rangeFormatsInRow(row_num);
+
+        if (!(cellTable.contains(row_num) || comments.contains(row_num) || rowsInfo.contains(row_num)
+              || !formats.isEmpty())) {
             //Only process rows with cell data / comments / formatting
             continue;
         }
@@ -1323,7 +1810,9 @@ void WorksheetPrivate::saveXmlSheetData(QXmlStreamWriter &writer) const
         if (row_spans.contains(span_index))
             span = row_spans[span_index];
 
-        if (cellTable.contains(row_num)) {
+        XlsxCellTable::const_iterator rowIt = cellTable.constFind(row_num);
+        const XlsxCellRow *cells = rowIt != cellTable.constEnd() ? &rowIt.value() : 0;
+        if (cells || !formats.isEmpty()) {
             writer.writeStartElement(QStringLiteral("row"));
             writer.writeAttribute(QStringLiteral("r"), QString::number(row_num));
 
@@ -1349,8 +1838,14 @@ void WorksheetPrivate::saveXmlSheetData(QXmlStreamWriter &writer) const
             }
 
             for (int col_num = dimension.firstColumn(); col_num <= dimension.lastColumn(); col_num++) {
-                if (cellTable[row_num].contains(col_num)) {
-                    saveXmlCellData(writer, row_num, col_num, cellTable[row_num][col_num]);
+                XlsxCellRow::const_iterator it;
+                if (cells && (it = cells->constFind(col_num)) != cells->constEnd()) {
+                    saveXmlCellData(writer, row_num, col_num, it.value());
+                } else if (!formats.isEmpty()) {
+                    //Styled but empty
+                    Format format = rangeFormatInRow(formats, col_num);
+                    if (!format.isEmpty())
+                        saveXmlBlankCell(writer, row_num, col_num, format);
                 }
             }
             writer.writeEndElement(); //row
@@ -1362,6 +1857,38 @@ void WorksheetPrivate::saveXmlSheetData(QXmlStreamWriter &writer) const
     }
 }
 
+void WorksheetPrivate::saveXmlBlankCell(QXmlStreamWriter &writer, int row, int col, const Format &format) const
+{
+    writer.writeStartElement(QStringLiteral("c"));
+    writer.writeAttribute(QStringLiteral("r"), xl_rowcol_to_cell_fast(row, col));
+    writer.writeAttribute(QStringLiteral("s"), QString::number(format.xfIndex()));
+    writer.writeEndElement(); //c
+}
+
+/*
+   Writes the "t" attribute of a formula cell from the type of its cached
+   \a value, and returns the text of its <v> element. A null string is
+   returned if the cell has no cached value.
+*/
+static QString writeFormulaValueType(QXmlStreamWriter &writer, const QVariant &value)
+{
+    if (!value.isValid())
+        return QString();
+    if (value.userType() == QMetaType::Bool) {
+        writer.writeAttribute(QStringLiteral("t"), QStringLiteral("b"));
+        return value.toBool() ? QStringLiteral("1") : QStringLiteral("0");
+    }
+    if (value.userType() == QMetaType::QString) {
+        QString text = value.toString();
+        if (FormulaValue::isErrorText(text))
+            writer.writeAttribute(QStringLiteral("t"), QStringLiteral("e"));
+        else
+            writer.writeAttribute(QStringLiteral("t"), QStringLiteral("str"));
+        return text;
+    }
+    return QString::number(value.toDouble(), 'g', 15);
+}
+
 void WorksheetPrivate::saveXmlCellData(QXmlStreamWriter &writer, int row, int col, QSharedPointer<Cell> cell) const
 {
     //This is the innermost loop so efficiency is important.
@@ -1370,9 +1897,12 @@ void WorksheetPrivate::saveXmlCellData(QXmlStreamWriter &writer, int row, int co
     writer.writeStartElement(QStringLiteral("c"));
     writer.writeAttribute(QStringLiteral("r"), cell_pos);
 
-    //Style used by the cell, row or col
+    //Style used by the cell, range, row or col
+    Format rangeFmt;
     if (!cell->format().isEmpty())
         writer.writeAttribute(QStringLiteral("s"), QString::number(cell->format().xfIndex()));
+    else if (!(rangeFmt = rangeFormat(row, col)).isEmpty())
+        writer.writeAttribute(QStringLiteral("s"), QString::number(rangeFmt.xfIndex()));
     else if (rowsInfo.contains(row) && !rowsInfo[row]->format.isEmpty())
         writer.writeAttribute(QStringLiteral("s"), QString::number(rowsInfo[row]->format.xfIndex()));
     else if (colsInfoHelper.contains(col) && !colsInfoHelper[col]->format.isEmpty())
@@ -1402,31 +1932,53 @@ void WorksheetPrivate::saveXmlCellData(QXmlStreamWriter &writer, int row, int co
                 }
                 writer.writeStartElement(QStringLiteral("t"));
                 writer.writeAttribute(QStringLiteral("xml:space"), QStringLiteral("preserve"));
-                writer.writeCharacters(string.fragmentText(i));
+                xl_write_characters(writer, string.fragmentText(i));
                 writer.writeEndElement();// t
                 writer.writeEndElement(); // r
             }
         } else {
-            writer.writeTextElement(QStringLiteral("t"), cell->value().toString());
+            xl_write_text_element(writer, QStringLiteral("t"), cell->value().toString());
         }
         writer.writeEndElement();//is
     } else if (cell->dataType() == Cell::Numeric){
         double value = cell->value().toDouble();
         writer.writeTextElement(QStringLiteral("v"), QString::number(value, 'g', 15));
     } else if (cell->dataType() == Cell::Formula) {
-        bool ok = true;
-        cell->formula().toDouble(&ok);
-        if (!ok) //is string
-            writer.writeAttribute(QStringLiteral("t"), QStringLiteral("str"));
-        writer.writeTextElement(QStringLiteral("f"), cell->formula());
-        writer.writeTextElement(QStringLiteral("v"), cell->value().toString());
+        QString valueText = writeFormulaValueType(writer, cell->value());
+        QSharedPointer<Cell> master;
+        if (cell->d_ptr->sharedIndex >= 0)
+            master = sharedFormulaMaster(cell->d_ptr->sharedIndex);
+        const CellRange &ref = master ? master->d_ptr->range : CellRange();
+        if (master && row >= ref.firstRow() && row <= ref.lastRow()
+                && col >= ref.firstColumn() && col <= ref.lastColumn()
+                && isSharedFormulaDerived(cell.data(), row, col)) {
+            //The text of a shared formula is only written in its master cell
+            if (master == cell) {
+                writer.writeStartElement(QStringLiteral("f"));
+                writer.writeAttribute(QStringLiteral("t"), QStringLiteral("shared"));
+                writer.writeAttribute(QStringLiteral("ref"), ref.toString());
+                writer.writeAttribute(QStringLiteral("si"), QString::number(cell->d_ptr->sharedIndex));
+                xl_write_characters(writer, cell->formula());
+                writer.writeEndElement(); //f
+            } else {
+                writer.writeEmptyElement(QStringLiteral("f"));
+                writer.writeAttribute(QStringLiteral("t"), QStringLiteral("shared"));
+                writer.writeAttribute(QStringLiteral("si"), QString::number(cell->d_ptr->sharedIndex));
+            }
+        } else {
+            xl_write_text_element(writer, QStringLiteral("f"), cell->formula());
+        }
+        if (!valueText.isNull())
+            xl_write_text_element(writer, QStringLiteral("v"), valueText);
     } else if (cell->dataType() == Cell::ArrayFormula) {
+        QString valueText = writeFormulaValueType(writer, cell->value());
         writer.writeStartElement(QStringLiteral("f"));
         writer.writeAttribute(QStringLiteral("t"), QStringLiteral("array"));
         writer.writeAttribute(QStringLiteral("ref"), cell->d_ptr->range.toString());
-        writer.writeCharacters(cell->formula());
+        xl_write_characters(writer, cell->formula());
         writer.writeEndElement(); //f
-        writer.writeTextElement(QStringLiteral("v"), cell->value().toString());
+        if (!valueText.isNull())
+            xl_write_text_element(writer, QStringLiteral("v"), valueText);
     } else if (cell->dataType() == Cell::Boolean) {
         writer.writeAttribute(QStringLiteral("t"), QStringLiteral("b"));
         writer.writeTextElement(QStringLiteral("v"), cell->value().toBool() ? QStringLiteral("1") : QStringLiteral("0"));
@@ -1442,9 +1994,9 @@ void WorksheetPrivate::saveXmlMergeCells(QXmlStreamWriter &writer) const
         return;
 
     writer.writeStartElement(QStringLiteral("mergeCells"));
-    writer.writeAttribute(QStringLiteral("count"), QString::number(merges.size()));
+    writer.writeAttribute(QStringLiteral("count"), QString::number(merges.count()));
 
-    foreach (CellRange range, merges) {
+    foreach (CellRange range, merges.ranges()) {
         QString cell1 = xl_rowcol_to_cell(range.firstRow(), range.firstColumn());
         QString cell2 = xl_rowcol_to_cell(range.lastRow(), range.lastColumn());
         writer.writeEmptyElement(QStringLiteral("mergeCell"));
@@ -1459,15 +2011,80 @@ void WorksheetPrivate::saveXmlDataValidations(QXmlStreamWriter &writer) const
     if (dataValidationsList.isEmpty())
         return;
 
+    //Validations differing only by their ranges are saved as one, with
+    //their ranges coalesced. Relative references are relative to the top
+    //left cell of the first range, so validations which have some are
+    //saved as they are.
+    QList<DataValidation> validations;
+    QHash<QString, int> validationIndexes;
+    foreach (DataValidation validation, dataValidationsList) {
+        if (validation.d->hasRelativeReferences()) {
+            validations.append(validation);
+            continue;
+        }
+        QString key = validation.d->ruleKey();
+        QHash<QString, int>::const_iterator it = validationIndexes.constFind(key);
+        if (it == validationIndexes.constEnd()) {
+            validationIndexes.insert(key, validations.size());
+            validations.append(validation);
+        } else {
+            validations[it.value()].d->ranges += validation.d->ranges;
+        }
+    }
+
     writer.writeStartElement(QStringLiteral("dataValidations"));
-    writer.writeAttribute(QStringLiteral("count"), QString::number(dataValidationsList.size()));
+    writer.writeAttribute(QStringLiteral("count"), QString::number(validations.size()));
 
-    foreach (DataValidation validation, dataValidationsList)
+    for (int i=0; i<validations.size(); ++i) {
+        DataValidation &validation = validations[i];
+        if (!validation.d->hasRelativeReferences())
+            validation.d->ranges = xl_coalesce_ranges(validation.d->ranges);
         validation.saveToXml(writer);
+    }
 
     writer.writeEndElement(); //dataValidations
 }
 
+void WorksheetPrivate::saveXmlConditionalFormattings(QXmlStreamWriter &writer) const
+{
+    //Same as the validations. Rules comparing each cell with the others
+    //of the ranges would mean something else over merged ranges, so they
+    //are not merged either. Rules can't be hashed, so only the ones with
+    //the same first rule type are compared.
+    QList<ConditionalFormatting> formattings;
+    QHash<QString, QList<int> > candidates;
+    foreach (ConditionalFormatting cf, conditionalFormattingList) {
+        if (cf.d->hasRelativeReferences() || cf.d->hasRangeRules()) {
+            formattings.append(cf);
+            continue;
+        }
+        QString key = QString::number(cf.d->cfRules.size());
+        if (!cf.d->cfRules.isEmpty())
+            key += cf.d->cfRules[0]->attrs.value(XlsxCfRuleData::A_type).toString();
+
+        QList<int> &indexes = candidates[key];
+        bool merged = false;
+        for (int i=0; i<indexes.size() && !merged; ++i) {
+            ConditionalFormatting &other = formattings[indexes[i]];
+            if (other.d->hasSameRules(*cf.d)) {
+                other.d->ranges += cf.d->ranges;
+                merged = true;
+            }
+        }
+        if (!merged) {
+            indexes.append(formattings.size());
+            formattings.append(cf);
+        }
+    }
+
+    for (int i=0; i<formattings.size(); ++i) {
+        ConditionalFormatting &cf = formattings[i];
+        if (!cf.d->hasRelativeReferences())
+            cf.d->ranges = xl_coalesce_ranges(cf.d->ranges);
+        cf.saveToXml(writer);
+    }
+}
+
 void WorksheetPrivate::saveXmlHyperlinks(QXmlStreamWriter &writer) const
 {
     if (urlTable.isEmpty())
@@ -1753,37 +2370,266 @@ bool Worksheet::groupColumns(int colFirst, int colLast, bool collapsed)
 }
 
 /*!
-    Return the range that contains cell data.
+    \overload
+    Applies \a format to all the cells in \a range.
  */
-CellRange Worksheet::dimension() const
+bool Worksheet::setRangeFormat(const QString &range, const Format &format)
 {
-    Q_D(const Worksheet);
-    return d->dimension;
+    return setRangeFormat(CellRange(range), format);
 }
 
-Drawing *Worksheet::drawing() const
+/*!
+    Applies \a format to all the cells in \a range.
+
+    The format is registered once and kept for the whole range instead of
+    being stored in every cell. Cells written later into the range without
+    a format of their own use it, and it takes precedence over the formats
+    of rows and columns. Cells that already exist in the range get \a format,
+    the empty ones are saved as blank cells of that style.
+
+    Returns false if \a range is not valid.
+ */
+bool Worksheet::setRangeFormat(const CellRange &range, const Format &format)
 {
-    Q_D(const Worksheet);
-    return d->drawing;
+    Q_D(Worksheet);
+    if (!range.isValid() || range.firstRow() < 1 || range.firstColumn() < 1
+            || range.lastRow() >= XLSX_ROW_MAX || range.lastColumn() >= XLSX_COLUMN_MAX)
+        return false;
+
+    d->setRangeFormat(range, format);
+    return true;
 }
 
-QList<XlsxImageData *> Worksheet::images() const
+/*!
+    Return the range that contains cell data.
+ */
+CellRange Worksheet::dimension() const
 {
     Q_D(const Worksheet);
-    return d->imageList;
+    return d->dimension;
 }
 
-void Worksheet::clearExtraDrawingInfo()
-{
+/*!
+    Reserves storage for \a rows rows of \a columns cells each.
+
+    Call this before filling a sheet whose size is known in advance, so
+    that the cell storage doesn't have to grow step by step.
+ */
+void Worksheet::reserve(int rows, int columns)
+{
+    Q_D(Worksheet);
+    d->reserveCells(rows, columns);
+}
+
+/*!
+    Inserts \a count empty rows before \a row. Returns false if \a row or
+    \a count is out of range.
+
+    The cells below move down, together with the merged cells, hyperlinks,
+    range formats, data validations, conditional formattings, row heights
+    and images. The references to the moved cells are updated in the
+    formulas of the workbook, in the defined names and print areas, and
+    in the formulas of the data validation and conditional formatting
+    rules. Rows pushed past the last row of the sheet are removed.
+
+    This is not a cheap operation. Cells are stored by row, so every row
+    below \a row is re-keyed, its cells moving with it; then every cell
+    of the workbook is visited to update the formulas. The cost grows
+    with the number of cells, not with the number of rows moved.
+
+    \sa removeRows(), insertColumns()
+ */
+bool Worksheet::insertRows(int row, int count)
+{
+    Q_D(Worksheet);
+    if (row < 1 || row > XLSX_ROW_MAX || count < 1)
+        return false;
+    d->moveCells(true, row, count);
+    return true;
+}
+
+/*!
+    Removes \a count rows starting at \a row. Returns false if \a row or
+    \a count is out of range.
+
+    The cells below move up. References of the formulas to removed cells
+    become #REF!, and ranges which lose some of their rows shrink. The
+    cost is the same as for insertRows().
+
+    \sa insertRows(), removeColumns()
+ */
+bool Worksheet::removeRows(int row, int count)
+{
+    Q_D(Worksheet);
+    if (row < 1 || row > XLSX_ROW_MAX || count < 1)
+        return false;
+    d->moveCells(true, row, -qMin(count, XLSX_ROW_MAX - row + 1));
+    return true;
+}
+
+/*!
+    Inserts \a count empty columns before \a column. Returns false if
+    \a column or \a count is out of range.
+
+    Everything moves as insertRows() describes. Columns are keys inside
+    each row, so every cell right of \a column is re-keyed, in every
+    row: the cost grows with the number of cells of the sheet, not with
+    the number of columns moved.
+
+    \sa insertRows(), removeColumns()
+ */
+bool Worksheet::insertColumns(int column, int count)
+{
+    Q_D(Worksheet);
+    if (column < 1 || column > XLSX_COLUMN_MAX || count < 1)
+        return false;
+    d->moveCells(false, column, count);
+    return true;
+}
+
+/*!
+    Removes \a count columns starting at \a column. Returns false if
+    \a column or \a count is out of range.
+
+    As with insertColumns(), every cell right of the removed columns is
+    re-keyed, so the cost grows with the number of cells of the sheet.
+
+    \sa removeRows(), insertColumns()
+ */
+bool Worksheet::removeColumns(int column, int count)
+{
+    Q_D(Worksheet);
+    if (column < 1 || column > XLSX_COLUMN_MAX || count < 1)
+        return false;
+    d->moveCells(false, column, -qMin(count, XLSX_COLUMN_MAX - column + 1));
+    return true;
+}
+
+/*!
+    Returns whether the formulas of the sheet are evaluated when the
+    document is saved. The default is false.
+
+    \sa setCalculationEnabled(), calculate()
+ */
+bool Worksheet::isCalculationEnabled() const
+{
+    Q_D(const Worksheet);
+    return d->formulaEngine != 0;
+}
+
+/*!
+    If  enable is true, the formulas of the sheet are evaluated when
+    the document is saved, so that the saved file contains their results.
+
+    The sheet then keeps track of which cells each formula reads, and
+    only the formulas affected by the cells written since the previous
+    calculation are evaluated again.
+
+    \sa calculate()
+ */
+void Worksheet::setCalculationEnabled(bool enable)
+{
+    Q_D(Worksheet);
+    if (enable == (d->formulaEngine != 0))
+        return;
+    if (enable) {
+        d->formulaEngine = new FormulaEngine(d);
+    } else {
+        delete d->formulaEngine;
+        d->formulaEngine = 0;
+    }
+}
+
+/*!
+    Returns the number of threads used to evaluate the formulas.
+    The default is 1.
+
+    \sa setCalculationThreadCount()
+ */
+int Worksheet::calculationThreadCount() const
+{
+    Q_D(const Worksheet);
+    return d->calculationThreadCount;
+}
+
+/*!
+    Sets the number of threads used to evaluate the formulas to \a count.
+    If \a count is 0, QThread::idealThreadCount() threads are used.
+
+    Formulas are grouped by dependency level, the formulas of a level
+    only reading the results of the previous levels. The levels are
+    evaluated one after the other, and the formulas of large levels by
+    several threads at once.
+ */
+void Worksheet::setCalculationThreadCount(int count)
+{
+    Q_D(Worksheet);
+    d->calculationThreadCount = qMax(count, 0);
+}
+
+/*!
+    Evaluates the formulas of the sheet and stores their results as the
+    cell values, which read() then returns. Returns the number of
+    formulas evaluated and the time taken.
+
+    The usual operators and a set of common functions such as SUM, IF,
+    VLOOKUP or CONCATENATE are supported. Other functions give #NAME?.
+    Formulas which are part of a circular reference give 0.
+
+    If calculation isn't enabled, all the formulas are evaluated.
+
+    \sa setCalculationEnabled(), setCalculationThreadCount()
+ */
+CalculationStatistics Worksheet::calculate()
+{
+    Q_D(Worksheet);
+    if (d->formulaEngine)
+        return d->formulaEngine->calculate();
+
+    FormulaEngine engine(d);
+    return engine.calculate();
+}
+
+/*!
+    Stops the running calculate() of this sheet as soon as possible.
+    This function can be called from any thread. It has no effect if no
+    calculation is running: a cancel arriving after a calculation ended
+    doesn't stop the next one.
+
+    The formulas which were not evaluated keep their previous results.
+    If calculation is enabled, they are evaluated by the next calculate().
+ */
+void Worksheet::cancelCalculation()
+{
+    Q_D(Worksheet);
+    d->calculationCanceled.store(d->calculationRun.load());
+}
+
+Drawing *Worksheet::drawing() const
+{
+    Q_D(const Worksheet);
+    return d->drawing;
+}
+
+QList<XlsxImageData *> Worksheet::images() const
+{
+    Q_D(const Worksheet);
+    return d->imageList;
+}
+
+void Worksheet::clearExtraDrawingInfo()
+{
     Q_D(Worksheet);
     if (d->drawing) {
         delete d->drawing;
         d->drawing = 0;
         d->drawingLinks.clear();
     }
+    //Row and column geometry used by prepareImage()
+    d->updatePixelSizes();
 }
 
-void Worksheet::prepareImage(int index, int image_id)
+void Worksheet::prepareImage(int index, int media_id)
 {
     Q_D(Worksheet);
     if (!d->drawing) {
@@ -1796,8 +2642,8 @@ void Worksheet::prepareImage(int index, int image_id)
     XlsxDrawingDimensionData *data = new XlsxDrawingDimensionData;
     data->drawing_type = 2;
 
-    double width = imageData->image.width() * imageData->xScale;
-    double height = imageData->image.height() * imageData->yScale;
+    double width = imageData->media->size().width() * imageData->xScale;
+    double height = imageData->media->size().height() * imageData->yScale;
 
     XlsxObjectPositionData posData = d->pixelsToEMUs(d->objectPixelsPosition(imageData->col, imageData->row, imageData->offset.x(), imageData->offset.y(), width, height));
     data->col_from = posData.col_start;
@@ -1815,46 +2661,61 @@ void Worksheet::prepareImage(int index, int image_id)
 
     d->drawing->dimensionList.append(data);
 
-    d->drawingLinks.append(QPair<QString, QString>(QStringLiteral("/image"), QStringLiteral("../media/image%1.png").arg(image_id)));
+    d->drawingLinks.append(QPair<QString, QString>(QStringLiteral("/image"), QStringLiteral("../media/image%1.%2").arg(media_id).arg(imageData->media->suffix())));
 }
 
 /*
- Convert the height of a cell from user's units to pixels. If the
- height hasn't been set by the user we use the default value. If
- the row is hidden it has a value of zero.
+ Convert the height of a cell from user's units to pixels.
 */
-int WorksheetPrivate::rowPixelsSize(int row) const
+static int rowHeightToPixels(double height)
 {
-    double height;
-    if (row_sizes.contains(row))
-        height = row_sizes[row];
-    else
-        height = default_row_height;
     return static_cast<int>(4.0 / 3.0 *height);
 }
 
 /*
  Convert the width of a cell from user's units to pixels. Excel rounds
- the column width to the nearest pixel. If the width hasn't been set
- by the user we use the default value. If the column is hidden it
- has a value of zero.
+ the column width to the nearest pixel.
 */
-int WorksheetPrivate::colPixelsSize(int col) const
+static int columnWidthToPixels(double width)
 {
     double max_digit_width = 7.0; //For Calabri 11
     double padding = 5.0;
-    int pixels = 0;
 
-    if (col_sizes.contains(col)) {
-        double width = col_sizes[col];
-        if (width < 1)
-            pixels = static_cast<int>(width * (max_digit_width + padding) + 0.5);
+    if (width < 1)
+        return static_cast<int>(width * (max_digit_width + padding) + 0.5);
+    return static_cast<int>(width * max_digit_width + 0.5) + padding;
+}
+
+/*
+ Collect the pixel sizes of the rows and columns from their infos.
+ If the height or width hasn't been set by the user we use the default
+ value. If the row or column is hidden it has a value of zero.
+*/
+void WorksheetPrivate::updatePixelSizes()
+{
+    row_sizes.clear(rowHeightToPixels(default_row_height));
+    QMapIterator<int, QSharedPointer<XlsxRowInfo> > rowIt(rowsInfo);
+    while (rowIt.hasNext()) {
+        rowIt.next();
+        QSharedPointer<XlsxRowInfo> info = rowIt.value();
+        if (info->hidden)
+            row_sizes.setSize(rowIt.key(), 0);
+        else if (info->height)
+            row_sizes.setSize(rowIt.key(), rowHeightToPixels(info->height));
+    }
+
+    col_sizes.clear(64);
+    foreach (QSharedPointer<XlsxColumnInfo> info, colsInfo) {
+        int pixels;
+        if (info->hidden)
+            pixels = 0;
+        else if (info->width)
+            pixels = columnWidthToPixels(info->width);
         else
-            pixels = static_cast<int>(width * max_digit_width + 0.5) + padding;
-    } else {
-        pixels = 64;
+            continue;
+        for (int col=info->firstColumn; col<=info->lastColumn; ++col)
+            col_sizes.setSize(col, pixels);
     }
-    return pixels;
 }
 
 /*
@@ -1873,39 +2734,17 @@ int WorksheetPrivate::colPixelsSize(int col) const
 */
 XlsxObjectPositionData WorksheetPrivate::objectPixelsPosition(int col_start, int row_start, double x1, double y1, double width, double height) const
 {
-    double x_abs = 0;
-    double y_abs = 0;
-    for (int col_id = 1; col_id < col_start; ++col_id)
-        x_abs += colPixelsSize(col_id);
-    x_abs += x1;
-    for (int row_id = 1; row_id < row_start; ++row_id)
-        y_abs += rowPixelsSize(row_id);
-    y_abs += y1;
+    double x_abs = col_sizes.position(col_start) + x1;
+    double y_abs = row_sizes.position(row_start) + y1;
 
     // Adjust start column for offsets that are greater than the col width.
-    while (x1 > colPixelsSize(col_start)) {
-        x1 -= colPixelsSize(col_start);
-        col_start += 1;
-    }
-    while (y1 > rowPixelsSize(row_start)) {
-        y1 -= rowPixelsSize(row_start);
-        row_start += 1;
-    }
+    col_start = col_sizes.indexAt(col_start, &x1);
+    row_start = row_sizes.indexAt(row_start, &y1);
 
-    int col_end = col_start;
-    int row_end = row_start;
     double x2 = width + x1;
     double y2 = height + y1;
-
-    while (x2 > colPixelsSize(col_end)) {
-        x2 -= colPixelsSize(col_end);
-        col_end += 1;
-    }
-
-    while (y2 > rowPixelsSize(row_end)) {
-        y2 -= rowPixelsSize(row_end);
-        row_end += 1;
-    }
+    int col_end = col_sizes.indexAt(col_start, &x2);
+    int row_end = row_sizes.indexAt(row_start, &y2);
 
     XlsxObjectPositionData data;
     data.col_start = col_start;
@@ -1957,13 +2796,15 @@ QByteArray Worksheet::saveToXmlData() const
     return data;
 }
 
-QSharedPointer<Cell> WorksheetPrivate::loadXmlNumericCellData(QXmlStreamReader &reader)
+QSharedPointer<Cell> WorksheetPrivate::loadXmlNumericCellData(QXmlStreamReader &reader, const QPoint &pos)
 {
     Q_ASSERT(reader.name() == QLatin1String("c"));
 
     QString v_str;
     QString f_str;
     QSharedPointer<Cell> cell;
+    int si = -1;
+    CellRange ref;
     while (!reader.atEnd() && !(reader.name() == QLatin1String("c") && reader.tokenType() == QXmlStreamReader::EndElement)) {
         reader.readNextStartElement();
         if (reader.tokenType() == QXmlStreamReader::StartElement) {
@@ -1971,26 +2812,37 @@ QSharedPointer<Cell> WorksheetPrivate::loadXmlNumericCellData(QXmlStreamReader &
                 v_str = reader.readElementText();
             } else if (reader.name() == QLatin1String("f")) {
                 QXmlStreamAttributes fAttrs = reader.attributes();
-                if (fAttrs.hasAttribute(QLatin1String("array"))) {
+                QStringRef type = fAttrs.value(QLatin1String("t"));
+                if (fAttrs.hasAttribute(QLatin1String("ref")))
+                    ref = CellRange(fAttrs.value(QLatin1String("ref")).toString());
+                if (type == QLatin1String("array")) {
                     cell = QSharedPointer<Cell>(new Cell(0, Cell::ArrayFormula));
-                    cell->d_ptr->range = CellRange(fAttrs.value(QLatin1String("ref")).toString());
+                    cell->d_ptr->range = ref;
                 } else {
                     cell = QSharedPointer<Cell>(new Cell(0, Cell::Formula));
+                    if (type == QLatin1String("shared"))
+                        si = xl_string_to_int(fAttrs.value(QLatin1String("si")));
                 }
-                f_str = reader.readElementText();
+                f_str = xl_unescape_characters(reader.readElementText());
             }
         }
     }
 
-    if (v_str.isEmpty() && f_str.isEmpty()) {
+    if (si >= 0) {
+        //shared formula, keep the value only if its master cell was not loaded
+        if (!setSharedFormula(cell.data(), pos.x(), pos.y(), si, f_str, ref))
+            return QSharedPointer<Cell>(new Cell(xl_string_to_double(v_str), Cell::Numeric));
+        cell->d_ptr->value = xl_string_to_double(v_str);
+        return cell;
+    } else if (v_str.isEmpty() && f_str.isEmpty()) {
         //blank type
         return QSharedPointer<Cell>(new Cell(QVariant(), Cell::Blank));
     } else if (f_str.isEmpty()) {
         //numeric type
-        return QSharedPointer<Cell>(new Cell(v_str.toDouble(), Cell::Numeric));
+        return QSharedPointer<Cell>(new Cell(xl_string_to_double(v_str), Cell::Numeric));
     } else {
         //formula type
-        cell->d_ptr->value = v_str.toDouble();
+        cell->d_ptr->value = xl_string_to_double(v_str);
         cell->d_ptr->formula = f_str;
     }
 
@@ -2002,6 +2854,15 @@ void WorksheetPrivate::loadXmlSheetData(QXmlStreamReader &reader)
     Q_Q(Worksheet);
     Q_ASSERT(reader.name() == QLatin1String("sheetData"));
 
+    const bool filterCells = loadOptions.hasCellSelection();
+    const bool valuesOnly = loadOptions.profile() == LoadOptions::ValuesOnly;
+
+    //Consecutive cells usually share the same style, so remember the last one.
+    int lastStyleIndex = -1;
+    Format lastFormat;
+
+    //Attribute values are parsed in place from QStringRef, no QString is
+    //created for them.
     while (!reader.atEnd() && !(reader.name() == QLatin1String("sheetData") && reader.tokenType() == QXmlStreamReader::EndElement)) {
         reader.readNextStartElement();
 
@@ -2009,6 +2870,16 @@ void WorksheetPrivate::loadXmlSheetData(QXmlStreamReader &reader)
             if (reader.name() == QLatin1String("row")) {
                 QXmlStreamAttributes attributes = reader.attributes();
 
+                if (filterCells && attributes.hasAttribute(QLatin1String("r"))
+                        && !loadOptions.isRowSelected(xl_string_to_int(attributes.value(QLatin1String("r"))))) {
+                    //None of the cells of this row is wanted.
+                    reader.skipCurrentElement();
+                    continue;
+                }
+
+                if (valuesOnly)
+                    continue;
+
                 if (attributes.hasAttribute(QLatin1String("customFormat"))
                         || attributes.hasAttribute(QLatin1String("customHeight"))
                         || attributes.hasAttribute(QLatin1String("hidden"))
@@ -2017,42 +2888,52 @@ void WorksheetPrivate::loadXmlSheetData(QXmlStreamReader &reader)
 
                     QSharedPointer<XlsxRowInfo> info(new XlsxRowInfo);
                     if (attributes.hasAttribute(QLatin1String("customFormat")) && attributes.hasAttribute(QLatin1String("s"))) {
-                        int idx = attributes.value(QLatin1String("s")).toString().toInt();
+                        int idx = xl_string_to_int(attributes.value(QLatin1String("s")));
                         info->format = workbook->styles()->xfFormat(idx);
                     }
                     if (attributes.hasAttribute(QLatin1String("customHeight")) && attributes.hasAttribute(QLatin1String("ht"))) {
-                        info->height = attributes.value(QLatin1String("ht")).toString().toDouble();
+                        info->height = attributes.value(QLatin1String("ht")).toDouble();
                     }
                     //both "hidden" and "collapsed" default are false
                     info->hidden = attributes.value(QLatin1String("hidden")) == QLatin1String("1");
                     info->collapsed = attributes.value(QLatin1String("collapsed")) == QLatin1String("1");
 
                     if (attributes.hasAttribute(QLatin1String("outlineLevel")))
-                        info->outlineLevel = attributes.value(QLatin1String("outlineLevel")).toString().toInt();
+                        info->outlineLevel = xl_string_to_int(attributes.value(QLatin1String("outlineLevel")));
 
                     //"r" is optional too.
                     if (attributes.hasAttribute(QLatin1String("r"))) {
-                        int row = attributes.value(QLatin1String("r")).toString().toInt();
+                        int row = xl_string_to_int(attributes.value(QLatin1String("r")));
                         rowsInfo[row] = info;
                     }
                 }
 
             } else if (reader.name() == QLatin1String("c")) {
                 QXmlStreamAttributes attributes = reader.attributes();
-                QString r = attributes.value(QLatin1String("r")).toString();
-                QPoint pos = xl_cell_to_rowcol(r);
+                QPoint pos = xl_cell_to_rowcol(attributes.value(QLatin1String("r")));
+
+                if (filterCells && !loadOptions.isCellSelected(pos.x(), pos.y())) {
+                    //Skip the cell before its style and value are looked at.
+                    reader.skipCurrentElement();
+                    continue;
+                }
 
                 //get format
                 Format format;
-                if (attributes.hasAttribute(QLatin1String("s"))) {
-                    int idx = attributes.value(QLatin1String("s")).toString().toInt();
-                    format = workbook->styles()->xfFormat(idx);
-                    if (!format.isValid())
-                        qDebug()<<QStringLiteral("<c s=\"%1\">Invalid style index: ").arg(idx)<<idx;
+                QStringRef styleRef = attributes.value(QLatin1String("s"));
+                if (!styleRef.isNull()) {
+                    int idx = xl_string_to_int(styleRef);
+                    if (idx != lastStyleIndex) {
+                        lastFormat = workbook->styles()->xfFormat(idx);
+                        lastStyleIndex = idx;
+                        if (!lastFormat.isValid())
+                            qDebug()<<QStringLiteral("<c s=\"%1\">Invalid style index: ").arg(idx)<<idx;
+                    }
+                    format = lastFormat;
                 }
 
-                if (attributes.hasAttribute(QLatin1String("t"))) {
-                    QString type = attributes.value(QLatin1String("t")).toString();
+                QStringRef type = attributes.value(QLatin1String("t"));
+                if (!type.isNull()) {
                     if (type == QLatin1String("s")) {
                         //string type
                         while (!reader.atEnd() && !(reader.name() == QLatin1String("c") && reader.tokenType() == QXmlStreamReader::EndElement)) {
@@ -2064,7 +2945,7 @@ void WorksheetPrivate::loadXmlSheetData(QXmlStreamReader &reader)
                                 QSharedPointer<Cell> data(new Cell(rs.toPlainString() ,Cell::String, format, q));
                                 if (rs.isRichString())
                                     data->d_ptr->richString = rs;
-                                cellTable[pos.x()][pos.y()] = QSharedPointer<Cell>(data);
+                                cellRow(pos.x())[pos.y()] = QSharedPointer<Cell>(data);
                             }
                         }
                     } else if (type == QLatin1String("inlineStr")) {
@@ -2074,9 +2955,9 @@ void WorksheetPrivate::loadXmlSheetData(QXmlStreamReader &reader)
                             if (reader.tokenType() == QXmlStreamReader::StartElement) {
                                 //:Todo, add rich text read support
                                 if (reader.name() == QLatin1String("t")) {
-                                    QString value = reader.readElementText();
+                                    QString value = xl_unescape_characters(reader.readElementText());
                                     QSharedPointer<Cell> data(new Cell(value, Cell::InlineString, format, q));
-                                    cellTable[pos.x()][pos.y()] = data;
+                                    cellRow(pos.x())[pos.y()] = data;
                                 }
                             }
                         }
@@ -2086,14 +2967,14 @@ void WorksheetPrivate::loadXmlSheetData(QXmlStreamReader &reader)
                         if (reader.name() == QLatin1String("v")) {
                             QString value = reader.readElementText();
                             QSharedPointer<Cell> data(new Cell(value.toInt() ? true : false, Cell::Boolean, format, q));
-                            cellTable[pos.x()][pos.y()] = data;
+                            cellRow(pos.x())[pos.y()] = data;
                         }
                     } else if (type == QLatin1String("str")) {
                         //formula type
-                        QSharedPointer<Cell> data = loadXmlNumericCellData(reader);
+                        QSharedPointer<Cell> data = loadXmlNumericCellData(reader, pos);
                         data->d_ptr->format = format;
                         data->d_ptr->parent = q;
-                        cellTable[pos.x()][pos.y()] = data;
+                        cellRow(pos.x())[pos.y()] = data;
                     } else if (type == QLatin1String("e")) {
                         //error type, such as #DIV/0! #NULL! #REF! etc
                         QString v_str, f_str;
@@ -2103,25 +2984,25 @@ void WorksheetPrivate::loadXmlSheetData(QXmlStreamReader &reader)
                                 if (reader.name() == QLatin1String("v"))
                                     v_str = reader.readElementText();
                                 else if (reader.name() == QLatin1String("f"))
-                                    f_str = reader.readElementText();
+                                    f_str = xl_unescape_characters(reader.readElementText());
                             }
                         }
                         QSharedPointer<Cell> data(new Cell(v_str, Cell::Error, format, q));
                         if (!f_str.isEmpty())
                             data->d_ptr->formula = f_str;
-                        cellTable[pos.x()][pos.y()] = data;
+                        cellRow(pos.x())[pos.y()] = data;
                     } else if (type == QLatin1String("n")) {
-                        QSharedPointer<Cell> data = loadXmlNumericCellData(reader);
+                        QSharedPointer<Cell> data = loadXmlNumericCellData(reader, pos);
                         data->d_ptr->format = format;
                         data->d_ptr->parent = q;
-                        cellTable[pos.x()][pos.y()] = data;
+                        cellRow(pos.x())[pos.y()] = data;
                     }
                 } else {
                     //default is "n"
-                    QSharedPointer<Cell> data = loadXmlNumericCellData(reader);
+                    QSharedPointer<Cell> data = loadXmlNumericCellData(reader, pos);
                     data->d_ptr->format = format;
                     data->d_ptr->parent = q;
-                    cellTable[pos.x()][pos.y()] = data;
+                    cellRow(pos.x())[pos.y()] = data;
                 }
             }
         }
@@ -2189,13 +3070,13 @@ void WorksheetPrivate::loadXmlMergeCells(QXmlStreamReader &reader)
                     QPoint p0 = xl_cell_to_rowcol(items[0]);
                     QPoint p1 = xl_cell_to_rowcol(items[1]);
 
-                    merges.append(CellRange(p0.x(), p0.y(), p1.x(), p1.y()));
+                    merges.insert(CellRange(p0.x(), p0.y(), p1.x(), p1.y()), 0);
                 }
             }
         }
     }
 
-    if (merges.size() != count)
+    if (merges.count() != count)
         qDebug("read merge cells error");
 }
 
@@ -2210,7 +3091,7 @@ void WorksheetPrivate::loadXmlDataValidations(QXmlStreamReader &reader)
         reader.readNextStartElement();
         if (reader.tokenType() == QXmlStreamReader::StartElement
                 && reader.name() == QLatin1String("dataValidation")) {
-            dataValidationsList.append(DataValidation::loadFromXml(reader));
+            appendDataValidation(DataValidation::loadFromXml(reader));
         }
     }
 
@@ -2273,18 +3154,331 @@ void WorksheetPrivate::loadXmlHyperlinks(QXmlStreamReader &reader)
     }
 }
 
+/*
+   The sheet is read by chunks of this size while sheetData is scanned,
+   and at most this much of it is searched for the start of sheetData.
+*/
+static const int XLSX_SHEET_SCAN_CHUNK_SIZE = 1024 * 1024;
+static const int XLSX_SHEET_HEAD_MAX_SIZE = 16 * 1024 * 1024;
+
+/*
+   Sequential device returning \a prefix, then the rest of \a device. It
+   lets QXmlStreamReader go on with the bytes read ahead by the scanner.
+*/
+class XlsxPrefixedDevice : public QIODevice
+{
+public:
+    XlsxPrefixedDevice(const QByteArray &prefix, QIODevice *device) :
+        m_prefix(prefix), m_pos(0), m_device(device)
+    {
+        open(QIODevice::ReadOnly);
+    }
+
+    bool isSequential() const
+    {
+        return true;
+    }
+
+    qint64 bytesAvailable() const
+    {
+        return m_prefix.size() - m_pos + m_device->bytesAvailable() + QIODevice::bytesAvailable();
+    }
+
+protected:
+    qint64 readData(char *data, qint64 maxlen)
+    {
+        if (m_pos < m_prefix.size()) {
+            qint64 len = qMin<qint64>(maxlen, m_prefix.size() - m_pos);
+            memcpy(data, m_prefix.constData() + m_pos, len);
+            m_pos += len;
+            return len;
+        }
+        return m_device->read(data, maxlen);
+    }
+
+    qint64 writeData(const char *, qint64)
+    {
+        return -1;
+    }
+
+private:
+    QByteArray m_prefix;
+    int m_pos;
+    QIODevice *m_device;
+};
+
+/*
+   Reads \a device up to the content of <sheetData>, then loads the rows
+   of sheetData with SheetDataScanner a chunk at a time, so that the sheet
+   is never held in memory as a whole. Returns the bytes read but not
+   loaded: the part before the rows, and what follows the scanned rows.
+   QXmlStreamReader is expected to parse them, followed by the rest of
+   \a device.
+
+   If the scanner meets anything it doesn't handle, the rows of the chunk
+   and the following ones are left to QXmlStreamReader. Cells are only
+   found by their "r" attribute, so it can take over at any row.
+*/
+QByteArray WorksheetPrivate::scanXmlSheetData(QIODevice *device)
+{
+    QByteArray head;
+    int start = -1;
+    int contentStart = -1;
+    while (contentStart == -1 && head.size() < XLSX_SHEET_HEAD_MAX_SIZE) {
+        QByteArray chunk = device->read(XLSX_SHEET_SCAN_CHUNK_SIZE);
+        if (chunk.isEmpty())
+            return head;
+        head.append(chunk);
+        if (start == -1)
+            start = head.indexOf("<sheetData");
+        if (start != -1)
+            contentStart = head.indexOf('>', start);
+    }
+    if (contentStart == -1)
+        return head;
+    char next = head.at(start + 10);
+    if (next != '>' && next != ' ' && next != '\t' && next != '\r' && next != '\n')
+        return head;
+    if (head.at(contentStart - 1) == '/')
+        return head; //<sheetData/>
+    ++contentStart;
+
+    //<dimension> comes before sheetData, size the cell storage from it.
+    int dimensionStart = head.lastIndexOf("<dimension ", start);
+    if (dimensionStart != -1) {
+        int refStart = head.indexOf("ref=\"", dimensionStart);
+        int refEnd = refStart == -1 ? -1 : head.indexOf('"', refStart + 5);
+        if (refEnd != -1 && refEnd < start) {
+            QString ref = QString::fromLatin1(head.constData() + refStart + 5, refEnd - refStart - 5);
+            reserveCells(CellRange(ref), device->size());
+        }
+    }
+
+    QByteArray rows = head.mid(contentStart);
+    head.truncate(contentStart);
+    while (true) {
+        //Only whole rows are scanned, the last row read may be incomplete.
+        int end = rows.indexOf("</sheetData>");
+        int cut = end != -1 ? end : rows.lastIndexOf("<row");
+        if (cut > 0) {
+            //Shared string references are only taken once the chunk is loaded.
+            QVector<int> sharedStringRefs;
+            SheetDataScanner scanner(rows.constData(), rows.constData() + cut);
+            if (!loadXmlSheetData(scanner, sharedStringRefs))
+                break;
+            for (int i=0; i<sharedStringRefs.size(); ++i)
+                sharedStrings()->incRefByStringIndex(sharedStringRefs[i]);
+            rows.remove(0, cut);
+        }
+        if (end != -1)
+            break;
+        QByteArray chunk = device->read(XLSX_SHEET_SCAN_CHUNK_SIZE);
+        if (chunk.isEmpty())
+            break;
+        rows.append(chunk);
+    }
+    reservedColumns = 0;
+
+    return head + rows;
+}
+
+/*
+   Counterpart of loadXmlSheetData(QXmlStreamReader &) working on the
+   tokens of SheetDataScanner. Returns false as soon as the scanner hits
+   something it doesn't handle.
+*/
+bool WorksheetPrivate::loadXmlSheetData(SheetDataScanner &scanner, QVector<int> &sharedStringRefs)
+{
+    Q_Q(Worksheet);
+
+    const bool filterCells = loadOptions.hasCellSelection();
+    const bool valuesOnly = loadOptions.profile() == LoadOptions::ValuesOnly;
+
+    int lastStyleIndex = -1;
+    Format lastFormat;
+
+    while (true) {
+        SheetDataScanner::TokenType token = scanner.readNext();
+        if (token == SheetDataScanner::EndOfData)
+            return true;
+
+        if (token == SheetDataScanner::RowStart) {
+            bool hasRow = scanner.hasAttribute("r");
+            int row = scanner.intAttribute("r");
+            if (filterCells && hasRow && !loadOptions.isRowSelected(row)) {
+                //None of the cells of this row is wanted.
+                do {
+                    token = scanner.readNext();
+                } while (token != SheetDataScanner::RowEnd && token != SheetDataScanner::Invalid
+                         && token != SheetDataScanner::EndOfData);
+                if (token != SheetDataScanner::RowEnd)
+                    return false;
+                continue;
+            }
+
+            if (valuesOnly)
+                continue;
+
+            if (scanner.hasAttribute("customFormat") || scanner.hasAttribute("customHeight")
+                    || scanner.hasAttribute("hidden") || scanner.hasAttribute("outlineLevel")
+                    || scanner.hasAttribute("collapsed")) {
+                QSharedPointer<XlsxRowInfo> info(new XlsxRowInfo);
+                if (scanner.hasAttribute("customFormat") && scanner.hasAttribute("s"))
+                    info->format = workbook->styles()->xfFormat(scanner.intAttribute("s"));
+                if (scanner.hasAttribute("customHeight") && scanner.hasAttribute("ht"))
+                    info->height = scanner.attribute("ht").toDouble();
+                //both "hidden" and "collapsed" default are false
+                info->hidden = scanner.attributeEquals("hidden", "1");
+                info->collapsed = scanner.attributeEquals("collapsed", "1");
+                if (scanner.hasAttribute("outlineLevel"))
+                    info->outlineLevel = scanner.intAttribute("outlineLevel");
+                //"r" is optional too.
+                if (hasRow)
+                    rowsInfo[row] = info;
+            }
+        } else if (token == SheetDataScanner::CellStart) {
+            QByteArray r = scanner.attribute("r");
+            QPoint pos = xl_cell_to_rowcol(r.constData(), r.size());
+            bool skip = filterCells && !loadOptions.isCellSelected(pos.x(), pos.y());
+
+            Format format;
+            if (!skip && scanner.hasAttribute("s")) {
+                int idx = scanner.intAttribute("s");
+                if (idx != lastStyleIndex) {
+                    lastFormat = workbook->styles()->xfFormat(idx);
+                    lastStyleIndex = idx;
+                    if (!lastFormat.isValid())
+                        qDebug()<<QStringLiteral("<c s=\"%1\">Invalid style index: ").arg(idx)<<idx;
+                }
+                format = lastFormat;
+            }
+
+            const bool hasType = scanner.hasAttribute("t");
+            QByteArray type = scanner.attribute("t");
+            const bool numeric = !hasType || type == "n" || type == "str";
+
+            //Collect the children of <c>, numbers are parsed in place.
+            QString v_str, f_str, t_str;
+            double v_num = 0;
+            bool hasValue = false, hasText = false;
+            bool isArray = false;
+            int si = -1;
+            CellRange ref;
+            while ((token = scanner.readNext()) != SheetDataScanner::CellEnd) {
+                bool ok = true;
+                if (token == SheetDataScanner::ValueText) {
+                    if (skip) {
+                        continue;
+                    } else if (numeric) {
+                        v_num = scanner.number();
+                        hasValue = !scanner.isTextEmpty();
+                    } else {
+                        v_str = scanner.text(&ok);
+                        hasValue = true;
+                    }
+                } else if (token == SheetDataScanner::FormulaText) {
+                    if (skip)
+                        continue;
+                    f_str = xl_unescape_characters(scanner.text(&ok));
+                    if (scanner.hasAttribute("ref"))
+                        ref = CellRange(QString::fromLatin1(scanner.attribute("ref")));
+                    if (scanner.attributeEquals("t", "shared"))
+                        si = scanner.intAttribute("si");
+                    else if (scanner.attributeEquals("t", "array"))
+                        isArray = true;
+                    else if (scanner.hasAttribute("t"))
+                        return false; //Data tables are left to QXmlStreamReader
+                } else if (token == SheetDataScanner::InlineStringText) {
+                    if (!skip)
+                        t_str = xl_unescape_characters(scanner.text(&ok));
+                    hasText = true;
+                } else {
+                    return false;
+                }
+                if (!ok)
+                    return false;
+            }
+            if (skip)
+                continue;
+
+            QSharedPointer<Cell> cell;
+            if (hasType && type == "s") {
+                if (hasValue) {
+                    int sst_idx = v_str.toInt();
+                    sharedStringRefs.append(sst_idx);
+                    RichString rs = sharedStrings()->getSharedString(sst_idx);
+                    cell = QSharedPointer<Cell>(new Cell(rs.toPlainString(), Cell::String, format, q));
+                    if (rs.isRichString())
+                        cell->d_ptr->richString = rs;
+                }
+            } else if (hasType && type == "inlineStr") {
+                if (hasText)
+                    cell = QSharedPointer<Cell>(new Cell(t_str, Cell::InlineString, format, q));
+            } else if (hasType && type == "b") {
+                if (hasValue)
+                    cell = QSharedPointer<Cell>(new Cell(v_str.toInt() ? true : false, Cell::Boolean, format, q));
+            } else if (hasType && type == "e") {
+                //error type, such as #DIV/0! #NULL! #REF! etc
+                cell = QSharedPointer<Cell>(new Cell(v_str, Cell::Error, format, q));
+                if (!f_str.isEmpty())
+                    cell->d_ptr->formula = f_str;
+            } else if (numeric) {
+                if (!hasValue && f_str.isEmpty()) {
+                    //blank type
+                    cell = QSharedPointer<Cell>(new Cell(QVariant(), Cell::Blank, format, q));
+                } else if (f_str.isEmpty()) {
+                    //numeric type
+                    cell = QSharedPointer<Cell>(new Cell(v_num, Cell::Numeric, format, q));
+                } else if (isArray) {
+                    cell = QSharedPointer<Cell>(new Cell(v_num, Cell::ArrayFormula, format, q));
+                    cell->d_ptr->formula = f_str;
+                    cell->d_ptr->range = ref;
+                } else if (si >= 0) {
+                    //shared formula, keep the value only if its master cell was not loaded
+                    cell = QSharedPointer<Cell>(new Cell(v_num, Cell::Formula, format, q));
+                    if (!setSharedFormula(cell.data(), pos.x(), pos.y(), si, f_str, ref))
+                        cell = QSharedPointer<Cell>(new Cell(v_num, Cell::Numeric, format, q));
+                } else {
+                    //formula type
+                    cell = QSharedPointer<Cell>(new Cell(v_num, Cell::Formula, format, q));
+                    cell->d_ptr->formula = f_str;
+                }
+            }
+            if (cell)
+                cellRow(pos.x())[pos.y()] = cell;
+        } else if (token != SheetDataScanner::RowEnd) {
+            return false;
+        }
+    }
+}
+
 bool Worksheet::loadFromXmlFile(QIODevice *device)
 {
     Q_D(Worksheet);
 
-    QXmlStreamReader reader(device);
+    //sheetData goes through the dedicated scanner, QXmlStreamReader then
+    //handles the rest.
+    qint64 size = device->size();
+    XlsxPrefixedDevice rest(d->scanXmlSheetData(device), device);
+
+    //Formatting and other non value parts are not wanted by a values only load.
+    const bool valuesOnly = d->loadOptions.profile() == LoadOptions::ValuesOnly;
+
+    QXmlStreamReader reader(&rest);
     while (!reader.atEnd()) {
         reader.readNextStartElement();
         if (reader.tokenType() == QXmlStreamReader::StartElement) {
-            if (reader.name() == QLatin1String("dimension")) {
+            if (valuesOnly && (reader.name() == QLatin1String("cols")
+                               || reader.name() == QLatin1String("dataValidations")
+                               || reader.name() == QLatin1String("conditionalFormatting")
+                               || reader.name() == QLatin1String("hyperlinks"))) {
+                reader.skipCurrentElement();
+            } else if (reader.name() == QLatin1String("dimension")) {
                 QXmlStreamAttributes attributes = reader.attributes();
                 QString range = attributes.value(QLatin1String("ref")).toString();
                 d->dimension = CellRange(range);
+                if (d->cellTable.isEmpty())
+                    d->reserveCells(d->dimension, size);
             } else if (reader.name() == QLatin1String("sheetViews")) {
                 d->loadXmlSheetViews(reader);
             } else if (reader.name() == QLatin1String("sheetFormatPr")) {
@@ -2300,16 +3494,35 @@ bool Worksheet::loadFromXmlFile(QIODevice *device)
             } else if (reader.name() == QLatin1String("conditionalFormatting")) {
                 ConditionalFormatting cf;
                 cf.loadFromXml(reader, workbook()->styles());
-                d->conditionalFormattingList.append(cf);
+                d->appendConditionalFormatting(cf);
             } else if (reader.name() == QLatin1String("hyperlinks")) {
                 d->loadXmlHyperlinks(reader);
             }
         }
     }
+    //The hint is for the file being loaded only.
+    d->reservedColumns = 0;
+    if (d->formulaEngine)
+        d->formulaEngine->invalidate();
+    d->invalidateValueIndex();
 
     return true;
 }
 
+/*!
+ * \internal
+ * Loads the sheet from \a device, keeping only the cells selected
+ * by \a options.
+ */
+bool Worksheet::loadFromXmlFile(QIODevice *device, const LoadOptions &options)
+{
+    Q_D(Worksheet);
+    d->loadOptions = options;
+    bool ret = loadFromXmlFile(device);
+    d->loadOptions = LoadOptions();
+    return ret;
+}
+
 bool Worksheet::loadFromXmlData(const QByteArray &data)
 {
     QBuffer buffer;
@@ -2328,6 +3541,852 @@ SharedStrings *WorksheetPrivate::sharedStrings() const
     return workbook->sharedStrings();
 }
 
+void WorksheetPrivate::appendDataValidation(const DataValidation &validation)
+{
+    dataValidationsList.append(validation);
+    foreach (CellRange range, validation.ranges())
+        dataValidationIndex.insert(range, dataValidationsList.size() - 1);
+}
+
+void WorksheetPrivate::appendConditionalFormatting(const ConditionalFormatting &cf)
+{
+    conditionalFormattingList.append(cf);
+    foreach (CellRange range, cf.ranges())
+        conditionalFormattingIndex.insert(range, conditionalFormattingList.size() - 1);
+}
+
+/*
+   Returns the format given to the cell (\a row, \a col) by the last
+   setRangeFormat() covering it, if any.
+*/
+Format WorksheetPrivate::rangeFormat(int row, int col) const
+{
+    if (rangeFormatIndex.isEmpty())
+        return Format();
+    int idx = rangeFormatIndex.lastValueAt(row, col);
+    return idx == -1 ? Format() : rangeFormats[idx].format;
+}
+
+/*
+   Returns the indexes in rangeFormats of the range formats which cover
+   some cells of \a row, oldest first.
+*/
+QList<int> WorksheetPrivate::rangeFormatsInRow(int row) const
+{
+    return rangeFormatIndex.valuesIntersecting(CellRange(row, 1, row, XLSX_COLUMN_MAX));
+}
+
+/*
+   Same as rangeFormat() for a cell of the row whose range formats are \a formats.
+*/
+Format WorksheetPrivate::rangeFormatInRow(const QList<int> &formats, int col) const
+{
+    for (int i=formats.size()-1; i>=0; --i) {
+        const XlsxRangeFormat &rangeFormat = rangeFormats[formats[i]];
+        if (col >= rangeFormat.range.firstColumn() && col <= rangeFormat.range.lastColumn())
+            return rangeFormat.format;
+    }
+    return Format();
+}
+
+/*
+   Gives \a format to \a range without creating any cell. The format is
+   registered once; cells already present in the range share it.
+*/
+void WorksheetPrivate::setRangeFormat(const CellRange &range, const Format &format)
+{
+    workbook->styles()->addXfFormat(format);
+    rangeFormats.append(XlsxRangeFormat(range, format));
+    rangeFormatIndex.insert(range, rangeFormats.size() - 1);
+
+    //Empty styled cells are saved, so they belong to the dimension.
+    if (!format.isEmpty()) {
+        checkDimensions(range.firstRow(), range.firstColumn());
+        checkDimensions(range.lastRow(), range.lastColumn());
+    }
+
+    QVector<XlsxCellTable::const_iterator> rows;
+    QVector<XlsxCellRow::const_iterator> cells;
+    hashItemsInRange(cellTable, range.firstRow(), range.lastRow(), rows);
+    for (int i=0; i<rows.size(); ++i) {
+        hashItemsInRange(rows[i].value(), range.firstColumn(), range.lastColumn(), cells);
+        for (int j=0; j<cells.size(); ++j)
+            cells[j].value()->d_ptr->format = format;
+    }
+}
+
+/*
+   Moves the items of the columns [\a firstColumn, \a lastColumn] of the
+   rows [\a firstRow, \a firstRow + \a rowCount) from \a map to \a parts,
+   one part per row.
+*/
+template<typename Map>
+static void takeRowParts(Map &map, int firstRow, int rowCount, int firstColumn, int lastColumn,
+                         QVector<typename Map::mapped_type> &parts)
+{
+    parts.resize(rowCount);
+    foreach (int row, keysInRange(map, firstRow, firstRow + rowCount - 1)) {
+        typename Map::iterator it = map.find(row);
+        typename Map::mapped_type &items = it.value();
+        foreach (int column, keysInRange(items, firstColumn, lastColumn))
+            parts[row - firstRow].insert(column, items.take(column));
+        if (items.isEmpty())
+            map.erase(it);
+    }
+}
+
+/*
+   Returns true if sorting the rows of \a range would break an array
+   formula of \a cellTable: an array spanning several rows, or sticking
+   out of the columns of \a range, which overlaps \a range.
+*/
+static bool sortSplitsArrayFormula(const XlsxCellTable &cellTable, const CellRange &range)
+{
+    //Arrays are stored in their top left cell, which can be above range.
+    XlsxCellTable::const_iterator rowIt = cellTable.constBegin();
+    for (; rowIt != cellTable.constEnd(); ++rowIt) {
+        if (rowIt.key() > range.lastRow())
+            continue;
+        XlsxCellRow::const_iterator it = rowIt.value().constBegin();
+        for (; it != rowIt.value().constEnd(); ++it) {
+            const CellPrivate *cell = it.value()->d_ptr;
+            if (cell->dataType != Cell::ArrayFormula || !cell->range.isValid())
+                continue;
+            const CellRange &array = cell->range;
+            if (array.firstRow() > range.lastRow() || array.lastRow() < range.firstRow()
+                    || array.firstColumn() > range.lastColumn() || array.lastColumn() < range.firstColumn())
+                continue;
+            if (array.rowCount() > 1 || array.firstColumn() < range.firstColumn()
+                    || array.lastColumn() > range.lastColumn())
+                return true;
+        }
+    }
+    return false;
+}
+
+/*!
+    Sorts the rows of \a range by the values of the \a keyColumns, and by
+    the next key column when the values are equal. The \a orders give the
+    order of each key column, ascending by default. Returns false if a key
+    column is outside \a range, if \a range overlaps merged cells, or if
+    it overlaps part of an array formula or an array formula of several
+    rows, which the sort would split.
+
+    As in Excel, numbers come before text, booleans and errors, text is
+    compared case insensitively and empty cells always go last. The sort
+    is stable. Hyperlinks and comments move with their cells, and the
+    relative references of the moved formulas are updated.
+
+    Only the cells move, their values and formats are not copied. Large
+    ranges are sorted by several threads.
+ */
+bool Worksheet::sortRange(const CellRange &range, const QList<int> &keyColumns, const QList<Qt::SortOrder> &orders)
+{
+    Q_D(Worksheet);
+    if (!range.isValid() || keyColumns.isEmpty() || (!orders.isEmpty() && orders.size() != keyColumns.size()))
+        return false;
+    foreach (int column, keyColumns) {
+        if (column < range.firstColumn() || column > range.lastColumn())
+            return false;
+    }
+    if (d->merges.intersects(range) || sortSplitsArrayFormula(d->cellTable, range))
+        return false;
+
+    const int firstRow = range.firstRow();
+    const int rowCount = range.rowCount();
+    QVector<XlsxCellRow> cells;
+    QVector<QMap<int, QSharedPointer<XlsxHyperlinkData> > > links;
+    QVector<QMap<int, QString> > notes;
+    takeRowParts(d->cellTable, firstRow, rowCount, range.firstColumn(), range.lastColumn(), cells);
+    takeRowParts(d->urlTable, firstRow, rowCount, range.firstColumn(), range.lastColumn(), links);
+    takeRowParts(d->comments, firstRow, rowCount, range.firstColumn(), range.lastColumn(), notes);
+
+    QVector<bool> descending(keyColumns.size());
+    for (int i=0; i<keyColumns.size(); ++i)
+        descending[i] = !orders.isEmpty() && orders[i] == Qt::DescendingOrder;
+    RowSorter sorter(rowCount, descending);
+    for (int row=0; row<rowCount; ++row) {
+        if (cells[row].isEmpty())
+            continue;
+        for (int i=0; i<keyColumns.size(); ++i) {
+            Cell *cell = cells[row].value(keyColumns[i]).data();
+            FormulaValue value = FormulaValue::fromCell(cell);
+            if (cell && cell->isRichString())
+                value = FormulaValue(FormulaValue::String, cell->d_ptr->richString.toPlainString());
+            switch (value.type) {
+            case FormulaValue::Number:
+                sorter.setNumber(row, i, value.number);
+                break;
+            case FormulaValue::String:
+                if (!value.text.isEmpty())
+                    sorter.setString(row, i, value.text);
+                break;
+            case FormulaValue::Boolean:
+                sorter.setBoolean(row, i, value.number != 0);
+                break;
+            case FormulaValue::Error:
+                sorter.setError(row, i);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    QVector<int> order = sorter.sort(rowCount > 1 ? QThread::idealThreadCount() : 1);
+    for (int i=0; i<rowCount; ++i) {
+        const int source = order[i];
+        const int offset = i - source;
+        const int row = firstRow + i;
+        if (!cells[source].isEmpty()) {
+            XlsxCellRow &target = d->cellRow(row);
+            XlsxCellRow::const_iterator it = cells[source].constBegin();
+            for (; it != cells[source].constEnd(); ++it) {
+                CellPrivate *cell = it.value()->d_ptr;
+                if (offset != 0 && !cell->formula.isEmpty()) {
+                    //Moved cells leave their shared formula
+                    cell->formula = xl_shift_formula(cell->formula, offset, 0);
+                    cell->sharedIndex = -1;
+                    if (cell->dataType == Cell::ArrayFormula) {
+                        cell->range = CellRange(cell->range.firstRow() + offset, cell->range.firstColumn(),
+                                                cell->range.lastRow() + offset, cell->range.lastColumn());
+                    } else {
+                        cell->range = CellRange();
+                    }
+                }
+                target.insert(it.key(), it.value());
+            }
+        }
+        QMapIterator<int, QSharedPointer<XlsxHyperlinkData> > link(links[source]);
+        while (link.hasNext()) {
+            link.next();
+            d->urlTable[row].insert(link.key(), link.value());
+        }
+        QMapIterator<int, QString> note(notes[source]);
+        while (note.hasNext()) {
+            note.next();
+            d->comments[row].insert(note.key(), note.value());
+        }
+    }
+
+    if (d->formulaEngine)
+        d->formulaEngine->invalidate();
+    d->invalidateValueIndex();
+    return true;
+}
+
+/*
+   Returns the text of \a cell if it is a string cell, or a null string.
+*/
+static QString cellText(const Cell *cell)
+{
+    if (!cell || (cell->dataType() != Cell::String && cell->dataType() != Cell::InlineString))
+        return QString();
+    if (cell->isRichString())
+        return cell->d_ptr->richString.toPlainString();
+    return cell->value().toString();
+}
+
+static bool textMatches(const QString &text, const QString &pattern, Qt::MatchFlags flags)
+{
+    Qt::CaseSensitivity cs = (flags & Qt::MatchCaseSensitive) ? Qt::CaseSensitive : Qt::CaseInsensitive;
+    switch (flags & 0x0F) {
+    case Qt::MatchContains:
+        return text.contains(pattern, cs);
+    case Qt::MatchStartsWith:
+        return text.startsWith(pattern, cs);
+    case Qt::MatchEndsWith:
+        return text.endsWith(pattern, cs);
+    default:
+        return text.compare(pattern, cs) == 0;
+    }
+}
+
+/*
+   Removes the cell at \a position from the value index.
+*/
+void WorksheetPrivate::unindexCell(const XlsxCellPosition &position) const
+{
+    QHash<XlsxCellPosition, QString>::iterator it = valueIndexTexts.find(position);
+    if (it == valueIndexTexts.end())
+        return;
+    XlsxValueIndex::iterator entry = valueIndex.find(it.value());
+    if (entry != valueIndex.end()) {
+        entry.value().remove(position);
+        if (entry.value().isEmpty())
+            valueIndex.erase(entry);
+    }
+    valueIndexTexts.erase(it);
+}
+
+/*
+   Indexes the string cells of \a range again after they were written.
+   The texts they were indexed with are dropped first, so the index
+   never holds more than the cells of the sheet.
+*/
+void WorksheetPrivate::indexCells(const CellRange &range) const
+{
+    const qint64 area = static_cast<qint64>(range.rowCount()) * range.columnCount();
+    if (area <= valueIndexTexts.size()) {
+        for (int row=range.firstRow(); row<=range.lastRow(); ++row) {
+            for (int col=range.firstColumn(); col<=range.lastColumn(); ++col)
+                unindexCell(XlsxCellPosition(row, col));
+        }
+    } else {
+        //Fewer indexed cells than positions in the range
+        QList<XlsxCellPosition> positions;
+        QHash<XlsxCellPosition, QString>::const_iterator it = valueIndexTexts.constBegin();
+        for (; it != valueIndexTexts.constEnd(); ++it) {
+            const XlsxCellPosition &pos = it.key();
+            if (pos.first >= range.firstRow() && pos.first <= range.lastRow()
+                    && pos.second >= range.firstColumn() && pos.second <= range.lastColumn())
+                positions.append(pos);
+        }
+        foreach (const XlsxCellPosition &pos, positions)
+            unindexCell(pos);
+    }
+
+    QVector<XlsxCellTable::const_iterator> rows;
+    QVector<XlsxCellRow::const_iterator> cells;
+    hashItemsInRange(cellTable, range.firstRow(), range.lastRow(), rows);
+    for (int i=0; i<rows.size(); ++i) {
+        hashItemsInRange(rows[i].value(), range.firstColumn(), range.lastColumn(), cells);
+        for (int j=0; j<cells.size(); ++j) {
+            QString text = cellText(cells[j].value().data());
+            if (!text.isNull()) {
+                XlsxCellPosition pos(rows[i].key(), cells[j].key());
+                valueIndex[text].insert(pos);
+                valueIndexTexts.insert(pos, text);
+            }
+        }
+    }
+}
+
+void WorksheetPrivate::buildValueIndex() const
+{
+    valueIndex.clear();
+    valueIndexTexts.clear();
+    XlsxCellTable::const_iterator it = cellTable.constBegin();
+    for (; it != cellTable.constEnd(); ++it) {
+        XlsxCellRow::const_iterator it2 = it.value().constBegin();
+        for (; it2 != it.value().constEnd(); ++it2) {
+            QString text = cellText(it2.value().data());
+            if (!text.isNull()) {
+                XlsxCellPosition pos(it.key(), it2.key());
+                valueIndex[text].insert(pos);
+                valueIndexTexts.insert(pos, text);
+            }
+        }
+    }
+    valueIndexValid = true;
+}
+
+/*
+   Drops the value index after the cells moved. It is built again by the
+   next search.
+*/
+void WorksheetPrivate::invalidateValueIndex()
+{
+    valueIndex.clear();
+    valueIndexTexts.clear();
+    valueIndexValid = false;
+}
+
+/*
+   Returns the string cells whose text matches \a text, row by row.
+*/
+QList<XlsxCellPosition> WorksheetPrivate::findCells(const QString &text, Qt::MatchFlags flags) const
+{
+    QList<XlsxCellPosition> positions;
+    if (!valueIndexEnabled) {
+        XlsxCellTable::const_iterator it = cellTable.constBegin();
+        for (; it != cellTable.constEnd(); ++it) {
+            XlsxCellRow::const_iterator it2 = it.value().constBegin();
+            for (; it2 != it.value().constEnd(); ++it2) {
+                QString cell = cellText(it2.value().data());
+                if (!cell.isNull() && textMatches(cell, text, flags))
+                    positions.append(XlsxCellPosition(it.key(), it2.key()));
+            }
+        }
+        qSort(positions);
+        return positions;
+    }
+
+    if (!valueIndexValid)
+        buildValueIndex();
+    XlsxValueIndex::const_iterator it = valueIndex.constBegin();
+    for (; it != valueIndex.constEnd(); ++it) {
+        if (textMatches(it.key(), text, flags)) {
+            foreach (const XlsxCellPosition &pos, it.value())
+                positions.append(pos);
+        }
+    }
+    qSort(positions);
+    return positions;
+}
+
+/*
+   Returns \a text with \a before replaced by \a after as the match type
+   \a matchType of Worksheet::replace() says.
+*/
+static QString replacedText(const QString &text, const QString &before, const QString &after,
+                            int matchType, Qt::CaseSensitivity cs)
+{
+    switch (matchType) {
+    case Qt::MatchContains:
+        return QString(text).replace(before, after, cs);
+    case Qt::MatchStartsWith:
+        return text.startsWith(before, cs) ? after + text.mid(before.size()) : text;
+    case Qt::MatchEndsWith:
+        return text.endsWith(before, cs) ? text.left(text.size() - before.size()) + after : text;
+    default:
+        return after;
+    }
+}
+
+/*
+   Replaces the text of the string cells matching \a before, see
+   Worksheet::replace(). The shared string table is updated once per
+   distinct replaced string.
+*/
+int WorksheetPrivate::replaceCells(const QString &before, const QString &after, Qt::MatchFlags flags)
+{
+    const int matchType = flags & 0x0F;
+    const bool partial = matchType == Qt::MatchContains || matchType == Qt::MatchStartsWith
+            || matchType == Qt::MatchEndsWith;
+    const Qt::CaseSensitivity cs = (flags & Qt::MatchCaseSensitive) ? Qt::CaseSensitive : Qt::CaseInsensitive;
+    QMap<QPair<RichString, RichString>, int> sharedStringEdits;
+    int count = 0;
+    foreach (const XlsxCellPosition &pos, findCells(before, flags)) {
+        CellPrivate *cell = q_ptr->cellAt(pos.first, pos.second)->d_ptr;
+        const bool rich = cell->richString.isRichString();
+        const QString text = rich ? cell->richString.toPlainString() : cell->value.toString();
+        RichString oldString = rich ? cell->richString : RichString(text);
+        if (partial && rich) {
+            //Only the fragments which can hold the match are edited
+            const int last = cell->richString.fragmentCount() - 1;
+            RichString string;
+            for (int i=0; i<=last; ++i) {
+                QString fragment = cell->richString.fragmentText(i);
+                if (matchType == Qt::MatchContains || (matchType == Qt::MatchStartsWith && i == 0)
+                        || (matchType == Qt::MatchEndsWith && i == last))
+                    fragment = replacedText(fragment, before, after, matchType, cs);
+                string.addFragment(fragment, cell->richString.fragmentFormat(i));
+            }
+            if (string.toPlainString() == text)
+                continue;
+            cell->richString = string;
+        } else {
+            QString newText = replacedText(text, before, after, matchType, cs);
+            if (newText == text && !rich)
+                continue;
+            cell->value = newText;
+            cell->richString = RichString();
+        }
+
+        if (valueIndexValid)
+            valueIndex[text].remove(pos);
+        if (cell->dataType == Cell::String) {
+            RichString newString = cell->richString.isRichString() ? cell->richString
+                                                                   : RichString(cell->value.toString());
+            sharedStringEdits[qMakePair(oldString, newString)] += 1;
+        }
+        cellChanged(pos.first, pos.second);
+        ++count;
+    }
+
+    QMap<QPair<RichString, RichString>, int>::const_iterator it = sharedStringEdits.constBegin();
+    for (; it != sharedStringEdits.constEnd(); ++it)
+        sharedStrings()->replaceSharedString(it.key().first, it.key().second, it.value());
+    return count;
+}
+
+/*!
+    Returns the string cells of this sheet whose text matches \a text,
+    row by row. The \a flags give the match type, Qt::MatchContains,
+    Qt::MatchStartsWith, Qt::MatchEndsWith or a whole cell match for any
+    other type, and whether the match is case sensitive.
+
+    Only string cells are searched, the results of formulas are not.
+
+    When the value index is enabled, the first search builds it, so this
+    function must not be called from several threads at once until the
+    sheet has been searched once.
+
+    \sa replace(), setValueIndexEnabled()
+ */
+QList<CellRange> Worksheet::find(const QString &text, Qt::MatchFlags flags) const
+{
+    Q_D(const Worksheet);
+    QList<CellRange> cells;
+    if (text.isEmpty())
+        return cells;
+    foreach (const XlsxCellPosition &pos, d->findCells(text, flags))
+        cells.append(CellRange(pos.first, pos.second, pos.first, pos.second));
+    return cells;
+}
+
+/*!
+    Replaces \a before by \a after in the string cells of this sheet, and
+    returns the number of cells changed. With Qt::MatchContains each
+    occurrence of \a before is replaced, with Qt::MatchStartsWith and
+    Qt::MatchEndsWith only the matching start or end of the text. The
+    formats of rich text fragments are kept, and a match which spans two
+    fragments is not replaced. With any other match type of \a flags,
+    such as Qt::MatchExactly, the whole text of the matching cells is
+    replaced by \a after.
+
+    \sa find(), Workbook::replace()
+ */
+int Worksheet::replace(const QString &before, const QString &after, Qt::MatchFlags flags)
+{
+    Q_D(Worksheet);
+    if (before.isEmpty())
+        return 0;
+    return d->replaceCells(before, after, flags);
+}
+
+/*!
+    Returns whether find() and replace() use an index of the string
+    cells. The default is false.
+ */
+bool Worksheet::isValueIndexEnabled() const
+{
+    Q_D(const Worksheet);
+    return d->valueIndexEnabled;
+}
+
+/*!
+    Enables the index of the string cells if \a enable is true. The index
+    maps each distinct text to its cells, so a search compares the
+    distinct strings of the sheet instead of all of its cells, and only
+    touches the cells found. It costs memory, and is worth it when the
+    sheet is searched many times, such as when a template is filled.
+
+    The index is built by the first search and kept up to date as cells
+    are written. As the first find() changes the sheet, it is not safe to
+    search a sheet from several threads before it was searched once.
+ */
+void Worksheet::setValueIndexEnabled(bool enable)
+{
+    Q_D(Worksheet);
+    d->valueIndexEnabled = enable;
+    d->invalidateValueIndex();
+}
+
+/*
+   Changes the keys of \a map from \a first on as xl_move_index() does.
+   Only the moved items are touched, and their values are moved as they
+   are: a row of cells moves without its cells being visited.
+*/
+template<typename Map>
+static void moveKeys(Map &map, int first, int count, int maxIndex)
+{
+    QList<QPair<int, typename Map::mapped_type> > moved;
+    typename Map::iterator it = map.begin();
+    while (it != map.end()) {
+        if (it.key() < first) {
+            ++it;
+            continue;
+        }
+        int key = xl_move_index(it.key(), first, count);
+        if (key > 0 && key <= maxIndex)
+            moved.append(qMakePair(key, it.value()));
+        it = map.erase(it);
+    }
+    for (int i=0; i<moved.size(); ++i)
+        map.insert(moved[i].first, moved[i].second);
+}
+
+/*
+   Same as moveKeys(), for the inner keys of a two level map. Inner maps
+   left empty are removed.
+*/
+template<typename Map>
+static void moveInnerKeys(Map &map, int first, int count, int maxIndex)
+{
+    typename Map::iterator it = map.begin();
+    while (it != map.end()) {
+        moveKeys(it.value(), first, count, maxIndex);
+        if (it.value().isEmpty())
+            it = map.erase(it);
+        else
+            ++it;
+    }
+}
+
+/*
+   Inserts \a count rows, if \a rows is true, or columns before \a first,
+   or removes -\a count of them from \a first, and moves everything which
+   refers to cells of the sheet accordingly.
+
+   The formulas of all the sheets of the workbook, with those of their
+   rules, and the defined names are updated, and the dependency graphs
+   of the formula engines are dropped.
+*/
+void WorksheetPrivate::moveCells(bool rows, int first, int count)
+{
+    const int maxIndex = rows ? XLSX_ROW_MAX : XLSX_COLUMN_MAX;
+
+    invalidateValueIndex();
+    if (rows) {
+        moveKeys(cellTable, first, count, maxIndex);
+        moveKeys(comments, first, count, maxIndex);
+        moveKeys(urlTable, first, count, maxIndex);
+        moveKeys(rowsInfo, first, count, maxIndex);
+    } else {
+        moveInnerKeys(cellTable, first, count, maxIndex);
+        moveInnerKeys(comments, first, count, maxIndex);
+        moveInnerKeys(urlTable, first, count, maxIndex);
+
+        QList<QSharedPointer<XlsxColumnInfo> > infos = colsInfo.values();
+        colsInfo.clear();
+        colsInfoHelper.clear();
+        foreach (QSharedPointer<XlsxColumnInfo> info, infos) {
+            if (!xl_move_span(&info->firstColumn, &info->lastColumn, first, count, maxIndex))
+                continue;
+            colsInfo.insert(info->firstColumn, info);
+            for (int col=info->firstColumn; col<=info->lastColumn; ++col)
+                colsInfoHelper[col] = info;
+        }
+    }
+
+    QHash<int, QPoint>::iterator sf = sharedFormulas.begin();
+    while (sf != sharedFormulas.end()) {
+        int &index = rows ? sf->rx() : sf->ry();
+        index = xl_move_index(index, first, count);
+        if (index == 0 || index > maxIndex) {
+            sf = sharedFormulas.erase(sf);
+        } else {
+            ++sf;
+        }
+    }
+
+    //Formulas of all the sheets may refer to this one
+    for (int i=0; i<workbook->worksheetCount(); ++i) {
+        WorksheetPrivate *sheet_d = workbook->worksheet(i)->d_ptr;
+        const bool inSheet = sheet_d == this;
+        XlsxCellTable::iterator it = sheet_d->cellTable.begin();
+        for (; it != sheet_d->cellTable.end(); ++it) {
+            XlsxCellRow::iterator it2 = it.value().begin();
+            for (; it2 != it.value().end(); ++it2) {
+                CellPrivate *cell = it2.value()->d_ptr;
+                if (!cell->formula.isEmpty())
+                    cell->formula = xl_move_formula(cell->formula, name, inSheet, rows, first, count);
+                if (inSheet && cell->range.isValid())
+                    cell->range = xl_move_range(cell->range, rows, first, count);
+            }
+        }
+        for (int j=0; j<sheet_d->dataValidationsList.size(); ++j)
+            sheet_d->dataValidationsList[j].d->moveFormulas(name, inSheet, rows, first, count);
+        for (int j=0; j<sheet_d->conditionalFormattingList.size(); ++j)
+            sheet_d->conditionalFormattingList[j].d->moveFormulas(name, inSheet, rows, first, count);
+        if (sheet_d->formulaEngine)
+            sheet_d->formulaEngine->invalidate();
+    }
+
+    //Defined names, print areas included, always name their sheet
+    QList<XlsxDefineNameData> &definedNames = workbook->d_func()->definedNamesList;
+    for (int i=0; i<definedNames.size(); ++i)
+        definedNames[i].formula = xl_move_formula(definedNames[i].formula, name, false, rows, first, count);
+
+    //A reference and its cell on both sides of the moved cells no longer
+    //keep their offset, so such cells leave their shared formula.
+    XlsxCellTable::iterator it = cellTable.begin();
+    for (; it != cellTable.end(); ++it) {
+        XlsxCellRow::iterator it2 = it.value().begin();
+        for (; it2 != it.value().end(); ++it2) {
+            Cell *cell = it2.value().data();
+            if (cell->d_ptr->sharedIndex >= 0 && !isSharedFormulaDerived(cell, it.key(), it2.key()))
+                cell->d_ptr->sharedIndex = -1;
+        }
+    }
+
+    QList<CellRange> mergedRanges = merges.ranges();
+    merges.clear();
+    foreach (CellRange range, mergedRanges) {
+        range = xl_move_range(range, rows, first, count);
+        if (range.isValid() && (range.rowCount() > 1 || range.columnCount() > 1))
+            merges.insert(range, 0);
+    }
+
+    QList<XlsxRangeFormat> formats = rangeFormats;
+    rangeFormats.clear();
+    rangeFormatIndex.clear();
+    foreach (XlsxRangeFormat rangeFormat, formats) {
+        rangeFormat.range = xl_move_range(rangeFormat.range, rows, first, count);
+        if (rangeFormat.range.isValid()) {
+            rangeFormats.append(rangeFormat);
+            rangeFormatIndex.insert(rangeFormat.range, rangeFormats.size() - 1);
+        }
+    }
+
+    QList<DataValidation> validations = dataValidationsList;
+    dataValidationsList.clear();
+    dataValidationIndex.clear();
+    foreach (DataValidation validation, validations) {
+        QList<CellRange> ranges;
+        foreach (CellRange range, validation.d->ranges) {
+            range = xl_move_range(range, rows, first, count);
+            if (range.isValid())
+                ranges.append(range);
+        }
+        if (!ranges.isEmpty()) {
+            validation.d->ranges = ranges;
+            appendDataValidation(validation);
+        }
+    }
+
+    QList<ConditionalFormatting> cfs = conditionalFormattingList;
+    conditionalFormattingList.clear();
+    conditionalFormattingIndex.clear();
+    foreach (ConditionalFormatting cf, cfs) {
+        QList<CellRange> ranges;
+        foreach (CellRange range, cf.d->ranges) {
+            range = xl_move_range(range, rows, first, count);
+            if (range.isValid())
+                ranges.append(range);
+        }
+        if (!ranges.isEmpty()) {
+            cf.d->ranges = ranges;
+            appendConditionalFormatting(cf);
+        }
+    }
+
+    //Images are anchored to 0 based rows and columns. Those of removed
+    //cells move to the first cell after them.
+    foreach (XlsxImageData *image, imageList) {
+        int &index = rows ? image->row : image->col;
+        int moved = xl_move_index(index + 1, first, count);
+        index = (moved == 0 ? first : qMin(moved, maxIndex)) - 1;
+    }
+
+    if (dimension.isValid())
+        dimension = xl_move_range(dimension, rows, first, count);
+}
+
+/*
+   Returns the cells of \a row, adding the row if it doesn't exist yet.
+   New rows get the capacity requested through reserveCells().
+*/
+XlsxCellRow &WorksheetPrivate::cellRow(int row)
+{
+    XlsxCellTable::iterator it = cellTable.find(row);
+    if (it == cellTable.end()) {
+        it = cellTable.insert(row, XlsxCellRow());
+        if (reservedColumns > 0)
+            it.value().reserve(reservedColumns);
+    }
+    return it.value();
+}
+
+/*
+   Returns the master cell of the shared formula \a si, or a null pointer
+   if it has been overwritten since.
+*/
+QSharedPointer<Cell> WorksheetPrivate::sharedFormulaMaster(int si) const
+{
+    QHash<int, QPoint>::const_iterator it = sharedFormulas.constFind(si);
+    if (it == sharedFormulas.constEnd())
+        return QSharedPointer<Cell>();
+    XlsxCellTable::const_iterator rowIt = cellTable.constFind(it->x());
+    if (rowIt == cellTable.constEnd())
+        return QSharedPointer<Cell>();
+    XlsxCellRow::const_iterator cellIt = rowIt->constFind(it->y());
+    if (cellIt == rowIt->constEnd())
+        return QSharedPointer<Cell>();
+
+    QSharedPointer<Cell> cell = cellIt.value();
+    if (cell->dataType() != Cell::Formula || cell->d_ptr->sharedIndex != si || !cell->d_ptr->range.isValid())
+        return QSharedPointer<Cell>();
+    return cell;
+}
+
+/*
+   Makes the loaded \a cell at (\a row, \a col) part of the shared formula
+   \a si. The master cell comes first, with the \a formula text and the
+   range \a ref; the text of the other cells is derived from it.
+
+   Returns false if the master cell is unknown.
+*/
+bool WorksheetPrivate::setSharedFormula(Cell *cell, int row, int col, int si, const QString &formula, const CellRange &ref)
+{
+    if (ref.isValid()) {
+        cell->d_ptr->formula = formula;
+        cell->d_ptr->range = ref;
+        cell->d_ptr->sharedIndex = si;
+        sharedFormulas[si] = QPoint(row, col);
+        if (si >= nextSharedIndex)
+            nextSharedIndex = si + 1;
+        return true;
+    }
+
+    QSharedPointer<Cell> master = sharedFormulaMaster(si);
+    if (!master)
+        return false;
+    QPoint pos = sharedFormulas[si];
+    cell->d_ptr->formula = xl_shift_formula(master->d_ptr->formula, row - pos.x(), col - pos.y());
+    cell->d_ptr->sharedIndex = si;
+    return true;
+}
+
+/*
+   Returns true if \a cell at (\a row, \a col) is the master of its
+   shared formula, or if its formula is the one derived from the master.
+*/
+bool WorksheetPrivate::isSharedFormulaDerived(const Cell *cell, int row, int col) const
+{
+    QSharedPointer<Cell> master = sharedFormulaMaster(cell->d_ptr->sharedIndex);
+    if (!master)
+        return false;
+    if (master.data() == cell)
+        return true;
+    QPoint pos = sharedFormulas.value(cell->d_ptr->sharedIndex);
+    return cell->d_ptr->formula == xl_shift_formula(master->d_ptr->formula, row - pos.x(), col - pos.y());
+}
+
+void WorksheetPrivate::reserveCells(int rows, int columns)
+{
+    if (rows > cellTable.size())
+        cellTable.reserve(rows);
+    reservedColumns = qMax(columns, 0);
+    for (XlsxCellTable::iterator it = cellTable.begin(); it != cellTable.end(); ++it) {
+        if (reservedColumns > it.value().size())
+            it.value().reserve(reservedColumns);
+    }
+}
+
+/*
+   Smallest xml a row or a cell can take in sheetData, <row r="1"/> and
+   <c r="A1"/>, and the most rows trusted to a dimension when the size of
+   the sheet isn't known.
+*/
+static const int XLSX_MIN_ROW_XML_SIZE = 12;
+static const int XLSX_MIN_CELL_XML_SIZE = 11;
+static const int XLSX_MAX_UNSIZED_RESERVE = 65536;
+
+/*
+   Reserves cell storage for a sheet whose <dimension> is \a range. The
+   dimension is only what the file claims, so it's capped by the number of
+   rows and cells \a dataSize bytes of xml can hold.
+*/
+void WorksheetPrivate::reserveCells(const CellRange &range, qint64 dataSize)
+{
+    if (!range.isValid() || loadOptions.hasCellSelection())
+        return;
+
+    qint64 rows = range.rowCount();
+    qint64 columns = range.columnCount();
+    if (dataSize > 0) {
+        rows = qMin(rows, dataSize / XLSX_MIN_ROW_XML_SIZE);
+        columns = qMin(columns, dataSize / XLSX_MIN_CELL_XML_SIZE / qMax(rows, Q_INT64_C(1)));
+    } else {
+        rows = qMin(rows, qint64(XLSX_MAX_UNSIZED_RESERVE));
+        columns = qMin(columns, qint64(XLSX_MAX_UNSIZED_RESERVE) / qMax(rows, Q_INT64_C(1)));
+    }
+    reserveCells(static_cast<int>(rows), static_cast<int>(columns));
+}
+
 /*!
  * Return the workbook
  */
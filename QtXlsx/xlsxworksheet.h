@@ -28,11 +28,13 @@
 #include "xlsxglobal.h"
 #include "xlsxcell.h"
 #include "xlsxcellrange.h"
+#include "xlsxcalculationstatistics.h"
 #include <QStringList>
 #include <QMap>
 #include <QVariant>
 #include <QPointF>
 #include <QSharedPointer>
+#include <QVector>
 class QIODevice;
 class QDateTime;
 class QUrl;
@@ -51,6 +53,7 @@ class CellRange;
 struct XlsxImageData;
 class RichString;
 class Relationships;
+class LoadOptions;
 
 class WorksheetPrivate;
 class Worksheet
@@ -61,6 +64,18 @@ public:
     int write(int row, int column, const QVariant &value, const Format &format=Format());
     QVariant read(const QString &row_column) const;
     QVariant read(int row, int column) const;
+    double readDouble(int row, int column, bool *ok=0) const;
+    QString readString(int row, int column, bool *ok=0) const;
+    bool readBool(int row, int column, bool *ok=0) const;
+    QVector<double> readDoubles(const CellRange &range) const;
+    QVector<QString> readStrings(const CellRange &range) const;
+    double sum(const CellRange &range) const;
+    double mean(const CellRange &range) const;
+    double minimum(const CellRange &range) const;
+    double maximum(const CellRange &range) const;
+    double standardDeviation(const CellRange &range) const;
+    int count(const CellRange &range) const;
+    int countBetween(const CellRange &range, double lower, double upper) const;
     int writeString(const QString &row_column, const QString &value, const Format &format=Format());
     int writeString(int row, int column, const QString &value, const Format &format=Format());
     int writeString(const QString &row_column, const RichString &value, const Format &format=Format());
@@ -73,6 +88,8 @@ public:
     int writeFormula(int row, int column, const QString &formula, const Format &format=Format(), double result=0);
     int writeArrayFormula(const QString &range, const QString &formula, const Format &format=Format());
     int writeArrayFormula(const CellRange &range, const QString &formula, const Format &format=Format());
+    int writeSharedFormula(const QString &range, const QString &formula, const Format &format=Format());
+    int writeSharedFormula(const CellRange &range, const QString &formula, const Format &format=Format());
     int writeBlank(const QString &row_column, const Format &format=Format());
     int writeBlank(int row, int column, const Format &format=Format());
     int writeBool(const QString &row_column, bool value, const Format &format=Format());
@@ -92,12 +109,19 @@ public:
     Cell *cellAt(int row, int column) const;
 
     int insertImage(int row, int column, const QImage &image, const QPointF &offset=QPointF(), double xScale=1, double yScale=1);
+    int insertImage(int row, int column, const QByteArray &data, const QPointF &offset=QPointF(), double xScale=1, double yScale=1);
 
     int mergeCells(const QString &range, const Format &format=Format());
     int mergeCells(const CellRange &range, const Format &format=Format());
     int unmergeCells(const QString &range);
     int unmergeCells(const CellRange &range);
     QList<CellRange> mergedCells() const;
+    CellRange mergedRangeAt(int row, int column) const;
+    QList<DataValidation> validationsAt(int row, int column) const;
+    QList<ConditionalFormatting> conditionalFormattingsAt(int row, int column) const;
+
+    bool setRangeFormat(const QString &range, const Format &format);
+    bool setRangeFormat(const CellRange &range, const Format &format);
 
     bool setRow(int row, double height, const Format &format=Format(), bool hidden=false);
     bool setColumn(int colFirst, int colLast, double width, const Format &format=Format(), bool hidden=false);
@@ -106,6 +130,25 @@ public:
     bool groupColumns(int colFirst, int colLast, bool collapsed = true);
     bool groupColumns(const QString &colFirst, const QString &colLast, bool collapsed = true);
     CellRange dimension() const;
+    void reserve(int rows, int columns);
+
+    bool insertRows(int row, int count);
+    bool removeRows(int row, int count);
+    bool insertColumns(int column, int count);
+    bool removeColumns(int column, int count);
+    bool sortRange(const CellRange &range, const QList<int> &keyColumns, const QList<Qt::SortOrder> &orders=QList<Qt::SortOrder>());
+
+    QList<CellRange> find(const QString &text, Qt::MatchFlags flags=Qt::MatchContains) const;
+    int replace(const QString &before, const QString &after, Qt::MatchFlags flags=Qt::MatchContains);
+    bool isValueIndexEnabled() const;
+    void setValueIndexEnabled(bool enable);
+
+    bool isCalculationEnabled() const;
+    void setCalculationEnabled(bool enable);
+    int calculationThreadCount() const;
+    void setCalculationThreadCount(int count);
+    CalculationStatistics calculate();
+    void cancelCalculation();
 
     bool isWindowProtected() const;
     void setWindowProtected(bool protect);
@@ -144,6 +187,7 @@ private:
     void saveToXmlFile(QIODevice *device) const;
     QByteArray saveToXmlData() const;
     bool loadFromXmlFile(QIODevice *device);
+    bool loadFromXmlFile(QIODevice *device, const LoadOptions &options);
     bool loadFromXmlData(const QByteArray &data);
 
     bool isChartsheet() const;
@@ -153,7 +197,7 @@ private:
     QList<QPair<QString, QString> > drawingLinks() const;
     Drawing *drawing() const;
     QList<XlsxImageData *> images() const;
-    void prepareImage(int index, int image_id);
+    void prepareImage(int index, int media_id);
     void clearExtraDrawingInfo();
 
     WorksheetPrivate * const d_ptr;
@@ -42,9 +42,18 @@
 #include "xlsxdatavalidation.h"
 #include "xlsxconditionalformatting.h"
 #include "xlsxrelationships_p.h"
+#include "xlsxloadoptions.h"
+#include "xlsxcellrangeindex_p.h"
+#include "xlsxpixelsizeindex_p.h"
+#include "xlsxmediafile_p.h"
+#include "xlsxformulaengine_p.h"
 
 #include <QImage>
 #include <QSharedPointer>
+#include <QHash>
+#include <QPoint>
+#include <QAtomicInt>
+#include <QSet>
 
 class QXmlStreamWriter;
 class QXmlStreamReader;
@@ -56,6 +65,7 @@ const int XLSX_COLUMN_MAX = 16384;
 const int XLSX_STRING_MAX = 32767;
 
 class SharedStrings;
+class SheetDataScanner;
 
 struct XlsxHyperlinkData
 {
@@ -81,14 +91,14 @@ struct XlsxHyperlinkData
 
 struct XlsxImageData
 {
-    XlsxImageData(int row, int col, const QImage &image, const QPointF &offset, double xScale, double yScale) :
-        row(row), col(col), image(image), offset(offset), xScale(xScale), yScale(yScale)
+    XlsxImageData(int row, int col, const QSharedPointer<MediaFile> &media, const QPointF &offset, double xScale, double yScale) :
+        row(row), col(col), media(media), offset(offset), xScale(xScale), yScale(yScale)
     {
     }
 
     int row;
     int col;
-    QImage image;
+    QSharedPointer<MediaFile> media;
     QPointF offset;
     double xScale;
     double yScale;
@@ -140,6 +150,38 @@ struct XlsxObjectPositionData
     double y_abs;
 };
 
+/*
+   Cells are kept in hashes, row number to row and column number to cell,
+   so that the storage can be reserved up front. Code that needs them in
+   order looks the keys up one by one.
+*/
+typedef QHash<int, QSharedPointer<Cell> > XlsxCellRow;
+typedef QHash<int, XlsxCellRow> XlsxCellTable;
+
+/*
+   The string cells of a sheet by their text, so that a search compares
+   each distinct string once instead of every cell. Entries are added as
+   cells are written, and those of overwritten cells are dropped by the
+   searches which find them stale.
+*/
+typedef QPair<int, int> XlsxCellPosition; //row and column
+typedef QHash<QString, QSet<XlsxCellPosition> > XlsxValueIndex;
+
+/*
+   Format given to a whole range. Empty cells covered by a non empty
+   format are saved as blank styled cells, without any Cell object.
+*/
+struct XlsxRangeFormat
+{
+    XlsxRangeFormat() {}
+    XlsxRangeFormat(const CellRange &range, const Format &format)
+        : range(range), format(format)
+    {}
+
+    CellRange range;
+    Format format;
+};
+
 struct XlsxRowInfo
 {
     XlsxRowInfo(double height=0, const Format &format=Format(), bool hidden=false) :
@@ -191,13 +233,15 @@ public:
     void saveXmlHyperlinks(QXmlStreamWriter &writer) const;
     void saveXmlDrawings(QXmlStreamWriter &writer) const;
     void saveXmlDataValidations(QXmlStreamWriter &writer) const;
-    int rowPixelsSize(int row) const;
-    int colPixelsSize(int col) const;
+    void saveXmlConditionalFormattings(QXmlStreamWriter &writer) const;
+    void updatePixelSizes();
     XlsxObjectPositionData objectPixelsPosition(int col_start, int row_start, double x1, double y1, double width, double height) const;
     XlsxObjectPositionData pixelsToEMUs(const XlsxObjectPositionData &data) const;
 
-    QSharedPointer<Cell> loadXmlNumericCellData(QXmlStreamReader &reader);
+    QSharedPointer<Cell> loadXmlNumericCellData(QXmlStreamReader &reader, const QPoint &pos);
     void loadXmlSheetData(QXmlStreamReader &reader);
+    bool loadXmlSheetData(SheetDataScanner &scanner, QVector<int> &sharedStringRefs);
+    QByteArray scanXmlSheetData(QIODevice *device);
     void loadXmlColumnsInfo(QXmlStreamReader &reader);
     void loadXmlMergeCells(QXmlStreamReader &reader);
     void loadXmlDataValidations(QXmlStreamReader &reader);
@@ -205,15 +249,63 @@ public:
     void loadXmlHyperlinks(QXmlStreamReader &reader);
 
     SharedStrings *sharedStrings() const;
+    Format rangeFormat(int row, int col) const;
+    QList<int> rangeFormatsInRow(int row) const;
+    Format rangeFormatInRow(const QList<int> &formats, int col) const;
+    void setRangeFormat(const CellRange &range, const Format &format);
+    void appendDataValidation(const DataValidation &validation);
+    void appendConditionalFormatting(const ConditionalFormatting &cf);
+    void saveXmlBlankCell(QXmlStreamWriter &writer, int row, int col, const Format &format) const;
+    XlsxCellRow &cellRow(int row);
+    void collectNumbers(const CellRange &range, QVector<double> &numbers) const;
+    void moveCells(bool rows, int first, int count);
+    QSharedPointer<Cell> sharedFormulaMaster(int si) const;
+    bool setSharedFormula(Cell *cell, int row, int col, int si, const QString &formula, const CellRange &ref);
+    bool isSharedFormulaDerived(const Cell *cell, int row, int col) const;
+    void reserveCells(int rows, int columns);
+    void reserveCells(const CellRange &range, qint64 dataSize);
+    void indexCells(const CellRange &range) const;
+    void unindexCell(const XlsxCellPosition &position) const;
+    void buildValueIndex() const;
+    void invalidateValueIndex();
+    QList<XlsxCellPosition> findCells(const QString &text, Qt::MatchFlags flags) const;
+    int replaceCells(const QString &before, const QString &after, Qt::MatchFlags flags);
+    inline void cellChanged(int row, int col)
+    {
+        if (formulaEngine)
+            formulaEngine->cellChanged(row, col);
+        if (valueIndexValid)
+            indexCells(CellRange(row, col, row, col));
+    }
+    inline void rangeChanged(const CellRange &range)
+    {
+        if (formulaEngine)
+            formulaEngine->rangeChanged(range);
+        if (valueIndexValid)
+            indexCells(range);
+    }
 
     Worksheet *q_ptr;
     Workbook *workbook;
     mutable Relationships relationships;
     Drawing *drawing;
-    QMap<int, QMap<int, QSharedPointer<Cell> > > cellTable;
+    XlsxCellTable cellTable;
+    int reservedColumns; //Reserved in every new row
     QMap<int, QMap<int, QString> > comments;
     QMap<int, QMap<int, QSharedPointer<XlsxHyperlinkData> > > urlTable;
-    QList<CellRange> merges;
+    CellRangeIndex merges;
+    QHash<int, QPoint> sharedFormulas; //si to the master cell
+    int nextSharedIndex;
+    FormulaEngine *formulaEngine; //0 unless calculation is enabled
+    int calculationThreadCount; //0 for QThread::idealThreadCount()
+    QAtomicInt calculationRun; //Number of the running or last calculation
+    QAtomicInt calculationCanceled; //Run a cancel was issued for, 0 for none
+    bool valueIndexEnabled;
+    mutable bool valueIndexValid; //Built by the first search
+    mutable XlsxValueIndex valueIndex;
+    mutable QHash<XlsxCellPosition, QString> valueIndexTexts; //Indexed text of each cell
+    QList<XlsxRangeFormat> rangeFormats;
+    CellRangeIndex rangeFormatIndex; //Values are indexes in rangeFormats
     QList<XlsxImageData *> imageList;
     QMap<int, QSharedPointer<XlsxRowInfo> > rowsInfo;
     QMap<int, QSharedPointer<XlsxColumnInfo> > colsInfo;
@@ -222,13 +314,15 @@ public:
 
     QList<DataValidation> dataValidationsList;
     QList<ConditionalFormatting> conditionalFormattingList;
+    CellRangeIndex dataValidationIndex; //Values are indexes in dataValidationsList
+    CellRangeIndex conditionalFormattingIndex; //Values are indexes in conditionalFormattingList
 
     CellRange dimension;
     int previous_row;
 
     mutable QMap<int, QString> row_spans;
-    QMap<int, double> row_sizes;
-    QMap<int, double> col_sizes;
+    PixelSizeIndex row_sizes; //Updated by updatePixelSizes()
+    PixelSizeIndex col_sizes;
 
     int outline_row_level;
     int outline_col_level;
@@ -250,6 +344,8 @@ public:
     bool showRuler;
     bool showOutlineSymbols;
     bool showWhiteSpace;
+
+    LoadOptions loadOptions; //Only used while the sheet is loaded
 };
 
 }
@@ -0,0 +1,82 @@
+/****************************************************************************
+** Copyright (c) 2013-2014 Debao Zhang <hello@debao.me>
+** All right reserved.
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+** NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+** LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+** OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+** WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+****************************************************************************/
+
+#ifndef QXLSX_XLSXZIPENTRY_P_H
+#define QXLSX_XLSXZIPENTRY_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt Xlsx API.  It exists for the convenience
+// of the Qt Xlsx.  This header file may change from
+// version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include <QByteArray>
+
+namespace QXlsx {
+
+/*
+   Signatures and limits of the zip file format shared by the
+   package reader and writer.
+*/
+enum {
+    ZipLocalHeaderSignature = 0x04034b50,
+    ZipCentralHeaderSignature = 0x02014b50,
+    ZipDataDescriptorSignature = 0x08074b50,
+    ZipEndOfCentralDirSignature = 0x06054b50,
+    Zip64EndOfCentralDirSignature = 0x06064b50,
+    Zip64EndOfCentralDirLocatorSignature = 0x07064b50,
+    Zip64ExtraFieldId = 0x0001
+};
+
+static const quint64 ZipMaxUInt32 = Q_UINT64_C(0xffffffff);
+static const int ZipMaxUShort = 0xffff;
+
+struct XlsxZipEntryInfo
+{
+    XlsxZipEntryInfo() :
+        crc32(0), compressedSize(0), uncompressedSize(0), localHeaderOffset(0)
+      , compressionMethod(0), flags(0), dosTime(0), zip64(false)
+    {
+    }
+
+    QByteArray fileName;
+    quint32 crc32;
+    quint64 compressedSize;
+    quint64 uncompressedSize;
+    quint64 localHeaderOffset;
+    quint16 compressionMethod;
+    quint16 flags;
+    quint32 dosTime;
+    bool zip64; //The local header carries a zip64 extra field
+};
+
+} // namespace QXlsx
+
+#endif // QXLSX_XLSXZIPENTRY_P_H
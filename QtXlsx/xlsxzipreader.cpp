@@ -25,39 +25,323 @@
 
 #include "xlsxzipreader_p.h"
 
-#include <private/qzipreader_p.h>
+#include <QFile>
+#include <limits.h>
+#include <string.h>
+#include <zlib.h>
 
 namespace QXlsx {
 
+/*
+   Minimal zip reader for the package, covering what xlsx producers
+   write: stored and deflated parts, data descriptors and the zip64
+   extensions for packages or parts larger than 4GB.
+
+   Files are memory mapped when possible, so reading the central
+   directory and the compressed parts doesn't copy them. Parts can be
+   inflated on demand through fileDevice().
+*/
+
+static const int ZipLocalHeaderSize = 30;
+static const int ZipCentralHeaderSize = 46;
+static const int ZipEndOfCentralDirSize = 22;
+static const int Zip64EndOfCentralDirSize = 56;
+static const int Zip64EndOfCentralDirLocatorSize = 20;
+static const int ZipInflateChunkSize = 64 * 1024;
+
+static inline quint16 readUShort(const uchar *data)
+{
+    return data[0] | (data[1] << 8);
+}
+
+static inline quint32 readUInt(const uchar *data)
+{
+    return readUShort(data) | (static_cast<quint32>(readUShort(data + 2)) << 16);
+}
+
+static inline quint64 readULongLong(const uchar *data)
+{
+    return readUInt(data) | (static_cast<quint64>(readUInt(data + 4)) << 32);
+}
+
+/*
+   Replaces the 32 bit values of \a info which overflowed by the ones of
+   the zip64 extra field found in \a extra.
+*/
+static void readZip64ExtraField(const uchar *extra, int extraLength, XlsxZipEntryInfo &info, bool hasOffset)
+{
+    int pos = 0;
+    while (pos + 4 <= extraLength) {
+        quint16 id = readUShort(extra + pos);
+        int size = readUShort(extra + pos + 2);
+        pos += 4;
+        if (pos + size > extraLength)
+            return;
+        if (id == Zip64ExtraFieldId) {
+            const uchar *field = extra + pos;
+            int fieldPos = 0;
+            if (info.uncompressedSize == ZipMaxUInt32 && fieldPos + 8 <= size) {
+                info.uncompressedSize = readULongLong(field + fieldPos);
+                fieldPos += 8;
+            }
+            if (info.compressedSize == ZipMaxUInt32 && fieldPos + 8 <= size) {
+                info.compressedSize = readULongLong(field + fieldPos);
+                fieldPos += 8;
+            }
+            if (hasOffset && info.localHeaderOffset == ZipMaxUInt32 && fieldPos + 8 <= size)
+                info.localHeaderOffset = readULongLong(field + fieldPos);
+            return;
+        }
+        pos += size;
+    }
+}
+
+/*
+   Sequential device which inflates a part of the package while it is
+   read, so the part is never held in memory as a whole.
+*/
+class ZipEntryReadDevice : public QIODevice
+{
+public:
+    ZipEntryReadDevice(const ZipReader *reader, const XlsxZipEntryInfo &info, qint64 dataOffset) :
+        m_reader(reader), m_info(info), m_dataOffset(dataOffset), m_inputPos(0), m_outputPos(0)
+      , m_finished(false)
+    {
+        memset(&m_stream, 0, sizeof(m_stream));
+        if (m_info.compressionMethod == 8 && inflateInit2(&m_stream, -MAX_WBITS) != Z_OK)
+            return;
+        open(QIODevice::ReadOnly);
+    }
+
+    ~ZipEntryReadDevice()
+    {
+        if (m_info.compressionMethod == 8 && isOpen())
+            inflateEnd(&m_stream);
+    }
+
+    bool isSequential() const
+    {
+        return true;
+    }
+
+    qint64 size() const
+    {
+        return static_cast<qint64>(m_info.uncompressedSize);
+    }
+
+    qint64 bytesAvailable() const
+    {
+        return static_cast<qint64>(m_info.uncompressedSize) - m_outputPos + QIODevice::bytesAvailable();
+    }
+
+protected:
+    qint64 readData(char *data, qint64 maxlen)
+    {
+        if (m_finished || maxlen <= 0)
+            return 0;
+
+        if (m_info.compressionMethod == 0) {
+            qint64 len = qMin<qint64>(maxlen, m_info.compressedSize - m_inputPos);
+            QByteArray chunk = m_reader->readAt(m_dataOffset + m_inputPos, len);
+            if (chunk.size() != len)
+                return -1;
+            memcpy(data, chunk.constData(), len);
+            m_inputPos += len;
+            m_outputPos += len;
+            m_finished = m_inputPos == static_cast<qint64>(m_info.compressedSize);
+            return len;
+        }
+
+        m_stream.next_out = reinterpret_cast<Bytef *>(data);
+        m_stream.avail_out = static_cast<uInt>(qMin<qint64>(maxlen, INT_MAX));
+        while (m_stream.avail_out > 0) {
+            if (m_stream.avail_in == 0) {
+                qint64 len = qMin<qint64>(ZipInflateChunkSize, m_info.compressedSize - m_inputPos);
+                if (len <= 0)
+                    break;
+                m_input = m_reader->readAt(m_dataOffset + m_inputPos, len);
+                if (m_input.size() != len)
+                    return -1;
+                m_inputPos += len;
+                m_stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(m_input.constData()));
+                m_stream.avail_in = static_cast<uInt>(len);
+            }
+            int res = inflate(&m_stream, Z_NO_FLUSH);
+            if (res == Z_STREAM_END) {
+                m_finished = true;
+                break;
+            }
+            if (res != Z_OK)
+                return -1;
+        }
+        qint64 produced = reinterpret_cast<char *>(m_stream.next_out) - data;
+        m_outputPos += produced;
+        return produced;
+    }
+
+    qint64 writeData(const char *, qint64)
+    {
+        return -1;
+    }
+
+private:
+    const ZipReader *m_reader;
+    XlsxZipEntryInfo m_info;
+    qint64 m_dataOffset;
+    qint64 m_inputPos;
+    qint64 m_outputPos;
+    bool m_finished;
+    z_stream m_stream;
+    QByteArray m_input;
+};
+
 ZipReader::ZipReader(const QString &filePath) :
-    m_reader(new QZipReader(filePath))
+    m_device(new QFile(filePath)), m_ownDevice(true), m_exists(false)
+  , m_mappedFile(0), m_mappedData(0), m_mappedSize(0)
 {
-    init();
+    if (m_device->open(QIODevice::ReadOnly))
+        init();
 }
 
 ZipReader::ZipReader(QIODevice *device) :
-    m_reader(new QZipReader(device))
+    m_device(device), m_ownDevice(false), m_exists(false)
+  , m_mappedFile(0), m_mappedData(0), m_mappedSize(0)
 {
-    init();
+    if (m_device && m_device->isReadable())
+        init();
 }
 
 ZipReader::~ZipReader()
 {
-
+    if (m_mappedData)
+        m_mappedFile->unmap(m_mappedData);
+    if (m_ownDevice)
+        delete m_device;
 }
 
 void ZipReader::init()
 {
-    QList<QZipReader::FileInfo> allFiles = m_reader->fileInfoList();
-    foreach (const QZipReader::FileInfo &fi, allFiles) {
-        if (fi.isFile)
-            m_filePaths.append(fi.filePath);
+    QFile *file = qobject_cast<QFile *>(m_device);
+    if (file && file->size() > 0) {
+        m_mappedData = file->map(0, file->size());
+        if (m_mappedData) {
+            m_mappedFile = file;
+            m_mappedSize = file->size();
+        }
+    }
+    m_exists = readCentralDirectory();
+}
+
+/*
+   Returns \a size bytes starting at \a offset. When the package is mapped
+   the returned array refers to the mapping and must not outlive the reader.
+*/
+QByteArray ZipReader::readAt(quint64 offset, qint64 size) const
+{
+    if (size < 0 || size > INT_MAX)
+        return QByteArray();
+    if (m_mappedData) {
+        if (offset > static_cast<quint64>(m_mappedSize) || static_cast<qint64>(offset) + size > m_mappedSize)
+            return QByteArray();
+        return QByteArray::fromRawData(reinterpret_cast<const char *>(m_mappedData + offset), static_cast<int>(size));
     }
+    if (!m_device->seek(static_cast<qint64>(offset)))
+        return QByteArray();
+    QByteArray data = m_device->read(size);
+    if (data.size() != size)
+        return QByteArray();
+    return data;
+}
+
+bool ZipReader::readCentralDirectory()
+{
+    if (m_device->isSequential())
+        return false;
+
+    //The end record is at the end of the file, followed by a comment of at most 64KB.
+    qint64 fileSize = m_device->size();
+    if (fileSize < ZipEndOfCentralDirSize)
+        return false;
+    qint64 tailSize = qMin<qint64>(fileSize, ZipEndOfCentralDirSize + ZipMaxUShort);
+    QByteArray tail = readAt(fileSize - tailSize, tailSize);
+    if (tail.isEmpty())
+        return false;
+
+    const uchar *tailData = reinterpret_cast<const uchar *>(tail.constData());
+    int eocdPos = -1;
+    for (int i = tail.size() - ZipEndOfCentralDirSize; i >= 0; --i) {
+        if (readUInt(tailData + i) == ZipEndOfCentralDirSignature) {
+            eocdPos = i;
+            break;
+        }
+    }
+    if (eocdPos < 0)
+        return false;
+
+    const uchar *eocd = tailData + eocdPos;
+    quint64 entryCount = readUShort(eocd + 10);
+    quint64 centralDirSize = readUInt(eocd + 12);
+    quint64 centralDirOffset = readUInt(eocd + 16);
+
+    //A zip64 end record is announced by the locator right in front of the end record.
+    qint64 eocdOffset = fileSize - tailSize + eocdPos;
+    if (eocdOffset >= Zip64EndOfCentralDirLocatorSize) {
+        QByteArray locator = readAt(eocdOffset - Zip64EndOfCentralDirLocatorSize, Zip64EndOfCentralDirLocatorSize);
+        const uchar *locatorData = reinterpret_cast<const uchar *>(locator.constData());
+        if (!locator.isEmpty() && readUInt(locatorData) == Zip64EndOfCentralDirLocatorSignature) {
+            QByteArray eocd64 = readAt(readULongLong(locatorData + 8), Zip64EndOfCentralDirSize);
+            const uchar *eocd64Data = reinterpret_cast<const uchar *>(eocd64.constData());
+            if (eocd64.isEmpty() || readUInt(eocd64Data) != Zip64EndOfCentralDirSignature)
+                return false;
+            entryCount = readULongLong(eocd64Data + 32);
+            centralDirSize = readULongLong(eocd64Data + 40);
+            centralDirOffset = readULongLong(eocd64Data + 48);
+        }
+    }
+
+    QByteArray centralDir = readAt(centralDirOffset, static_cast<qint64>(centralDirSize));
+    if (centralDir.size() != static_cast<qint64>(centralDirSize))
+        return false;
+
+    const uchar *data = reinterpret_cast<const uchar *>(centralDir.constData());
+    int pos = 0;
+    for (quint64 i = 0; i < entryCount; ++i) {
+        if (pos + ZipCentralHeaderSize > centralDir.size() || readUInt(data + pos) != ZipCentralHeaderSignature)
+            return false;
+        const uchar *header = data + pos;
+        int nameLength = readUShort(header + 28);
+        int extraLength = readUShort(header + 30);
+        int commentLength = readUShort(header + 32);
+        if (pos + ZipCentralHeaderSize + nameLength + extraLength + commentLength > centralDir.size())
+            return false;
+
+        XlsxZipEntryInfo info;
+        info.flags = readUShort(header + 8);
+        info.compressionMethod = readUShort(header + 10);
+        info.dosTime = readUInt(header + 12);
+        info.crc32 = readUInt(header + 16);
+        info.compressedSize = readUInt(header + 20);
+        info.uncompressedSize = readUInt(header + 24);
+        info.localHeaderOffset = readUInt(header + 42);
+        info.fileName = QByteArray(reinterpret_cast<const char *>(header + ZipCentralHeaderSize), nameLength);
+        readZip64ExtraField(header + ZipCentralHeaderSize + nameLength, extraLength, info, true);
+        pos += ZipCentralHeaderSize + nameLength + extraLength + commentLength;
+
+        if (info.fileName.endsWith('/'))
+            continue; //directory
+
+        QString filePath = (info.flags & 0x0800) ? QString::fromUtf8(info.fileName)
+                                                 : QString::fromLocal8Bit(info.fileName);
+        m_index.insert(filePath, m_entries.size());
+        m_entries.append(info);
+        m_filePaths.append(filePath);
+    }
+    return true;
 }
 
 bool ZipReader::exists() const
 {
-    return m_reader->exists();
+    return m_exists;
 }
 
 QStringList ZipReader::filePaths() const
@@ -65,9 +349,86 @@ QStringList ZipReader::filePaths() const
     return m_filePaths;
 }
 
+bool ZipReader::contains(const QString &fileName) const
+{
+    return m_index.contains(fileName);
+}
+
+/*
+   Returns the offset of the data of the part \a info, which follows its
+   local header, or -1 if the header is invalid.
+*/
+qint64 ZipReader::entryDataOffset(const XlsxZipEntryInfo &info) const
+{
+    QByteArray localHeader = readAt(info.localHeaderOffset, ZipLocalHeaderSize);
+    const uchar *header = reinterpret_cast<const uchar *>(localHeader.constData());
+    if (localHeader.isEmpty() || readUInt(header) != ZipLocalHeaderSignature)
+        return -1;
+    return static_cast<qint64>(info.localHeaderOffset) + ZipLocalHeaderSize
+            + readUShort(header + 26) + readUShort(header + 28);
+}
+
 QByteArray ZipReader::fileData(const QString &fileName) const
 {
-    return m_reader->fileData(fileName);
+    int idx = m_index.value(fileName, -1);
+    if (idx == -1)
+        return QByteArray();
+    const XlsxZipEntryInfo &info = m_entries[idx];
+    if (info.uncompressedSize > INT_MAX)
+        return QByteArray();
+
+    qint64 dataOffset = entryDataOffset(info);
+    if (dataOffset < 0)
+        return QByteArray();
+    QByteArray compressed = readAt(dataOffset, static_cast<qint64>(info.compressedSize));
+    if (compressed.size() != static_cast<qint64>(info.compressedSize))
+        return QByteArray();
+    if (info.compressionMethod == 0)
+        return QByteArray(compressed.constData(), compressed.size()); //detach from the mapping
+    if (info.compressionMethod != 8)
+        return QByteArray();
+
+    QByteArray data;
+    data.resize(static_cast<int>(info.uncompressedSize));
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, -MAX_WBITS) != Z_OK)
+        return QByteArray();
+    zs.next_in = reinterpret_cast<Bytef *>(compressed.data());
+    zs.avail_in = compressed.size();
+    zs.next_out = reinterpret_cast<Bytef *>(data.data());
+    zs.avail_out = data.size();
+    int res = inflate(&zs, Z_FINISH);
+    inflateEnd(&zs);
+    if (res != Z_STREAM_END)
+        return QByteArray();
+    data.resize(static_cast<int>(zs.total_out));
+    return data;
+}
+
+/*
+   Returns a device which inflates the part \a fileName while it is read,
+   or 0 if there is no such part. The caller takes ownership of the device,
+   which must not outlive the reader.
+*/
+QIODevice *ZipReader::fileDevice(const QString &fileName) const
+{
+    int idx = m_index.value(fileName, -1);
+    if (idx == -1)
+        return 0;
+    const XlsxZipEntryInfo &info = m_entries[idx];
+    if (info.compressionMethod != 0 && info.compressionMethod != 8)
+        return 0;
+    qint64 dataOffset = entryDataOffset(info);
+    if (dataOffset < 0)
+        return 0;
+
+    ZipEntryReadDevice *device = new ZipEntryReadDevice(this, info, dataOffset);
+    if (!device->isOpen()) {
+        delete device;
+        return 0;
+    }
+    return device;
 }
 
 } // namespace QXlsx
@@ -38,14 +38,18 @@
 //
 
 #include "xlsxglobal.h"
-#include <QScopedPointer>
+#include "xlsxzipentry_p.h"
+#include <QList>
+#include <QHash>
 #include <QStringList>
 
-class QZipReader;
 class QIODevice;
+class QFile;
 
 namespace QXlsx {
 
+class ZipEntryReadDevice;
+
 class ZipReader
 {
 public:
@@ -54,13 +58,27 @@ public:
     ~ZipReader();
     bool exists() const;
     QStringList filePaths() const;
+    bool contains(const QString &fileName) const;
     QByteArray fileData(const QString &fileName) const;
+    QIODevice *fileDevice(const QString &fileName) const;
 
 private:
     Q_DISABLE_COPY(ZipReader)
+    friend class ZipEntryReadDevice;
     void init();
-    QScopedPointer<QZipReader> m_reader;
+    bool readCentralDirectory();
+    QByteArray readAt(quint64 offset, qint64 size) const;
+    qint64 entryDataOffset(const XlsxZipEntryInfo &info) const;
+
+    QIODevice *m_device;
+    bool m_ownDevice;
+    bool m_exists;
+    QFile *m_mappedFile;
+    uchar *m_mappedData;
+    qint64 m_mappedSize;
+    QList<XlsxZipEntryInfo> m_entries;
     QStringList m_filePaths;
+    QHash<QString, int> m_index;
 };
 
 } // namespace QXlsx
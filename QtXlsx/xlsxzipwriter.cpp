@@ -23,46 +23,589 @@
 **
 ****************************************************************************/
 #include "xlsxzipwriter_p.h"
+#include <QFile>
+#include <QDateTime>
 #include <QDebug>
-#include <private/qzipwriter_p.h>
+#include <string.h>
+#include <zlib.h>
 
 namespace QXlsx {
 
-ZipWriter::ZipWriter(const QString &filePath)
+/*
+   The zip container is written by hand instead of through Qt's private
+   QZipWriter, so that the deflate level can be chosen per part and so
+   that packages larger than 4GB can be produced with the zip64
+   extensions.
+
+   Parts added as a whole carry the final crc and sizes in their local
+   header. Parts streamed through beginFile()/endFile() get placeholder
+   values which are patched once the part is complete. When the output
+   device is sequential, such as a socket or a pipe, nothing can be
+   patched; the values follow the part data in a data descriptor instead,
+   and such parts are always deflated so that streaming readers can find
+   their end.
+*/
+
+static const int ZipChunkSize = 64 * 1024;
+
+/*
+   Extra field id used to reserve room for a zip64 extra field in the
+   local header of a streamed part that did not need it in the end.
+   This is the alignment padding id, which readers skip.
+*/
+static const quint16 ZipPaddingExtraFieldId = 0xd935;
+
+static void appendUShort(QByteArray &data, quint16 value)
+{
+    data.append(static_cast<char>(value & 0xff));
+    data.append(static_cast<char>((value >> 8) & 0xff));
+}
+
+static void appendUInt(QByteArray &data, quint32 value)
 {
-    m_writer = new QZipWriter(filePath, QIODevice::WriteOnly);
-    m_writer->setCompressionPolicy(QZipWriter::AutoCompress);
+    appendUShort(data, value & 0xffff);
+    appendUShort(data, (value >> 16) & 0xffff);
 }
 
-ZipWriter::ZipWriter(QIODevice *device)
+static void appendULongLong(QByteArray &data, quint64 value)
 {
-    m_writer = new QZipWriter(device);
-    m_writer->setCompressionPolicy(QZipWriter::AutoCompress);
+    appendUInt(data, static_cast<quint32>(value & ZipMaxUInt32));
+    appendUInt(data, static_cast<quint32>(value >> 32));
+}
+
+static quint32 clampToUInt(quint64 value)
+{
+    return value >= ZipMaxUInt32 ? static_cast<quint32>(ZipMaxUInt32) : static_cast<quint32>(value);
+}
+
+static quint32 toDosTime(const QDateTime &dateTime)
+{
+    QDate date = dateTime.date();
+    QTime time = dateTime.time();
+    if (date.year() < 1980)
+        return (1 << 21) | (1 << 16); //1980-01-01 00:00:00
+
+    quint32 dosDate = ((date.year() - 1980) << 9) | (date.month() << 5) | date.day();
+    quint32 dosTime = (time.hour() << 11) | (time.minute() << 5) | (time.second() / 2);
+    return (dosDate << 16) | dosTime;
+}
+
+/*
+   Returns the raw deflate stream of \a data, or an empty array if zlib failed.
+*/
+static QByteArray deflateData(const QByteArray &data, int level)
+{
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return QByteArray();
+
+    QByteArray out;
+    out.resize(static_cast<int>(deflateBound(&zs, data.size())));
+    zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.constData()));
+    zs.avail_in = data.size();
+    zs.next_out = reinterpret_cast<Bytef *>(out.data());
+    zs.avail_out = out.size();
+
+    int res = deflate(&zs, Z_FINISH);
+    deflateEnd(&zs);
+    if (res != Z_STREAM_END)
+        return QByteArray();
+
+    out.resize(static_cast<int>(zs.total_out));
+    return out;
+}
+
+/*
+   Write only device handed out by ZipWriter::beginFile(). Everything
+   written to it is compressed straight into the package.
+*/
+class ZipEntryDevice : public QIODevice
+{
+public:
+    explicit ZipEntryDevice(ZipWriter *writer) :
+        m_writer(writer)
+    {
+        open(QIODevice::WriteOnly | QIODevice::Unbuffered);
+    }
+
+protected:
+    qint64 readData(char *, qint64)
+    {
+        return -1;
+    }
+
+    qint64 writeData(const char *data, qint64 len)
+    {
+        return m_writer->writeEntryData(data, len) ? len : -1;
+    }
+
+private:
+    ZipWriter *m_writer;
+};
+
+ZipWriter::ZipWriter(const QString &filePath) :
+    m_ownDevice(true), m_error(false), m_closed(false), m_startPos(0), m_offset(0)
+  , m_compressionLevel(Z_DEFAULT_COMPRESSION), m_entryDevice(0), m_deflater(0)
+{
+    QFile *file = new QFile(filePath);
+    if (!file->open(QIODevice::WriteOnly))
+        m_error = true;
+    m_device = file;
+}
+
+ZipWriter::ZipWriter(QIODevice *device) :
+    m_device(device), m_ownDevice(false), m_error(false), m_closed(false), m_startPos(0), m_offset(0)
+  , m_compressionLevel(Z_DEFAULT_COMPRESSION), m_entryDevice(0), m_deflater(0)
+{
+    if (!m_device || !m_device->isWritable())
+        m_error = true;
+    else if (!m_device->isSequential())
+        m_startPos = m_device->pos();
 }
 
 ZipWriter::~ZipWriter()
 {
-    delete m_writer;
+    if (!m_closed)
+        close();
+    if (m_ownDevice)
+        delete m_device;
 }
 
 bool ZipWriter::error() const
 {
-    return m_writer->status() != QZipWriter::NoError;
+    return m_error;
+}
+
+/*
+   Sets the default deflate \a level used for all parts, 0 means the
+   parts are stored without compression, 1 is the fastest and 9 the best
+   compression. -1 selects the zlib default.
+*/
+void ZipWriter::setCompressionLevel(int level)
+{
+    m_compressionLevel = level;
+}
+
+/*
+   Overrides the deflate \a level for all parts whose path starts with
+   \a pathPrefix, such as "xl/media/". The longest matching prefix wins.
+*/
+void ZipWriter::setCompressionLevel(const QString &pathPrefix, int level)
+{
+    m_partCompressionLevels[pathPrefix] = level;
+}
+
+int ZipWriter::compressionLevel(const QString &filePath) const
+{
+    int level = m_compressionLevel;
+    int matchedLength = -1;
+    QMapIterator<QString, int> it(m_partCompressionLevels);
+    while (it.hasNext()) {
+        it.next();
+        if (it.key().size() > matchedLength && filePath.startsWith(it.key())) {
+            level = it.value();
+            matchedLength = it.key().size();
+        }
+    }
+    return level;
+}
+
+bool ZipWriter::write(const char *data, qint64 size)
+{
+    if (m_error)
+        return false;
+    if (m_device->write(data, size) != size) {
+        m_error = true;
+        return false;
+    }
+    m_offset += size;
+    return true;
+}
+
+bool ZipWriter::write(const QByteArray &data)
+{
+    return write(data.constData(), data.size());
+}
+
+XlsxZipEntryInfo ZipWriter::createEntryInfo(const QString &filePath) const
+{
+    XlsxZipEntryInfo info;
+    info.fileName = filePath.toUtf8();
+    if (info.fileName.size() != filePath.size())
+        info.flags |= 0x0800; //Language encoding flag, the name is utf8
+    info.dosTime = toDosTime(QDateTime::currentDateTime());
+    info.localHeaderOffset = m_offset;
+    return info;
 }
 
+/*
+   Copies the contents of \a device into the package in chunks, so the
+   part never has to be held in memory as a whole.
+*/
 void ZipWriter::addFile(const QString &filePath, QIODevice *device)
 {
-    m_writer->addFile(filePath, device);
+    Q_ASSERT(device);
+    bool opened = false;
+    if (!device->isOpen()) {
+        if (!device->open(QIODevice::ReadOnly)) {
+            m_error = true;
+            return;
+        }
+        opened = true;
+    }
+
+    QIODevice *entry = beginFile(filePath, device->isSequential() ? -1 : device->size());
+    if (entry) {
+        QByteArray chunk;
+        chunk.resize(ZipChunkSize);
+        qint64 read;
+        while ((read = device->read(chunk.data(), chunk.size())) > 0) {
+            if (entry->write(chunk.constData(), read) != read)
+                break;
+        }
+        endFile();
+    }
+
+    if (opened)
+        device->close();
 }
 
 void ZipWriter::addFile(const QString &filePath, const QByteArray &data)
 {
-    m_writer->addFile(filePath, data);
+    if (m_error || m_closed || m_entryDevice)
+        return;
+
+    XlsxZipEntryInfo info = createEntryInfo(filePath);
+    info.uncompressedSize = data.size();
+    info.crc32 = crc32(crc32(0, 0, 0), reinterpret_cast<const Bytef *>(data.constData()), data.size());
+
+    QByteArray contents = data;
+    int level = compressionLevel(filePath);
+    if (level != 0 && data.size() >= 64) {
+        QByteArray compressed = deflateData(data, level);
+        //Keep the stored copy if deflate doesn't pay off.
+        if (!compressed.isEmpty() && compressed.size() < data.size()) {
+            contents = compressed;
+            info.compressionMethod = 8;
+        }
+    }
+    info.compressedSize = contents.size();
+
+    writeLocalFileHeader(info);
+    write(contents);
+    m_entries.append(info);
+}
+
+/*
+   Starts a new part named \a filePath and returns a device the part
+   contents can be written to, or 0 on error. The part is finished by
+   endFile(); no other part can be added in between.
+
+   \a sizeHint is the expected uncompressed size, -1 if unknown. Parts
+   which may exceed 4GB get a zip64 extra field in their local header.
+   On sequential devices a part of unknown size is assumed to stay below
+   4GB, as some consumers refuse zip64 fields they don't need.
+*/
+QIODevice *ZipWriter::beginFile(const QString &filePath, qint64 sizeHint)
+{
+    if (m_error || m_closed || m_entryDevice)
+        return 0;
+
+    m_current = createEntryInfo(filePath);
+    m_entryDevice = new ZipEntryDevice(this);
+    m_current.crc32 = crc32(0, 0, 0);
+
+    //Streaming unzippers find the end of a part followed by a data
+    //descriptor through its deflate stream, which stored data lacks. On
+    //sequential devices, parts meant to be stored are deflated at level 0
+    //instead: the data is kept as is, in stored deflate blocks.
+    int level = compressionLevel(filePath);
+    if (level != 0 || m_device->isSequential()) {
+        m_deflater = new z_stream;
+        memset(m_deflater, 0, sizeof(z_stream));
+        if (deflateInit2(m_deflater, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            delete m_deflater;
+            m_deflater = 0;
+            m_error = true;
+        }
+        m_current.compressionMethod = 8;
+        m_deflateBuffer.resize(ZipChunkSize);
+    }
+
+    //Raw deflate never grows the data by more than a few bytes per 16KB block.
+    bool mayOverflow = sizeHint >= 0 && static_cast<quint64>(sizeHint + sizeHint / 1024 + 1024) >= ZipMaxUInt32;
+    if (m_device->isSequential()) {
+        m_current.flags |= 0x0008; //crc and sizes are in the data descriptor
+        m_current.zip64 = mayOverflow;
+    } else {
+        m_current.zip64 = sizeHint < 0 || mayOverflow;
+    }
+    writeLocalFileHeader(m_current);
+    return m_entryDevice;
+}
+
+bool ZipWriter::writeEntryData(const char *data, qint64 size)
+{
+    if (m_error)
+        return false;
+
+    const Bytef *bytes = reinterpret_cast<const Bytef *>(data);
+    qint64 remaining = size;
+    while (remaining > 0) {
+        uInt len = static_cast<uInt>(qMin<qint64>(remaining, ZipMaxUInt32 / 2));
+        m_current.crc32 = crc32(m_current.crc32, bytes, len);
+        bytes += len;
+        remaining -= len;
+    }
+    m_current.uncompressedSize += size;
+
+    if (!m_deflater) {
+        m_current.compressedSize += size;
+        return write(data, size);
+    }
+    return deflateEntryData(data, size, Z_NO_FLUSH);
+}
+
+bool ZipWriter::deflateEntryData(const char *data, qint64 size, int flush)
+{
+    const char *next = data;
+    qint64 remaining = size;
+    do {
+        uInt len = static_cast<uInt>(qMin<qint64>(remaining, ZipMaxUInt32 / 2));
+        m_deflater->next_in = reinterpret_cast<Bytef *>(const_cast<char *>(next));
+        m_deflater->avail_in = len;
+        next += len;
+        remaining -= len;
+        int zflush = remaining > 0 ? Z_NO_FLUSH : flush;
+        int res;
+        do {
+            m_deflater->next_out = reinterpret_cast<Bytef *>(m_deflateBuffer.data());
+            m_deflater->avail_out = m_deflateBuffer.size();
+            res = deflate(m_deflater, zflush);
+            if (res == Z_STREAM_ERROR) {
+                m_error = true;
+                return false;
+            }
+            int produced = m_deflateBuffer.size() - m_deflater->avail_out;
+            m_current.compressedSize += produced;
+            if (produced && !write(m_deflateBuffer.constData(), produced))
+                return false;
+        } while (m_deflater->avail_out == 0 || (zflush == Z_FINISH && res != Z_STREAM_END));
+    } while (remaining > 0);
+    return true;
+}
+
+/*
+   Finishes the part started by beginFile(). The device returned by
+   beginFile() is deleted.
+*/
+void ZipWriter::endFile()
+{
+    if (!m_entryDevice)
+        return;
+
+    delete m_entryDevice;
+    m_entryDevice = 0;
+
+    if (m_deflater) {
+        if (!m_error)
+            deflateEntryData(0, 0, Z_FINISH);
+        deflateEnd(m_deflater);
+        delete m_deflater;
+        m_deflater = 0;
+    }
+    m_deflateBuffer.clear();
+
+    if (m_error)
+        return;
+
+    if (m_current.flags & 0x0008)
+        writeDataDescriptor(m_current);
+    else
+        patchLocalFileHeader(m_current);
+    m_entries.append(m_current);
+}
+
+void ZipWriter::writeDataDescriptor(const XlsxZipEntryInfo &info)
+{
+    bool overflow = info.compressedSize >= ZipMaxUInt32 || info.uncompressedSize >= ZipMaxUInt32;
+    if (overflow && !info.zip64) {
+        //The 32 bit sizes announced by the local header can't be honored.
+        m_error = true;
+        return;
+    }
+
+    QByteArray descriptor;
+    appendUInt(descriptor, ZipDataDescriptorSignature);
+    appendUInt(descriptor, info.crc32);
+    if (info.zip64) {
+        appendULongLong(descriptor, info.compressedSize);
+        appendULongLong(descriptor, info.uncompressedSize);
+    } else {
+        appendUInt(descriptor, static_cast<quint32>(info.compressedSize));
+        appendUInt(descriptor, static_cast<quint32>(info.uncompressedSize));
+    }
+    write(descriptor);
+}
+
+/*
+   Seeks back to the local header of \a info and fills in the crc and
+   sizes, which were unknown when the header was written.
+*/
+void ZipWriter::patchLocalFileHeader(const XlsxZipEntryInfo &info)
+{
+    bool needZip64 = info.compressedSize >= ZipMaxUInt32 || info.uncompressedSize >= ZipMaxUInt32;
+    if (needZip64 && !info.zip64) {
+        //The size hint was wrong, there is no room for the zip64 extra field.
+        m_error = true;
+        return;
+    }
+
+    qint64 headerPos = m_startPos + static_cast<qint64>(info.localHeaderOffset);
+    QByteArray sizes;
+    appendUInt(sizes, info.crc32);
+    appendUInt(sizes, needZip64 ? static_cast<quint32>(ZipMaxUInt32) : static_cast<quint32>(info.compressedSize));
+    appendUInt(sizes, needZip64 ? static_cast<quint32>(ZipMaxUInt32) : static_cast<quint32>(info.uncompressedSize));
+
+    bool ok = m_device->seek(headerPos + 14) && m_device->write(sizes) == sizes.size();
+    if (ok && needZip64) {
+        QByteArray version;
+        appendUShort(version, 45);
+        QByteArray extra;
+        appendUShort(extra, Zip64ExtraFieldId);
+        appendUShort(extra, 16);
+        appendULongLong(extra, info.uncompressedSize);
+        appendULongLong(extra, info.compressedSize);
+        ok = m_device->seek(headerPos + 4) && m_device->write(version) == version.size()
+                && m_device->seek(headerPos + 30 + info.fileName.size())
+                && m_device->write(extra) == extra.size();
+    }
+    if (!ok || !m_device->seek(m_startPos + static_cast<qint64>(m_offset)))
+        m_error = true;
+}
+
+/*
+   Writes the local header of \a info followed by the file name and,
+   for zip64 parts, the extra field. Parts followed by a data descriptor
+   get a real zip64 extra field, seekable parts a placeholder which
+   patchLocalFileHeader() turns into one if needed.
+*/
+void ZipWriter::writeLocalFileHeader(const XlsxZipEntryInfo &info)
+{
+    bool hasDescriptor = info.flags & 0x0008;
+    bool zip64Sizes = info.zip64 && hasDescriptor;
+
+    QByteArray header;
+    appendUInt(header, ZipLocalHeaderSignature);
+    appendUShort(header, zip64Sizes ? 45 : 20); //version needed to extract
+    appendUShort(header, info.flags);
+    appendUShort(header, info.compressionMethod);
+    appendUInt(header, info.dosTime);
+    appendUInt(header, info.crc32);
+    appendUInt(header, zip64Sizes ? static_cast<quint32>(ZipMaxUInt32) : clampToUInt(info.compressedSize));
+    appendUInt(header, zip64Sizes ? static_cast<quint32>(ZipMaxUInt32) : clampToUInt(info.uncompressedSize));
+    appendUShort(header, info.fileName.size());
+    appendUShort(header, info.zip64 ? 20 : 0); //extra field length
+    header.append(info.fileName);
+    if (info.zip64) {
+        appendUShort(header, hasDescriptor ? Zip64ExtraFieldId : ZipPaddingExtraFieldId);
+        appendUShort(header, 16);
+        appendULongLong(header, 0);
+        appendULongLong(header, 0);
+    }
+    write(header);
+}
+
+void ZipWriter::writeCentralDirectory()
+{
+    quint64 centralDirOffset = m_offset;
+    foreach (const XlsxZipEntryInfo &info, m_entries) {
+        //Only the values which don't fit go to the zip64 extra field, in this order.
+        QByteArray extra;
+        if (info.uncompressedSize >= ZipMaxUInt32)
+            appendULongLong(extra, info.uncompressedSize);
+        if (info.compressedSize >= ZipMaxUInt32)
+            appendULongLong(extra, info.compressedSize);
+        if (info.localHeaderOffset >= ZipMaxUInt32)
+            appendULongLong(extra, info.localHeaderOffset);
+        if (!extra.isEmpty()) {
+            QByteArray field;
+            appendUShort(field, Zip64ExtraFieldId);
+            appendUShort(field, extra.size());
+            extra.prepend(field);
+        }
+        quint16 version = extra.isEmpty() && !(info.zip64 && (info.flags & 0x0008)) ? 20 : 45;
+
+        QByteArray header;
+        appendUInt(header, ZipCentralHeaderSignature);
+        appendUShort(header, version); //version made by
+        appendUShort(header, version); //version needed to extract
+        appendUShort(header, info.flags);
+        appendUShort(header, info.compressionMethod);
+        appendUInt(header, info.dosTime);
+        appendUInt(header, info.crc32);
+        appendUInt(header, clampToUInt(info.compressedSize));
+        appendUInt(header, clampToUInt(info.uncompressedSize));
+        appendUShort(header, info.fileName.size());
+        appendUShort(header, extra.size()); //extra field length
+        appendUShort(header, 0); //file comment length
+        appendUShort(header, 0); //disk number start
+        appendUShort(header, 0); //internal file attributes
+        appendUInt(header, 0); //external file attributes
+        appendUInt(header, clampToUInt(info.localHeaderOffset));
+        header.append(info.fileName);
+        header.append(extra);
+        write(header);
+    }
+    quint64 centralDirSize = m_offset - centralDirOffset;
+    quint64 entryCount = m_entries.size();
+
+    if (entryCount >= static_cast<quint64>(ZipMaxUShort) || centralDirSize >= ZipMaxUInt32
+            || centralDirOffset >= ZipMaxUInt32) {
+        quint64 eocd64Offset = m_offset;
+        QByteArray eocd64;
+        appendUInt(eocd64, Zip64EndOfCentralDirSignature);
+        appendULongLong(eocd64, 44); //size of the remaining record
+        appendUShort(eocd64, 45); //version made by
+        appendUShort(eocd64, 45); //version needed to extract
+        appendUInt(eocd64, 0); //number of this disk
+        appendUInt(eocd64, 0); //disk where central directory starts
+        appendULongLong(eocd64, entryCount);
+        appendULongLong(eocd64, entryCount);
+        appendULongLong(eocd64, centralDirSize);
+        appendULongLong(eocd64, centralDirOffset);
+
+        appendUInt(eocd64, Zip64EndOfCentralDirLocatorSignature);
+        appendUInt(eocd64, 0); //disk where the zip64 end record starts
+        appendULongLong(eocd64, eocd64Offset);
+        appendUInt(eocd64, 1); //total number of disks
+        write(eocd64);
+    }
+
+    QByteArray eocd;
+    appendUInt(eocd, ZipEndOfCentralDirSignature);
+    appendUShort(eocd, 0); //number of this disk
+    appendUShort(eocd, 0); //disk where central directory starts
+    appendUShort(eocd, static_cast<quint16>(qMin<quint64>(entryCount, ZipMaxUShort)));
+    appendUShort(eocd, static_cast<quint16>(qMin<quint64>(entryCount, ZipMaxUShort)));
+    appendUInt(eocd, clampToUInt(centralDirSize));
+    appendUInt(eocd, clampToUInt(centralDirOffset));
+    appendUShort(eocd, 0); //comment length
+    write(eocd);
 }
 
 void ZipWriter::close()
 {
-    m_writer->close();
+    if (m_closed)
+        return;
+    endFile();
+    m_closed = true;
+
+    if (!m_error)
+        writeCentralDirectory();
+    if (m_ownDevice)
+        m_device->close();
 }
 
 } // namespace QXlsx
@@ -36,12 +36,18 @@
 // We mean it.
 //
 
+#include "xlsxzipentry_p.h"
 #include <QString>
+#include <QByteArray>
+#include <QList>
+#include <QMap>
 class QIODevice;
-class QZipWriter;
+struct z_stream_s;
 
 namespace QXlsx {
 
+class ZipEntryDevice;
+
 class ZipWriter
 {
 public:
@@ -49,13 +55,45 @@ public:
     explicit ZipWriter(QIODevice *device);
     ~ZipWriter();
 
+    void setCompressionLevel(int level);
+    void setCompressionLevel(const QString &pathPrefix, int level);
+    int compressionLevel(const QString &filePath) const;
+
     void addFile(const QString &filePath, QIODevice *device);
     void addFile(const QString &filePath, const QByteArray &data);
+    QIODevice *beginFile(const QString &filePath, qint64 sizeHint=-1);
+    void endFile();
     bool error() const;
     void close();
 
 private:
-    QZipWriter *m_writer;
+    Q_DISABLE_COPY(ZipWriter)
+    friend class ZipEntryDevice;
+    XlsxZipEntryInfo createEntryInfo(const QString &filePath) const;
+    bool writeEntryData(const char *data, qint64 size);
+    bool deflateEntryData(const char *data, qint64 size, int flush);
+    void patchLocalFileHeader(const XlsxZipEntryInfo &info);
+    void writeDataDescriptor(const XlsxZipEntryInfo &info);
+    void writeLocalFileHeader(const XlsxZipEntryInfo &info);
+    void writeCentralDirectory();
+    bool write(const QByteArray &data);
+    bool write(const char *data, qint64 size);
+
+    QIODevice *m_device;
+    bool m_ownDevice;
+    bool m_error;
+    bool m_closed;
+    qint64 m_startPos;
+    quint64 m_offset;
+    int m_compressionLevel;
+    QMap<QString, int> m_partCompressionLevels;
+    QList<XlsxZipEntryInfo> m_entries;
+
+    //State of the entry opened by beginFile()
+    XlsxZipEntryInfo m_current;
+    ZipEntryDevice *m_entryDevice;
+    z_stream_s *m_deflater;
+    QByteArray m_deflateBuffer;
 };
 
 } // namespace QXlsx
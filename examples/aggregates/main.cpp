@@ -0,0 +1,144 @@
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QVariant>
+#include <QtGlobal>
+#include <math.h>
+#include <stdio.h>
+
+#include "xlsxdocument.h"
+#include "xlsxworksheet.h"
+#include "xlsxcell.h"
+#include "xlsxcellrange.h"
+
+using namespace QXlsx;
+
+/*
+   Measures the aggregates of Worksheet against a loop over cellAt(), on a
+   numeric column and on a column mixing numbers, text and booleans.
+   Returns non zero if their results differ.
+*/
+
+static const int RowCount = 1000000;
+static const int Repeat = 10;
+
+struct Aggregates
+{
+    double sum;
+    double minimum;
+    double maximum;
+    double deviation;
+    int count;
+    int between;
+};
+
+//What the aggregates did before, one QVariant conversion per cell.
+static Aggregates scalarAggregates(const Worksheet *sheet, const CellRange &range)
+{
+    Aggregates result;
+    result.sum = 0;
+    result.minimum = qInf();
+    result.maximum = -qInf();
+    result.count = 0;
+    result.between = 0;
+    double squares = 0;
+    for (int row=range.firstRow(); row<=range.lastRow(); ++row) {
+        for (int col=range.firstColumn(); col<=range.lastColumn(); ++col) {
+            Cell *cell = sheet->cellAt(row, col);
+            if (!cell || cell->dataType() != Cell::Numeric)
+                continue;
+            double value = cell->value().toDouble();
+            result.sum += value;
+            squares += value * value;
+            result.minimum = qMin(result.minimum, value);
+            result.maximum = qMax(result.maximum, value);
+            result.count += 1;
+            if (value >= 100 && value <= 500)
+                result.between += 1;
+        }
+    }
+    double mean = result.sum / result.count;
+    result.deviation = sqrt((squares - result.count * mean * mean) / (result.count - 1));
+    return result;
+}
+
+static Aggregates worksheetAggregates(const Worksheet *sheet, const CellRange &range)
+{
+    Aggregates result;
+    result.sum = sheet->sum(range);
+    result.minimum = sheet->minimum(range);
+    result.maximum = sheet->maximum(range);
+    result.deviation = sheet->standardDeviation(range);
+    result.count = sheet->count(range);
+    result.between = sheet->countBetween(range, 100, 500);
+    return result;
+}
+
+static bool nearlyEqual(double a, double b)
+{
+    return qAbs(a - b) <= 1e-9 * qMax(qAbs(a), qAbs(b));
+}
+
+static int compare(const char *name, const Aggregates &a, const Aggregates &b)
+{
+    if (nearlyEqual(a.sum, b.sum) && a.minimum == b.minimum && a.maximum == b.maximum
+            && nearlyEqual(a.deviation, b.deviation) && a.count == b.count && a.between == b.between)
+        return 0;
+    printf("MISMATCH %s: sum %.17g/%.17g min %g/%g max %g/%g stddev %.17g/%.17g count %d/%d between %d/%d\n",
+           name, a.sum, b.sum, a.minimum, b.minimum, a.maximum, b.maximum,
+           a.deviation, b.deviation, a.count, b.count, a.between, b.between);
+    return 1;
+}
+
+static int run(const char *name, const Worksheet *sheet, const CellRange &range)
+{
+    QElapsedTimer timer;
+    Aggregates expected, result;
+
+    timer.start();
+    for (int i=0; i<Repeat; ++i)
+        expected = scalarAggregates(sheet, range);
+    qint64 scalarTime = timer.nsecsElapsed() / Repeat;
+
+    timer.restart();
+    for (int i=0; i<Repeat; ++i)
+        result = worksheetAggregates(sheet, range);
+    qint64 worksheetTime = timer.nsecsElapsed() / Repeat;
+
+    timer.restart();
+    double sum = 0;
+    for (int i=0; i<Repeat; ++i)
+        sum += sheet->sum(range);
+    qint64 sumTime = timer.nsecsElapsed() / Repeat;
+
+    printf("%s, %d cells (checksum %g)\n", name, range.rowCount() * range.columnCount(), sum);
+    printf("  cellAt() loop, all aggregates  %8.2f ms\n", scalarTime / 1e6);
+    printf("  Worksheet, all aggregates      %8.2f ms\n", worksheetTime / 1e6);
+    printf("  Worksheet::sum() alone         %8.2f ms\n", sumTime / 1e6);
+    return compare(name, expected, result);
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+
+    Document xlsx;
+    Worksheet *sheet = xlsx.currentWorksheet();
+    qsrand(1);
+    for (int row=1; row<=RowCount; ++row) {
+        double value = (qrand() % 100000) / 100.0;
+        sheet->writeNumeric(row, 1, value);
+        switch (row % 4) {
+        case 0: sheet->writeString(row, 2, QStringLiteral("n/a")); break;
+        case 1: sheet->writeBool(row, 2, true); break;
+        default: sheet->writeNumeric(row, 2, value); break;
+        }
+    }
+
+    int failures = 0;
+    failures += run("numeric column", sheet, CellRange(1, 1, RowCount, 1));
+    failures += run("mixed column", sheet, CellRange(1, 2, RowCount, 2));
+    failures += run("both columns", sheet, CellRange(1, 1, RowCount, 2));
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,181 @@
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QVector>
+#include <QtGlobal>
+#include <stdio.h>
+#include <string.h>
+
+#include "xlsxutility_p.h"
+
+using namespace QXlsx;
+
+/*
+   Checks xl_string_to_double() against QString::toDouble() and measures
+   the throughput of both. Returns non zero if a check fails.
+*/
+
+//Parsed exactly as QString::toDouble() does, bit for bit.
+static const char * const sameAsToDouble[] = {
+    //Integers
+    "0", "-0", "+0", "1", "-1", "42", "000123", "4294967296", "9007199254740992",
+    "9007199254740993", "18446744073709551615", "18446744073709551616",
+    "123456789012345678901234567890",
+    //Decimals
+    "0.5", ".5", "5.", "-.5", "+1.5", "000123.4500", "0.000001", "0.1", "0.2", "0.3",
+    "3.14159265358979323846264338327950288", "0.1000000000000000055511151231257827",
+    "2.718281828459045", "1234567.8901234567", "99999999999999999999.5",
+    //Exponent forms written by Excel
+    "1.5E-3", "2E+20", "1E5", "1e005", "1E+308", "1.7976931348623157E+308",
+    "-1.2345678901234567E-100", "1e22", "1e23", "1e-22", "1e-23", "123.456e-7",
+    "8.9884656743115795E+307", "5E-1", "0E0", "0.0e+0",
+    //Denormals and the edges of the normal range
+    "2.2250738585072014E-308", "2.2250738585072009E-308", "2.2250738585072011E-308",
+    "4.9406564584124654E-324", "1e-320", "2.4703282292062327E-324",
+    "2.4703282292062328E-324", "-4.9406564584124654E-324",
+    //Overflow and underflow
+    "1e400", "-1e400", "1e-400",
+    //White space around the number
+    " 1.5", "1.5 ", "\t-2E+3\r\n", "\n42\n",
+    //Junk, not a number
+    "", " ", "-", "+", ".", "e5", "1e", "1e+", "1.2.3", "12abc", "abc12", "--1",
+    "1 2", "0x10", "1.5E-3x", "1e5.5", "1E 5", "- 1",
+    0
+};
+
+//Not numbers in cell values, although QString::toDouble() accepts some.
+static const char * const rejected[] = {
+    "inf", "-inf", "nan", "1,000", "1,5", "\v1", 0
+};
+
+static bool sameBits(double a, double b)
+{
+    return memcmp(&a, &b, sizeof(double)) == 0;
+}
+
+static int checkText(const QString &text)
+{
+    bool expectedOk;
+    double expected = text.toDouble(&expectedOk);
+    if (!expectedOk)
+        expected = 0;
+
+    bool ok;
+    double value = xl_string_to_double(text, &ok);
+    QByteArray utf8 = text.toUtf8();
+    bool rawOk;
+    double rawValue = xl_string_to_double(utf8.constData(), utf8.size(), &rawOk);
+
+    if (ok != expectedOk || rawOk != expectedOk || !sameBits(value, expected) || !sameBits(rawValue, expected)) {
+        printf("MISMATCH \"%s\": toDouble %.17g (%d), xl_string_to_double %.17g (%d), raw %.17g (%d)\n",
+               utf8.constData(), expected, expectedOk, value, ok, rawValue, rawOk);
+        return 1;
+    }
+    return 0;
+}
+
+static double randomDouble()
+{
+    quint64 bits = 0;
+    for (int i=0; i<4; ++i)
+        bits = (bits << 16) | (qrand() & 0xffff);
+    double value;
+    memcpy(&value, &bits, sizeof(double));
+    return value;
+}
+
+static int checkCorpus()
+{
+    int failures = 0;
+    int count = 0;
+    for (int i=0; sameAsToDouble[i]; ++i, ++count)
+        failures += checkText(QString::fromLatin1(sameAsToDouble[i]));
+
+    for (int i=0; rejected[i]; ++i, ++count) {
+        bool ok;
+        xl_string_to_double(QString::fromLatin1(rejected[i]), &ok);
+        if (ok) {
+            printf("MISMATCH \"%s\": accepted\n", rejected[i]);
+            ++failures;
+        }
+    }
+
+    //Random bit patterns, in the forms the numbers are saved with.
+    qsrand(1);
+    for (int i=0; i<200000; ++i) {
+        double value = randomDouble();
+        if (qIsNaN(value) || qIsInf(value))
+            continue;
+        failures += checkText(QString::number(value, 'g', 15));
+        failures += checkText(QString::number(value, 'g', 17));
+        failures += checkText(QString::number(value, 'e', 10));
+        count += 3;
+    }
+    //Integers and short decimals, as most cells hold.
+    for (int i=0; i<200000; ++i) {
+        failures += checkText(QString::number(qrand() - RAND_MAX / 2));
+        failures += checkText(QString::number((qrand() % 1000000) / 100.0, 'f', 2));
+        count += 2;
+    }
+
+    printf("corpus: %d values, %d mismatches\n", count, failures);
+    return failures;
+}
+
+static void benchmark()
+{
+    QStringList texts;
+    qsrand(2);
+    for (int i=0; i<1000000; ++i) {
+        switch (i % 4) {
+        case 0: texts.append(QString::number(qrand() % 100000)); break;
+        case 1: texts.append(QString::number((qrand() % 10000000) / 100.0, 'f', 2)); break;
+        case 2: texts.append(QString::number(qrand() / 3.0, 'g', 15)); break;
+        default: texts.append(QString::number(qrand() * 1e-9, 'E', 14)); break;
+        }
+    }
+    QVector<QByteArray> raw;
+    raw.reserve(texts.size());
+    qint64 bytes = 0;
+    foreach (const QString &text, texts) {
+        raw.append(text.toLatin1());
+        bytes += text.size();
+    }
+
+    QElapsedTimer timer;
+    double sum = 0;
+
+    timer.start();
+    foreach (const QString &text, texts)
+        sum += text.toDouble();
+    qint64 toDoubleTime = timer.nsecsElapsed();
+
+    timer.restart();
+    foreach (const QString &text, texts)
+        sum += xl_string_to_double(text);
+    qint64 parseTime = timer.nsecsElapsed();
+
+    timer.restart();
+    for (int i=0; i<raw.size(); ++i)
+        sum += xl_string_to_double(raw[i].constData(), raw[i].size());
+    qint64 rawParseTime = timer.nsecsElapsed();
+
+    printf("benchmark: %d values, %lld bytes (checksum %g)\n", texts.size(), bytes, sum);
+    printf("  QString::toDouble           %8.1f ns/value %8.1f MB/s\n",
+           double(toDoubleTime) / texts.size(), bytes * 1000.0 / toDoubleTime);
+    printf("  xl_string_to_double(QString) %7.1f ns/value %8.1f MB/s\n",
+           double(parseTime) / texts.size(), bytes * 1000.0 / parseTime);
+    printf("  xl_string_to_double(char *)  %7.1f ns/value %8.1f MB/s\n",
+           double(rawParseTime) / texts.size(), bytes * 1000.0 / rawParseTime);
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+
+    int failures = checkCorpus();
+    if (!a.arguments().contains(QStringLiteral("--no-benchmark")))
+        benchmark();
+
+    return failures ? 1 : 0;
+}
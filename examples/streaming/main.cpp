@@ -0,0 +1,232 @@
+#include <QCoreApplication>
+#include <QBuffer>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QThread>
+#include <QVariant>
+#include <QtGlobal>
+#include <stdio.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "xlsxdocument.h"
+#include "xlsxworksheet.h"
+
+using namespace QXlsx;
+
+/*
+   Saves a document to a local socket, a sequential device, and checks
+   what arrives at the other end as a streaming unzipper would read it:
+   from the first byte on, finding the end of each part without the
+   central directory. The package is then loaded back and compared with
+   the cells written. This is done with the default compression and with
+   StoreOnly. Returns non zero if a check fails.
+*/
+
+static const int RowCount = 20000;
+
+static quint16 readUShort(const QByteArray &data, int pos)
+{
+    const uchar *p = reinterpret_cast<const uchar *>(data.constData()) + pos;
+    return p[0] | (p[1] << 8);
+}
+
+static quint32 readUInt(const QByteArray &data, int pos)
+{
+    return readUShort(data, pos) | (static_cast<quint32>(readUShort(data, pos + 2)) << 16);
+}
+
+static void fillDocument(Document &xlsx)
+{
+    for (int row=1; row<=RowCount; ++row) {
+        xlsx.write(row, 1, row);
+        xlsx.write(row, 2, QStringLiteral("text %1").arg(row));
+        xlsx.write(row, 3, row * 0.5);
+    }
+}
+
+static int check(bool ok, const char *what)
+{
+    if (ok)
+        return 0;
+    printf("FAILED: %s\n", what);
+    return 1;
+}
+
+/*
+   Saves a document to the local server \a serverName from its own
+   thread, as a producer would.
+*/
+class Sender : public QThread
+{
+public:
+    Sender(const QString &serverName, bool stored) :
+        m_serverName(serverName), m_stored(stored), m_saved(false)
+    {
+    }
+
+    bool isSaved() const
+    {
+        return m_saved;
+    }
+
+protected:
+    void run()
+    {
+        QLocalSocket socket;
+        socket.connectToServer(m_serverName, QIODevice::WriteOnly);
+        if (!socket.waitForConnected(10000))
+            return;
+
+        Document xlsx;
+        if (m_stored)
+            xlsx.setCompressionLevel(Document::StoreOnly);
+        fillDocument(xlsx);
+        m_saved = xlsx.saveAs(&socket);
+
+        while (socket.bytesToWrite() > 0 && socket.waitForBytesWritten(10000)) {
+        }
+        socket.disconnectFromServer();
+        if (socket.state() != QLocalSocket::UnconnectedState)
+            socket.waitForDisconnected(10000);
+    }
+
+private:
+    QString m_serverName;
+    bool m_stored;
+    bool m_saved;
+};
+
+/*
+   Returns the number of bytes of the raw deflate stream starting at
+   \a pos of \a data, or -1 if it doesn't end before the end of \a data.
+*/
+static int deflateStreamLength(const QByteArray &data, int pos)
+{
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, -MAX_WBITS) != Z_OK)
+        return -1;
+
+    QByteArray out(64 * 1024, 0);
+    zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.constData() + pos));
+    zs.avail_in = data.size() - pos;
+    int res;
+    do {
+        zs.next_out = reinterpret_cast<Bytef *>(out.data());
+        zs.avail_out = out.size();
+        res = inflate(&zs, Z_NO_FLUSH);
+    } while (res == Z_OK);
+    int length = res == Z_STREAM_END ? static_cast<int>(zs.total_in) : -1;
+    inflateEnd(&zs);
+    return length;
+}
+
+/*
+   Walks the local headers of \a package from its start. A part whose
+   sizes follow it in a data descriptor must be deflated, otherwise
+   nothing tells where it ends. Sets \a streamed to the number of such
+   parts.
+*/
+static int readAsStream(const QByteArray &package, int *streamed)
+{
+    int failures = 0;
+    int pos = 0;
+    *streamed = 0;
+    while (pos + 30 <= package.size() && readUInt(package, pos) == 0x04034b50) {
+        const quint16 flags = readUShort(package, pos + 6);
+        const quint16 method = readUShort(package, pos + 8);
+        const int dataPos = pos + 30 + readUShort(package, pos + 26) + readUShort(package, pos + 28);
+        if (!(flags & 0x0008)) {
+            pos = dataPos + static_cast<int>(readUInt(package, pos + 18));
+            continue;
+        }
+
+        ++*streamed;
+        if (method != 8) {
+            failures += check(false, "a part with a data descriptor is deflated");
+            break;
+        }
+        const int length = deflateStreamLength(package, dataPos);
+        if (length < 0) {
+            failures += check(false, "the deflate stream of a part ends");
+            break;
+        }
+        //Data descriptor, with its optional signature
+        pos = dataPos + length;
+        if (pos + 16 > package.size() || readUInt(package, pos) != 0x08074b50) {
+            failures += check(false, "a data descriptor follows the part");
+            break;
+        }
+        failures += check(readUInt(package, pos + 8) == static_cast<quint32>(length),
+                          "compressed size of the data descriptor");
+        pos += 16;
+    }
+    failures += check(pos + 4 <= package.size() && readUInt(package, pos) == 0x02014b50,
+                      "the central directory follows the last part");
+    return failures;
+}
+
+static int checkCells(const QByteArray &package)
+{
+    QByteArray data = package;
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::ReadOnly);
+    Document xlsx(&buffer);
+
+    int failures = 0;
+    for (int row=1; row<=RowCount && !failures; ++row) {
+        failures += check(xlsx.read(row, 1).toInt() == row, "integer read back");
+        failures += check(xlsx.read(row, 2).toString() == QStringLiteral("text %1").arg(row), "string read back");
+        failures += check(xlsx.read(row, 3).toDouble() == row * 0.5, "number read back");
+    }
+    return failures;
+}
+
+static int run(bool stored)
+{
+    const QString serverName = QStringLiteral("qtxlsx_streaming_example");
+    QLocalServer::removeServer(serverName);
+    QLocalServer server;
+    if (!server.listen(serverName))
+        return check(false, "listen on the local server");
+
+    Sender sender(serverName, stored);
+    sender.start();
+
+    QByteArray received;
+    QLocalSocket *socket = server.waitForNewConnection(10000) ? server.nextPendingConnection() : 0;
+    while (socket) {
+        received += socket->readAll();
+        if (socket->state() == QLocalSocket::UnconnectedState || !socket->waitForReadyRead(10000)) {
+            received += socket->readAll();
+            break;
+        }
+    }
+    sender.wait();
+
+    int failures = 0;
+    failures += check(socket != 0, "connection from the sender");
+    failures += check(sender.isSaved(), "save to the local socket");
+    if (failures)
+        return failures;
+
+    int streamed = 0;
+    failures += readAsStream(received, &streamed);
+    failures += check(streamed > 0, "the worksheet is streamed with a data descriptor");
+    failures += checkCells(received);
+
+    printf("%s: %d bytes, %d streamed parts: %s\n", stored ? "StoreOnly" : "DefaultCompression",
+           received.size(), streamed, failures ? "failed" : "ok");
+    return failures;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+
+    int failures = run(false);
+    failures += run(true);
+
+    return failures ? 1 : 0;
+}
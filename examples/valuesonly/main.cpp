@@ -0,0 +1,118 @@
+#include <QCoreApplication>
+#include <QColor>
+#include <QDate>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QStringList>
+#include <QUrl>
+#include <QVariant>
+#include <QtGlobal>
+#include <stdio.h>
+
+#include "xlsxdocument.h"
+#include "xlsxworksheet.h"
+#include "xlsxformat.h"
+#include "xlsxloadoptions.h"
+
+using namespace QXlsx;
+
+/*
+   Measures the load of a styled workbook with the FullLoad and the
+   ValuesOnly profiles, and checks that both read the same values and
+   that a document loaded with ValuesOnly refuses to be saved. Returns
+   non zero if a check fails.
+*/
+
+static const int RowCount = 200000;
+static const int FormatCount = 400;
+static const int Repeat = 3;
+
+static void writeWorkbook(const QString &path)
+{
+    QList<Format> formats;
+    for (int i=0; i<FormatCount; ++i) {
+        Format format;
+        format.setFontColor(QColor::fromHsv(i * 360 / FormatCount, 200, 160));
+        format.setFontBold(i % 2);
+        format.setPatternBackgroundColor(QColor::fromHsv((i * 7) % 360, 40, 250));
+        format.setBorderStyle(i % 3 ? Format::BorderThin : Format::BorderDashed);
+        format.setNumberFormat(i % 5 ? QStringLiteral("#,##0.00") : QStringLiteral("0.0%"));
+        formats.append(format);
+    }
+    Format dateFormat;
+    dateFormat.setNumberFormat(QStringLiteral("yyyy-mm-dd"));
+    dateFormat.setFontItalic(true);
+
+    Document xlsx;
+    Worksheet *sheet = xlsx.currentWorksheet();
+    for (int row=1; row<=RowCount; ++row) {
+        const Format &format = formats[row % FormatCount];
+        sheet->writeNumeric(row, 1, row * 1.25, format);
+        sheet->writeString(row, 2, QStringLiteral("item %1").arg(row % 1000), format);
+        sheet->writeDateTime(row, 3, QDateTime(QDate(2000, 1, 1).addDays(row % 10000)), dateFormat);
+        if (row % 100 == 0)
+            sheet->writeHyperlink(row, 4, QUrl(QStringLiteral("http://example.com/%1").arg(row)));
+    }
+    xlsx.saveAs(path);
+}
+
+static double loadTime(const QString &path, const LoadOptions &options)
+{
+    QElapsedTimer timer;
+    timer.start();
+    for (int i=0; i<Repeat; ++i) {
+        Document xlsx(path, options);
+        xlsx.read(1, 1);
+    }
+    return timer.nsecsElapsed() / 1e6 / Repeat;
+}
+
+static int check(bool ok, const char *what)
+{
+    if (ok)
+        return 0;
+    printf("FAILED: %s\n", what);
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+
+    const QString path = QDir::temp().filePath(QStringLiteral("qtxlsx_valuesonly.xlsx"));
+    const QString copyPath = QDir::temp().filePath(QStringLiteral("qtxlsx_valuesonly_copy.xlsx"));
+    writeWorkbook(path);
+    QFile::remove(copyPath);
+
+    LoadOptions valuesOnly;
+    valuesOnly.setProfile(LoadOptions::ValuesOnly);
+
+    int failures = 0;
+    {
+        Document full(path);
+        Document values(path, valuesOnly);
+        for (int row=1; row<=RowCount && failures < 10; ++row) {
+            for (int col=1; col<=3; ++col) {
+                if (full.read(row, col) != values.read(row, col)) {
+                    printf("MISMATCH row %d column %d\n", row, col);
+                    ++failures;
+                }
+            }
+        }
+        failures += check(!values.saveAs(copyPath), "a values only document is not saved");
+        failures += check(!QFileInfo(copyPath).exists(),
+                          "nothing is written for a values only document");
+    }
+
+    const double fullTime = loadTime(path, LoadOptions());
+    const double valuesTime = loadTime(path, valuesOnly);
+    printf("%d rows, %d formats, %lld bytes\n", RowCount, FormatCount, QFileInfo(path).size());
+    printf("  FullLoad    %8.1f ms\n", fullTime);
+    printf("  ValuesOnly  %8.1f ms\n", valuesTime);
+
+    QFile::remove(path);
+    QFile::remove(copyPath);
+    return failures ? 1 : 0;
+}
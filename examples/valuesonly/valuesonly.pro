@@ -0,0 +1,17 @@
+QT += core gui
+
+TARGET = valuesonly
+CONFIG += console
+CONFIG -= app_bundle
+
+TEMPLATE = app
+
+# Linked against the QtXlsx static library built in ../../QtXlsx
+INCLUDEPATH += $$PWD/../../QtXlsx
+LIBS += -L$$OUT_PWD/../../QtXlsx -lQtXlsx
+contains(QT_CONFIG, system-zlib) {
+    if(unix|mingw):LIBS += -lz
+    else:LIBS += zdll.lib
+}
+
+SOURCES += main.cpp
@@ -0,0 +1,242 @@
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QScopedPointer>
+#include <QStringList>
+#include <QtGlobal>
+#include <stdio.h>
+#include <string.h>
+
+#include "xlsxzipwriter_p.h"
+#include "xlsxzipreader_p.h"
+
+using namespace QXlsx;
+
+/*
+   Writes packages which need the zip64 extensions with ZipWriter and
+   reads them back with ZipReader: one with more than 65535 parts, and
+   one with a part larger than 4GB followed by a small part. The records
+   written are checked byte by byte. Returns non zero if a check fails.
+
+   With --stored the large part is not compressed, so that the next
+   local header and the central directory start past 4GB as well. This
+   needs about 4.5GB of free disk space.
+*/
+
+static const int ManyEntryCount = 70000;
+static const qint64 LargeEntrySize = Q_INT64_C(4608) * 1024 * 1024;
+static const int ChunkSize = 1024 * 1024;
+
+static quint16 readUShort(const QByteArray &data, int pos)
+{
+    const uchar *p = reinterpret_cast<const uchar *>(data.constData()) + pos;
+    return p[0] | (p[1] << 8);
+}
+
+static quint32 readUInt(const QByteArray &data, int pos)
+{
+    return readUShort(data, pos) | (static_cast<quint32>(readUShort(data, pos + 2)) << 16);
+}
+
+static quint64 readULongLong(const QByteArray &data, int pos)
+{
+    return readUInt(data, pos) | (static_cast<quint64>(readUInt(data, pos + 4)) << 32);
+}
+
+static QByteArray readAt(const QString &path, qint64 offset, int size)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly) || !file.seek(offset))
+        return QByteArray();
+    return file.read(size);
+}
+
+static int check(bool ok, const char *what)
+{
+    if (ok)
+        return 0;
+    printf("FAILED: %s\n", what);
+    return 1;
+}
+
+/*
+   Checks the end of central directory records of \a path: the zip64
+   record and its locator are present, and the 16 and 32 bit fields of
+   the classic record which overflow are saturated. Sets \a centralDirOffset.
+*/
+static int checkEndRecords(const QString &path, quint64 expectedEntries, quint64 *centralDirOffset)
+{
+    const qint64 size = QFileInfo(path).size();
+
+    //No comment is written, so the records are at fixed distances from the end.
+    QByteArray tail = readAt(path, size - 56 - 20 - 22, 56 + 20 + 22);
+    int failures = 0;
+    failures += check(tail.size() == 98, "read the end records");
+    if (failures)
+        return failures;
+    failures += check(readUInt(tail, 0) == Zip64EndOfCentralDirSignature, "zip64 end of central directory signature");
+    failures += check(readUShort(tail, 14) == 45, "zip64 end record version needed");
+    failures += check(readULongLong(tail, 32) == expectedEntries, "zip64 end record entry count");
+    failures += check(readUInt(tail, 56) == Zip64EndOfCentralDirLocatorSignature, "zip64 locator signature");
+    failures += check(readULongLong(tail, 64) == static_cast<quint64>(size - 98), "zip64 locator offset");
+    failures += check(readUInt(tail, 76) == ZipEndOfCentralDirSignature, "end of central directory signature");
+
+    const quint16 entries = readUShort(tail, 86);
+    failures += check(entries == qMin<quint64>(expectedEntries, ZipMaxUShort), "end record entry count");
+    *centralDirOffset = readULongLong(tail, 48);
+    const quint32 offset32 = readUInt(tail, 92);
+    failures += check(*centralDirOffset >= ZipMaxUInt32 ? offset32 == ZipMaxUInt32 : offset32 == *centralDirOffset,
+                      "end record central directory offset");
+    return failures;
+}
+
+static int checkManyEntries(const QString &path)
+{
+    {
+        ZipWriter writer(path);
+        for (int i=0; i<ManyEntryCount; ++i)
+            writer.addFile(QStringLiteral("parts/%1.txt").arg(i), QByteArray("part ") + QByteArray::number(i));
+        writer.close();
+        if (writer.error())
+            return check(false, "write the package with many parts");
+    }
+
+    int failures = 0;
+    quint64 centralDirOffset = 0;
+    failures += checkEndRecords(path, ManyEntryCount, &centralDirOffset);
+
+    ZipReader reader(path);
+    failures += check(reader.exists(), "read the package with many parts");
+    failures += check(reader.filePaths().size() == ManyEntryCount, "number of parts read back");
+    for (int i=0; i<ManyEntryCount; i+=997) {
+        QByteArray data = reader.fileData(QStringLiteral("parts/%1.txt").arg(i));
+        failures += check(data == QByteArray("part ") + QByteArray::number(i), "contents of a part read back");
+    }
+    failures += check(reader.fileData(QStringLiteral("parts/%1.txt").arg(ManyEntryCount - 1))
+                      == QByteArray("part ") + QByteArray::number(ManyEntryCount - 1), "contents of the last part");
+
+    printf("%d parts: %s\n", ManyEntryCount, failures ? "failed" : "ok");
+    return failures;
+}
+
+//Contents of the chunk \a index of the large part.
+static QByteArray largeChunk(qint64 index)
+{
+    static QByteArray pattern;
+    if (pattern.isEmpty()) {
+        pattern.resize(ChunkSize);
+        for (int i=0; i<ChunkSize; ++i)
+            pattern[i] = static_cast<char>((i * 7 + i / 251) & 0xff);
+    }
+    QByteArray chunk = pattern;
+    memcpy(chunk.data(), &index, sizeof(index));
+    return chunk;
+}
+
+static int checkLargeEntry(const QString &path, bool stored)
+{
+    {
+        ZipWriter writer(path);
+        writer.setCompressionLevel(stored ? 0 : 1);
+        QIODevice *device = writer.beginFile(QStringLiteral("large.bin"), LargeEntrySize);
+        for (qint64 i=0; device && i<LargeEntrySize / ChunkSize; ++i) {
+            if (device->write(largeChunk(i)) != ChunkSize)
+                break;
+        }
+        writer.endFile();
+        writer.addFile(QStringLiteral("after.txt"), QByteArray("after the large part"));
+        writer.close();
+        if (writer.error())
+            return check(false, "write the package with a large part");
+    }
+
+    int failures = 0;
+
+    //Local header of the large part, patched once its sizes were known.
+    QByteArray local = readAt(path, 0, 30 + 9 + 20);
+    if (local.size() != 30 + 9 + 20)
+        return check(false, "read the local header");
+    failures += check(readUInt(local, 0) == ZipLocalHeaderSignature, "local header signature");
+    failures += check(readUShort(local, 4) == 45, "local header version needed");
+    failures += check(readUInt(local, 22) == ZipMaxUInt32, "local header uncompressed size saturated");
+    failures += check(readUShort(local, 28) == 20, "local header extra field length");
+    failures += check(readUShort(local, 39) == Zip64ExtraFieldId, "local zip64 extra field id");
+    failures += check(readULongLong(local, 43) == static_cast<quint64>(LargeEntrySize), "local zip64 uncompressed size");
+    const quint64 compressedSize = readULongLong(local, 51);
+
+    //Central directory, with the end records when they are needed.
+    quint64 centralDirOffset = 0;
+    if (stored) {
+        failures += checkEndRecords(path, 2, &centralDirOffset);
+    } else {
+        QByteArray eocd = readAt(path, QFileInfo(path).size() - 22, 22);
+        if (eocd.size() != 22)
+            return failures + check(false, "read the end record");
+        failures += check(readUInt(eocd, 0) == ZipEndOfCentralDirSignature, "end of central directory signature");
+        centralDirOffset = readUInt(eocd, 16);
+    }
+    QByteArray central = readAt(path, static_cast<qint64>(centralDirOffset), 46 + 9 + 12);
+    if (central.size() != 46 + 9 + 12)
+        return failures + check(false, "read the central header");
+    failures += check(readUInt(central, 0) == ZipCentralHeaderSignature, "central header signature");
+    failures += check(readUShort(central, 6) == 45, "central header version needed");
+    failures += check(readUInt(central, 24) == ZipMaxUInt32, "central header uncompressed size saturated");
+    failures += check(readUShort(central, 46 + 9) == Zip64ExtraFieldId, "central zip64 extra field id");
+    failures += check(readULongLong(central, 46 + 9 + 4) == static_cast<quint64>(LargeEntrySize),
+                      "central zip64 uncompressed size");
+    if (stored) {
+        //The next part starts past 4GB, its offset is in its zip64 extra field.
+        QByteArray next = readAt(path, static_cast<qint64>(centralDirOffset) + 46 + 9 + 20, 46 + 9 + 12);
+        if (next.size() != 46 + 9 + 12)
+            return failures + check(false, "read the second central header");
+        failures += check(readUInt(next, 0) == ZipCentralHeaderSignature, "second central header signature");
+        failures += check(readUInt(next, 42) == ZipMaxUInt32, "second central header offset saturated");
+        failures += check(readULongLong(next, 46 + 9 + 4) == 30 + 9 + 20 + compressedSize,
+                          "second central zip64 offset");
+    }
+
+    ZipReader reader(path);
+    failures += check(reader.exists(), "read the package with a large part");
+    failures += check(reader.fileData(QStringLiteral("after.txt")) == "after the large part",
+                      "part after the large one");
+    QScopedPointer<QIODevice> device(reader.fileDevice(QStringLiteral("large.bin")));
+    failures += check(device && device->size() == LargeEntrySize, "size of the large part");
+    if (device) {
+        QByteArray chunk(ChunkSize, 0);
+        qint64 total = 0;
+        bool same = true;
+        for (qint64 index=0; ; ++index) {
+            //The device may return less than asked, fill whole chunks.
+            int size = 0;
+            qint64 read;
+            while (size < ChunkSize && (read = device->read(chunk.data() + size, ChunkSize - size)) > 0)
+                size += static_cast<int>(read);
+            if (size == 0)
+                break;
+            if (memcmp(chunk.constData(), largeChunk(index).constData(), size) != 0)
+                same = false;
+            total += size;
+        }
+        failures += check(same, "contents of the large part");
+        failures += check(total == LargeEntrySize, "bytes read from the large part");
+    }
+
+    printf("%lld byte part, %s: %s\n", LargeEntrySize, stored ? "stored" : "deflated", failures ? "failed" : "ok");
+    return failures;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    const bool stored = a.arguments().contains(QStringLiteral("--stored"));
+
+    const QString manyPath = QDir::temp().filePath(QStringLiteral("qtxlsx_zip64_many.zip"));
+    const QString largePath = QDir::temp().filePath(QStringLiteral("qtxlsx_zip64_large.zip"));
+    int failures = checkManyEntries(manyPath);
+    failures += checkLargeEntry(largePath, stored);
+    QFile::remove(manyPath);
+    QFile::remove(largePath);
+
+    return failures ? 1 : 0;
+}